@@ -0,0 +1,64 @@
+//==============================================================================
+// Microbenchmarks no pc
+//==============================================================================
+// mesmos casos do env bench do ESP32 (include/Bench.cpp), sobre os backends de pc do Hal e do ShiftChains.
+// os numeros servem para comparar versões do codigo na mesma maquina, nao para prever o tempo no ESP32.
+//
+// uso: pio run -e native_bench && .pio/build/native_bench/program
+//   ou: g++ -std=gnu++11 -O2 -Iinclude bench/bench.cpp -o bench_pc && ./bench_pc
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+#include <Bench.cpp>
+
+// pinos quaisquer (no pc so o nivel é guardado), mesma separação de cadeias do main.cpp
+#define BENCH_DATA_RELES 4
+#define BENCH_CLOCK_RELES 19
+#define BENCH_LATCH_RELES 18
+#define BENCH_DATA_LEDS1 17
+#define BENCH_CLOCK_LEDS1 16
+#define BENCH_LATCH_LEDS1 4
+#define BENCH_DATA_LEDS2 13
+#define BENCH_CLOCK_LEDS2 14
+#define BENCH_LATCH_LEDS2 27
+#define BENCH_DATA_LEDS3 33
+#define BENCH_CLOCK_LEDS3 25
+#define BENCH_LATCH_LEDS3 26
+
+//------------------------------------------------------------------------------
+// Contagem de alocações (todo new do programa passa por aqui)
+//------------------------------------------------------------------------------
+void *operator new(size_t tamanho){
+  bench_alocacoes++;
+  void *ponteiro = malloc(tamanho ? tamanho : 1);
+  if (ponteiro == nullptr) throw std::bad_alloc();
+  return ponteiro;
+}
+
+void *operator new[](size_t tamanho){
+  return operator new(tamanho);
+}
+
+void operator delete(void *ponteiro) noexcept{
+  free(ponteiro);
+}
+
+void operator delete[](void *ponteiro) noexcept{
+  free(ponteiro);
+}
+
+int main(){
+  hal_sim.log = false; // so a tabela na saida
+  cadeias_595.add_chain(BENCH_DATA_RELES, BENCH_CLOCK_RELES, BENCH_LATCH_RELES);
+  cadeias_595.add_chain(BENCH_DATA_LEDS1, BENCH_CLOCK_LEDS1, BENCH_LATCH_LEDS1);
+  cadeias_595.add_chain(BENCH_DATA_LEDS2, BENCH_CLOCK_LEDS2, BENCH_LATCH_LEDS2);
+  cadeias_595.add_chain(BENCH_DATA_LEDS3, BENCH_CLOCK_LEDS3, BENCH_LATCH_LEDS3);
+  cadeias_595.begin();
+  montar_curva_luz(8 * 60, 14 * 60); // janela da agenda padrão dos leds
+
+  bench_print("%-34s %16s %16s %14s\n", "caso", "tempo", "alocacoes", "heap perdido");
+  bench_modulos(BENCH_DATA_LEDS3, BENCH_CLOCK_LEDS3, BENCH_LATCH_LEDS3);
+  return 0;
+}
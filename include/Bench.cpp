@@ -0,0 +1,341 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <FarmControl.cpp>
+#include <JsonStream.cpp>
+
+//------------------------------------------------------------------------------
+// Microbenchmarks dos caminhos quentes (pc e ESP32)
+//------------------------------------------------------------------------------
+// no pc: bench/bench.cpp (pio run -e native_bench), tempo por clock_gettime
+// no ESP32: env bench (-DBENCH), roda no setup() antes das tasks, tempo pelo contador de ciclos da cpu
+// cada medida roda BENCH_LOTES lotes e fica com o melhor (menos ruido de interrupção/escalonador);
+// alocações sao contadas pelo operator new (pc) ou pelo malloc embrulhado com -Wl,--wrap (ESP32).
+// o parser de requisições do ESPAsyncWebServer nao entra: ele é privado e preso a um AsyncClient conectado.
+
+#define BENCH_LOTES 5
+
+#ifdef ARDUINO
+  #include <Arduino.h>
+
+  #define bench_print(...) Serial.printf(__VA_ARGS__)
+
+  static inline uint32_t bench_ticks(){
+    return ESP.getCycleCount();
+  }
+
+  //ciclos -> ns (o contador é de 32 bits: lotes precisam durar menos de ~17s a 240MHz)
+  static inline double bench_ns(uint32_t ticks){
+    return ticks * 1000.0 / getCpuFrequencyMhz();
+  }
+
+  static inline int32_t bench_heap_livre(){
+    return (int32_t)ESP.getFreeHeap();
+  }
+#else
+  #include <time.h>
+
+  #define bench_print(...) printf(__VA_ARGS__)
+
+  static inline uint32_t bench_ticks(){
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint32_t)((uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec);
+  }
+
+  static inline double bench_ns(uint32_t ticks){
+    return ticks;
+  }
+
+  static inline int32_t bench_heap_livre(){
+    return 0;
+  }
+#endif
+
+static volatile uint32_t bench_alocacoes = 0; // incrementado pelos ganchos de alocação
+static volatile uint32_t bench_sumidouro = 0;  // resultados usados, para o compilador nao eliminar o laço
+
+#if defined(ARDUINO) && defined(BENCH)
+  // ganchos do -Wl,--wrap=malloc/calloc/realloc (env bench): contam todas as alocações, inclusive as da String
+  extern "C" {
+    void *__real_malloc(size_t tamanho);
+    void *__real_calloc(size_t quantidade, size_t tamanho);
+    void *__real_realloc(void *ponteiro, size_t tamanho);
+
+    void *__wrap_malloc(size_t tamanho){
+      bench_alocacoes++;
+      return __real_malloc(tamanho);
+    }
+
+    void *__wrap_calloc(size_t quantidade, size_t tamanho){
+      bench_alocacoes++;
+      return __real_calloc(quantidade, tamanho);
+    }
+
+    void *__wrap_realloc(void *ponteiro, size_t tamanho){
+      bench_alocacoes++;
+      return __real_realloc(ponteiro, tamanho);
+    }
+  }
+#endif
+
+//mede uma função: melhor ns/op entre os lotes, alocações e heap perdido por operação
+static void bench(const char *nome, void (*funcao)(void), uint32_t iteracoes){
+  funcao(); // aquece caches e estado inicial
+
+  double melhor = 1e30;
+  uint32_t alocacoes = 0;
+  int32_t heap_perdido = 0;
+  for (uint8_t lote = 0; lote < BENCH_LOTES; lote++) {
+    uint32_t alocacoes_antes = bench_alocacoes;
+    int32_t heap_antes = bench_heap_livre();
+    uint32_t inicio = bench_ticks();
+    for (uint32_t i = 0; i < iteracoes; i++) funcao();
+    double ns = bench_ns(bench_ticks() - inicio) / iteracoes;
+    if (ns < melhor) melhor = ns;
+    alocacoes += bench_alocacoes - alocacoes_antes;
+    heap_perdido += heap_antes - bench_heap_livre();
+  }
+
+  double total = (double)iteracoes * BENCH_LOTES;
+  bench_print("%-34s %10.1f ns/op %8.2f aloc/op %8.2f B/op\n", nome, melhor, alocacoes / total, heap_perdido / total);
+}
+
+//------------------------------------------------------------------------------
+// Referencia: envio antigo dos 74HC595 (um vetor de bool por cadeia, um shiftOut por chamada)
+//------------------------------------------------------------------------------
+static uint8_t bench_pino_data;
+static uint8_t bench_pino_clock;
+static uint8_t bench_pino_latch;
+
+static void legado_code_74hc595(bool data_arr[], uint8_t pin_data, uint8_t pin_clock, uint8_t pin_latch){
+  uint8_t binario = 0;
+  for (int i = 0; i < 8; i++) {
+    if (data_arr[i] == 1) binario |= 1 << (7 - i);
+  }
+
+  #ifdef ARDUINO
+    digitalWrite(pin_latch, LOW);
+    shiftOut(pin_data, pin_clock, MSBFIRST, binario);
+    digitalWrite(pin_latch, HIGH);
+    digitalWrite(pin_latch, LOW);
+  #else
+    // mesma sequencia de escritas de pino, pelo backend de pc do ShiftChains
+    uint64_t data = (uint64_t)1 << pin_data;
+    uint64_t clock = (uint64_t)1 << pin_clock;
+    uint64_t latch = (uint64_t)1 << pin_latch;
+    shift_gpio_clear(latch);
+    for (int8_t b = 7; b >= 0; b--) {
+      if (binario & (1 << b)) shift_gpio_set(data);
+      else shift_gpio_clear(data);
+      shift_gpio_set(clock);
+      shift_gpio_clear(clock);
+    }
+    shift_gpio_set(latch);
+    shift_gpio_clear(latch);
+  #endif
+}
+
+//set_state_leds antigo: 24 set_led, cada um reenviando as 3 cadeias (aqui todas no mesmo par de pinos de teste)
+static void legado_set_state_leds(bool vermelho, bool azul){
+  static bool vetores[3][8];
+  for (uint8_t i = 0; i < 12; i++) {
+    for (uint8_t cor = 0; cor < 2; cor++) {
+      bool valor = cor ? vermelho : azul;
+      uint8_t posicao = cor ? i : i + 12;
+      vetores[posicao / 8][posicao % 8] = valor;
+      for (uint8_t c = 0; c < 3; c++) legado_code_74hc595(vetores[c], bench_pino_data, bench_pino_clock, bench_pino_latch);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// Casos
+//------------------------------------------------------------------------------
+static uint32_t bench_contador = 0;
+
+static void caso_legado_code_74hc595(){
+  static bool vetor[8] = {1, 0, 1, 0, 1, 0, 1, 0};
+  vetor[0] = !vetor[0];
+  legado_code_74hc595(vetor, bench_pino_data, bench_pino_clock, bench_pino_latch);
+}
+
+static void caso_commit_mudou(){
+  cadeias_595.set(CADEIA_RELES, state.rele_byte()); // reles sempre iguais: so a cadeia de leds troca
+  cadeias_595.set(CADEIA_LEDS3, (uint8_t)bench_contador++);
+  cadeias_595.commit();
+}
+
+static void caso_commit_igual(){
+  cadeias_595.commit();
+}
+
+static void caso_legado_set_state_leds(){
+  legado_set_state_leds(bench_contador & 1, bench_contador & 1);
+  bench_contador++;
+}
+
+static void caso_set_state_leds(){
+  set_state_leds(bench_contador & 1, bench_contador & 1);
+  bench_contador++;
+}
+
+static void caso_aplicar_luz_dimmer(){
+  leds.fill_level((uint8_t)bench_contador, 128);
+  leds.present();
+  bench_contador++;
+}
+
+static OffTime bench_relogio;
+
+static void caso_civil(){
+  DataHora data;
+  OffTime::civil(1704067200LL + (int64_t)(bench_contador++ % 36500) * 86399, data);
+  bench_sumidouro += data.mes + data.minuto_dia;
+}
+
+static void caso_get_month(){
+  bench_sumidouro += bench_relogio.get_month() + bench_relogio.get_minute_of_day(); // mesmo segundo: cache
+  bench_contador++;
+}
+
+static ExpressaoCron bench_cron;
+
+static void caso_cron_next(){
+  bench_sumidouro += (uint32_t)CronSchedule::next(bench_cron, 1704067200LL + (int64_t)(bench_contador++ % 100000) * 617);
+}
+
+static void caso_fotoperiodo(){
+  uint16_t minuto = bench_contador++ % MINUTOS_DIA;
+  bench_sumidouro += fotoperiodo.red(minuto) + fotoperiodo.blue(minuto);
+}
+
+static Scheduler bench_agenda;
+
+static void bench_tarefa_vazia(){
+  bench_sumidouro++;
+}
+
+static void caso_scheduler_run(){
+  bench_sumidouro += bench_agenda.run(bench_contador);
+  bench_contador += 7;
+}
+
+static Scheduler bench_agenda_medida;
+static TaskMetrics bench_metricas;
+
+static void caso_scheduler_run_metricas(){
+  bench_sumidouro += bench_agenda_medida.run(bench_contador);
+  bench_contador += 7;
+}
+
+static SensorFilter<JANELA_FILTRO_DHT, EMA_SHIFT_DHT> bench_filtro;
+
+static void caso_filtro_dht(){
+  bench_filtro.push(250 + (int16_t)(bench_contador % 13), bench_contador);
+  bench_contador++;
+  bench_sumidouro += bench_filtro.value();
+}
+
+static ClimateController bench_clima;
+
+static void caso_controle_clima(){
+  EntradaClima entrada;
+  entrada.temperatura_x10 = 280 + (int16_t)(bench_contador % 40);
+  entrada.umidade_x10 = 850;
+  entrada.umidade_externa = 60;
+  entrada.chuva = false;
+  entrada.ajuste_temp_x10 = 0;
+  bench_sumidouro += bench_clima.update(entrada, bench_contador * 5000);
+  bench_contador++;
+}
+
+static Rollup bench_rollup;
+
+static void caso_rollup(){
+  bench_rollup.add(1704067200UL + bench_contador, 250 + (int16_t)(bench_contador % 13));
+  bench_contador++;
+}
+
+//resposta tipica do OpenWeatherMap (weather?lat=..&units=metric), entregue em pedaços como o socket faria
+static const char bench_json_clima[] =
+  "{\"coord\":{\"lon\":-54.22,\"lat\":-28.3},\"weather\":[{\"id\":500,\"main\":\"Rain\",\"description\":\"light rain\","
+  "\"icon\":\"10d\"}],\"base\":\"stations\",\"main\":{\"temp\":23.46,\"feels_like\":23.81,\"temp_min\":23.46,"
+  "\"temp_max\":23.46,\"pressure\":1012,\"humidity\":87,\"sea_level\":1012,\"grnd_level\":985},\"visibility\":10000,"
+  "\"wind\":{\"speed\":3.6,\"deg\":140,\"gust\":6.1},\"rain\":{\"1h\":0.25},\"clouds\":{\"all\":100},\"dt\":1704067200,"
+  "\"sys\":{\"country\":\"BR\",\"sunrise\":1704012345,\"sunset\":1704062345},\"timezone\":-10800,\"id\":3449340,"
+  "\"name\":\"Ijui\",\"cod\":200}";
+static const char *const bench_caminhos_clima[] = {"main.humidity", "main.temp", "rain.1h", "wind.speed"};
+
+static void bench_campo_clima(void *, uint8_t indice, const char *valor, bool){
+  bench_sumidouro += indice + JsonStream::fixed(valor, 1);
+}
+
+static void caso_json_clima(){
+  JsonStream parser(bench_caminhos_clima, 4, bench_campo_clima, nullptr);
+  for (size_t i = 0; i < sizeof(bench_json_clima) - 1; i += 64) {
+    size_t n = sizeof(bench_json_clima) - 1 - i;
+    parser.feed(bench_json_clima + i, n < 64 ? n : 64);
+  }
+  bench_sumidouro += parser.done();
+}
+
+static RingLog bench_log; // anel proprio: no ESP32 a task de log ja esta drenando o registro_log
+static RegistroLog bench_registro;
+
+static void caso_log_gravar_ler(){
+  static uint8_t modulo = bench_log.module("BENCH");
+  bench_log.write(modulo, LOG_INFO, bench_contador, "Bomba %d sem vazao, %lu mL, %s", 1, (unsigned long)bench_contador, "falha");
+  bench_sumidouro += bench_log.read(bench_registro);
+  bench_contador++;
+}
+
+static void caso_log_formatar(){
+  char linha[LOG_MAX_LINHA];
+  bench_sumidouro += bench_log.format(bench_registro, linha, sizeof(linha));
+}
+
+static void caso_log_filtrado(){
+  hal_log_debug("BENCH", "Bomba %d:%02d Min", (int)(bench_contador % 60), 5); // debug desligado por padrao
+  bench_contador++;
+}
+
+//roda os casos que nao dependem da interface (lcd/rede)
+//os pinos sao de uma cadeia de leds livre para o envio antigo (os leds piscam durante a medida)
+static void bench_modulos(uint8_t pin_data, uint8_t pin_clock, uint8_t pin_latch){
+  bench_pino_data = pin_data;
+  bench_pino_clock = pin_clock;
+  bench_pino_latch = pin_latch;
+
+  for (uint8_t i = 0; i < 8; i++) bench_agenda.add(bench_tarefa_vazia, 100 + i * 37, 0);
+  for (uint8_t i = 0; i < 8; i++) bench_agenda_medida.add(bench_tarefa_vazia, 100 + i * 37, 0);
+  bench_metricas.attach(bench_agenda_medida);
+  bench_clima.config(config_clima_atual());
+  bench_relogio.set(1704078000UL);
+  CronSchedule::compile("30 6-20/3 * * 1-5", bench_cron);
+
+  bench("legado code_74hc595", caso_legado_code_74hc595, 2000);
+  bench("ShiftChains::commit (1 cadeia)", caso_commit_mudou, 2000);
+  bench("ShiftChains::commit (sem mudanca)", caso_commit_igual, 20000);
+  bench("legado set_state_leds", caso_legado_set_state_leds, 50);
+  bench("set_state_leds", caso_set_state_leds, 2000);
+  bench("OffTime::civil (data do epoch)", caso_civil, 20000);
+  bench("OffTime::get_month (cache)", caso_get_month, 20000);
+  bench("CronSchedule::next (dias uteis)", caso_cron_next, 20000);
+  bench("Photoperiod::red/blue", caso_fotoperiodo, 20000);
+  bench("Scheduler::run (8 tarefas)", caso_scheduler_run, 20000);
+  bench("Scheduler::run + TaskMetrics", caso_scheduler_run_metricas, 20000);
+  bench("SensorFilter::push", caso_filtro_dht, 20000);
+  bench("ClimateController::update", caso_controle_clima, 20000);
+  bench("Rollup::add (1min/15min/1h)", caso_rollup, 20000);
+  bench("JsonStream (resposta do clima)", caso_json_clima, 2000);
+  bench("RingLog gravar + ler", caso_log_gravar_ler, 20000);
+  bench("RingLog::format (dreno)", caso_log_formatar, 2000);
+  bench("hal_log_debug (filtrado)", caso_log_filtrado, 20000);
+  bench("LedFrame::present (dimmer)", caso_aplicar_luz_dimmer, 2000); // por ultimo: liga a interrupção do BCM
+
+  set_state_leds(false, false); // volta ao caminho estatico (para o BCM)
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef CLIMATE_CONTROLLER
+#define CLIMATE_CONTROLLER
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Ponto fixo Q16.16 (1.0 = 65536), sem nenhuma operação em float em tempo de execução
+//------------------------------------------------------------------------------
+typedef int32_t q16_t;
+
+#define Q16_UM 65536
+#define Q16(x) ((q16_t)((x) * 65536.0))                       // somente com constantes (resolvido na compilação)
+#define Q16_DECIMOS(d) ((q16_t)(((int64_t)(d) << 16) / 10))  // decimos (leituras dos sensores) -> Q16
+
+static inline q16_t q16_mul(q16_t a, q16_t b){
+  return (q16_t)(((int64_t)a * b) >> 16);
+}
+
+static inline q16_t q16_limitar(q16_t v, q16_t minimo, q16_t maximo){
+  return (v < minimo) ? minimo : ((v > maximo) ? maximo : v);
+}
+
+//PID em Q16 com saida limitada a [0, 1] e anti-windup por integração condicional
+//(o integrador nao acumula quando a saida ja esta saturada no sentido do erro)
+class PidQ16{
+  private:
+    q16_t kp = 0;
+    q16_t ki = 0;  // por segundo
+    q16_t kd = 0;  // segundos
+    q16_t integral = 0;
+    q16_t erro_anterior = 0;
+    bool iniciado = false;
+
+  public:
+    void config(q16_t kp_novo, q16_t ki_novo, q16_t kd_novo){
+      kp = kp_novo;
+      ki = ki_novo;
+      kd = kd_novo;
+    }
+
+    void reset(){
+      integral = 0;
+      erro_anterior = 0;
+      iniciado = false;
+    }
+
+    //erro positivo = precisa de mais saida (mais ventilação)
+    q16_t update(q16_t erro, uint32_t dt_ms){
+      q16_t p = q16_mul(kp, erro);
+
+      q16_t d = 0;
+      if (iniciado && dt_ms > 0) {
+        d = (q16_t)(((int64_t)q16_mul(kd, erro - erro_anterior) * 1000) / dt_ms);
+      }
+      erro_anterior = erro;
+      iniciado = true;
+
+      q16_t incremento = (q16_t)(((int64_t)q16_mul(ki, erro) * dt_ms) / 1000);
+      q16_t tentativa = p + d + integral + incremento;
+      bool saturado_alto = (tentativa > Q16_UM && incremento > 0);
+      bool saturado_baixo = (tentativa < 0 && incremento < 0);
+      if (!saturado_alto && !saturado_baixo) {
+        integral = q16_limitar(integral + incremento, -Q16_UM, Q16_UM);
+      }
+
+      return q16_limitar(p + d + integral, 0, Q16_UM);
+    }
+
+    q16_t integral_term(){
+      return integral;
+    }
+};
+
+//entradas do controlador (mesmo ponto fixo das leituras: decimos)
+struct EntradaClima{
+  int16_t temperatura_x10;
+  int16_t umidade_x10;
+  uint8_t umidade_externa;  // %
+  bool chuva;
+  int16_t ajuste_temp_x10;  // deslocamento dos limites de temperatura pela previsão (negativo ventila antes, positivo segura calor)
+};
+
+//parametros do controlador
+struct ConfigClima{
+  int16_t temp_alvo_x10;      // acima disso os exaustores resfriam
+  int16_t temp_min_x10;       // abaixo disso os exaustores nunca ligam (segura o calor)
+  int16_t umid_alvo_x10;      // acima disso os exaustores desumidificam
+  int16_t umid_limite_x10;    // a partir disso a umidade nao liga os exaustores (extremo: caso do ar condicionado)
+  uint8_t umid_externa_max;   // so desumidifica se o ar de fora for mais seco que isso
+  q16_t kp_temp;              // saida por grau
+  q16_t ki_temp;              // saida por grau por segundo
+  q16_t kp_umid;              // saida por ponto de umidade
+  q16_t ki_umid;              // saida por ponto de umidade por segundo
+  uint32_t janela_ms;         // janela da modulação por tempo (saida 0.5 = metade da janela ligado)
+  uint32_t min_ligado_ms;     // ciclos menores que isso nao ligam o rele
+  uint32_t max_continuo_ms;   // tempo maximo ligado sem parar
+  uint32_t descanso_ms;       // pausa obrigatoria depois do tempo maximo
+};
+
+//quem decidiu o estado atual dos exaustores
+enum MotivoExaustor{
+  EXAUSTOR_PARADO,        // sem demanda
+  EXAUSTOR_TEMPERATURA,   // demanda de resfriamento
+  EXAUSTOR_UMIDADE,       // demanda de desumidificação
+  EXAUSTOR_FRIO,          // veto: abaixo da temperatura minima
+  EXAUSTOR_DESCANSO       // pausa depois do tempo maximo ligado
+};
+
+//controlador unificado de clima: um PID de temperatura e um de umidade, arbitrados em uma unica demanda
+//  - frio (abaixo de temp_min) veta tudo e zera os integradores
+//  - umidade so conta se o ar externo ajuda (mais seco e sem chuva) e abaixo de umid_limite, senao o integrador dela é zerado
+//  - a maior demanda vence
+//  - ajuste_temp_x10 (previsão) desloca alvo e minimo juntos: o controle age antes da mudança chegar
+//a demanda (0 a 1) vira liga/desliga do rele por modulação de tempo dentro de uma janela.
+class ClimateController{
+  private:
+    ConfigClima cfg;
+    PidQ16 pid_temp;
+    PidQ16 pid_umid;
+
+    q16_t demanda = 0;
+    MotivoExaustor motivo = EXAUSTOR_PARADO;
+    bool ligado = false;
+    bool iniciado = false;
+    uint32_t ultimo_update = 0;
+    uint32_t inicio_janela = 0;
+    uint32_t millis_ligou = 0;
+    uint32_t millis_descanso = 0;
+    bool descansando = false;
+
+  public:
+    void config(const ConfigClima &nova){
+      cfg = nova;
+      pid_temp.config(cfg.kp_temp, cfg.ki_temp, 0);
+      pid_umid.config(cfg.kp_umid, cfg.ki_umid, 0);
+    }
+
+    //calcula a demanda e retorna se os exaustores devem estar ligados agora
+    bool update(const EntradaClima &entrada, uint32_t agora){
+      uint32_t dt = iniciado ? (agora - ultimo_update) : 0;
+      ultimo_update = agora;
+      if (!iniciado) {
+        inicio_janela = agora;
+        iniciado = true;
+      }
+
+      // malhas
+      q16_t demanda_temp = 0;
+      q16_t demanda_umid = 0;
+      int16_t temp_alvo = cfg.temp_alvo_x10 + entrada.ajuste_temp_x10;
+      bool frio = entrada.temperatura_x10 < cfg.temp_min_x10 + entrada.ajuste_temp_x10;
+      bool ar_externo_ajuda = !entrada.chuva && entrada.umidade_externa < cfg.umid_externa_max;
+      bool umidade_extrema = entrada.umidade_x10 >= cfg.umid_limite_x10;
+
+      if (frio) {
+        pid_temp.reset();
+        pid_umid.reset();
+      } else {
+        demanda_temp = pid_temp.update(Q16_DECIMOS(entrada.temperatura_x10 - temp_alvo), dt);
+        if (ar_externo_ajuda && !umidade_extrema) {
+          demanda_umid = pid_umid.update(Q16_DECIMOS(entrada.umidade_x10 - cfg.umid_alvo_x10), dt);
+        } else {
+          pid_umid.reset();
+        }
+      }
+
+      // arbitragem
+      if (frio) {
+        demanda = 0;
+        motivo = EXAUSTOR_FRIO;
+      } else if (demanda_temp >= demanda_umid) {
+        demanda = demanda_temp;
+        motivo = demanda ? EXAUSTOR_TEMPERATURA : EXAUSTOR_PARADO;
+      } else {
+        demanda = demanda_umid;
+        motivo = EXAUSTOR_UMIDADE;
+      }
+
+      // modulação por tempo dentro da janela
+      if (agora - inicio_janela >= cfg.janela_ms) inicio_janela = agora;
+      uint32_t tempo_ligado = (uint32_t)(((uint64_t)demanda * cfg.janela_ms) >> 16);
+      if (tempo_ligado < cfg.min_ligado_ms) tempo_ligado = 0;
+      if (cfg.janela_ms - tempo_ligado < cfg.min_ligado_ms) tempo_ligado = cfg.janela_ms; // quase 100%: nao desliga por pouco tempo
+      bool quer_ligar = (agora - inicio_janela) < tempo_ligado;
+
+      // protecao: tempo maximo ligado continuamente seguido de descanso
+      if (descansando && agora - millis_descanso >= cfg.descanso_ms) descansando = false;
+      if (ligado && quer_ligar && agora - millis_ligou >= cfg.max_continuo_ms) {
+        descansando = true;
+        millis_descanso = agora;
+      }
+      if (descansando) {
+        quer_ligar = false;
+        if (demanda) motivo = EXAUSTOR_DESCANSO;
+      }
+
+      if (quer_ligar && !ligado) millis_ligou = agora;
+      ligado = quer_ligar;
+      return ligado;
+    }
+
+    //demanda atual em Q16 (0 a 1)
+    q16_t demand(){
+      return demanda;
+    }
+
+    //demanda atual em porcentagem
+    uint8_t demand_percent(){
+      return (uint8_t)(((int64_t)demanda * 100) >> 16);
+    }
+
+    MotivoExaustor reason(){
+      return motivo;
+    }
+
+    bool output(){
+      return ligado;
+    }
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef CLOCK_DISCIPLINE
+#define CLOCK_DISCIPLINE
+
+#include <stdint.h>
+#include <string.h>
+#include <OffTime.cpp>
+
+#define NTP_TAMANHO_PACOTE 48
+#define NTP_PORTA 123
+#define NTP_ERA_1970 2208988800LL       // Segundos de 1900 (inicio da era NTP) ate 1970
+#define RELOGIO_LIMITE_AJUSTE_US 128000  // Erro acima disso vira salto (set) em vez de ajuste gradual (mesmo limite do ntpd)
+#define RELOGIO_IDA_VOLTA_MAX_US 500000  // Resposta com ida e volta maior que isso é descartada (fila no caminho, erro grande)
+#define RELOGIO_INTERVALO_DERIVA_S 900   // Intervalo minimo entre as amostras usadas para medir a deriva
+#define RELOGIO_DERIVA_MAX_PPB 500000    // Deriva medida acima disso (500 ppm) é tratada como erro de medida
+#define RELOGIO_EMA_SHIFT 2              // Peso de cada nova medida da deriva (1/4)
+
+//qualidade do sincronismo (mostrada em /metricas e no resumo da serial)
+struct MetricasRelogio{
+  uint32_t sincronizacoes;   // respostas aceitas
+  uint32_t descartadas;      // pacote invalido, servidor sem sincronismo ou ida e volta longa
+  uint32_t sem_resposta;     // pedidos sem resposta ate o timeout
+  uint32_t saltos;           // correções por salto (a primeira é a do boot)
+  int32_t ultimo_erro_us;    // servidor - local na ultima resposta aceita (antes de corrigir)
+  int32_t maior_erro_us;     // maior |erro| corrigido sem salto
+  uint32_t ida_volta_us;     // ida e volta da ultima resposta aceita
+  int32_t deriva_ppb;        // correção de frequencia em uso
+  uint32_t ultima_utc;       // epoch UTC da ultima resposta aceita
+};
+
+//disciplina o OffTime por SNTP (RFC 4330) sem depender da rede: quem chama envia o pedido montado por request()
+//e entrega a resposta em response(), com o uptime de cada um (a task de rede do ESP32 ou o servidor falso do simulador)
+//  - erro = ((T2 - T1) + (T3 - T4)) / 2 e ida e volta = (T4 - T1) - (T3 - T2), com T1/T4 no relogio local
+//  - deriva: inclinação de (hora do servidor - uptime) entre amostras a pelo menos RELOGIO_INTERVALO_DERIVA_S,
+//    suavizada por media exponencial e aplicada como correção de frequencia (ppb) no OffTime
+//  - erro pequeno é absorvido aos poucos (OffTime::discipline), grande vira salto
+class ClockDiscipline{
+  private:
+    OffTime &relogio;
+    MetricasRelogio metricas;
+
+    uint8_t origem[8];              // transmit timestamp do pedido (o servidor devolve em originate)
+    bool pendente = false;
+    uint64_t uptime_pedido = 0;
+
+    bool tem_amostra = false;       // amostra de referencia da deriva
+    int64_t amostra_uptime = 0;
+    int64_t amostra_bruta = 0;      // hora do servidor - uptime (us)
+    bool deriva_medida = false;
+    int32_t deriva_ppb = 0;
+    uint32_t intervalo_ms = 0;      // ultimo intervalo entregue por poll_interval_ms()
+
+    void medir_deriva(int64_t uptime, int64_t bruta){
+      if (!tem_amostra) {
+        tem_amostra = true;
+        amostra_uptime = uptime;
+        amostra_bruta = bruta;
+        return;
+      }
+      int64_t intervalo = uptime - amostra_uptime;
+      if (intervalo < (int64_t)RELOGIO_INTERVALO_DERIVA_S * 1000000) return; // mantem a referencia mais antiga
+      int64_t medida = (bruta - amostra_bruta) * 1000 / (intervalo / 1000000); // ppb
+      amostra_uptime = uptime;
+      amostra_bruta = bruta;
+      if (medida > RELOGIO_DERIVA_MAX_PPB || medida < -RELOGIO_DERIVA_MAX_PPB) return;
+      if (!deriva_medida) {
+        deriva_ppb = (int32_t)medida;
+        deriva_medida = true;
+      } else {
+        deriva_ppb += ((int32_t)medida - deriva_ppb) / (1 << RELOGIO_EMA_SHIFT);
+      }
+    }
+
+  public:
+    //timestamp NTP (segundos desde 1900 + fração de 2^-32 s, big-endian) de um epoch UTC em us
+    static void encode_timestamp(uint8_t *destino, int64_t unix_us){
+      uint64_t segundos = (uint64_t)(unix_us / 1000000 + NTP_ERA_1970);
+      uint32_t fracao = (uint32_t)(((uint64_t)(unix_us % 1000000) << 32) / 1000000);
+      for (uint8_t i = 0; i < 4; i++) destino[i] = (uint8_t)(segundos >> (24 - 8 * i));
+      for (uint8_t i = 0; i < 4; i++) destino[4 + i] = (uint8_t)(fracao >> (24 - 8 * i));
+    }
+
+    //epoch UTC em us de um timestamp NTP; segundos abaixo de 2^31 sao da era 1 (depois de 2036-02-07)
+    static int64_t decode_timestamp(const uint8_t *origem_bytes){
+      uint32_t segundos = 0, fracao = 0;
+      for (uint8_t i = 0; i < 4; i++) segundos = (segundos << 8) | origem_bytes[i];
+      for (uint8_t i = 0; i < 4; i++) fracao = (fracao << 8) | origem_bytes[4 + i];
+      int64_t completo = (int64_t)segundos + (segundos < 0x80000000UL ? 0x100000000LL : 0);
+      return (completo - NTP_ERA_1970) * 1000000 + (int64_t)(((uint64_t)fracao * 1000000) >> 32);
+    }
+
+    ClockDiscipline(OffTime &relogio_disciplinado) : relogio(relogio_disciplinado){
+      memset(&metricas, 0, sizeof(metricas));
+      memset(origem, 0, sizeof(origem));
+    }
+
+    //monta o pedido (modo cliente, versão 4) com o relogio local no uptime de envio
+    void request(uint8_t pacote[NTP_TAMANHO_PACOTE], uint64_t uptime_us){
+      memset(pacote, 0, NTP_TAMANHO_PACOTE);
+      pacote[0] = (0 << 6) | (4 << 3) | 3; // LI 0, VN 4, modo 3
+      encode_timestamp(origem, relogio.utc_at_us(uptime_us));
+      memcpy(pacote + 40, origem, 8);
+      uptime_pedido = uptime_us;
+      pendente = true;
+    }
+
+    //processa a resposta recebida no uptime dado; false se foi descartada
+    bool response(const uint8_t pacote[NTP_TAMANHO_PACOTE], uint64_t uptime_us){
+      uint8_t modo = pacote[0] & 0x07;
+      uint8_t salto = pacote[0] >> 6;
+      uint8_t estrato = pacote[1];
+      if (!pendente || modo != 4 || salto == 3 || estrato == 0 || estrato > 15 || memcmp(pacote + 24, origem, 8) != 0) {
+        metricas.descartadas++; // resposta atrasada de outro pedido, kiss-o'-death ou servidor sem referencia
+        return false;
+      }
+      pendente = false;
+
+      int64_t t1 = relogio.utc_at_us(uptime_pedido);
+      int64_t t2 = decode_timestamp(pacote + 32);
+      int64_t t3 = decode_timestamp(pacote + 40);
+      int64_t t4 = relogio.utc_at_us(uptime_us);
+      int64_t ida_volta = (t4 - t1) - (t3 - t2);
+      int64_t erro = ((t2 - t1) + (t3 - t4)) / 2;
+      if (ida_volta < 0 || ida_volta > RELOGIO_IDA_VOLTA_MAX_US) {
+        metricas.descartadas++;
+        return false;
+      }
+
+      medir_deriva((int64_t)uptime_us, t4 + erro - (int64_t)uptime_us);
+
+      if (erro > RELOGIO_LIMITE_AJUSTE_US || erro < -RELOGIO_LIMITE_AJUSTE_US) {
+        relogio.set_us(relogio.utc_us() + erro);
+        relogio.discipline(0, deriva_ppb);
+        metricas.saltos++;
+      } else {
+        relogio.discipline(erro, deriva_ppb);
+        int32_t absoluto = erro < 0 ? -erro : erro;
+        if (absoluto > metricas.maior_erro_us) metricas.maior_erro_us = absoluto;
+      }
+
+      metricas.sincronizacoes++;
+      metricas.ultimo_erro_us = (int32_t)(erro > INT32_MAX ? INT32_MAX : erro < -INT32_MAX ? -INT32_MAX : erro);
+      metricas.ida_volta_us = (uint32_t)ida_volta;
+      metricas.deriva_ppb = deriva_ppb;
+      metricas.ultima_utc = relogio.utc();
+      return true;
+    }
+
+    //o pedido pendente expirou sem resposta
+    void timeout(){
+      if (!pendente) return;
+      pendente = false;
+      metricas.sem_resposta++;
+    }
+
+    //intervalo ate a proxima sincronização, chamado uma vez por pedido terminado (resposta ou timeout):
+    //curto enquanto a deriva nao foi medida (sem a correção de frequencia o erro de uma hora passa de
+    //RELOGIO_LIMITE_AJUSTE_US a partir de ~36 ppm e vira salto), depois dobra ate longo enquanto a media refina
+    uint32_t poll_interval_ms(uint32_t curto, uint32_t longo){
+      if (!deriva_medida || intervalo_ms < curto) intervalo_ms = curto;
+      else intervalo_ms = intervalo_ms > longo / 2 ? longo : intervalo_ms * 2;
+      return intervalo_ms;
+    }
+
+    //erro ainda sendo absorvido pelo OffTime (us)
+    int64_t pending_us() const{
+      return relogio.pending_us();
+    }
+
+    const MetricasRelogio &metrics() const{
+      return metricas;
+    }
+};
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef CONFIG_STORE
+#define CONFIG_STORE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#define CONFIG_MAX_PARAMETROS 32   // Limite do filtro do JsonStream (um caminho por parametro) e da gravação
+#define CONFIG_MAX_OBSERVADORES 8  // Controladores avisados quando os seus parametros mudam
+#define CONFIG_MAX_CASAS 6         // Casas decimais do ponto fixo (o texto convertido cabe em int64)
+#define CONFIG_MAX_TEXTO 24        // Valor formatado com sinal, ponto e terminador
+#define CONFIG_VERSAO 1
+
+//descritor de um parametro: a tabela de quem usa (constexpr, na ordem do enum) é a unica definição do parametro
+//valores inteiros em ponto fixo com casas decimais (temp_max = 305 com 1 casa é 30.5 no json)
+struct DescritorConfig{
+  const char *nome;     // chave no json e identificação na gravação
+  const char *unidade;  // so informativa (GET /config)
+  int32_t minimo;
+  int32_t maximo;
+  int32_t padrao;
+  uint8_t casas;
+  uint32_t grupos;      // bits dos controladores avisados quando o parametro muda
+};
+
+//conferencias da tabela na compilação (static_assert de quem define)
+constexpr bool config_nomes_iguais(const char *a, const char *b){
+  return *a == *b && (*a == '\0' || config_nomes_iguais(a + 1, b + 1));
+}
+
+constexpr bool config_nome_repetido(const DescritorConfig *tabela, uint8_t n, const char *nome){
+  return n > 0 && (config_nomes_iguais(tabela->nome, nome) || config_nome_repetido(tabela + 1, n - 1, nome));
+}
+
+//nome presente e unico, padrão dentro dos limites e casas suportadas
+constexpr bool config_tabela_valida(const DescritorConfig *tabela, uint8_t n){
+  return n == 0 || (tabela->nome != nullptr && tabela->unidade != nullptr && tabela->casas <= CONFIG_MAX_CASAS &&
+                    tabela->minimo <= tabela->padrao && tabela->padrao <= tabela->maximo &&
+                    !config_nome_repetido(tabela + 1, n - 1, tabela->nome) && config_tabela_valida(tabela + 1, n - 1));
+}
+
+//alteração de varios parametros de uma vez (http/websocket -> task de controle): vale inteira ou nada muda
+template <uint8_t N>
+struct TransacaoConfig{
+  uint8_t quantidade = 0;
+  uint8_t ids[N];
+  int32_t valores[N];
+};
+
+//gravação no NVS em um unico blob (a escrita de um blob é atomica): parametros identificados pelo FNV-1a do nome,
+//tamanho fixo para que adicionar ou remover parametros mantenha os valores dos outros
+struct ConfigGravada{
+  uint16_t versao;
+  uint8_t quantidade;
+  uint32_t chaves[CONFIG_MAX_PARAMETROS];
+  int32_t valores[CONFIG_MAX_PARAMETROS];
+  uint32_t verificacao;                    // FNV-1a dos campos acima
+};
+
+//chamado uma vez por commit que mudou algum parametro dos grupos assinados
+typedef void (*ConfigObservador)();
+
+//coerencia entre parametros (ex: minimo abaixo do alvo), sobre os valores que ficariam depois do commit
+typedef bool (*ConfigValidador)(const int32_t *valores);
+
+//registro de parametros em tempo de execução: leitura O(1) pelo indice do enum, alteração so por transação
+//(validada inteira antes de escrever o primeiro valor) e aviso aos observadores depois de aplicar tudo.
+//sem locks: cada task tem a sua instancia (a de controle recebe as transações por fila)
+template <uint8_t N>
+class ConfigStore{
+  static_assert(N > 0 && N <= CONFIG_MAX_PARAMETROS, "ConfigStore: de 1 a CONFIG_MAX_PARAMETROS parametros");
+
+  private:
+    const DescritorConfig *descritores;
+    ConfigValidador validador;
+    int32_t valores[N];
+    const char *nomes[N];   // filtro do JsonStream
+    ConfigObservador observadores[CONFIG_MAX_OBSERVADORES];
+    uint32_t grupos_observados[CONFIG_MAX_OBSERVADORES];
+    uint8_t quantidade_observadores = 0;
+
+    static uint32_t chave(const char *nome){
+      uint32_t hash = 2166136261u;
+      while (*nome) hash = (hash ^ (uint8_t)*nome++) * 16777619u;
+      return hash;
+    }
+
+    static uint32_t checksum(const ConfigGravada &gravada){
+      const uint8_t *bytes = (const uint8_t*)&gravada;
+      uint32_t hash = 2166136261u;
+      for (size_t i = 0; i < offsetof(ConfigGravada, verificacao); i++) hash = (hash ^ bytes[i]) * 16777619u;
+      return hash;
+    }
+
+  public:
+    ConfigStore(const DescritorConfig *tabela, ConfigValidador validador_coerencia = nullptr)
+      : descritores(tabela), validador(validador_coerencia){
+      for (uint8_t i = 0; i < N; i++) {
+        valores[i] = descritores[i].padrao;
+        nomes[i] = descritores[i].nome;
+      }
+    }
+
+    //10^casas
+    static int32_t scale(uint8_t casas){
+      int32_t escala = 1;
+      while (casas-- > 0) escala *= 10;
+      return escala;
+    }
+
+    //texto decimal ("30.5", "-2", "0.0002") para ponto fixo, arredondando pela primeira casa descartada;
+    //false com qualquer outro caractere (true, null, expoente) ou fora do int32
+    static bool parse(const char *texto, uint8_t casas, int32_t &saida){
+      bool negativo = *texto == '-';
+      if (negativo || *texto == '+') texto++;
+      int64_t resultado = 0;
+      uint8_t digitos = 0;
+      while (*texto >= '0' && *texto <= '9') {
+        if (++digitos > 10) return false;
+        resultado = resultado * 10 + (*texto++ - '0');
+      }
+      int8_t restantes = casas;
+      if (*texto == '.') {
+        texto++;
+        bool arredondou = false;
+        while (*texto >= '0' && *texto <= '9') {
+          if (restantes > 0) {
+            resultado = resultado * 10 + (*texto - '0');
+            restantes--;
+          } else if (!arredondou) {
+            if (*texto >= '5') resultado++;
+            arredondou = true;
+          }
+          texto++;
+          digitos++;
+        }
+      }
+      if (digitos == 0 || *texto != '\0') return false;
+      while (restantes-- > 0) resultado *= 10;
+      if (resultado > INT32_MAX) return false;
+      saida = (int32_t)(negativo ? -resultado : resultado);
+      return true;
+    }
+
+    //ponto fixo para texto decimal com todas as casas (305 com 1 casa = "30.5")
+    static void format(int32_t valor, uint8_t casas, char saida[CONFIG_MAX_TEXTO]){
+      if (casas == 0) {
+        snprintf(saida, CONFIG_MAX_TEXTO, "%ld", (long)valor);
+        return;
+      }
+      if (casas > CONFIG_MAX_CASAS) casas = CONFIG_MAX_CASAS;
+      uint32_t escala = (uint32_t)scale(casas);
+      uint32_t absoluto = valor < 0 ? 0u - (uint32_t)valor : (uint32_t)valor;
+      snprintf(saida, CONFIG_MAX_TEXTO, "%s%lu.%0*lu", valor < 0 ? "-" : "", (unsigned long)(absoluto / escala), casas,
+               (unsigned long)(absoluto % escala));
+    }
+
+    int32_t get(uint8_t id) const{
+      return valores[id];
+    }
+
+    const DescritorConfig &descriptor(uint8_t id) const{
+      return descritores[id];
+    }
+
+    //nomes na ordem dos indices (caminhos do JsonStream)
+    const char *const *names() const{
+      return nomes;
+    }
+
+    //indice pelo nome, -1 se nao existe
+    int8_t find(const char *nome) const{
+      for (uint8_t i = 0; i < N; i++) {
+        if (strcmp(nomes[i], nome) == 0) return i;
+      }
+      return -1;
+    }
+
+    bool valid(uint8_t id, int32_t valor) const{
+      return id < N && valor >= descritores[id].minimo && valor <= descritores[id].maximo;
+    }
+
+    //acrescenta (ou troca, se ja estiver na transação) um valor; false fora dos limites
+    bool stage(TransacaoConfig<N> &transacao, uint8_t id, int32_t valor) const{
+      if (!valid(id, valor)) return false;
+      for (uint8_t i = 0; i < transacao.quantidade; i++) {
+        if (transacao.ids[i] == id) {
+          transacao.valores[i] = valor;
+          return true;
+        }
+      }
+      if (transacao.quantidade >= N) return false;
+      transacao.ids[transacao.quantidade] = id;
+      transacao.valores[transacao.quantidade++] = valor;
+      return true;
+    }
+
+    //todos os valores dentro dos limites e o resultado coerente
+    bool check(const TransacaoConfig<N> &transacao) const{
+      if (transacao.quantidade > N) return false;
+      int32_t resultado[N];
+      memcpy(resultado, valores, sizeof(resultado));
+      for (uint8_t i = 0; i < transacao.quantidade; i++) {
+        if (!valid(transacao.ids[i], transacao.valores[i])) return false;
+        resultado[transacao.ids[i]] = transacao.valores[i];
+      }
+      return validador == nullptr || validador(resultado);
+    }
+
+    //aplica a transação inteira (ou nada, se check() falhar) e depois avisa os observadores dos grupos que mudaram
+    bool commit(const TransacaoConfig<N> &transacao, uint32_t *grupos_alterados = nullptr){
+      if (!check(transacao)) return false;
+      uint32_t grupos = 0;
+      for (uint8_t i = 0; i < transacao.quantidade; i++) {
+        uint8_t id = transacao.ids[i];
+        if (valores[id] == transacao.valores[i]) continue;
+        valores[id] = transacao.valores[i];
+        grupos |= descritores[id].grupos;
+      }
+      for (uint8_t i = 0; i < quantidade_observadores; i++) {
+        if (grupos & grupos_observados[i]) observadores[i]();
+      }
+      if (grupos_alterados != nullptr) *grupos_alterados = grupos;
+      return true;
+    }
+
+    bool subscribe(uint32_t grupos, ConfigObservador observador){
+      if (quantidade_observadores >= CONFIG_MAX_OBSERVADORES) return false;
+      observadores[quantidade_observadores] = observador;
+      grupos_observados[quantidade_observadores++] = grupos;
+      return true;
+    }
+
+    void save(ConfigGravada &gravada) const{
+      memset(&gravada, 0, sizeof(gravada));
+      gravada.versao = CONFIG_VERSAO;
+      gravada.quantidade = N;
+      for (uint8_t i = 0; i < N; i++) {
+        gravada.chaves[i] = chave(nomes[i]);
+        gravada.valores[i] = valores[i];
+      }
+      gravada.verificacao = checksum(gravada);
+    }
+
+    //aplica os parametros gravados que ainda existem e estao nos limites atuais (os outros ficam como estao);
+    //retorna quantos foram lidos, 0 com gravação corrompida ou incoerente (nada muda)
+    uint8_t load(const ConfigGravada &gravada){
+      if (gravada.versao != CONFIG_VERSAO || gravada.quantidade > CONFIG_MAX_PARAMETROS || gravada.verificacao != checksum(gravada)) return 0;
+      TransacaoConfig<N> transacao;
+      for (uint8_t i = 0; i < N; i++) {
+        uint32_t procurada = chave(nomes[i]);
+        for (uint8_t j = 0; j < gravada.quantidade; j++) {
+          if (gravada.chaves[j] == procurada) {
+            stage(transacao, i, gravada.valores[j]);
+            break;
+          }
+        }
+      }
+      return commit(transacao) ? transacao.quantidade : 0;
+    }
+};
+
+#endif
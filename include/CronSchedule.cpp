@@ -0,0 +1,330 @@
+#ifndef CRON_SCHEDULE
+#define CRON_SCHEDULE
+
+#include <stdint.h>
+#include <string.h>
+#include <OffTime.cpp>
+
+#define CRON_MAX_TRABALHOS 8          // Trabalhos agendados (um por atuador)
+#define CRON_MAX_EXPRESSAO 32         // Texto de uma expressão, com o '\0' (guardado para o /agenda e o NVS)
+#define CRON_DURACAO_MAX_S 86400UL    // Maior duração de uma janela
+#define CRON_SALTO_S 300              // Relogio andou mais que isso entre dois run() (ou voltou): reprograma tudo
+#define CRON_MAX_VOLTAS 64            // Limite da busca do proximo disparo (29/02 leva ate 8 anos, ~24 voltas)
+#define CRON_NUNCA INT64_MAX
+
+//expressão cron compilada: um bit por valor aceito em cada campo
+struct ExpressaoCron{
+  uint64_t minutos;       // bits 0-59
+  uint32_t horas;         // bits 0-23
+  uint32_t dias;          // bits 1-31
+  uint16_t meses;         // bits 1-12
+  uint8_t dias_semana;    // bits 0-6 (0 = domingo)
+  bool dia_restrito;      // dia do mes diferente de '*'
+  bool semana_restrita;   // dia da semana diferente de '*'
+};
+
+typedef void (*CronAcao)(uint8_t trabalho, bool ligado);
+
+//agenda de janelas "liga no disparo da expressão, desliga duracao_s depois", com expressões cron de 5 campos
+//(minuto hora dia mes dia_semana; '*', listas com ',', faixas com '-' e passos com '/', domingo = 0 ou 7).
+//  - cada campo vira uma mascara de bits: o proximo valor aceito de um campo é um shift e um ctz, sem laço
+//  - epochs na hora local do OffTime (now64); resolução de um minuto
+//  - uma fila so de eventos (inicio ou fim de janela de todos os trabalhos): run() dispara os vencidos em ordem
+//    e diz quando é o proximo, a task chamadora dorme ate la
+//  - set() troca a expressão e a duração em funcionamento: se o instante atual cai numa janela, o trabalho liga
+//dia do mes e dia da semana restritos ao mesmo tempo valem qualquer um dos dois (como no cron).
+class CronSchedule{
+  private:
+    struct Trabalho{
+      ExpressaoCron expressao;
+      char texto[CRON_MAX_EXPRESSAO];
+      uint32_t duracao_s;
+      int64_t inicio;       // proximo disparo
+      int64_t fim;          // fim da janela em andamento
+      bool configurado;
+      bool ativo;           // dentro de uma janela
+    };
+
+    Trabalho trabalhos[CRON_MAX_TRABALHOS];
+    CronAcao acao;
+    int64_t ultimo = INT64_MIN;   // epoch do run() anterior
+
+    //divisão arredondando para baixo (antes do NTP o epoch local pode ser negativo)
+    static int64_t dividir(int64_t a, int64_t b){
+      return a >= 0 ? a / b : -((-a + b - 1) / b);
+    }
+
+    //menor valor aceito >= desde, -1 se nao houver
+    static int8_t primeiro(uint64_t bits, uint8_t desde){
+      if (desde >= 64) return -1;
+      bits >>= desde;
+      return bits ? (int8_t)(desde + __builtin_ctzll(bits)) : -1;
+    }
+
+    static uint8_t dias_no_mes(int32_t ano, uint8_t mes){
+      static const uint8_t dias[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+      bool bissexto = (ano % 4 == 0 && ano % 100 != 0) || ano % 400 == 0;
+      return dias[mes - 1] + (mes == 2 && bissexto);
+    }
+
+    //le um numero do texto (false se nao tiver digito)
+    static bool numero(const char *&texto, uint8_t &valor){
+      if (*texto < '0' || *texto > '9') return false;
+      uint16_t lido = 0;
+      while (*texto >= '0' && *texto <= '9') {
+        lido = lido * 10 + (*texto++ - '0');
+        if (lido > 255) return false;
+      }
+      valor = (uint8_t)lido;
+      return true;
+    }
+
+    //um campo: itens separados por ',' (N, N-M, *, com /passo opcional) ate um espaço ou o fim do texto
+    static bool campo(const char *&texto, uint8_t minimo, uint8_t maximo, uint64_t &bits, bool &restrito){
+      bits = 0;
+      restrito = false;
+      while (true) {
+        uint8_t de = minimo, ate = maximo, passo = 1;
+        bool faixa = false;
+        if (*texto == '*') {
+          texto++;
+        } else {
+          if (!numero(texto, de)) return false;
+          ate = de;
+          if (*texto == '-') {
+            texto++;
+            faixa = true;
+            if (!numero(texto, ate)) return false;
+          }
+          restrito = true;
+        }
+        if (*texto == '/') {
+          texto++;
+          if (!numero(texto, passo) || passo == 0) return false;
+          if (restrito && !faixa) ate = maximo; // "5/15" = de 5 ate o fim, a cada 15 ("5-5/15" é so o 5)
+          restrito = true;
+        }
+        if (de < minimo || ate > maximo || de > ate) return false;
+        for (uint16_t v = de; v <= ate; v += passo) bits |= (uint64_t)1 << v;
+        if (*texto != ',') break;
+        texto++;
+      }
+      return *texto == ' ' || *texto == '\0';
+    }
+
+    static bool dia_aceito(const ExpressaoCron &e, uint8_t dia, uint8_t dia_semana){
+      bool pelo_dia = (e.dias >> dia) & 1;
+      bool pela_semana = (e.dias_semana >> dia_semana) & 1;
+      return e.dia_restrito && e.semana_restrita ? pelo_dia || pela_semana : pelo_dia && pela_semana;
+    }
+
+    //dias desde 1970 do proximo dia candidato depois de hoje (pode cair no mes seguinte, que é conferido de novo)
+    static int64_t proximo_dia(const ExpressaoCron &e, int32_t ano, uint8_t mes, uint8_t dia, int64_t hoje, uint8_t dia_semana){
+      uint8_t ultimo_dia = dias_no_mes(ano, mes);
+      int8_t d = primeiro(e.dias, dia + 1);
+      int64_t pelo_dia = hoje + (d > 0 && d <= ultimo_dia ? d - dia : ultimo_dia - dia + 1);
+      uint16_t semanas = e.dias_semana | (e.dias_semana << 7); // duas semanas: o ctz acha a proxima sem dar a volta
+      int64_t pela_semana = hoje + primeiro(semanas, dia_semana + 1) - dia_semana;
+      if (!e.dia_restrito) return pela_semana;
+      if (!e.semana_restrita) return pelo_dia;
+      return pelo_dia < pela_semana ? pelo_dia : pela_semana;
+    }
+
+    //janela em andamento e proximo disparo a partir de agora (set() e saltos do relogio)
+    void programar(Trabalho &t, int64_t agora){
+      t.ativo = false;
+      t.fim = 0;
+      int64_t disparo = next(t.expressao, agora - t.duracao_s); // primeiro disparo cuja janela ainda nao acabou
+      while (disparo <= agora) {
+        t.ativo = true;
+        t.fim = disparo + t.duracao_s;
+        disparo = next(t.expressao, disparo);
+      }
+      t.inicio = disparo;
+    }
+
+    //reprograma todos e avisa quem mudou de estado
+    void reprogramar(int64_t agora){
+      for (uint8_t id = 0; id < CRON_MAX_TRABALHOS; id++) {
+        Trabalho &t = trabalhos[id];
+        if (!t.configurado) continue;
+        bool antes = t.ativo;
+        programar(t, agora);
+        if (t.ativo != antes) acao(id, t.ativo);
+      }
+    }
+
+    //trata o evento vencido do trabalho: fim da janela ou novo disparo
+    void disparar(uint8_t id){
+      Trabalho &t = trabalhos[id];
+      if (t.ativo && t.fim < t.inicio) { // empate: o novo disparo estende a janela, sem desligar e religar
+        t.ativo = false;
+        acao(id, false);
+        return;
+      }
+      int64_t fim = t.inicio + t.duracao_s;
+      t.inicio = next(t.expressao, t.inicio);
+      if (t.ativo) {
+        if (fim > t.fim) t.fim = fim; // janelas sobrepostas: so estende
+        return;
+      }
+      t.ativo = true;
+      t.fim = fim;
+      acao(id, true);
+    }
+
+  public:
+    CronSchedule(CronAcao callback) : acao(callback){
+      memset(trabalhos, 0, sizeof(trabalhos));
+    }
+
+    //compila "minuto hora dia mes dia_semana"; false se a expressão for invalida ou nunca disparar (ex: 30 de fevereiro)
+    static bool compile(const char *texto, ExpressaoCron &saida){
+      if (texto == nullptr || strlen(texto) >= CRON_MAX_EXPRESSAO) return false;
+      static const uint8_t minimos[5] = {0, 0, 1, 1, 0};
+      static const uint8_t maximos[5] = {59, 23, 31, 12, 7};
+      uint64_t bits[5];
+      bool restrito[5];
+      for (uint8_t i = 0; i < 5; i++) {
+        while (*texto == ' ') texto++;
+        if (!campo(texto, minimos[i], maximos[i], bits[i], restrito[i])) return false;
+      }
+      while (*texto == ' ') texto++;
+      if (*texto != '\0') return false;
+
+      saida.minutos = bits[0];
+      saida.horas = (uint32_t)bits[1];
+      saida.dias = (uint32_t)bits[2];
+      saida.meses = (uint16_t)bits[3];
+      saida.dias_semana = (uint8_t)((bits[4] | bits[4] >> 7) & 0x7F); // 7 = domingo
+      saida.dia_restrito = restrito[2];
+      saida.semana_restrita = restrito[4];
+
+      // so dia do mes restrito: algum mes aceito precisa ter o menor dia aceito
+      if (saida.dia_restrito && !saida.semana_restrita) {
+        uint8_t menor_dia = (uint8_t)primeiro(saida.dias, 1);
+        bool existe = false;
+        for (uint8_t mes = 1; mes <= 12; mes++) {
+          if (((saida.meses >> mes) & 1) && menor_dia <= (mes == 2 ? 29 : dias_no_mes(2001, mes))) existe = true;
+        }
+        if (!existe) return false;
+      }
+      return true;
+    }
+
+    //primeiro disparo estritamente depois de depois (epoch local), CRON_NUNCA se nao achar
+    //cada campo é resolvido pela mascara; so volta ao inicio quando um campo estoura para o seguinte
+    static int64_t next(const ExpressaoCron &e, int64_t depois){
+      int64_t t = (dividir(depois, 60) + 1) * 60;
+      for (uint8_t volta = 0; volta < CRON_MAX_VOLTAS; volta++) {
+        int64_t hoje = dividir(t, SEGUNDOS_DIA);
+        uint32_t segundos_dia = (uint32_t)(t - hoje * SEGUNDOS_DIA);
+        int16_t ano;
+        uint8_t mes, dia;
+        OffTime::civil_from_days((int32_t)hoje, ano, mes, dia);
+
+        if (!((e.meses >> mes) & 1)) {
+          int8_t m = primeiro(e.meses, mes + 1);
+          if (m < 0) {
+            ano++;
+            m = primeiro(e.meses, 1);
+          }
+          t = (int64_t)OffTime::days_from_civil(ano, m, 1) * SEGUNDOS_DIA;
+          continue;
+        }
+
+        uint8_t dia_semana = (uint8_t)(hoje >= -4 ? (hoje + 4) % 7 : (hoje + 5) % 7 + 6);
+        if (!dia_aceito(e, dia, dia_semana)) {
+          t = proximo_dia(e, ano, mes, dia, hoje, dia_semana) * SEGUNDOS_DIA;
+          continue;
+        }
+
+        uint8_t hora = segundos_dia / 3600;
+        uint8_t minuto = segundos_dia / 60 % 60;
+        int8_t h = primeiro(e.horas, hora);
+        if (h < 0) {
+          t = (hoje + 1) * SEGUNDOS_DIA;
+          continue;
+        }
+        if (h != hora) minuto = 0;
+        int8_t m = primeiro(e.minutos, minuto);
+        if (m < 0) {
+          t = hoje * SEGUNDOS_DIA + (h + 1) * 3600; // hora 24 = proximo dia
+          continue;
+        }
+        return hoje * SEGUNDOS_DIA + h * 3600 + m * 60;
+      }
+      return CRON_NUNCA;
+    }
+
+    //troca a expressão e a duração do trabalho id ("" desativa); false mantem a anterior
+    bool set(uint8_t id, const char *texto, uint32_t duracao_s, int64_t agora){
+      if (id >= CRON_MAX_TRABALHOS) return false;
+      Trabalho &t = trabalhos[id];
+      bool antes = t.configurado && t.ativo;
+      if (texto == nullptr || texto[0] == '\0') {
+        t.configurado = false;
+        t.ativo = false;
+        t.texto[0] = '\0';
+        if (antes) acao(id, false);
+        return true;
+      }
+
+      ExpressaoCron expressao;
+      if (!compile(texto, expressao) || duracao_s == 0 || duracao_s > CRON_DURACAO_MAX_S) return false;
+      t.expressao = expressao;
+      strcpy(t.texto, texto);
+      t.duracao_s = duracao_s;
+      t.configurado = true;
+      programar(t, agora);
+      if (t.ativo != antes) acao(id, t.ativo);
+      return true;
+    }
+
+    //dispara os eventos vencidos ate agora (epoch local) e retorna o epoch do proximo (CRON_NUNCA sem trabalhos)
+    int64_t run(int64_t agora){
+      if (ultimo != INT64_MIN && (agora < ultimo || agora - ultimo > CRON_SALTO_S)) reprogramar(agora);
+      ultimo = agora;
+      while (true) {
+        uint8_t id = CRON_MAX_TRABALHOS;
+        int64_t menor = CRON_NUNCA;
+        for (uint8_t i = 0; i < CRON_MAX_TRABALHOS; i++) { // poucos trabalhos: a fila é uma busca pelo menor evento
+          int64_t evento = next_event(i);
+          if (evento < menor) {
+            menor = evento;
+            id = i;
+          }
+        }
+        if (id == CRON_MAX_TRABALHOS || menor > agora) return menor;
+        disparar(id);
+      }
+    }
+
+    //proximo evento do trabalho: fim da janela se estiver ligado, senao o proximo disparo
+    int64_t next_event(uint8_t id) const{
+      if (id >= CRON_MAX_TRABALHOS || !trabalhos[id].configurado) return CRON_NUNCA;
+      const Trabalho &t = trabalhos[id];
+      return t.ativo && t.fim < t.inicio ? t.fim : t.inicio;
+    }
+
+    bool active(uint8_t id) const{
+      return id < CRON_MAX_TRABALHOS && trabalhos[id].configurado && trabalhos[id].ativo;
+    }
+
+    //inicio da janela atual, ou do proximo disparo se estiver desligado
+    int64_t window_start(uint8_t id) const{
+      if (id >= CRON_MAX_TRABALHOS || !trabalhos[id].configurado) return CRON_NUNCA;
+      const Trabalho &t = trabalhos[id];
+      return t.ativo ? t.fim - t.duracao_s : t.inicio;
+    }
+
+    const char *expression(uint8_t id) const{
+      return id < CRON_MAX_TRABALHOS ? trabalhos[id].texto : "";
+    }
+
+    uint32_t duration(uint8_t id) const{
+      return id < CRON_MAX_TRABALHOS && trabalhos[id].configurado ? trabalhos[id].duracao_s : 0;
+    }
+};
+
+#endif
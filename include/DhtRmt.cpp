@@ -0,0 +1,240 @@
+#ifndef DHT_RMT
+#define DHT_RMT
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+  #include <Arduino.h>
+  #include <driver/rmt.h>
+  #include <driver/gpio.h>
+  #include <esp_timer.h>
+#else
+  #include <Hal.cpp>
+
+  // mesmo formato do rmt_item32_t do esp-idf, para decodificar capturas gravadas no pc
+  typedef struct {
+    uint32_t duration0 : 15;
+    uint32_t level0 : 1;
+    uint32_t duration1 : 15;
+    uint32_t level1 : 1;
+  } rmt_item32_t;
+#endif
+
+#define DHT_T_START_MS 20        // Tempo em nivel baixo para acordar o sensor (minimo 18ms)
+#define DHT_T_CAPTURA_MS 10      // Janela de captura da resposta (resposta completa leva ~5ms)
+#define DHT_LIMIAR_BIT_US 40     // Nivel alto maior que isso = bit 1 (0: ~27us, 1: ~70us)
+#define DHT_IDLE_US 200          // Linha parada por mais que isso encerra a captura
+#define DHT_BITS 40
+
+//qualidade da ultima leitura
+enum QualidadeDht{
+  DHT_SEM_LEITURA,     // nenhuma leitura ainda
+  DHT_OK,
+  DHT_SEM_RESPOSTA,    // sensor nao respondeu (ou resposta incompleta)
+  DHT_ERRO_CHECKSUM,
+  DHT_FORA_FAIXA       // checksum ok mas valores impossiveis para o DHT11
+};
+
+//leitura publicada pelo driver
+struct LeituraDht{
+  int16_t temperatura_x10 = 0; // decimos de grau
+  uint16_t umidade_x10 = 0;    // decimos de %
+  uint32_t millis_leitura = 0; // instante em que a conversao terminou
+  QualidadeDht qualidade = DHT_SEM_LEITURA;
+};
+
+//leitor do DHT11 sem bloqueio e sem desligar interrupções
+//trigger() puxa a linha para baixo e retorna; um esp_timer solta a linha e liga o RMT, que captura os pulsos
+//da resposta em hardware; depois de DHT_T_CAPTURA_MS a captura é encerrada e poll() decodifica fora da interrupção.
+class DhtRmt{
+  private:
+    LeituraDht ultima;
+    volatile bool pronto = false;   // captura encerrada, aguardando decodificação
+    volatile bool ocupado = false;  // conversao em andamento
+    void (*ao_terminar)(void) = nullptr;
+
+    #ifdef ARDUINO
+      gpio_num_t pino;
+      rmt_channel_t canal;
+      RingbufHandle_t ringbuf = nullptr;
+      esp_timer_handle_t timer = nullptr;
+      uint8_t etapa = 0; // 0: soltar a linha e capturar, 1: encerrar a captura
+
+      static void callback_timer(void *arg){
+        DhtRmt *dht = (DhtRmt*)arg;
+        if (dht->etapa == 0) {
+          // fim do pulso de start: solta a linha (open drain) e começa a capturar
+          gpio_set_level(dht->pino, 1);
+          rmt_rx_start(dht->canal, true);
+          dht->etapa = 1;
+          esp_timer_start_once(dht->timer, DHT_T_CAPTURA_MS * 1000);
+        } else {
+          rmt_rx_stop(dht->canal);
+          dht->pronto = true;
+          if (dht->ao_terminar != nullptr) dht->ao_terminar();
+        }
+      }
+    #endif
+
+  public:
+
+    //decodifica os pulsos capturados (funcao pura, pode ser usada no pc com capturas gravadas)
+    static QualidadeDht decode(const rmt_item32_t *itens, uint16_t quantidade, uint8_t bytes[5]){
+      // procura a resposta do sensor: ~80us baixo + ~80us alto
+      uint16_t inicio = 0;
+      while (inicio < quantidade) {
+        const rmt_item32_t &item = itens[inicio];
+        inicio++;
+        if (item.level0 == 0 && item.duration0 > 60 && item.duration0 < 100 && item.duration1 > 60 && item.duration1 < 100) break;
+        if (inicio == quantidade) return DHT_SEM_RESPOSTA;
+      }
+      if (quantidade < inicio + DHT_BITS) return DHT_SEM_RESPOSTA;
+
+      for (uint8_t i = 0; i < 5; i++) bytes[i] = 0;
+      for (uint8_t bit = 0; bit < DHT_BITS; bit++) {
+        const rmt_item32_t &item = itens[inicio + bit];
+        // o ultimo bit pode terminar em idle (duration1 = 0 quando a linha nao voltou a cair): usa o limiar de idle
+        uint16_t alto = item.duration1 ? item.duration1 : DHT_IDLE_US;
+        if (item.level0 != 0) return DHT_SEM_RESPOSTA;
+        bytes[bit / 8] <<= 1;
+        if (alto > DHT_LIMIAR_BIT_US) bytes[bit / 8] |= 1;
+      }
+
+      if ((uint8_t)(bytes[0] + bytes[1] + bytes[2] + bytes[3]) != bytes[4]) return DHT_ERRO_CHECKSUM;
+      return DHT_OK;
+    }
+
+    //converte os 5 bytes em uma leitura (decimos), descartando so valores impossiveis (acima de 100% ou fora de -20C a 80C):
+    //a faixa especificada do DHT11 (0-50C, 20-90%) nao é usada como limite porque a estufa saturada passa dela de verdade
+    static QualidadeDht convert(const uint8_t bytes[5], LeituraDht &leitura){
+      leitura.umidade_x10 = bytes[0] * 10 + (bytes[1] % 10);
+      int16_t temperatura = bytes[2] * 10 + ((bytes[3] & 0x7F) % 10);
+      leitura.temperatura_x10 = (bytes[3] & 0x80) ? -temperatura : temperatura;
+
+      if (leitura.umidade_x10 > 1000 || leitura.temperatura_x10 < -200 || leitura.temperatura_x10 > 800) return DHT_FORA_FAIXA;
+      return DHT_OK;
+    }
+
+    #ifdef ARDUINO
+    //configura o pino (open drain com pull-up) e o canal RMT de captura
+    void begin(uint8_t pin, uint8_t canal_rmt, void (*callback_fim)(void) = nullptr){
+      pino = (gpio_num_t)pin;
+      canal = (rmt_channel_t)canal_rmt;
+      ao_terminar = callback_fim;
+
+      gpio_set_direction(pino, GPIO_MODE_INPUT_OUTPUT_OD);
+      gpio_set_pull_mode(pino, GPIO_PULLUP_ONLY);
+      gpio_set_level(pino, 1);
+
+      rmt_config_t config = RMT_DEFAULT_CONFIG_RX(pino, canal);
+      config.clk_div = 80; // 1 tick = 1us
+      config.rx_config.filter_en = true;
+      config.rx_config.filter_ticks_thresh = 100; // ignora ruidos menores que ~1.25us (ticks do APB)
+      config.rx_config.idle_threshold = DHT_IDLE_US;
+      rmt_config(&config);
+      rmt_driver_install(canal, 512, 0);
+      rmt_get_ringbuf_handle(canal, &ringbuf);
+
+      // rmt_config() refaz a matriz de gpio so como entrada: devolve a saida open drain
+      gpio_set_direction(pino, GPIO_MODE_INPUT_OUTPUT_OD);
+
+      esp_timer_create_args_t args = {};
+      args.callback = &callback_timer;
+      args.arg = this;
+      args.name = "dht";
+      esp_timer_create(&args, &timer);
+    }
+
+    //inicia uma conversao sem bloquear, retorna false se a anterior ainda nao terminou
+    bool trigger(){
+      if (ocupado) return false;
+      ocupado = true;
+      pronto = false;
+      etapa = 0;
+      gpio_set_level(pino, 0);
+      esp_timer_start_once(timer, DHT_T_START_MS * 1000);
+      return true;
+    }
+
+    //decodifica a captura se ela ja terminou, retorna true quando uma nova leitura foi publicada (valida ou nao)
+    bool poll(uint32_t agora){
+      if (!pronto) return false;
+      pronto = false;
+
+      size_t tamanho = 0;
+      rmt_item32_t *itens = (rmt_item32_t*)xRingbufferReceive(ringbuf, &tamanho, 0);
+
+      LeituraDht leitura = ultima;
+      leitura.millis_leitura = agora;
+      if (itens == nullptr) {
+        leitura.qualidade = DHT_SEM_RESPOSTA;
+      } else {
+        uint8_t bytes[5];
+        leitura.qualidade = decode(itens, tamanho / sizeof(rmt_item32_t), bytes);
+        vRingbufferReturnItem(ringbuf, (void*)itens);
+
+        if (leitura.qualidade == DHT_OK) {
+          LeituraDht convertida = leitura;
+          convertida.qualidade = convert(bytes, convertida);
+          if (convertida.qualidade == DHT_OK) leitura = convertida;
+          else leitura.qualidade = convertida.qualidade;
+        }
+      }
+
+      // descarta capturas que sobraram (ex: ruido) para a proxima conversao começar limpa
+      while ((itens = (rmt_item32_t*)xRingbufferReceive(ringbuf, &tamanho, 0)) != nullptr) {
+        vRingbufferReturnItem(ringbuf, (void*)itens);
+      }
+
+      // em caso de erro mantem os ultimos valores validos, so muda a qualidade e o instante
+      ultima = leitura;
+      ocupado = false;
+      return true;
+    }
+    #else
+    //backend do pc: a resposta vem do gancho hal_sim.dht e passa pela mesma validação do hardware
+    void begin(uint8_t pin, uint8_t canal_rmt, void (*callback_fim)(void) = nullptr){
+      (void)pin;
+      (void)canal_rmt;
+      ao_terminar = callback_fim;
+    }
+
+    bool trigger(){
+      if (ocupado) return false;
+      ocupado = true;
+      pronto = true;
+      if (ao_terminar != nullptr) ao_terminar();
+      return true;
+    }
+
+    bool poll(uint32_t agora){
+      if (!pronto) return false;
+      pronto = false;
+
+      LeituraDht leitura = ultima;
+      leitura.millis_leitura = agora;
+      uint8_t bytes[5];
+      if (hal_sim.dht == nullptr || !hal_sim.dht(bytes)) {
+        leitura.qualidade = DHT_SEM_RESPOSTA;
+      } else if ((uint8_t)(bytes[0] + bytes[1] + bytes[2] + bytes[3]) != bytes[4]) {
+        leitura.qualidade = DHT_ERRO_CHECKSUM;
+      } else {
+        LeituraDht convertida = leitura;
+        convertida.qualidade = convert(bytes, convertida);
+        if (convertida.qualidade == DHT_OK) leitura = convertida;
+        else leitura.qualidade = convertida.qualidade;
+      }
+
+      ultima = leitura;
+      ocupado = false;
+      return true;
+    }
+    #endif
+
+    //ultima leitura (valores validos mais recentes + qualidade da ultima tentativa)
+    const LeituraDht &last(){
+      return ultima;
+    }
+};
+
+#endif
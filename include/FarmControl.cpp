@@ -0,0 +1,879 @@
+#ifndef FARM_CONTROL
+#define FARM_CONTROL
+
+#include <Hal.cpp>
+#include <OffTime.cpp>
+#include <Scheduler.cpp>
+#include <ShiftChains.cpp>
+#include <LedFrame.cpp>
+#include <Photoperiod.cpp>
+#include <DhtRmt.cpp>
+#include <SensorFilter.cpp>
+#include <FlowMeter.cpp>
+#include <ClimateController.cpp>
+#include <TaskMetrics.cpp>
+#include <Historian.cpp>
+#include <Rollup.cpp>
+#include <Forecast.cpp>
+#include <CronSchedule.cpp>
+#include <ConfigStore.cpp>
+
+//controle da fazenda (bomba, vazão, caixa, irrigação, clima e leds) separado do main.cpp para rodar igual
+//no ESP32 e no simulador do pc (sim/): so usa os drivers e o Hal.cpp, nunca rede, FreeRTOS ou Arduino direto.
+//quem chama (task de controle ou simulador) entrega os eventos e chama controle_ciclo() a cada deadline.
+
+//------------------------------------------------------------------------------
+// Configurações de Tempo (em milissegundos)
+//------------------------------------------------------------------------------
+#define T_DHT 5000                   // Tempo entre leituras do sensor DHT11
+#define T_MAX_AGENDA 60*1000         // Maior espera entre avaliações da agenda (acompanha ajustes do relogio)
+#define T_VERIFICAR_EXAUSTOR 5000    // Periodo do controlador de clima (acompanha as leituras do DHT11)
+#define T_VERIFICAR_LEDS 1000        // Tempo entre avaliações da curva de luz dos LEDs (consulta O(1) na tabela)
+#define T_FLUXO 1000                 // Tempo entre amostras do medidor de vazão
+#define T_VERIFICAR_CAIXA 10*1000    // Tempo entre verificações da caixa d'agua (as boias tambem acordam a tarefa por evento)
+#define T_RETENTAR_CAIXA 30*60*1000UL // Pausa depois de um enchimento demorado antes de reabrir a solenoide
+#define MAX_TENTATIVAS_CAIXA 3       // Novas tentativas de enchimento antes de travar em falha (ate as boias indicarem cheia)
+#define T_DEBOUNCE_BOIAS 50          // Tempo sem bordas para aceitar um novo nivel das boias
+#define EPOCH_VALIDO 1600000000UL    // Relogio abaixo disso ainda nao foi acertado (sem amostras no historico)
+
+//------------------------------------------------------------------------------
+// Configurações de Operação da Fazenda Vertical
+//------------------------------------------------------------------------------
+#define TEMP_IDEAL 25       // Temperatura ideal na estufa (valor inicial antes da primeira leitura)
+
+#define UMID_MAX 95         // Umidade extrema: a partir dela a umidade nao liga os exaustores (so a temperatura)
+#define UMID_IDEAL 70        // Umidade ideal na estufa
+
+#define PULSOS_POR_LITRO 450        // Calibração do sensor de fluxo (YF-S201: 7.5Hz por L/min)
+#define JANELA_FLUXO 10             // Amostras (T_FLUXO) na media de vazão
+
+#define JANELA_FILTRO_DHT 5  // Amostras na mediana do DHT11 (5 * T_DHT = 25s)
+#define EMA_SHIFT_DHT 2      // Suavização da EMA sobre a mediana (alfa = 1/4)
+
+#define DECIMOS(x) ((x) * 10) // Converte os valores iniciais para o ponto fixo das leituras (decimos)
+
+//------------------------------------------------------------------------------
+// Parametros de Operação (padrão e limites), alteraveis em funcionamento pelo /config e gravados no NVS
+//------------------------------------------------------------------------------
+/**
+ * @brief Controladores avisados quando um parametro deles muda (bits de DescritorConfig::grupos).
+ */
+enum GrupoConfig{
+  GRUPO_CLIMA = 1 << 0,  // controlador de clima (reconfigurado a cada alteração)
+  GRUPO_BOMBA = 1 << 1,  // vazão e falha da bomba (lidos a cada amostra)
+  GRUPO_CAIXA = 1 << 2,  // enchimento da caixa (lido a cada verificação)
+  GRUPO_LEDS  = 1 << 3   // curva de luz (remontada a cada alteração)
+};
+
+/**
+ * @brief Parametros do registro (indice em descritores_config e no ConfigStore).
+ */
+enum ParametroConfig{
+  PARAM_TEMP_MAX,
+  PARAM_TEMP_MIN,
+  PARAM_TEMP_MARGEM,
+  PARAM_UMID_MAX_EXAUST,
+  PARAM_KP_TEMP,
+  PARAM_KI_TEMP,
+  PARAM_KP_UMID,
+  PARAM_KI_UMID,
+  PARAM_JANELA_EXAUSTORES,
+  PARAM_MIN_LIGADO_EXAUSTORES,
+  PARAM_TIMEOUT_EXAUSTORES,
+  PARAM_DESCANSO_EXAUSTORES,
+  PARAM_VAZAO_MIN,
+  PARAM_PARTIDA_BOMBA,
+  PARAM_AMOSTRAS_FALHA_FLUXO,
+  PARAM_MAX_ENCHIMENTO,
+  PARAM_RAMPA_LEDS,
+  PARAM_VERMELHO_MANHA,
+  PARAM_AZUL_TARDE,
+  N_PARAMETROS
+};
+
+// valores em ponto fixo com "casas" decimais (temp_max 300 com 1 casa = 30.0 C, ja em decimos como as leituras)
+constexpr DescritorConfig descritores_config[N_PARAMETROS] = {
+  // nome                    unidade    minimo  maximo  padrao casas grupos
+  {"temp_max",               "C",       150,    450,    300,   1,    GRUPO_CLIMA}, // Temperatura máxima desejada na estufa
+  {"temp_min",               "C",       0,      350,    200,   1,    GRUPO_CLIMA}, // Temperatura mínima desejada (abaixo dela os exaustores nao ligam)
+  {"temp_margem",            "C",       0,      100,    20,    1,    GRUPO_CLIMA}, // Margem abaixo da máxima onde o resfriamento começa
+  {"umid_max_exaust",        "%",       50,     100,    90,    0,    GRUPO_CLIMA}, // Umidade que ativa os exaustores (se a externa for menor)
+  {"kp_temp",                "1/C",     0,      5000,   250,   3,    GRUPO_CLIMA}, // Demanda por grau acima do alvo (4C acima = 100%)
+  {"ki_temp",                "1/C.s",   0,      100000, 100,   5,    GRUPO_CLIMA}, // Demanda acumulada por grau por segundo (1C por ~4min = +25%)
+  {"kp_umid",                "1/%",     0,      5000,   50,    3,    GRUPO_CLIMA}, // Demanda por ponto de umidade acima do alvo (20% acima = 100%)
+  {"ki_umid",                "1/%.s",   0,      100000, 20,    5,    GRUPO_CLIMA}, // Demanda acumulada por ponto de umidade por segundo
+  {"janela_exaustores",      "s",       60,     3600,   300,   0,    GRUPO_CLIMA}, // Janela da modulação por tempo (demanda 50% = 2.5min ligado a cada 5min)
+  {"min_ligado_exaustores",  "s",       5,      600,    30,    0,    GRUPO_CLIMA}, // Menor tempo ligado/desligado dentro da janela (protege rele e motores)
+  {"timeout_exaustores",     "s",       300,    86400,  3600,  0,    GRUPO_CLIMA}, // Tempo máximo que os exaustores podem ficar ligados continuamente
+  {"descanso_exaustores",    "s",       60,     7200,   600,   0,    GRUPO_CLIMA}, // Pausa obrigatoria depois de timeout_exaustores ligados
+  {"vazao_min",              "L/min",   0,      2000,   100,   2,    GRUPO_BOMBA}, // Vazão minima com a bomba ligada
+  {"partida_bomba",          "s",       1,      120,    10,    0,    GRUPO_BOMBA}, // Tempo apos ligar a bomba antes de cobrar a vazão minima
+  {"amostras_falha_fluxo",   "",        3,      120,    15,    0,    GRUPO_BOMBA}, // Amostras seguidas abaixo da vazão minima para considerar a bomba em falha
+  {"max_enchimento",         "min",     1,      240,    30,    0,    GRUPO_CAIXA}, // Tempo maximo com a solenoide da caixa aberta sem atingir o nivel maximo
+  {"rampa_leds",             "min",     1,      180,    30,    0,    GRUPO_LEDS},  // Duração do amanhecer e do entardecer
+  {"vermelho_manha",         "",        0,      255,    180,   0,    GRUPO_LEDS},  // Brilho do vermelho no fim do amanhecer (manhã mais azul)
+  {"azul_tarde",             "",        0,      255,    150,   0,    GRUPO_LEDS},  // Brilho do azul no inicio do entardecer (tarde mais vermelha)
+};
+static_assert(config_tabela_valida(descritores_config, N_PARAMETROS), "descritores_config: nome repetido ou padrao fora dos limites");
+
+typedef ConfigStore<N_PARAMETROS> ConfigFazenda;
+typedef TransacaoConfig<N_PARAMETROS> TransacaoFazenda;
+
+//------------------------------------------------------------------------------
+// Agenda Padrão (cron: minuto hora dia mes dia_semana, hora local), alteravel em funcionamento pelo GET /agenda
+//------------------------------------------------------------------------------
+#define AGENDA_BOMBA "*/15 * * * *"    // Partidas da bomba d'água
+#define DURACAO_BOMBA_S (5*60)         // Tempo ligada a cada partida (5 ligada e 10 desligada)
+#define AGENDA_IRRIGACAO "*/2 * * * *" // Inicio de cada ciclo de irrigação
+#define DURACAO_IRRIGACAO_S 60         // Tempo com a solenoide de irrigação aberta
+#define AGENDA_LEDS "0 8 * * *"        // Inicio do amanhecer dos LEDs
+#define DURACAO_LEDS_S (14*3600)       // Do inicio do amanhecer ao fim do entardecer (apagam as 22h)
+
+//------------------------------------------------------------------------------
+// Cadeias de 74HC595 (ordem de registro no driver)
+//------------------------------------------------------------------------------
+#define CADEIA_RELES 0
+#define CADEIA_LEDS1 1
+#define CADEIA_LEDS2 2
+#define CADEIA_LEDS3 3
+
+//------------------------------------------------------------------------------
+// Definições de Cor dos LEDs
+//------------------------------------------------------------------------------
+#define RED 1
+#define BLUE 0
+
+//------------------------------------------------------------------------------
+// Estruturas de Dados
+//------------------------------------------------------------------------------
+
+/**
+ * @brief Estrutura para armazenar o estado dos atuadores.
+ */
+struct Outs{
+  bool bomba1 = false;
+  bool bomba2 = false;
+  bool solenoide_caixa = false;
+  bool solenoide_irrigacao = false;
+  bool exaustor = false;
+  bool contatora_leds = false;
+  bool refletor = false;
+  bool lampada = false;
+  bool ac = false;
+
+  // Empacota os reles na ordem da placa (bomba1 no bit mais significativo)
+  byte rele_byte() const {
+    return (bomba1 << 7) | (bomba2 << 6) | (solenoide_caixa << 5) | (solenoide_irrigacao << 4) |
+           (contatora_leds << 3) | (exaustor << 2) | (refletor << 1) | (lampada << 0);
+  }
+};
+
+/**
+ * @brief Estrutura para armazenar os dados dos sensores.
+ */
+struct Ins{
+  int16_t temperatura = DECIMOS(TEMP_IDEAL); // Filtrada, em decimos de grau
+  int16_t umidade = DECIMOS(UMID_IDEAL);     // Filtrada, em decimos de %
+  bool chuva = false;
+  byte umidade_externa = UMID_IDEAL;
+  int16_t temperatura_externa_x10 = DECIMOS(TEMP_IDEAL); // Da api de clima, em decimos de grau
+  uint16_t vento_x10 = 0;              // Da api de clima, em decimos de m/s
+  uint16_t vazao_x100 = 0;             // Vazão da aquaponia, em centesimos de L/min
+  bool boia_max = false;               // Caixa d'agua no nivel maximo
+  bool boia_min = false;               // Caixa d'agua acima do nivel minimo
+  unsigned long millis_dht = 0;        // Instante da ultima tentativa de leitura do DHT11
+  byte qualidade_dht = DHT_SEM_LEITURA; // Resultado da ultima tentativa (QualidadeDht)
+};
+
+/**
+ * @brief Dados climáticos externos enviados pela task de rede para a task de controle.
+ */
+struct DadosClima{
+  byte umidade_externa = UMID_IDEAL;
+  int16_t temperatura_externa_x10 = DECIMOS(TEMP_IDEAL); // decimos de grau
+  uint16_t chuva_x10 = 0;                                // chuva na ultima hora, em decimos de mm
+  uint16_t vento_x10 = 0;                                // decimos de m/s
+};
+
+/**
+ * @brief Dispositivos virtuais da Alexa.
+ */
+enum DispositivoAlexa{
+  ALEXA_BOMBA,
+  ALEXA_BOMBA_AUTO,
+  ALEXA_EXAUSTOR,
+  ALEXA_EXAUSTOR_AUTO,
+  ALEXA_LAMPADAS,
+  ALEXA_LEDS,
+  ALEXA_REFLETOR,
+  ALEXA_LEDS_AUTO
+};
+
+/**
+ * @brief Comando da Alexa enviado pelo loop (fauxmo) para a task de controle.
+ */
+struct ComandoAlexa{
+  DispositivoAlexa dispositivo;
+  bool estado;
+};
+
+/**
+ * @brief Canais gravados no historico (uma amostra por leitura do DHT11, a cada T_DHT).
+ */
+enum CanalHistorico{
+  HIST_TEMPERATURA,      // decimos de grau (filtrada)
+  HIST_UMIDADE,          // decimos de % (filtrada)
+  HIST_UMIDADE_EXTERNA,  // %
+  HIST_VAZAO,            // centesimos de L/min
+  HIST_DEMANDA_EXAUSTOR, // % do controlador de clima
+  HIST_RELES,            // Outs::rele_byte() com o estado da caixa nos bits 8 e 9
+  N_CANAIS_HISTORICO
+};
+
+const char* const nomes_canais_historico[N_CANAIS_HISTORICO] = {
+  "temperatura_x10", "umidade_x10", "umidade_externa", "vazao_x100", "demanda_exaustor", "reles"
+};
+
+/**
+ * @brief Canais agregados em 1min/15min/1h para os graficos (atualizados a cada amostra).
+ */
+enum CanalRollup{
+  ROLLUP_TEMPERATURA, // decimos de grau, filtrada (so leituras validas do DHT11)
+  ROLLUP_UMIDADE,     // decimos de %, filtrada (so leituras validas do DHT11)
+  ROLLUP_VAZAO,       // centesimos de L/min, a cada T_FLUXO
+  N_CANAIS_ROLLUP
+};
+
+const char* const nomes_canais_rollup[N_CANAIS_ROLLUP] = {"temperatura_x10", "umidade_x10", "vazao_x100"};
+
+/**
+ * @brief Atuadores acionados pela agenda (indice do trabalho no CronSchedule).
+ */
+enum TrabalhoAgenda{
+  TRABALHO_BOMBA,      // bomba disponivel ligada durante a janela
+  TRABALHO_IRRIGACAO,  // solenoide de irrigação aberta durante a janela
+  TRABALHO_LEDS,       // curva de luz (amanhecer e entardecer dentro da janela)
+  N_TRABALHOS_AGENDA
+};
+
+const char* const nomes_trabalhos_agenda[N_TRABALHOS_AGENDA] = {"bomba", "irrigacao", "leds"};
+
+/**
+ * @brief Expressão e duração de um trabalho da agenda (padrão, NVS e comandos do GET /agenda para a task de controle).
+ */
+struct ComandoAgenda{
+  uint8_t trabalho;                      // TrabalhoAgenda
+  char expressao[CRON_MAX_EXPRESSAO];    // vazia desativa o trabalho
+  uint32_t duracao_s;
+};
+
+const ComandoAgenda agenda_padrao[N_TRABALHOS_AGENDA] = {
+  {TRABALHO_BOMBA, AGENDA_BOMBA, DURACAO_BOMBA_S},
+  {TRABALHO_IRRIGACAO, AGENDA_IRRIGACAO, DURACAO_IRRIGACAO_S},
+  {TRABALHO_LEDS, AGENDA_LEDS, DURACAO_LEDS_S},
+};
+
+//------------------------------------------------------------------------------
+// Variáveis Globais
+//------------------------------------------------------------------------------
+// state, input, agenda e configuracao pertencem somente a task de controle, as outras tasks usam as filas do main.cpp
+Outs state;                // Variável global para armazenar o estado dos atuadores
+Ins input;                 // Variável global para armazenar os dados dos sensores
+unsigned long millis_partida_bomba = 0; // Instante em que a bomba atual ligou (para a carencia da vazão)
+bool falha_bomba[2] = {false, false};   // Bomba sem vazão detectada (vale ate reiniciar)
+
+/**
+ * @brief Estados do controle de enchimento da caixa d'agua.
+ */
+enum EstadoCaixa{
+  CAIXA_NORMAL,    // solenoide fechada, aguardando o nivel minimo
+  CAIXA_ENCHENDO,  // solenoide aberta ate o nivel maximo
+  CAIXA_FALHA      // boias incoerentes ou enchimento demorado demais: solenoide fechada
+};
+EstadoCaixa estado_caixa = CAIXA_NORMAL;
+unsigned long millis_inicio_enchimento = 0;
+unsigned long millis_falha_caixa = 0;  // Inicio da pausa antes de tentar encher de novo
+byte tentativas_caixa = 0;             // Enchimentos demorados seguidos (zera quando a caixa enche)
+bool retentar_caixa = false;           // Falha por tempo de enchimento: tenta de novo depois de T_RETENTAR_CAIXA
+uint8_t id_tarefa_caixa = SCHED_ID_INVALIDO; // Tarefa antecipada pelos eventos das boias
+uint8_t id_tarefa_agenda = SCHED_ID_INVALIDO; // Tarefa que dorme ate o proximo evento da agenda
+
+bool alexa_controll_exaust = false; // Flag para indicar se o controle dos exaustores está sendo feito pela Alexa
+bool alexa_controll_bomba = false;  // Flag para indicar se o controle da bomba d'água está sendo feito pela Alexa
+bool alexa_controll_leds = false;   // Flag para indicar se o controle dos LEDs está sendo feito pela Alexa
+
+void acao_agenda(uint8_t trabalho, bool ligado);
+bool config_coerente(const int32_t *valores);
+
+//------------------------------------------------------------------------------
+// Instâncias de Objetos
+//------------------------------------------------------------------------------
+OffTime offtime;           // Objeto para lidar com o horário
+CronSchedule agenda(acao_agenda);       // Janelas da bomba, irrigação e leds numa fila so de eventos
+ConfigFazenda configuracao(descritores_config, config_coerente); // Parametros de operação em uso (recebe as transações do /config)
+Scheduler scheduler_controle;            // Agendador da task de controle (bomba, irrigação, dht, exaustores e leds)
+TaskMetrics metricas_controle;          // Duração e atraso das tarefas do controle e voltas da task
+DhtRmt sensor_dht;                      // Leitor do DHT11 via RMT (sem bloquear nem desligar interrupções)
+SensorFilter<JANELA_FILTRO_DHT, EMA_SHIFT_DHT> filtro_temperatura; // Amostras de temperatura (decimos)
+SensorFilter<JANELA_FILTRO_DHT, EMA_SHIFT_DHT> filtro_umidade;     // Amostras de umidade (decimos)
+FlowMeter fluxo;                        // Medidor de vazão da aquaponia (PCNT)
+ClimateController clima;                // PID de temperatura e umidade arbitrados nos exaustores
+Historian<N_CANAIS_HISTORICO> historico; // Serie temporal comprimida na flash (gravada pela task de rede)
+Rollup rollups[N_CANAIS_ROLLUP];        // Agregados recentes por canal na ram (GET /serie)
+Forecast previsao;                      // Proximas horas de clima externo (recebida da task de rede)
+ShiftChains cadeias_595;               // Driver dos 74HC595 (reles e leds), envia tudo em um commit()
+LedFrame leds(&cadeias_595, CADEIA_LEDS1, CADEIA_LEDS2, CADEIA_LEDS3); // Framebuffer dos leds de cultivo
+
+Photoperiod fotoperiodo;  // Tabela de brilho por minuto do dia (montada da janela dos leds na agenda)
+
+//------------------------------------------------------------------------------
+// Protótipos de Funções
+//------------------------------------------------------------------------------
+void controle_iniciar(uint32_t agora, const ComandoAgenda agendas[N_TRABALHOS_AGENDA] = agenda_padrao);
+uint32_t controle_ciclo();
+void atualizar_boias(bool maximo, bool minimo);
+void main_agenda();
+bool agenda_valida(const ComandoAgenda& comando, int32_t rampa_leds_min);
+bool aplicar_agenda(const ComandoAgenda& comando);
+bool aplicar_config(const TransacaoFazenda& transacao);
+q16_t config_q16(uint8_t parametro);
+bool ligar_bomba();
+void main_fluxo();
+void trocar_bomba_falha();
+void main_caixa();
+void falha_caixa(const char* motivo);
+void set_outs();
+void main_get_dht();
+void processar_dht();
+void main_exaustores();
+void amostrar_historico();
+void amostrar_rollup(CanalRollup canal, int16_t valor);
+ConfigClima config_clima_atual();
+void config_clima();
+void main_leds();
+bool montar_curva_agenda();
+void remontar_curva_luz();
+bool montar_curva_luz(uint16_t inicio_minuto, uint16_t duracao_min);
+void modo_apresentacao();
+void aplicar_luz(byte vermelho, byte azul);
+void set_led(bool color, byte num_led, bool state);
+void set_state_leds(bool red_value, bool blue_value);
+void aplicar_comando_alexa(const ComandoAlexa& comando);
+
+//==============================================================================
+// Inicialização das Tarefas de Controle
+//==============================================================================
+// agendas: configuração de cada TrabalhoAgenda (padrão ou lida do NVS); as janelas ja abertas ligam agora
+void controle_iniciar(uint32_t agora, const ComandoAgenda agendas[N_TRABALHOS_AGENDA]){
+  metricas_controle.attach(scheduler_controle);
+  configuracao.subscribe(GRUPO_CLIMA, config_clima);
+  configuracao.subscribe(GRUPO_LEDS, remontar_curva_luz);
+  for (uint8_t i = 0; i < N_TRABALHOS_AGENDA; i++) {
+    if (!aplicar_agenda(agendas[i])) aplicar_agenda(agenda_padrao[i]);
+  }
+  id_tarefa_agenda = scheduler_controle.add(main_agenda, T_MAX_AGENDA, agora);
+  metricas_controle.name(id_tarefa_agenda, "agenda");
+  metricas_controle.name(scheduler_controle.add(main_leds, T_VERIFICAR_LEDS, agora), "leds");
+  metricas_controle.name(scheduler_controle.add(main_get_dht, T_DHT, agora), "dht");
+  metricas_controle.name(scheduler_controle.add(main_exaustores, T_VERIFICAR_EXAUSTOR, agora), "exaustores");
+  metricas_controle.name(scheduler_controle.add(main_fluxo, T_FLUXO, agora, T_FLUXO), "fluxo");
+  id_tarefa_caixa = scheduler_controle.add(main_caixa, T_VERIFICAR_CAIXA, agora);
+  metricas_controle.name(id_tarefa_caixa, "caixa");
+}
+
+//==============================================================================
+// Ciclo de Controle: aplica as leituras prontas, roda as tarefas vencidas e atualiza as saidas
+//==============================================================================
+uint32_t controle_ciclo(){
+  // Decodifica a captura do DHT11 se ela terminou
+  if (sensor_dht.poll(hal_millis())) {
+    processar_dht();
+    amostrar_historico();
+  }
+
+  uint32_t tempo_proxima = scheduler_controle.run(hal_millis());
+
+  set_outs();
+  return tempo_proxima; // ms ate o proximo deadline
+}
+
+//==============================================================================
+// Novo Nivel das Boias: atualiza a entrada e antecipa o controle da caixa
+//==============================================================================
+void atualizar_boias(bool maximo, bool minimo){
+  input.boia_max = maximo;
+  input.boia_min = minimo;
+  scheduler_controle.run_now(id_tarefa_caixa, hal_millis());
+}
+
+//==============================================================================
+// Função para Disparar os Eventos Vencidos da Agenda
+//==============================================================================
+void main_agenda(){
+  int64_t proximo = agenda.run(offtime.now64());
+
+  // Dorme ate o proximo evento (na hora do OffTime, com ms), no maximo T_MAX_AGENDA
+  uint32_t espera = T_MAX_AGENDA;
+  if (proximo != CRON_NUNCA) {
+    int64_t faltam_ms = (proximo - offtime.timezone()) * 1000 - offtime.utc_us() / 1000 + 1;
+    if (faltam_ms < (int64_t)espera) espera = faltam_ms > 0 ? (uint32_t)faltam_ms : 1;
+  }
+  scheduler_controle.set_interval(id_tarefa_agenda, espera, hal_millis());
+}
+
+//==============================================================================
+// Função para Acionar um Atuador no Inicio ou no Fim da Janela da Agenda
+//==============================================================================
+void acao_agenda(uint8_t trabalho, bool ligado){
+  switch (trabalho) {
+    case TRABALHO_BOMBA:
+      if (alexa_controll_bomba) break; // Alexa no controle da bomba
+      if (ligado) {
+        ligar_bomba(); // a bomba usada depende das falhas detectadas em main_fluxo()
+      } else {
+        state.bomba1 = false;
+        state.bomba2 = false;
+      }
+      break;
+    case TRABALHO_IRRIGACAO:
+      state.solenoide_irrigacao = ligado;
+      break;
+    case TRABALHO_LEDS:
+      if (ligado) montar_curva_agenda(); // a expressão pode abrir em horarios diferentes
+      main_leds();
+      break;
+  }
+  set_outs();
+}
+
+//==============================================================================
+// Função para Validar a Configuração de um Trabalho da Agenda (task de controle, http e NVS)
+//==============================================================================
+// expressão vazia (desativa) ou valida, duração ate CRON_DURACAO_MAX_S e, nos leds, as duas rampas dentro da janela
+// (rampa_leds_min da configuração de quem valida: a task de controle ou a copia do servidor http)
+bool agenda_valida(const ComandoAgenda& comando, int32_t rampa_leds_min){
+  if (comando.trabalho >= N_TRABALHOS_AGENDA || memchr(comando.expressao, '\0', CRON_MAX_EXPRESSAO) == nullptr) return false;
+  if (comando.expressao[0] == '\0') return true;
+  ExpressaoCron expressao;
+  if (!CronSchedule::compile(comando.expressao, expressao) || comando.duracao_s == 0 || comando.duracao_s > CRON_DURACAO_MAX_S) return false;
+  uint32_t minutos = comando.duracao_s / 60;
+  return comando.trabalho != TRABALHO_LEDS || ((int32_t)minutos > 2 * rampa_leds_min && minutos < MINUTOS_DIA);
+}
+
+//==============================================================================
+// Função para Trocar a Expressão e a Duração de um Trabalho da Agenda
+//==============================================================================
+bool aplicar_agenda(const ComandoAgenda& comando){
+  if (!agenda_valida(comando, configuracao.get(PARAM_RAMPA_LEDS))) {
+    hal_log_erro("AGENDA", "Agenda invalida para o trabalho %d", comando.trabalho);
+    return false;
+  }
+  agenda.set(comando.trabalho, comando.expressao, comando.duracao_s, offtime.now64());
+  hal_log("AGENDA", "%s: '%s' por %lus", nomes_trabalhos_agenda[comando.trabalho], agenda.expression(comando.trabalho),
+          (unsigned long)comando.duracao_s);
+  if (id_tarefa_agenda != SCHED_ID_INVALIDO) scheduler_controle.run_now(id_tarefa_agenda, hal_millis()); // recalcula a espera
+  return true;
+}
+
+//==============================================================================
+// Função para Aplicar uma Alteração dos Parametros de Operação (inteira ou nada)
+//==============================================================================
+// os observadores (clima e curva de luz) rodam aqui, depois que todos os valores foram trocados
+bool aplicar_config(const TransacaoFazenda& transacao){
+  if (!configuracao.commit(transacao)) {
+    hal_log_erro("CONFIG", "Alteracao com %d parametros invalida ou incoerente, nada mudou", transacao.quantidade);
+    return false;
+  }
+  for (uint8_t i = 0; i < transacao.quantidade; i++) {
+    const DescritorConfig& descritor = configuracao.descriptor(transacao.ids[i]);
+    hal_log("CONFIG", "%s = %ld (%d casas)", descritor.nome, (long)transacao.valores[i], descritor.casas);
+  }
+  return true;
+}
+
+//==============================================================================
+// Função para Conferir a Coerencia entre os Parametros (antes de qualquer valor mudar)
+//==============================================================================
+// valores: todos os parametros como ficariam depois da alteração (indices de ParametroConfig)
+bool config_coerente(const int32_t *valores){
+  if (valores[PARAM_TEMP_MIN] >= valores[PARAM_TEMP_MAX] - valores[PARAM_TEMP_MARGEM]) return false; // alvo acima do minimo
+  return 2 * valores[PARAM_MIN_LIGADO_EXAUSTORES] <= valores[PARAM_JANELA_EXAUSTORES];             // liga e desliga cabem na janela
+}
+
+// Parametro em ponto fixo (casas decimais) para Q16, truncado como o Q16() das constantes
+q16_t config_q16(uint8_t parametro){
+  return (q16_t)((int64_t)configuracao.get(parametro) * Q16_UM / ConfigFazenda::scale(configuracao.descriptor(parametro).casas));
+}
+
+//==============================================================================
+// Função para Ligar a Bomba Disponivel (bomba1, ou bomba2 se a 1 estiver em falha)
+//==============================================================================
+bool ligar_bomba(){
+  state.bomba1 = false;
+  state.bomba2 = false;
+
+  if (!falha_bomba[0]) {
+    state.bomba1 = true;
+  } else if (!falha_bomba[1]) {
+    state.bomba2 = true;
+  } else {
+    hal_log_erro("BOMBA", "As duas bombas estao em falha, aquaponia parada");
+    return false;
+  }
+  return true;
+}
+
+//==============================================================================
+// Função para Medir a Vazão e Detectar Falha da Bomba
+//==============================================================================
+void main_fluxo(){
+  static bool estava_ligada = false;
+  static byte amostras_sem_fluxo = 0;
+
+  fluxo.sample();
+  input.vazao_x100 = fluxo.flow_x100();
+  amostrar_rollup(ROLLUP_VAZAO, (int16_t)input.vazao_x100);
+
+  bool ligada = state.bomba1 || state.bomba2;
+  if (ligada && !estava_ligada) {
+    // Partida (automatica ou pela Alexa): so cobra vazão depois da carencia
+    millis_partida_bomba = hal_millis();
+    fluxo.reset_window();
+  }
+  estava_ligada = ligada;
+
+  if (!ligada || hal_millis() - millis_partida_bomba < (uint32_t)configuracao.get(PARAM_PARTIDA_BOMBA) * 1000) {
+    amostras_sem_fluxo = 0;
+    return;
+  }
+
+  if ((int32_t)fluxo.last_flow_x100() < configuracao.get(PARAM_VAZAO_MIN)) {
+    amostras_sem_fluxo++;
+  } else {
+    amostras_sem_fluxo = 0;
+  }
+
+  if (amostras_sem_fluxo >= configuracao.get(PARAM_AMOSTRAS_FALHA_FLUXO)) {
+    amostras_sem_fluxo = 0;
+    trocar_bomba_falha();
+    estava_ligada = false; // a bomba reserva passa pela carencia de partida
+  }
+}
+
+//==============================================================================
+// Função para Trocar para a Bomba Reserva quando a Atual nao Gera Vazão
+//==============================================================================
+void trocar_bomba_falha(){
+  byte atual = state.bomba1 ? 0 : 1;
+  falha_bomba[atual] = true;
+  hal_log_erro("BOMBA", "Bomba %d sem vazao, marcada em falha", atual + 1);
+
+  if (ligar_bomba()) {
+    hal_log("BOMBA", "Trocando para a bomba %d", state.bomba1 ? 1 : 2);
+  }
+  set_outs();
+}
+
+
+//==============================================================================
+// Função para Controlar o Enchimento da Caixa D'Água (histerese entre as boias)
+//==============================================================================
+void main_caixa(){
+  bool incoerente = input.boia_max && !input.boia_min; // maximo sem minimo: alguma boia travada
+
+  switch (estado_caixa) {
+    case CAIXA_NORMAL:
+      if (incoerente) {
+        falha_caixa("boias incoerentes");
+      } else if (!input.boia_min) {
+        estado_caixa = CAIXA_ENCHENDO;
+        millis_inicio_enchimento = hal_millis();
+        hal_log("CAIXA", "Nivel minimo, enchendo caixa");
+      }
+      break;
+
+    case CAIXA_ENCHENDO:
+      if (incoerente) {
+        falha_caixa("boias incoerentes");
+      } else if (input.boia_max) {
+        estado_caixa = CAIXA_NORMAL;
+        tentativas_caixa = 0;
+        hal_log("CAIXA", "Nivel maximo, caixa cheia");
+      } else if (hal_millis() - millis_inicio_enchimento > (uint32_t)configuracao.get(PARAM_MAX_ENCHIMENTO) * 60 * 1000) {
+        falha_caixa("enchimento sem atingir o nivel maximo");
+        if (tentativas_caixa < MAX_TENTATIVAS_CAIXA) {
+          tentativas_caixa++;
+          retentar_caixa = true;
+          millis_falha_caixa = hal_millis();
+          hal_log("CAIXA", "Tentativa %d de %d em %lu min", tentativas_caixa, MAX_TENTATIVAS_CAIXA, (unsigned long)(T_RETENTAR_CAIXA / 60000));
+        } else {
+          hal_log_erro("CAIXA", "Tentativas esgotadas, solenoide travada ate a caixa encher");
+        }
+      }
+      break;
+
+    case CAIXA_FALHA:
+      // Sai da falha com as duas boias coerentes e a caixa cheia, ou, depois de um enchimento
+      // demorado, tentando de novo apos a pausa (boias incoerentes nunca reabrem a solenoide sozinhas)
+      if (input.boia_max && input.boia_min) {
+        estado_caixa = CAIXA_NORMAL;
+        tentativas_caixa = 0;
+        retentar_caixa = false;
+        hal_log("CAIXA", "Boias normalizadas");
+      } else if (retentar_caixa && !incoerente && hal_millis() - millis_falha_caixa >= T_RETENTAR_CAIXA) {
+        estado_caixa = CAIXA_ENCHENDO;
+        retentar_caixa = false;
+        millis_inicio_enchimento = hal_millis();
+        hal_log("CAIXA", "Tentando encher a caixa de novo");
+      }
+      break;
+  }
+
+  state.solenoide_caixa = (estado_caixa == CAIXA_ENCHENDO);
+  set_outs();
+}
+
+void falha_caixa(const char* motivo){
+  estado_caixa = CAIXA_FALHA;
+  retentar_caixa = false;
+  hal_log_erro("CAIXA", "Falha na caixa: %s", motivo);
+}
+
+//==============================================================================
+// Função para Ler os Dados do Sensor DHT11
+//==============================================================================
+void main_get_dht(){
+  // So inicia a conversao, o resultado chega em processar_dht() uns 30ms depois
+  if (!sensor_dht.trigger()) {
+    hal_log_aviso("DHT", "Conversao anterior do DHT11 ainda em andamento");
+  }
+}
+
+//==============================================================================
+// Função para Aplicar a Leitura do DHT11 (chamada quando a captura termina)
+//==============================================================================
+void processar_dht(){
+  const LeituraDht &leitura = sensor_dht.last();
+  input.millis_dht = leitura.millis_leitura;
+  input.qualidade_dht = leitura.qualidade;
+
+  // Somente leituras validas entram nos filtros, os controladores usam o valor filtrado
+  if (leitura.qualidade == DHT_OK) {
+    filtro_umidade.push(leitura.umidade_x10, leitura.millis_leitura);
+    filtro_temperatura.push(leitura.temperatura_x10, leitura.millis_leitura);
+    input.umidade = filtro_umidade.value();
+    input.temperatura = filtro_temperatura.value();
+    amostrar_rollup(ROLLUP_TEMPERATURA, input.temperatura);
+    amostrar_rollup(ROLLUP_UMIDADE, input.umidade);
+  } else {
+    hal_log_aviso("DHT", "Falha na leitura do DHT11, codigo: %d", leitura.qualidade);
+  }
+}
+
+//==============================================================================
+// Função para Controlar os Exaustores (Temperatura e Umidade)
+//==============================================================================
+void main_exaustores(){
+  if(alexa_controll_exaust == false){
+    EntradaClima entrada;
+    entrada.temperatura_x10 = input.temperatura;
+    entrada.umidade_x10 = input.umidade;
+    entrada.umidade_externa = input.umidade_externa;
+    entrada.chuva = input.chuva;
+    entrada.ajuste_temp_x10 = previsao.adjustment_x10(offtime.now(), input.temperatura, configuracao.get(PARAM_TEMP_MAX),
+                                                       configuracao.get(PARAM_TEMP_MIN));
+    state.exaustor = clima.update(entrada, hal_millis());
+  }
+}
+
+//==============================================================================
+// Função para Amostrar o Historico (so comprime na ram, a task de rede grava na flash)
+//==============================================================================
+// fora do scheduler: cada leitura do DHT11 (com falha ou nao) vira uma amostra, sem mexer na ordem das tarefas
+void amostrar_historico(){
+  uint32_t agora = offtime.now();
+  if (!offtime.synced() || agora < EPOCH_VALIDO) return;
+
+  AmostraHistorico<N_CANAIS_HISTORICO> amostra;
+  amostra.epoch = agora;
+  amostra.valores[HIST_TEMPERATURA] = input.temperatura;
+  amostra.valores[HIST_UMIDADE] = input.umidade;
+  amostra.valores[HIST_UMIDADE_EXTERNA] = input.umidade_externa;
+  amostra.valores[HIST_VAZAO] = input.vazao_x100;
+  amostra.valores[HIST_DEMANDA_EXAUSTOR] = clima.demand_percent();
+  amostra.valores[HIST_RELES] = state.rele_byte() | ((int32_t)estado_caixa << 8);
+  historico.append(amostra);
+}
+
+//==============================================================================
+// Função para Agregar uma Amostra nos Rollups (1min, 15min e 1h)
+//==============================================================================
+void amostrar_rollup(CanalRollup canal, int16_t valor){
+  uint32_t agora = offtime.now();
+  if (!offtime.synced() || agora < EPOCH_VALIDO) return;
+  rollups[canal].add(agora, valor);
+}
+
+//==============================================================================
+// Função para Configurar o Controlador de Clima (no setup e a cada alteração dos parametros do GRUPO_CLIMA)
+//==============================================================================
+ConfigClima config_clima_atual(){
+  ConfigClima cfg;
+  cfg.temp_alvo_x10 = configuracao.get(PARAM_TEMP_MAX) - configuracao.get(PARAM_TEMP_MARGEM);
+  cfg.temp_min_x10 = configuracao.get(PARAM_TEMP_MIN);
+  cfg.umid_alvo_x10 = DECIMOS(configuracao.get(PARAM_UMID_MAX_EXAUST) - 5);
+  cfg.umid_externa_max = configuracao.get(PARAM_UMID_MAX_EXAUST);
+  cfg.umid_limite_x10 = DECIMOS(UMID_MAX);
+  cfg.kp_temp = config_q16(PARAM_KP_TEMP);
+  cfg.ki_temp = config_q16(PARAM_KI_TEMP);
+  cfg.kp_umid = config_q16(PARAM_KP_UMID);
+  cfg.ki_umid = config_q16(PARAM_KI_UMID);
+  cfg.janela_ms = configuracao.get(PARAM_JANELA_EXAUSTORES) * 1000;
+  cfg.min_ligado_ms = configuracao.get(PARAM_MIN_LIGADO_EXAUSTORES) * 1000;
+  cfg.max_continuo_ms = configuracao.get(PARAM_TIMEOUT_EXAUSTORES) * 1000;
+  cfg.descanso_ms = configuracao.get(PARAM_DESCANSO_EXAUSTORES) * 1000;
+  return cfg;
+}
+
+void config_clima(){
+  clima.config(config_clima_atual());
+}
+
+//==============================================================================
+// Função para Atualizar o Estado das Saídas
+//==============================================================================
+void set_outs(){
+  // O driver so reescreve o registrador se algum rele mudou
+  cadeias_595.set(CADEIA_RELES, state.rele_byte());
+  cadeias_595.commit();
+}
+
+//==============================================================================
+// Função para Controlar os LEDs
+//==============================================================================
+void main_leds(){
+  if(alexa_controll_leds == false){
+    if (!agenda.active(TRABALHO_LEDS)) {
+      aplicar_luz(0, 0);
+      return;
+    }
+    uint16_t minuto_dia = offtime.calendar().minuto_dia;
+    aplicar_luz(fotoperiodo.red(minuto_dia), fotoperiodo.blue(minuto_dia));
+  }
+}
+
+//==============================================================================
+// Funções para Montar a Curva de Luz da Janela Atual dos LEDs na Agenda
+//==============================================================================
+bool montar_curva_agenda(){
+  int64_t minuto_inicio = (agenda.window_start(TRABALHO_LEDS) / 60 % MINUTOS_DIA + MINUTOS_DIA) % MINUTOS_DIA;
+  return montar_curva_luz((uint16_t)minuto_inicio, agenda.duration(TRABALHO_LEDS) / 60);
+}
+
+// Parametros da curva mudaram: com a janela aberta vale na hora, senao a proxima abertura ja monta com eles
+void remontar_curva_luz(){
+  if (!agenda.active(TRABALHO_LEDS)) return;
+  if (!montar_curva_agenda()) {
+    hal_log_erro("LEDS", "Rampas nao cabem na janela dos leds, mantendo a curva anterior");
+    return;
+  }
+  main_leds();
+}
+
+//==============================================================================
+// Função para Montar a Curva de Luz de uma Janela (amanhecer no inicio, entardecer no fim)
+//==============================================================================
+// o meio dia fica nas 12h quando cabe entre as rampas, senao no meio da janela (janela pode passar da meia noite)
+bool montar_curva_luz(uint16_t inicio_minuto, uint16_t duracao_min){
+  uint16_t rampa = (uint16_t)configuracao.get(PARAM_RAMPA_LEDS);
+  byte vermelho_manha = (byte)configuracao.get(PARAM_VERMELHO_MANHA);
+  byte azul_tarde = (byte)configuracao.get(PARAM_AZUL_TARDE);
+  if (duracao_min <= 2 * rampa || duracao_min >= MINUTOS_DIA) return false;
+  uint16_t meio_dia = (12 * 60 + MINUTOS_DIA - inicio_minuto) % MINUTOS_DIA; // minutos depois do inicio
+  if (meio_dia <= rampa || meio_dia >= duracao_min - rampa) meio_dia = duracao_min / 2;
+
+  const PontoLuz relativos[] = {
+    {0,                               0,              0},          // inicio do amanhecer
+    {rampa,                           vermelho_manha, 255},        // manhã
+    {meio_dia,                        255,            255},        // meio dia
+    {(uint16_t)(duracao_min - rampa), 255,            azul_tarde}, // inicio do entardecer
+    {duracao_min,                     0,              0},          // noite
+  };
+  const uint8_t n = sizeof(relativos) / sizeof(relativos[0]);
+
+  // no relogio do dia, começando pelo ponto de menor minuto (a tabela é circular)
+  PontoLuz curva[n];
+  uint8_t primeiro = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    curva[i] = relativos[i];
+    curva[i].minuto = (inicio_minuto + relativos[i].minuto) % MINUTOS_DIA;
+    if (curva[i].minuto < curva[primeiro].minuto) primeiro = i;
+  }
+  PontoLuz ordenada[n];
+  for (uint8_t i = 0; i < n; i++) ordenada[i] = curva[(primeiro + i) % n];
+  return fotoperiodo.build(ordenada, n);
+}
+
+//==============================================================================
+// Função para Modo de Apresentação dos LEDs (Não Implementado)
+//==============================================================================
+void modo_apresentacao(){
+  // Lógica para o modo de apresentação dos LEDs (a ser implementada)
+}
+
+//==============================================================================
+// Função para Aplicar o Brilho dos LEDs (contatora e refletor acompanham)
+//==============================================================================
+void aplicar_luz(byte vermelho, byte azul){
+  bool ligado = (vermelho > 0 || azul > 0);
+  state.contatora_leds = ligado;
+  state.refletor = ligado;
+  set_outs();
+
+  leds.fill_level(vermelho, azul);
+  leds.present(); // so reenvia se o brilho mudou
+}
+
+//==============================================================================
+// Função para Controlar um LED Individual
+//==============================================================================
+void set_led(bool color, byte num_led, bool state){
+  leds.set(color == RED, num_led, state);
+  leds.present();
+}
+
+//==============================================================================
+// Função para Definir o Estado de Todos os LEDs
+//==============================================================================
+void set_state_leds(bool red_value, bool blue_value){  
+  leds.fill(red_value, blue_value);
+  leds.present(); // um unico envio, somente das cadeias que mudaram
+}
+
+//==============================================================================
+// Função para Aplicar um Comando da Alexa (task de controle)
+//==============================================================================
+void aplicar_comando_alexa(const ComandoAlexa& comando){
+  switch (comando.dispositivo) {
+    case ALEXA_BOMBA:
+      if (comando.estado) {
+        ligar_bomba(); // respeita as bombas em falha
+      } else {
+        state.bomba1 = false;
+        state.bomba2 = false;
+      }
+      break;
+    case ALEXA_BOMBA_AUTO:    alexa_controll_bomba = !comando.estado; break;
+    case ALEXA_EXAUSTOR:      state.exaustor = comando.estado; break;
+    case ALEXA_EXAUSTOR_AUTO: alexa_controll_exaust = !comando.estado; break;
+    case ALEXA_LAMPADAS:      state.lampada = comando.estado; break;
+    case ALEXA_LEDS:
+      set_state_leds(comando.estado, comando.estado);
+      state.contatora_leds = comando.estado;
+      break;
+    case ALEXA_REFLETOR:      state.refletor = comando.estado; break;
+    case ALEXA_LEDS_AUTO:     alexa_controll_leds = !comando.estado; break;
+  }
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef FLOAT_SWITCH
+#define FLOAT_SWITCH
+
+#include <Arduino.h>
+#include <freertos/timers.h>
+#include <freertos/queue.h>
+
+//evento publicado quando o nivel estabiliza em um novo estado
+struct EventoNivel{
+  bool maximo;       // boia de nivel maximo acionada (agua no topo)
+  bool minimo;       // boia de nivel minimo acionada (agua acima do minimo)
+  uint32_t millis;
+};
+
+//monitor das duas boias da caixa d'agua por interrupção
+//a interrupção de cada pino so reinicia um timer de debounce (FreeRTOS, one-shot); quando o timer vence
+//sem novas bordas os pinos sao lidos uma vez e, se o estado mudou, um EventoNivel vai para a fila.
+//a fila tem uma posição so e cada evento sobrescreve o anterior: quem consome sempre ve o nivel mais recente.
+//nao existe polling: a task que consome a fila é acordada pelo callback informado no begin().
+class FloatSwitch{
+  private:
+    uint8_t pino_max;
+    uint8_t pino_min;
+    uint8_t nivel_ativo;
+    TimerHandle_t timer_debounce = nullptr;
+    QueueHandle_t fila = nullptr;
+    void (*ao_mudar)(void) = nullptr;
+    EventoNivel estavel;
+    bool iniciado = false;
+
+    static void IRAM_ATTR isr(void *arg){
+      FloatSwitch *boias = (FloatSwitch*)arg;
+      BaseType_t troca_contexto = pdFALSE;
+      xTimerResetFromISR(boias->timer_debounce, &troca_contexto);
+      if (troca_contexto) portYIELD_FROM_ISR();
+    }
+
+    static void callback_debounce(TimerHandle_t timer){
+      FloatSwitch *boias = (FloatSwitch*)pvTimerGetTimerID(timer);
+      boias->ler(false);
+    }
+
+    //le os pinos e publica se mudou (ou sempre, na leitura inicial)
+    void ler(bool forcar){
+      EventoNivel atual;
+      atual.maximo = (digitalRead(pino_max) == nivel_ativo);
+      atual.minimo = (digitalRead(pino_min) == nivel_ativo);
+      atual.millis = millis();
+
+      if (!forcar && iniciado && atual.maximo == estavel.maximo && atual.minimo == estavel.minimo) return;
+      estavel = atual;
+      iniciado = true;
+
+      xQueueOverwrite(fila, &atual);
+      if (ao_mudar != nullptr) ao_mudar();
+    }
+
+  public:
+
+    //configura os pinos (GPIO 34/35 sao somente entrada e sem pull-up interno: resistores externos)
+    //nivel_acionado: nivel lido quando a boia esta levantada
+    bool begin(uint8_t pin_max, uint8_t pin_min, uint8_t nivel_acionado, uint16_t debounce_ms, void (*callback_mudanca)(void) = nullptr){
+      pino_max = pin_max;
+      pino_min = pin_min;
+      nivel_ativo = nivel_acionado;
+      ao_mudar = callback_mudanca;
+
+      fila = xQueueCreate(1, sizeof(EventoNivel));
+      timer_debounce = xTimerCreate("boias", pdMS_TO_TICKS(debounce_ms) > 0 ? pdMS_TO_TICKS(debounce_ms) : 1, pdFALSE, this, callback_debounce);
+      if (fila == nullptr || timer_debounce == nullptr) return false;
+
+      pinMode(pino_max, INPUT);
+      pinMode(pino_min, INPUT);
+      attachInterruptArg(digitalPinToInterrupt(pino_max), isr, this, CHANGE);
+      attachInterruptArg(digitalPinToInterrupt(pino_min), isr, this, CHANGE);
+
+      ler(true); // estado inicial
+      return true;
+    }
+
+    //retira o ultimo nivel publicado (se houver um novo) sem bloquear
+    bool next(EventoNivel &evento){
+      if (fila == nullptr) return false;
+      return xQueueReceive(fila, &evento, 0) == pdTRUE;
+    }
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef FLOW_METER
+#define FLOW_METER
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+  #include <Arduino.h>
+  #include <driver/pcnt.h>
+#else
+  #include <Hal.cpp>
+#endif
+
+#define FLUXO_JANELA_MAX 30   // Maior janela deslizante suportada (amostras)
+#define FLUXO_LIMITE_PCNT 32000 // O contador volta a zero ao atingir este valor
+
+//medidor de vazão (sensor de efeito hall, ex: YF-S201) contando os pulsos no periferico PCNT
+//os pulsos sao contados em hardware (sem uma interrupção por pulso); sample() é chamado em intervalo fixo,
+//le quantos pulsos entraram desde a ultima amostra e mantem a soma de uma janela deslizante para calcular L/min.
+class FlowMeter{
+  private:
+    uint16_t pulsos[FLUXO_JANELA_MAX]; // pulsos de cada amostra da janela
+    uint8_t janela = 10;
+    uint8_t posicao = 0;
+    uint8_t preenchidas = 0;
+    uint32_t soma = 0;
+    uint32_t total = 0;             // pulsos desde o boot
+    int16_t ultimo_contador = 0;
+    uint16_t pulsos_por_litro = 450;
+    uint16_t intervalo_ms = 1000;
+
+    #ifdef ARDUINO
+      pcnt_unit_t unidade;
+
+      int16_t ler_contador(){
+        int16_t contador = 0;
+        pcnt_get_counter_value(unidade, &contador);
+        return contador;
+      }
+    #else
+      uint8_t unidade = 0;
+
+      int16_t ler_contador(){
+        return (hal_sim.pcnt != nullptr) ? hal_sim.pcnt(unidade) : ultimo_contador;
+      }
+    #endif
+
+  public:
+
+    //configura a janela: quantidade de amostras e o intervalo entre elas
+    void config(uint16_t pulsos_litro, uint8_t amostras_janela, uint16_t intervalo_amostra_ms){
+      pulsos_por_litro = pulsos_litro ? pulsos_litro : 1;
+      janela = (amostras_janela == 0) ? 1 : (amostras_janela > FLUXO_JANELA_MAX ? FLUXO_JANELA_MAX : amostras_janela);
+      intervalo_ms = intervalo_amostra_ms ? intervalo_amostra_ms : 1;
+      posicao = 0;
+      preenchidas = 0;
+      soma = 0;
+    }
+
+    #ifdef ARDUINO
+    //configura a unidade do PCNT para contar as bordas de subida do pino
+    void begin(uint8_t pin, uint8_t unidade_pcnt){
+      unidade = (pcnt_unit_t)unidade_pcnt;
+
+      pcnt_config_t config = {};
+      config.pulse_gpio_num = pin;
+      config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+      config.channel = PCNT_CHANNEL_0;
+      config.unit = unidade;
+      config.pos_mode = PCNT_COUNT_INC;
+      config.neg_mode = PCNT_COUNT_DIS;
+      config.lctrl_mode = PCNT_MODE_KEEP;
+      config.hctrl_mode = PCNT_MODE_KEEP;
+      config.counter_h_lim = FLUXO_LIMITE_PCNT;
+      config.counter_l_lim = 0;
+      pcnt_unit_config(&config);
+
+      pcnt_set_filter_value(unidade, 1000); // ignora pulsos menores que ~12us (ruido)
+      pcnt_filter_enable(unidade);
+
+      pcnt_counter_pause(unidade);
+      pcnt_counter_clear(unidade);
+      pcnt_counter_resume(unidade);
+      ultimo_contador = 0;
+    }
+    #else
+    //backend do pc: o contador vem do gancho hal_sim.pcnt
+    void begin(uint8_t pin, uint8_t unidade_pcnt){
+      (void)pin;
+      unidade = unidade_pcnt;
+      ultimo_contador = ler_contador();
+    }
+    #endif
+
+    //le o contador de hardware e adiciona a amostra
+    void sample(){
+      int16_t contador = ler_contador();
+      add_pulses((contador - ultimo_contador + FLUXO_LIMITE_PCNT) % FLUXO_LIMITE_PCNT);
+      ultimo_contador = contador;
+    }
+
+    //adiciona os pulsos de um intervalo (separado do hardware para poder simular no pc)
+    void add_pulses(uint16_t quantidade){
+      if (preenchidas == janela) soma -= pulsos[posicao];
+      else preenchidas++;
+      pulsos[posicao] = quantidade;
+      soma += quantidade;
+      total += quantidade;
+      posicao = (posicao + 1) % janela;
+    }
+
+    //vazão media da janela em centesimos de L/min
+    uint32_t flow_x100(){
+      if (preenchidas == 0) return 0;
+      // pulsos/ms -> L/min: pulsos * 60000 / (ms * pulsos_por_litro)
+      uint64_t tempo_ms = (uint64_t)preenchidas * intervalo_ms;
+      return (uint32_t)(((uint64_t)soma * 60000ULL * 100ULL) / (tempo_ms * pulsos_por_litro));
+    }
+
+    //vazão somente da ultima amostra (reage mais rapido, usada para detectar falha)
+    uint32_t last_flow_x100(){
+      if (preenchidas == 0) return 0;
+      uint16_t ultimo = pulsos[(posicao + janela - 1) % janela];
+      return (uint32_t)(((uint64_t)ultimo * 60000ULL * 100ULL) / ((uint64_t)intervalo_ms * pulsos_por_litro));
+    }
+
+    //volume total desde o boot em mL
+    uint32_t total_ml(){
+      return (uint32_t)(((uint64_t)total * 1000ULL) / pulsos_por_litro);
+    }
+
+    //descarta a janela (ex: ao trocar de bomba, para nao misturar vazões)
+    void reset_window(){
+      posicao = 0;
+      preenchidas = 0;
+      soma = 0;
+    }
+};
+
+#endif
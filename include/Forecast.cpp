@@ -0,0 +1,249 @@
+#ifndef FORECAST
+#define FORECAST
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <JsonStream.cpp>
+
+#define PREVISAO_HORAS 48             // Horas guardadas a partir da hora da coleta
+#define PREVISAO_PONTOS 48            // Pontos lidos de um provedor (OpenWeather: 3h cada, Open-Meteo: 1h cada)
+#define PREVISAO_HORAS_MIN 6          // Menos horas que isso: coleta descartada
+#define PREVISAO_VERSAO 1             // Muda quando PrevisaoClima muda (cache antigo do NVS é ignorado)
+#define PREVISAO_VALIDADE_S (24 * 3600UL) // Previsão mais velha que isso nao é usada
+#define PREVISAO_HORIZONTE_H 3        // Horas à frente olhadas pelo ajuste do controle de clima
+#define PREVISAO_AJUSTE_MAX_X10 20    // Maior deslocamento dos limites de temperatura (decimos)
+
+//provedores de previsão, na ordem de tentativa
+enum FonteClima : uint8_t{
+  FONTE_NENHUMA,
+  FONTE_OPENWEATHER,  // /data/2.5/forecast (pontos de 3h, pop de 0 a 1)
+  FONTE_OPEN_METEO    // /v1/forecast?hourly=...&timeformat=unixtime (pontos de 1h, probabilidade em %)
+};
+
+//cache compacto das proximas horas (tamanho fixo, gravado inteiro no NVS e passado por fila entre as tasks)
+//epochs no mesmo relogio do OffTime (hora local)
+struct PrevisaoClima{
+  uint16_t versao;
+  uint8_t fonte;
+  uint8_t horas;                                  // horas preenchidas a partir de inicio
+  uint32_t inicio;                                // epoch da hora 0 (multiplo de 3600)
+  uint32_t obtida;                                // epoch da coleta
+  int16_t temperatura_x10[PREVISAO_HORAS];        // decimos de grau
+  uint8_t umidade[PREVISAO_HORAS];                // %
+  uint8_t chuva_prob[PREVISAO_HORAS];             // probabilidade de chuva, %
+  uint32_t verificacao;                           // FNV-1a dos campos acima
+};
+
+//campos lidos de cada elemento da previsão (mesma ordem nos dois provedores)
+enum CampoPrevisao{
+  PREVISAO_EPOCH,
+  PREVISAO_TEMPERATURA,
+  PREVISAO_UMIDADE,
+  PREVISAO_CHUVA,
+  N_CAMPOS_PREVISAO
+};
+
+const char* const caminhos_openweather[N_CAMPOS_PREVISAO] = {
+  "list[*].dt", "list[*].main.temp", "list[*].main.humidity", "list[*].pop"
+};
+
+const char* const caminhos_open_meteo[N_CAMPOS_PREVISAO] = {
+  "hourly.time[*]", "hourly.temperature_2m[*]", "hourly.relative_humidity_2m[*]", "hourly.precipitation_probability[*]"
+};
+
+//------------------------------------------------------------------------------
+// Consulta (task de controle)
+//------------------------------------------------------------------------------
+class Forecast{
+  private:
+    PrevisaoClima dados;
+    bool carregada = false;
+
+  public:
+    static uint32_t checksum(const PrevisaoClima &previsao){
+      const uint8_t *bytes = (const uint8_t*)&previsao;
+      uint32_t hash = 2166136261u;
+      for (size_t i = 0; i < offsetof(PrevisaoClima, verificacao); i++) hash = (hash ^ bytes[i]) * 16777619u;
+      return hash;
+    }
+
+    //confere versao e soma (cache lido do NVS)
+    static bool check(const PrevisaoClima &previsao){
+      return previsao.versao == PREVISAO_VERSAO && previsao.horas <= PREVISAO_HORAS && previsao.verificacao == checksum(previsao);
+    }
+
+    bool set(const PrevisaoClima &previsao){
+      if (!check(previsao)) return false;
+      dados = previsao;
+      carregada = true;
+      return true;
+    }
+
+    const PrevisaoClima &data() const{
+      return dados;
+    }
+
+    //tem previsão recente que cobre o instante agora
+    bool valid(uint32_t agora) const{
+      return carregada && agora >= dados.inicio && agora - dados.obtida < PREVISAO_VALIDADE_S &&
+             (agora - dados.inicio) / 3600 < dados.horas;
+    }
+
+    //valores previstos para a hora de epoch (false fora da previsão)
+    bool at(uint32_t epoch, int16_t &temperatura_x10, uint8_t &umidade, uint8_t &chuva_prob) const{
+      if (!carregada || epoch < dados.inicio) return false;
+      uint32_t hora = (epoch - dados.inicio) / 3600;
+      if (hora >= dados.horas) return false;
+      temperatura_x10 = dados.temperatura_x10[hora];
+      umidade = dados.umidade[hora];
+      chuva_prob = dados.chuva_prob[hora];
+      return true;
+    }
+
+    //deslocamento (decimos) dos limites de temperatura do controle de clima, pela previsão das proximas horas:
+    //  - calor chegando (maxima externa acima de limite_calor) com o ar de fora agora mais frio que a estufa:
+    //    negativo, ventila antes e guarda ar fresco
+    //  - frio chegando (minima externa abaixo de limite_frio): positivo, para de ventilar antes e segura o calor
+    //metade da diferença prevista, ate PREVISAO_AJUSTE_MAX_X10; 0 sem previsão valida (controle so reativo)
+    int16_t adjustment_x10(uint32_t agora, int16_t temp_interna_x10, int16_t limite_calor_x10, int16_t limite_frio_x10) const{
+      if (!valid(agora)) return 0;
+      int16_t agora_x10, maxima = INT16_MIN, minima = INT16_MAX;
+      uint8_t umidade, chuva;
+      at(agora, agora_x10, umidade, chuva);
+      for (uint8_t h = 1; h <= PREVISAO_HORIZONTE_H; h++) {
+        int16_t temperatura;
+        if (!at(agora + h * 3600UL, temperatura, umidade, chuva)) break;
+        if (temperatura > maxima) maxima = temperatura;
+        if (temperatura < minima) minima = temperatura;
+      }
+      if (maxima == INT16_MIN) return 0;
+
+      int16_t ajuste = 0;
+      if (maxima > limite_calor_x10 && agora_x10 < temp_interna_x10) ajuste = -(maxima - limite_calor_x10) / 2;
+      else if (minima < limite_frio_x10) ajuste = (limite_frio_x10 - minima) / 2;
+      if (ajuste > PREVISAO_AJUSTE_MAX_X10) ajuste = PREVISAO_AJUSTE_MAX_X10;
+      if (ajuste < -PREVISAO_AJUSTE_MAX_X10) ajuste = -PREVISAO_AJUSTE_MAX_X10;
+      return ajuste;
+    }
+};
+
+//------------------------------------------------------------------------------
+// Coleta (task de rede): resposta de um provedor em fluxo -> PrevisaoClima por hora
+//------------------------------------------------------------------------------
+class ForecastBuilder{
+  private:
+    struct Ponto{
+      uint32_t epoch;           // UTC, como vem do provedor
+      int16_t temperatura_x10;
+      uint8_t umidade;
+      uint8_t chuva_prob;
+      uint8_t presentes;        // bit por CampoPrevisao
+    };
+
+    Ponto pontos[PREVISAO_PONTOS];
+    uint8_t quantidade = 0;
+    FonteClima fonte = FONTE_NENHUMA;
+    JsonStream parser;
+
+    static void campo(void *contexto, uint8_t indice, const char *valor, bool){
+      ForecastBuilder &coletor = *(ForecastBuilder*)contexto;
+      uint16_t elemento = coletor.parser.index();
+      if (elemento >= PREVISAO_PONTOS || valor[0] == 'n') return; // alem do cache ou null
+      Ponto &ponto = coletor.pontos[elemento];
+      if (elemento >= coletor.quantidade) coletor.quantidade = elemento + 1;
+      int32_t numero;
+      switch (indice) {
+        case PREVISAO_EPOCH:       ponto.epoch = (uint32_t)JsonStream::fixed(valor, 0); break;
+        case PREVISAO_TEMPERATURA: ponto.temperatura_x10 = (int16_t)JsonStream::fixed(valor, 1); break;
+        case PREVISAO_UMIDADE:
+          numero = JsonStream::fixed(valor, 0);
+          ponto.umidade = numero < 0 ? 0 : numero > 100 ? 100 : numero;
+          break;
+        case PREVISAO_CHUVA:
+          numero = JsonStream::fixed(valor, coletor.fonte == FONTE_OPENWEATHER ? 2 : 0); // pop 0..1 -> %
+          ponto.chuva_prob = numero < 0 ? 0 : numero > 100 ? 100 : numero;
+          break;
+      }
+      ponto.presentes |= 1 << indice;
+    }
+
+    static int32_t interpolar(int32_t a, int32_t b, uint32_t passado, uint32_t intervalo){
+      return intervalo ? a + (b - a) * (int32_t)passado / (int32_t)intervalo : a;
+    }
+
+  public:
+    ForecastBuilder() : parser(caminhos_openweather, N_CAMPOS_PREVISAO, campo, this){}
+
+    //prepara para a resposta de um provedor
+    void begin(FonteClima nova_fonte){
+      fonte = nova_fonte;
+      quantidade = 0;
+      memset(pontos, 0, sizeof(pontos));
+      parser = JsonStream(nova_fonte == FONTE_OPEN_METEO ? caminhos_open_meteo : caminhos_openweather, N_CAMPOS_PREVISAO, campo, this);
+    }
+
+    bool feed(const char *dados, size_t tamanho){
+      return parser.feed(dados, tamanho);
+    }
+
+    bool done() const{
+      return parser.done();
+    }
+
+    //interpola os pontos em horas a partir da hora de agora (epoch local), ou da hora do primeiro ponto se ele vier mais
+    //de 3h depois (nenhuma hora sem dados dentro de horas); fuso_s converte o UTC do provedor
+    //false se o documento nao fechou ou cobriu menos de PREVISAO_HORAS_MIN horas
+    bool build(PrevisaoClima &saida, uint32_t agora, int32_t fuso_s){
+      memset(&saida, 0, sizeof(saida));
+      if (!parser.done()) return false;
+
+      // so pontos completos, em ordem de tempo (os provedores ja entregam ordenado)
+      Ponto validos[PREVISAO_PONTOS];
+      uint8_t n = 0;
+      const uint8_t completo = (1 << N_CAMPOS_PREVISAO) - 1;
+      for (uint8_t i = 0; i < quantidade; i++) {
+        if (pontos[i].presentes != completo) continue;
+        if (n > 0 && pontos[i].epoch + fuso_s <= validos[n - 1].epoch) continue;
+        validos[n] = pontos[i];
+        validos[n].epoch += fuso_s;
+        n++;
+      }
+      if (n == 0) return false;
+
+      saida.versao = PREVISAO_VERSAO;
+      saida.fonte = fonte;
+      saida.inicio = agora / 3600 * 3600;
+      if (validos[0].epoch > saida.inicio + 3 * 3600UL) saida.inicio = validos[0].epoch / 3600 * 3600; // começa bem depois de agora: sem horas vazias no cache
+      saida.obtida = agora;
+      uint8_t p = 0;
+      for (uint8_t h = 0; h < PREVISAO_HORAS; h++) {
+        uint32_t instante = saida.inicio + h * 3600UL;
+        while (p + 1 < n && validos[p + 1].epoch <= instante) p++;
+        const Ponto &a = validos[p];
+        if (instante < a.epoch) {
+          saida.temperatura_x10[h] = a.temperatura_x10; // ate 3h antes do primeiro ponto
+          saida.umidade[h] = a.umidade;
+          saida.chuva_prob[h] = a.chuva_prob;
+        } else if (p + 1 < n) {
+          const Ponto &b = validos[p + 1];
+          uint32_t intervalo = b.epoch - a.epoch;
+          uint32_t passado = instante - a.epoch;
+          saida.temperatura_x10[h] = interpolar(a.temperatura_x10, b.temperatura_x10, passado, intervalo);
+          saida.umidade[h] = interpolar(a.umidade, b.umidade, passado, intervalo);
+          saida.chuva_prob[h] = interpolar(a.chuva_prob, b.chuva_prob, passado, intervalo);
+        } else if (instante - a.epoch < 3 * 3600UL) {
+          saida.temperatura_x10[h] = a.temperatura_x10; // ate 3h depois do ultimo ponto
+          saida.umidade[h] = a.umidade;
+          saida.chuva_prob[h] = a.chuva_prob;
+        } else {
+          break;
+        }
+        saida.horas = h + 1;
+      }
+      saida.verificacao = Forecast::checksum(saida);
+      return saida.horas >= PREVISAO_HORAS_MIN;
+    }
+};
+
+#endif
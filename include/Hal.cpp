@@ -0,0 +1,128 @@
+#ifndef HAL
+#define HAL
+
+#include <stdint.h>
+#include <RingLog.cpp>
+
+//------------------------------------------------------------------------------
+// Camada fina entre a logica de controle e o hardware
+//------------------------------------------------------------------------------
+// no ESP32 tudo vira chamada direta do Arduino/esp-idf (sem custo extra);
+// no pc (sem ARDUINO) o relogio é simulado e os sensores sao ganchos preenchidos pelo simulador (sim/).
+// os pinos das cadeias de 74HC595 ja tem backend proprio do pc em ShiftChains.cpp.
+//
+// log: hal_log("MODULO", "formato do printf", args...) so grava no anel do RingLog (sem String, sem heap);
+// quem escreve na serial é o hal_log_drenar(), chamado pela task de log no ESP32 e logo apos cada mensagem no pc.
+
+#ifdef ARDUINO
+  #include <Arduino.h>
+  #include <esp_timer.h>
+
+  static inline uint32_t hal_millis(){
+    return millis();
+  }
+
+  static inline uint32_t hal_micros(){
+    return micros();
+  }
+
+  //tempo desde o boot em us, 64 bits (nao volta a zero como millis()/micros())
+  static inline uint64_t hal_uptime_us(){
+    return (uint64_t)esp_timer_get_time();
+  }
+
+  #define HAL_LOG_ATIVO true
+  #define HAL_LOG_DEPOIS()
+
+  static inline void hal_log_escrever(const char *linha, size_t tamanho){
+    Serial.write((const uint8_t*)linha, tamanho);
+    Serial.write("\r\n");
+  }
+
+#else
+  #include <stdio.h>
+  #include <string.h>
+
+  typedef uint8_t byte;
+
+  //estado do hardware simulado
+  struct HalSim{
+    uint32_t relogio = 0;       // millis() simulado, so anda quando o simulador manda
+    uint64_t relogio_us = 0;    // mesmo relogio em us, sem voltar a zero (base do OffTime)
+    bool log = true;            // desliga os logs para rodar meses de simulação rapido
+    bool (*dht)(uint8_t bytes[5]) = nullptr;    // resposta do DHT11 (false = sensor nao respondeu)
+    int16_t (*pcnt)(uint8_t unidade) = nullptr; // valor atual do contador de pulsos (0 a FLUXO_LIMITE_PCNT-1)
+  };
+  static HalSim hal_sim;
+
+  static inline uint32_t hal_millis(){
+    return hal_sim.relogio;
+  }
+
+  //o relogio simulado nao anda dentro de uma tarefa: durações medidas no pc sao sempre 0
+  static inline uint32_t hal_micros(){
+    return hal_sim.relogio * 1000UL;
+  }
+
+  static inline uint64_t hal_uptime_us(){
+    return hal_sim.relogio_us;
+  }
+
+  //avança o relogio simulado
+  static inline void hal_sim_avancar(uint32_t ms){
+    hal_sim.relogio += ms;
+    hal_sim.relogio_us += (uint64_t)ms * 1000;
+  }
+
+  #define HAL_LOG_ATIVO hal_sim.log
+  #define HAL_LOG_DEPOIS() hal_log_drenar()
+
+  static inline void hal_log_escrever(const char *linha, size_t tamanho){
+    fwrite(linha, 1, tamanho, stdout);
+    fputc('\n', stdout);
+  }
+#endif
+
+//------------------------------------------------------------------------------
+// Log
+//------------------------------------------------------------------------------
+static RingLog registro_log;
+
+//id do modulo fica em uma variavel estatica de cada ponto de log (registrado uma vez so);
+//mensagens desligadas para o modulo custam uma comparação e as acima de LOG_NIVEL_MAXIMO nem sao compiladas
+#define hal_log_nivel(nivel, modulo, formato, ...) \
+  do { \
+    if ((nivel) <= LOG_NIVEL_MAXIMO && HAL_LOG_ATIVO) { \
+      static uint8_t id_modulo_log = registro_log.module(modulo); \
+      if (registro_log.enabled(id_modulo_log, nivel)) { \
+        registro_log.write(id_modulo_log, nivel, hal_millis(), formato, ##__VA_ARGS__); \
+        HAL_LOG_DEPOIS(); \
+      } \
+      if (false) log_verificar_formato(formato, ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define hal_log(modulo, formato, ...) hal_log_nivel(LOG_INFO, modulo, formato, ##__VA_ARGS__)
+#define hal_log_erro(modulo, formato, ...) hal_log_nivel(LOG_ERRO, modulo, formato, ##__VA_ARGS__)
+#define hal_log_aviso(modulo, formato, ...) hal_log_nivel(LOG_AVISO, modulo, formato, ##__VA_ARGS__)
+#define hal_log_debug(modulo, formato, ...) hal_log_nivel(LOG_DEBUG, modulo, formato, ##__VA_ARGS__)
+
+//formata e escreve tudo o que esta no anel (consumidor unico: uma task so, ou o proprio hal_log no pc)
+static inline void hal_log_drenar(){
+  static uint32_t descartados_avisados = 0;
+  char linha[LOG_MAX_LINHA];
+  RegistroLog registro;
+  while (registro_log.read(registro)) {
+    hal_log_escrever(linha, registro_log.format(registro, linha, sizeof(linha)));
+  }
+
+  uint32_t descartados = registro_log.dropped();
+  if (descartados != descartados_avisados) {
+    int tamanho = snprintf(linha, sizeof(linha), "%9lu [LOG]: AVISO %lu mensagens descartadas (anel cheio)",
+                           (unsigned long)hal_millis(), (unsigned long)(descartados - descartados_avisados));
+    hal_log_escrever(linha, tamanho);
+    descartados_avisados = descartados;
+  }
+}
+
+#endif
@@ -0,0 +1,641 @@
+#ifndef HISTORIAN
+#define HISTORIAN
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <Hal.cpp>
+
+#ifdef ARDUINO
+  #include <LittleFS.h>
+#else
+  #include <sys/stat.h>
+  #include <dirent.h>
+#endif
+
+#define HIST_MARCA 0x4842           // "HB" no inicio de cada bloco gravado
+#define HIST_VERSAO 1
+#define HIST_BLOCO_BYTES 2048       // Bitstream de um bloco (uma hora de amostras de 5s cabe com folga)
+#define HIST_BLOCOS_RAM 3           // Bloco ativo + blocos fechados esperando a gravação
+#define HIST_SEGUNDOS_BLOCO 3600    // Um bloco nunca atravessa a hora: resumo por hora sem ler as amostras
+#define HIST_DIAS_MAX 180           // Arquivos diarios mantidos (o mais antigo é apagado antes, se faltar espaço)
+#define HIST_RESERVA_BYTES 32768    // Espaço livre minimo na partição antes de apagar o dia mais antigo
+#define HIST_MAX_CAMINHO 40
+#define HIST_SEGUNDOS_DIA 86400UL
+
+//------------------------------------------------------------------------------
+// Arquivos: LittleFS no ESP32 (partição "spiffs" da tabela padrão), diretorio comum no pc
+//------------------------------------------------------------------------------
+class ArquivoHist{
+  private:
+  #ifdef ARDUINO
+    fs::File arquivo;
+  #else
+    FILE *arquivo = nullptr;
+  #endif
+
+    //dia de um nome "<dias desde 1970>.bin" (com ou sem diretorio), ou menor se nao for um arquivo de dia
+    static uint32_t dia_do_nome(const char *nome, uint32_t menor){
+      const char *barra = strrchr(nome, '/');
+      if (barra != nullptr) nome = barra + 1;
+      char *fim;
+      unsigned long dia = strtoul(nome, &fim, 10);
+      if (fim == nome || strcmp(fim, ".bin") != 0) return menor;
+      return dia < menor ? (uint32_t)dia : menor;
+    }
+
+  public:
+  #ifdef ARDUINO
+    static bool mount(const char *raiz){
+      if (!LittleFS.begin(true)) return false; // formata na primeira vez
+      return LittleFS.exists(raiz) || LittleFS.mkdir(raiz);
+    }
+
+    bool open(const char *caminho, bool anexar){
+      arquivo = LittleFS.open(caminho, anexar ? FILE_APPEND : FILE_READ);
+      return (bool)arquivo;
+    }
+
+    size_t read(void *dados, size_t tamanho){ return arquivo.read((uint8_t*)dados, tamanho); }
+    size_t write(const void *dados, size_t tamanho){ return arquivo.write((const uint8_t*)dados, tamanho); }
+    bool seek(uint32_t posicao){ return arquivo.seek(posicao); }
+    uint32_t size(){ return arquivo.size(); }
+    void close(){ arquivo.close(); }
+
+    static bool exists(const char *caminho){ return LittleFS.exists(caminho); }
+    static bool remove(const char *caminho){ return LittleFS.remove(caminho); }
+    static uint32_t free_bytes(){ return LittleFS.totalBytes() - LittleFS.usedBytes(); }
+
+    //dia do arquivo mais antigo do diretorio (padrao se nao houver nenhum): uma listagem, nao um exists() por dia
+    static uint32_t oldest_day(const char *raiz, uint32_t padrao){
+      fs::File diretorio = LittleFS.open(raiz);
+      if (!diretorio || !diretorio.isDirectory()) return padrao;
+      uint32_t menor = padrao;
+      for (fs::File arquivo = diretorio.openNextFile(); arquivo; arquivo = diretorio.openNextFile()) {
+        menor = dia_do_nome(arquivo.name(), menor);
+      }
+      return menor;
+    }
+  #else
+    static bool mount(const char *raiz){
+      mkdir(raiz, 0755);
+      struct stat info;
+      return stat(raiz, &info) == 0;
+    }
+
+    bool open(const char *caminho, bool anexar){
+      arquivo = fopen(caminho, anexar ? "ab" : "rb");
+      return arquivo != nullptr;
+    }
+
+    size_t read(void *dados, size_t tamanho){ return fread(dados, 1, tamanho, arquivo); }
+    size_t write(const void *dados, size_t tamanho){ return fwrite(dados, 1, tamanho, arquivo); }
+    bool seek(uint32_t posicao){ return fseek(arquivo, posicao, SEEK_SET) == 0; }
+
+    uint32_t size(){
+      long atual = ftell(arquivo);
+      fseek(arquivo, 0, SEEK_END);
+      long tamanho = ftell(arquivo);
+      fseek(arquivo, atual, SEEK_SET);
+      return (uint32_t)tamanho;
+    }
+
+    void close(){
+      if (arquivo != nullptr) fclose(arquivo);
+      arquivo = nullptr;
+    }
+
+    static bool exists(const char *caminho){
+      struct stat info;
+      return stat(caminho, &info) == 0;
+    }
+
+    static bool remove(const char *caminho){ return ::remove(caminho) == 0; }
+    static uint32_t free_bytes(){ return UINT32_MAX; } // no pc so o limite de dias vale
+
+    static uint32_t oldest_day(const char *raiz, uint32_t padrao){
+      DIR *diretorio = opendir(raiz);
+      if (diretorio == nullptr) return padrao;
+      uint32_t menor = padrao;
+      for (struct dirent *entrada = readdir(diretorio); entrada != nullptr; entrada = readdir(diretorio)) {
+        menor = dia_do_nome(entrada->d_name, menor);
+      }
+      closedir(diretorio);
+      return menor;
+    }
+  #endif
+};
+
+//------------------------------------------------------------------------------
+// Bitstream (bit mais significativo primeiro)
+//------------------------------------------------------------------------------
+class BitsEscrita{
+  private:
+    uint8_t *dados;
+    uint32_t capacidade_bits;
+    uint32_t posicao = 0;
+
+  public:
+    void begin(uint8_t *buffer, uint16_t bytes){
+      dados = buffer;
+      capacidade_bits = (uint32_t)bytes * 8;
+      posicao = 0;
+      memset(buffer, 0, bytes);
+    }
+
+    void write(uint32_t valor, uint8_t bits){
+      while (bits > 0) {
+        uint8_t livres = 8 - (posicao & 7);
+        uint8_t n = bits < livres ? bits : livres;
+        uint8_t pedaco = (uint8_t)((valor >> (bits - n)) & ((1u << n) - 1));
+        dados[posicao >> 3] |= pedaco << (livres - n);
+        posicao += n;
+        bits -= n;
+      }
+    }
+
+    uint32_t free_bits() const{ return capacidade_bits - posicao; }
+    uint16_t bytes() const{ return (uint16_t)((posicao + 7) / 8); }
+};
+
+class BitsLeitura{
+  private:
+    const uint8_t *dados;
+    uint32_t total_bits;
+    uint32_t posicao = 0;
+
+  public:
+    BitsLeitura(const uint8_t *buffer, uint16_t bytes) : dados(buffer), total_bits((uint32_t)bytes * 8){}
+
+    uint32_t read(uint8_t bits){
+      uint32_t valor = 0;
+      while (bits > 0) {
+        if (posicao >= total_bits) return valor << bits; // bloco truncado: completa com zeros
+        uint8_t disponiveis = 8 - (posicao & 7);
+        uint8_t n = bits < disponiveis ? bits : disponiveis;
+        uint8_t pedaco = (dados[posicao >> 3] >> (disponiveis - n)) & ((1u << n) - 1);
+        valor = (valor << n) | pedaco;
+        posicao += n;
+        bits -= n;
+      }
+      return valor;
+    }
+
+    bool bit(){ return read(1) != 0; }
+};
+
+//------------------------------------------------------------------------------
+// Amostras e resumos
+//------------------------------------------------------------------------------
+template <uint8_t CANAIS>
+struct AmostraHistorico{
+  uint32_t epoch;
+  int32_t valores[CANAIS]; // ponto fixo do chamador (decimos, centesimos, bits de estado...)
+};
+
+struct ResumoCanal{
+  int32_t minimo;
+  int32_t maximo;
+  int64_t soma;
+
+  void reset(){
+    minimo = INT32_MAX;
+    maximo = INT32_MIN;
+    soma = 0;
+  }
+
+  void add(int32_t valor){
+    if (valor < minimo) minimo = valor;
+    if (valor > maximo) maximo = valor;
+    soma += valor;
+  }
+
+  void merge(const ResumoCanal &outro){
+    if (outro.minimo < minimo) minimo = outro.minimo;
+    if (outro.maximo > maximo) maximo = outro.maximo;
+    soma += outro.soma;
+  }
+};
+
+//resumo de um intervalo: soma de resumos de blocos (nunca precisa decodificar as amostras)
+template <uint8_t CANAIS>
+struct ResumoHistorico{
+  uint32_t inicio;
+  uint32_t fim;
+  uint32_t amostras;
+  ResumoCanal canais[CANAIS];
+
+  void reset(){
+    inicio = UINT32_MAX;
+    fim = 0;
+    amostras = 0;
+    for (uint8_t c = 0; c < CANAIS; c++) canais[c].reset();
+  }
+
+  //media de um canal (0 sem amostras)
+  int32_t mean(uint8_t canal) const{
+    return amostras ? (int32_t)(canais[canal].soma / (int64_t)amostras) : 0;
+  }
+};
+
+//cabeçalho gravado antes do bitstream de cada bloco: intervalo, quantidade e resumo por canal
+template <uint8_t CANAIS>
+struct CabecalhoBloco{
+  uint16_t marca;
+  uint8_t versao;
+  uint8_t canais;
+  uint16_t amostras;
+  uint16_t bytes;         // tamanho do bitstream que vem logo depois
+  uint32_t inicio;        // epoch da primeira amostra
+  uint32_t fim;           // epoch da ultima amostra
+  ResumoCanal resumo[CANAIS];
+};
+
+//------------------------------------------------------------------------------
+// Compressão estilo Gorilla
+//------------------------------------------------------------------------------
+//  - tempo: delta-of-delta do epoch; amostras em cadencia fixa custam 1 bit
+//      0 -> '0' | [-63,64] -> '10'+7 bits | [-255,256] -> '110'+9 | [-2047,2048] -> '1110'+12 | resto -> '1111'+32
+//  - valores: XOR com o valor anterior do mesmo canal; igual custa 1 bit
+//      '0' igual | '10' bits significativos dentro da janela anterior | '11' + 5 bits de zeros a esquerda
+//      + 5 bits (tamanho - 1) + bits significativos
+//  - a primeira amostra do bloco vai crua (32 bits por campo): cada bloco decodifica sozinho
+template <uint8_t CANAIS>
+class CodecGorilla{
+  private:
+    uint32_t epoch_anterior;
+    int32_t delta_anterior;
+    uint32_t valores[CANAIS];
+    uint8_t zeros_esquerda[CANAIS];
+    uint8_t zeros_direita[CANAIS];
+    bool janela[CANAIS];
+    bool primeira;
+
+    static uint8_t clz32(uint32_t x){ return (uint8_t)__builtin_clz(x); }
+    static uint8_t ctz32(uint32_t x){ return (uint8_t)__builtin_ctz(x); }
+
+  public:
+    //pior caso de uma amostra em bits (para fechar o bloco antes de estourar)
+    static const uint32_t BITS_PIOR = 36 + CANAIS * 44;
+
+    void reset(){
+      primeira = true;
+      epoch_anterior = 0;
+      delta_anterior = 0;
+      for (uint8_t c = 0; c < CANAIS; c++) {
+        valores[c] = 0;
+        janela[c] = false;
+      }
+    }
+
+    void encode(BitsEscrita &bits, const AmostraHistorico<CANAIS> &amostra){
+      if (primeira) {
+        bits.write(amostra.epoch, 32);
+        for (uint8_t c = 0; c < CANAIS; c++) {
+          valores[c] = (uint32_t)amostra.valores[c];
+          bits.write(valores[c], 32);
+        }
+        epoch_anterior = amostra.epoch;
+        primeira = false;
+        return;
+      }
+
+      int32_t delta = (int32_t)(amostra.epoch - epoch_anterior);
+      int32_t dod = delta - delta_anterior;
+      if (dod == 0) {
+        bits.write(0, 1);
+      } else if (dod >= -63 && dod <= 64) {
+        bits.write(0b10, 2);
+        bits.write((uint32_t)(dod + 63), 7);
+      } else if (dod >= -255 && dod <= 256) {
+        bits.write(0b110, 3);
+        bits.write((uint32_t)(dod + 255), 9);
+      } else if (dod >= -2047 && dod <= 2048) {
+        bits.write(0b1110, 4);
+        bits.write((uint32_t)(dod + 2047), 12);
+      } else {
+        bits.write(0b1111, 4);
+        bits.write((uint32_t)dod, 32);
+      }
+      delta_anterior = delta;
+      epoch_anterior = amostra.epoch;
+
+      for (uint8_t c = 0; c < CANAIS; c++) {
+        uint32_t valor = (uint32_t)amostra.valores[c];
+        uint32_t x = valor ^ valores[c];
+        valores[c] = valor;
+        if (x == 0) {
+          bits.write(0, 1);
+          continue;
+        }
+
+        uint8_t esquerda = clz32(x);
+        uint8_t direita = ctz32(x);
+        if (esquerda > 31) esquerda = 31; // 5 bits
+        if (janela[c] && esquerda >= zeros_esquerda[c] && direita >= zeros_direita[c]) {
+          uint8_t significativos = 32 - zeros_esquerda[c] - zeros_direita[c];
+          bits.write(0b10, 2);
+          bits.write(x >> zeros_direita[c], significativos);
+        } else {
+          uint8_t significativos = 32 - esquerda - direita;
+          bits.write(0b11, 2);
+          bits.write(esquerda, 5);
+          bits.write(significativos - 1, 5);
+          bits.write(x >> direita, significativos);
+          zeros_esquerda[c] = esquerda;
+          zeros_direita[c] = direita;
+          janela[c] = true;
+        }
+      }
+    }
+
+    void decode(BitsLeitura &bits, AmostraHistorico<CANAIS> &amostra){
+      if (primeira) {
+        amostra.epoch = bits.read(32);
+        for (uint8_t c = 0; c < CANAIS; c++) {
+          valores[c] = bits.read(32);
+          amostra.valores[c] = (int32_t)valores[c];
+        }
+        epoch_anterior = amostra.epoch;
+        primeira = false;
+        return;
+      }
+
+      int32_t dod;
+      if (!bits.bit()) dod = 0;
+      else if (!bits.bit()) dod = (int32_t)bits.read(7) - 63;
+      else if (!bits.bit()) dod = (int32_t)bits.read(9) - 255;
+      else if (!bits.bit()) dod = (int32_t)bits.read(12) - 2047;
+      else dod = (int32_t)bits.read(32);
+      delta_anterior += dod;
+      epoch_anterior += delta_anterior;
+      amostra.epoch = epoch_anterior;
+
+      for (uint8_t c = 0; c < CANAIS; c++) {
+        if (bits.bit()) {
+          uint32_t x;
+          if (!bits.bit()) {
+            uint8_t significativos = 32 - zeros_esquerda[c] - zeros_direita[c];
+            x = bits.read(significativos) << zeros_direita[c];
+          } else {
+            uint8_t esquerda = bits.read(5);
+            uint8_t significativos = bits.read(5) + 1;
+            uint8_t direita = 32 - esquerda - significativos;
+            x = bits.read(significativos) << direita;
+            zeros_esquerda[c] = esquerda;
+            zeros_direita[c] = direita;
+          }
+          valores[c] ^= x;
+        }
+        amostra.valores[c] = (int32_t)valores[c];
+      }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Historiador
+//------------------------------------------------------------------------------
+//serie temporal so de acrescimo na flash, um arquivo por dia (raiz/<dias desde 1970>.bin) com blocos de ate uma hora.
+//  - append() (task de controle) só comprime na ram; quando o bloco fecha (virada da hora ou bitstream cheio)
+//    ele vai para a fila de blocos fechados, sem tocar na flash
+//  - flush() (task de baixa prioridade) grava os blocos fechados de uma vez: uma escrita por hora, pouco desgaste
+//  - cada bloco tem min/max/soma por canal no cabeçalho: resumos (media das ultimas 24h, por hora) so leem
+//    cabeçalhos e pulam o bitstream; samples() decodifica quando as amostras cruas sao necessarias
+//  - retenção: apaga o arquivo do dia mais antigo quando passa de HIST_DIAS_MAX ou falta espaço
+//a hora corrente (bloco ativo) so aparece nas consultas depois de gravada.
+//um produtor (append/close) e um consumidor (flush); consultas podem rodar em outra task (so leem arquivos).
+template <uint8_t CANAIS>
+class Historian{
+  private:
+    struct Bloco{
+      CabecalhoBloco<CANAIS> cabecalho;
+      uint8_t dados[HIST_BLOCO_BYTES];
+    };
+
+    Bloco blocos[HIST_BLOCOS_RAM];
+    uint32_t fechados = 0;  // blocos fechados desde o boot (produtor); o ativo é blocos[fechados % N]
+    uint32_t gravados = 0;  // blocos ja gravados (consumidor)
+    CodecGorilla<CANAIS> codec;
+    BitsEscrita bits;
+    bool ativo_vazio = true;
+
+    char raiz[HIST_MAX_CAMINHO - 16];
+    bool iniciado = false;
+    bool antigo_conhecido = false;  // dia_mais_antigo ja veio da listagem (na primeira gravação, com o relogio acertado)
+    uint32_t dia_mais_antigo = 0;
+
+    uint32_t perdidos = 0;        // blocos descartados (fila cheia ou sem sistema de arquivos)
+    uint32_t falhas_gravacao = 0;
+    uint32_t bytes_gravados = 0;
+    uint32_t amostras_gravadas = 0;
+
+    Bloco &ativo(){
+      return blocos[fechados % HIST_BLOCOS_RAM];
+    }
+
+    void iniciar_bloco(const AmostraHistorico<CANAIS> &amostra){
+      Bloco &bloco = ativo();
+      bloco.cabecalho.marca = HIST_MARCA;
+      bloco.cabecalho.versao = HIST_VERSAO;
+      bloco.cabecalho.canais = CANAIS;
+      bloco.cabecalho.amostras = 0;
+      bloco.cabecalho.bytes = 0;
+      bloco.cabecalho.inicio = amostra.epoch;
+      bloco.cabecalho.fim = amostra.epoch;
+      for (uint8_t c = 0; c < CANAIS; c++) bloco.cabecalho.resumo[c].reset();
+      bits.begin(bloco.dados, HIST_BLOCO_BYTES);
+      codec.reset();
+      ativo_vazio = false;
+    }
+
+    void caminho_dia(char *caminho, uint32_t dia){
+      snprintf(caminho, HIST_MAX_CAMINHO, "%s/%lu.bin", raiz, (unsigned long)dia);
+    }
+
+    //chama o callback com o cabeçalho de cada bloco gravado que cruza [inicio, fim); retorna blocos visitados
+    //ler_dados: tambem carrega o bitstream em dados (senao so pula)
+    template <typename Callback>
+    uint32_t percorrer(uint32_t inicio, uint32_t fim, bool ler_dados, Callback callback){
+      if (!iniciado || fim <= inicio) return 0;
+      static uint8_t dados[HIST_BLOCO_BYTES]; // consultas nao rodam em paralelo (uma task de interface/rede)
+      uint32_t visitados = 0;
+      char caminho[HIST_MAX_CAMINHO];
+      for (uint32_t dia = inicio / HIST_SEGUNDOS_DIA; dia <= (fim - 1) / HIST_SEGUNDOS_DIA; dia++) {
+        caminho_dia(caminho, dia);
+        ArquivoHist arquivo;
+        if (!arquivo.open(caminho, false)) continue;
+        uint32_t tamanho = arquivo.size();
+        uint32_t posicao = 0;
+        CabecalhoBloco<CANAIS> cabecalho;
+        while (posicao + sizeof(cabecalho) <= tamanho) {
+          if (!arquivo.seek(posicao) || arquivo.read(&cabecalho, sizeof(cabecalho)) != sizeof(cabecalho)) break;
+          if (cabecalho.marca != HIST_MARCA || cabecalho.canais != CANAIS) break; // fim util do arquivo
+          uint32_t proximo = posicao + sizeof(cabecalho) + cabecalho.bytes;
+          if (proximo > tamanho) break; // gravação interrompida
+          if (cabecalho.fim >= inicio && cabecalho.inicio < fim) {
+            if (ler_dados && arquivo.read(dados, cabecalho.bytes) != cabecalho.bytes) break;
+            callback(cabecalho, dados);
+            visitados++;
+          }
+          posicao = proximo;
+        }
+        arquivo.close();
+      }
+      return visitados;
+    }
+
+    //hoje é o dia do bloco recem gravado: o dia mais antigo sai da listagem do diretorio (na primeira vez e depois
+    //de cada remoção), entao buracos de meses entre arquivos ou saltos do relogio nao viram um laço por dia
+    void apagar_antigos(uint32_t hoje){
+      if (!antigo_conhecido) {
+        dia_mais_antigo = ArquivoHist::oldest_day(raiz, hoje);
+        antigo_conhecido = true;
+      }
+      char caminho[HIST_MAX_CAMINHO];
+      while (dia_mais_antigo < hoje &&
+             (hoje - dia_mais_antigo >= HIST_DIAS_MAX || ArquivoHist::free_bytes() < HIST_RESERVA_BYTES)) {
+        caminho_dia(caminho, dia_mais_antigo);
+        if (!ArquivoHist::remove(caminho)) break; // sem como liberar espaço: tenta de novo na proxima gravação
+        hal_log("HISTORICO", "Dia %lu apagado (retencao)", (unsigned long)dia_mais_antigo);
+        dia_mais_antigo = ArquivoHist::oldest_day(raiz, hoje);
+      }
+    }
+
+  public:
+    //monta o sistema de arquivos; o arquivo mais antigo (retenção) so é procurado na primeira gravação, quando o
+    //dia ja vem de um relogio acertado (no setup o NTP pode nao ter respondido)
+    bool begin(const char *diretorio){
+      strncpy(raiz, diretorio, sizeof(raiz) - 1);
+      raiz[sizeof(raiz) - 1] = '\0';
+      if (!ArquivoHist::mount(raiz)) return false;
+      antigo_conhecido = false;
+      iniciado = true;
+      return true;
+    }
+
+    //acrescenta uma amostra (epoch crescente); fecha o bloco na virada da hora ou quando o bitstream enche
+    void append(const AmostraHistorico<CANAIS> &amostra){
+      if (!ativo_vazio) {
+        const CabecalhoBloco<CANAIS> &atual = ativo().cabecalho;
+        bool virou_hora = (amostra.epoch / HIST_SEGUNDOS_BLOCO) != (atual.inicio / HIST_SEGUNDOS_BLOCO);
+        if (virou_hora || amostra.epoch < atual.fim || bits.free_bits() < CodecGorilla<CANAIS>::BITS_PIOR || atual.amostras == UINT16_MAX) {
+          close_block();
+        }
+      }
+      if (ativo_vazio) iniciar_bloco(amostra);
+
+      CabecalhoBloco<CANAIS> &cabecalho = ativo().cabecalho;
+      codec.encode(bits, amostra);
+      cabecalho.amostras++;
+      cabecalho.fim = amostra.epoch;
+      cabecalho.bytes = bits.bytes();
+      for (uint8_t c = 0; c < CANAIS; c++) cabecalho.resumo[c].add(amostra.valores[c]);
+    }
+
+    //fecha o bloco ativo (mesmo incompleto) e o coloca na fila de gravação
+    void close_block(){
+      if (ativo_vazio) return;
+      ativo_vazio = true;
+      if (fechados + 1 - __atomic_load_n(&gravados, __ATOMIC_ACQUIRE) >= HIST_BLOCOS_RAM) {
+        perdidos++; // o proximo ativo cairia em um bloco ainda nao gravado: descarta este
+        return;
+      }
+      __atomic_store_n(&fechados, fechados + 1, __ATOMIC_RELEASE);
+    }
+
+    //grava os blocos fechados (consumidor), retorna quantos foram gravados
+    uint8_t flush(){
+      uint8_t quantidade = 0;
+      while (gravados != __atomic_load_n(&fechados, __ATOMIC_ACQUIRE)) {
+        const Bloco &bloco = blocos[gravados % HIST_BLOCOS_RAM];
+        if (!iniciado) {
+          perdidos++;
+        } else {
+          char caminho[HIST_MAX_CAMINHO];
+          uint32_t dia = bloco.cabecalho.inicio / HIST_SEGUNDOS_DIA;
+          caminho_dia(caminho, dia);
+          ArquivoHist arquivo;
+          bool ok = arquivo.open(caminho, true);
+          if (ok) {
+            ok = arquivo.write(&bloco.cabecalho, sizeof(bloco.cabecalho)) == sizeof(bloco.cabecalho) &&
+                 arquivo.write(bloco.dados, bloco.cabecalho.bytes) == bloco.cabecalho.bytes;
+            arquivo.close();
+          }
+          if (ok) {
+            bytes_gravados += sizeof(bloco.cabecalho) + bloco.cabecalho.bytes;
+            amostras_gravadas += bloco.cabecalho.amostras;
+            quantidade++;
+            apagar_antigos(dia);
+          } else {
+            falhas_gravacao++;
+            hal_log_erro("HISTORICO", "Falha ao gravar bloco em %s", raiz);
+          }
+        }
+        __atomic_store_n(&gravados, gravados + 1, __ATOMIC_RELEASE);
+      }
+      return quantidade;
+    }
+
+    //resumo de [inicio, fim) somando os cabeçalhos dos blocos (resolução de um bloco: uma hora)
+    uint32_t summary(uint32_t inicio, uint32_t fim, ResumoHistorico<CANAIS> &resumo){
+      resumo.reset();
+      return percorrer(inicio, fim, false, [&](const CabecalhoBloco<CANAIS> &cabecalho, const uint8_t *){
+        if (cabecalho.inicio < resumo.inicio) resumo.inicio = cabecalho.inicio;
+        if (cabecalho.fim > resumo.fim) resumo.fim = cabecalho.fim;
+        resumo.amostras += cabecalho.amostras;
+        for (uint8_t c = 0; c < CANAIS; c++) resumo.canais[c].merge(cabecalho.resumo[c]);
+      });
+    }
+
+    //um resumo por hora de [inicio, fim), em ordem; retorna quantas horas tinham dados
+    template <typename Callback>
+    uint32_t hours(uint32_t inicio, uint32_t fim, Callback callback){
+      ResumoHistorico<CANAIS> hora;
+      hora.reset();
+      uint32_t horas = 0;
+      percorrer(inicio, fim, false, [&](const CabecalhoBloco<CANAIS> &cabecalho, const uint8_t *){
+        if (hora.amostras > 0 && cabecalho.inicio / HIST_SEGUNDOS_BLOCO != hora.inicio / HIST_SEGUNDOS_BLOCO) {
+          callback(hora);
+          horas++;
+          hora.reset();
+        }
+        if (cabecalho.inicio < hora.inicio) hora.inicio = cabecalho.inicio;
+        if (cabecalho.fim > hora.fim) hora.fim = cabecalho.fim;
+        hora.amostras += cabecalho.amostras;
+        for (uint8_t c = 0; c < CANAIS; c++) hora.canais[c].merge(cabecalho.resumo[c]);
+      });
+      if (hora.amostras > 0) {
+        callback(hora);
+        horas++;
+      }
+      return horas;
+    }
+
+    //decodifica as amostras gravadas em [inicio, fim), retorna quantas foram entregues
+    template <typename Callback>
+    uint32_t samples(uint32_t inicio, uint32_t fim, Callback callback){
+      uint32_t entregues = 0;
+      percorrer(inicio, fim, true, [&](const CabecalhoBloco<CANAIS> &cabecalho, const uint8_t *dados){
+        BitsLeitura leitura(dados, cabecalho.bytes);
+        CodecGorilla<CANAIS> decodificador;
+        decodificador.reset();
+        AmostraHistorico<CANAIS> amostra;
+        for (uint16_t i = 0; i < cabecalho.amostras; i++) {
+          decodificador.decode(leitura, amostra);
+          if (amostra.epoch >= inicio && amostra.epoch < fim) {
+            callback(amostra);
+            entregues++;
+          }
+        }
+      });
+      return entregues;
+    }
+
+    uint32_t lost_blocks() const{ return perdidos; }
+    uint32_t write_failures() const{ return falhas_gravacao; }
+    uint32_t bytes_written() const{ return bytes_gravados; }
+    uint32_t samples_written() const{ return amostras_gravadas; }
+};
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef JSON_STREAM
+#define JSON_STREAM
+
+#include <stdint.h>
+#include <string.h>
+
+#define JSON_MAX_PROFUNDIDADE 12  // Objetos/vetores aninhados acompanhados
+#define JSON_MAX_CAMINHO 64       // Caminho atual ("main.humidity", "weather[0].id"); mais longo nunca casa com o filtro
+#define JSON_MAX_VALOR 32         // Valor escalar guardado (strings maiores sao truncadas)
+
+//valor escalar de um caminho do filtro: indice em caminhos[], texto sem aspas (truncado em JSON_MAX_VALOR - 1)
+//texto = true para strings, false para numeros/true/false/null
+typedef void (*JsonCampo)(void *contexto, uint8_t indice, const char *valor, bool texto);
+
+//parser de json em fluxo (estilo SAX): recebe o documento aos pedaços (direto do socket) e so entrega os valores
+//escalares cujo caminho esta no filtro. Memoria fixa (~150 bytes), sem alocação e sem montar arvore.
+//caminhos: chaves separadas por '.' e indices de vetor entre colchetes, ex: "main.temp", "rain.1h", "weather[0].main";
+//"[*]" casa com qualquer indice ("list[*].main.temp") e index() diz qual elemento esta sendo entregue.
+class JsonStream{
+  private:
+    enum Estado : uint8_t{
+      ESPERA_VALOR,
+      ESPERA_CHAVE_OU_FIM,  // logo depois de '{'
+      ESPERA_CHAVE,         // depois de ',' em objeto
+      CHAVE,
+      ESPERA_DOIS_PONTOS,
+      TEXTO,
+      LITERAL,              // numero, true, false, null
+      DEPOIS_VALOR,
+      FIM,
+      ERRO
+    };
+
+    struct Nivel{
+      bool vetor;
+      bool base_ok;         // caminho do container coube no buffer
+      uint8_t base;         // tamanho do caminho do container
+      uint16_t indice;      // elemento atual (vetores)
+    };
+
+    const char *const *caminhos;
+    uint8_t quantidade_caminhos;
+    JsonCampo callback;
+    void *contexto;
+
+    Estado estado = ESPERA_VALOR;
+    bool escape = false;
+    uint8_t profundidade = 0;
+    Nivel niveis[JSON_MAX_PROFUNDIDADE];
+    char caminho[JSON_MAX_CAMINHO];
+    uint8_t tamanho_caminho = 0;
+    bool caminho_ok = true;
+    char valor[JSON_MAX_VALOR];
+    uint8_t tamanho_valor = 0;
+    uint32_t encontrados = 0;   // bit i: caminhos[i] ja entregue
+
+    void acrescentar(const char *texto, uint8_t n){
+      if (!caminho_ok || tamanho_caminho + n >= JSON_MAX_CAMINHO) {
+        caminho_ok = false;
+        return;
+      }
+      memcpy(caminho + tamanho_caminho, texto, n);
+      tamanho_caminho += n;
+      caminho[tamanho_caminho] = '\0';
+    }
+
+    //volta o caminho para o do container atual
+    void voltar_base(){
+      const Nivel &nivel = niveis[profundidade - 1];
+      tamanho_caminho = nivel.base;
+      caminho[tamanho_caminho] = '\0';
+      caminho_ok = nivel.base_ok;
+    }
+
+    void caminho_indice(){
+      char texto[8];
+      uint8_t n = 0;
+      uint16_t indice = niveis[profundidade - 1].indice;
+      char digitos[5];
+      uint8_t d = 0;
+      do { digitos[d++] = '0' + indice % 10; indice /= 10; } while (indice > 0);
+      texto[n++] = '[';
+      while (d > 0) texto[n++] = digitos[--d];
+      texto[n++] = ']';
+      voltar_base();
+      acrescentar(texto, n);
+    }
+
+    bool abrir(bool vetor){
+      if (profundidade >= JSON_MAX_PROFUNDIDADE) return false;
+      Nivel &nivel = niveis[profundidade++];
+      nivel.vetor = vetor;
+      nivel.base = tamanho_caminho;
+      nivel.base_ok = caminho_ok;
+      nivel.indice = 0;
+      if (vetor) {
+        caminho_indice();
+        estado = ESPERA_VALOR;
+      } else {
+        estado = ESPERA_CHAVE_OU_FIM;
+      }
+      return true;
+    }
+
+    bool fechar(bool vetor){
+      if (profundidade == 0 || niveis[profundidade - 1].vetor != vetor) return false;
+      voltar_base();
+      profundidade--;
+      estado = profundidade == 0 ? FIM : DEPOIS_VALOR;
+      return true;
+    }
+
+    //compara o caminho atual com um do filtro, "[*]" no filtro aceita qualquer indice
+    static bool casa(const char *atual, const char *filtro){
+      while (*filtro) {
+        if (filtro[0] == '[' && filtro[1] == '*' && filtro[2] == ']') {
+          if (*atual != '[') return false;
+          while (*atual && *atual != ']') atual++;
+          if (*atual != ']') return false;
+          atual++;
+          filtro += 3;
+          continue;
+        }
+        if (*atual++ != *filtro++) return false;
+      }
+      return *atual == '\0';
+    }
+
+    void entregar(bool texto){
+      valor[tamanho_valor] = '\0';
+      estado = profundidade == 0 ? FIM : DEPOIS_VALOR;
+      if (!caminho_ok) return;
+      for (uint8_t i = 0; i < quantidade_caminhos; i++) {
+        if (casa(caminho, caminhos[i])) {
+          encontrados |= (uint32_t)1 << i;
+          callback(contexto, i, valor, texto);
+          return;
+        }
+      }
+    }
+
+    void guardar(char c){
+      if (tamanho_valor < JSON_MAX_VALOR - 1) valor[tamanho_valor++] = c;
+    }
+
+    static bool espaco(char c){
+      return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+
+    static bool parte_literal(char c){
+      return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' || c == '-' || c == '+' || c == 'E';
+    }
+
+  public:
+    //caminhos: ate 32 caminhos (o vetor precisa viver enquanto o parser for usado)
+    JsonStream(const char *const *caminhos, uint8_t quantidade, JsonCampo callback, void *contexto)
+      : caminhos(caminhos), quantidade_caminhos(quantidade > 32 ? 32 : quantidade), callback(callback), contexto(contexto){
+      reset();
+    }
+
+    void reset(){
+      estado = ESPERA_VALOR;
+      escape = false;
+      profundidade = 0;
+      tamanho_caminho = 0;
+      caminho[0] = '\0';
+      caminho_ok = true;
+      tamanho_valor = 0;
+      encontrados = 0;
+    }
+
+    //processa um caractere do documento (false depois de um erro de sintaxe)
+    bool feed(char c){
+      switch (estado) {
+        case ESPERA_VALOR:
+          if (espaco(c)) break;
+          if (c == '{') { if (!abrir(false)) estado = ERRO; break; }
+          if (c == '[') { if (!abrir(true)) estado = ERRO; break; }
+          if (c == ']' && profundidade > 0 && niveis[profundidade - 1].vetor && niveis[profundidade - 1].indice == 0) {
+            fechar(true); // vetor vazio
+            break;
+          }
+          tamanho_valor = 0;
+          if (c == '"') { estado = TEXTO; escape = false; break; }
+          if (parte_literal(c)) { guardar(c); estado = LITERAL; break; }
+          estado = ERRO;
+          break;
+
+        case ESPERA_CHAVE_OU_FIM:
+        case ESPERA_CHAVE:
+          if (espaco(c)) break;
+          if (c == '"') {
+            voltar_base();
+            if (tamanho_caminho > 0) acrescentar(".", 1);
+            estado = CHAVE;
+            escape = false;
+            break;
+          }
+          if (c == '}' && estado == ESPERA_CHAVE_OU_FIM) { fechar(false); break; } // objeto vazio
+          estado = ERRO;
+          break;
+
+        case CHAVE:
+          if (escape) { escape = false; acrescentar(&c, 1); break; }
+          if (c == '\\') { escape = true; break; }
+          if (c == '"') { estado = ESPERA_DOIS_PONTOS; break; }
+          acrescentar(&c, 1);
+          break;
+
+        case ESPERA_DOIS_PONTOS:
+          if (espaco(c)) break;
+          estado = c == ':' ? ESPERA_VALOR : ERRO;
+          break;
+
+        case TEXTO:
+          if (escape) { escape = false; guardar(c == 'n' ? '\n' : c == 't' ? '\t' : c); break; } // \uXXXX fica como uXXXX
+          if (c == '\\') { escape = true; break; }
+          if (c == '"') { entregar(true); break; }
+          guardar(c);
+          break;
+
+        case LITERAL:
+          if (parte_literal(c)) { guardar(c); break; }
+          entregar(false);
+          return feed(c); // o delimitador pertence ao proximo estado
+
+        case DEPOIS_VALOR:
+          if (espaco(c)) break;
+          if (c == ',') {
+            Nivel &nivel = niveis[profundidade - 1];
+            if (nivel.vetor) {
+              nivel.indice++;
+              caminho_indice();
+              estado = ESPERA_VALOR;
+            } else {
+              estado = ESPERA_CHAVE;
+            }
+            break;
+          }
+          if (c == '}' && fechar(false)) break;
+          if (c == ']' && fechar(true)) break;
+          estado = ERRO;
+          break;
+
+        case FIM:
+          if (!espaco(c)) estado = ERRO;
+          break;
+
+        case ERRO:
+          break;
+      }
+      return estado != ERRO;
+    }
+
+    bool feed(const char *dados, size_t tamanho){
+      for (size_t i = 0; i < tamanho; i++) {
+        if (!feed(dados[i])) return false;
+      }
+      return true;
+    }
+
+    //documento fechado (um numero solto no topo so termina com um delimitador depois dele)
+    bool done() const{
+      return estado == FIM;
+    }
+
+    bool error() const{
+      return estado == ERRO;
+    }
+
+    //indice do elemento no vetor mais interno que contem o valor sendo entregue (0 fora de vetores)
+    uint16_t index() const{
+      for (uint8_t n = profundidade; n > 0; n--) {
+        if (niveis[n - 1].vetor) return niveis[n - 1].indice;
+      }
+      return 0;
+    }
+
+    //todos os caminhos do filtro ja foram entregues (o resto do documento pode ser descartado)
+    //com "[*]" so diz que o primeiro elemento chegou: leia ate done()
+    bool complete() const{
+      uint32_t todos = quantidade_caminhos == 32 ? UINT32_MAX : ((uint32_t)1 << quantidade_caminhos) - 1;
+      return encontrados == todos;
+    }
+
+    //converte um numero em texto para ponto fixo com casas decimais (23.456 com 1 casa = 234), sem float
+    static int32_t fixed(const char *texto, uint8_t casas){
+      bool negativo = *texto == '-';
+      if (negativo || *texto == '+') texto++;
+      int32_t resultado = 0;
+      while (*texto >= '0' && *texto <= '9') resultado = resultado * 10 + (*texto++ - '0');
+      int8_t restantes = casas;
+      if (*texto == '.') {
+        texto++;
+        while (*texto >= '0' && *texto <= '9' && restantes > 0) {
+          resultado = resultado * 10 + (*texto++ - '0');
+          restantes--;
+        }
+        if (*texto >= '5' && *texto <= '9') resultado++; // arredonda pela primeira casa descartada
+      }
+      while (restantes-- > 0) resultado *= 10;
+      return negativo ? -resultado : resultado;
+    }
+};
+
+#endif
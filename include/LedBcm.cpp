@@ -0,0 +1,158 @@
+#ifndef LED_BCM
+#define LED_BCM
+
+#include <stdint.h>
+#include <string.h>
+#include <ShiftChains.cpp>
+
+#define BCM_BITS 8            // Resolucao do brilho (8 bits, 0-255)
+#define BCM_CADEIAS 3         // Cadeias de leds atualizadas pela interrupção
+#define BCM_TEMPO_BASE_US 32  // Duracao do bit menos significativo, periodo = 255 * base (~8ms, ~120Hz)
+#define BCM_TIMER 0           // Timer de hardware usado
+
+//Binary Code Modulation para os leds de cultivo
+//o brilho de cada canal (8 bits) é dividido em 8 planos de bits, o plano b fica aceso por 2^b * base.
+//a interrupção do timer so envia os 3 bytes ja prontos do plano atual e reprograma o alarme,
+//entao sao 8 interrupções por periodo, independente da quantidade de leds.
+//os planos sao calculados fora da interrupção (LedFrame::present) e trocados no inicio do periodo (buffer duplo).
+//o timer deve ser iniciado no mesmo core de quem chama load(), assim a troca do buffer nunca ocorre no meio de uma escrita.
+class LedBcm{
+  private:
+    ShiftChains *cadeias;
+    uint8_t indice[BCM_CADEIAS]; // indice de cada cadeia de leds no ShiftChains
+    uint8_t mascara = 0;
+
+    // planos[buffer][bit][cadeia], indexado pelo indice do ShiftChains (formato do shift_isr)
+    uint8_t planos[2][BCM_BITS][SHIFT_MAX_CADEIAS];
+    volatile uint8_t ativo = 0;
+    volatile bool troca_pendente = false;
+    volatile uint8_t plano_atual = 0;
+    bool rodando = false;
+
+    volatile uint32_t ciclos_max = 0;
+    volatile uint32_t ciclos_soma = 0;
+    volatile uint32_t interrupcoes = 0;
+
+    #ifdef ARDUINO
+      hw_timer_t *timer = nullptr;
+    #endif
+
+    static LedBcm *instancia;
+
+    static IRAM_ATTR void trampolim(){
+      if (instancia != nullptr) instancia->isr();
+    }
+
+  public:
+    LedBcm(ShiftChains *cadeias_595, uint8_t cadeia1, uint8_t cadeia2, uint8_t cadeia3){
+      cadeias = cadeias_595;
+      indice[0] = cadeia1;
+      indice[1] = cadeia2;
+      indice[2] = cadeia3;
+      for (uint8_t i = 0; i < BCM_CADEIAS; i++) mascara |= (1 << indice[i]);
+      memset(planos, 0, sizeof(planos));
+    }
+
+    //carrega um novo conjunto de planos: bytes[bit][i] é o byte da cadeia i (na ordem do construtor) no plano 'bit'
+    //é aplicado no inicio do proximo periodo
+    void load(const uint8_t bytes[BCM_BITS][BCM_CADEIAS]){
+      troca_pendente = false;
+      uint8_t livre = ativo ^ 1;
+      for (uint8_t b = 0; b < BCM_BITS; b++) {
+        for (uint8_t i = 0; i < BCM_CADEIAS; i++) {
+          planos[livre][b][indice[i]] = bytes[b][i];
+        }
+      }
+      troca_pendente = true;
+      if (!rodando) start();
+    }
+
+    //reserva as cadeias de leds e inicia o timer
+    void start(){
+      if (rodando) return;
+      instancia = this;
+      cadeias->reserve(mascara);
+      plano_atual = 0;
+      rodando = true;
+
+      #ifdef ARDUINO
+        if (timer == nullptr) {
+          timer = timerBegin(BCM_TIMER, 80, true); // 80MHz / 80 = 1 tick por us
+          timerAttachInterrupt(timer, &trampolim, true);
+        }
+        timerWrite(timer, 0);
+        timerAlarmWrite(timer, BCM_TEMPO_BASE_US, true);
+        timerAlarmEnable(timer);
+      #endif
+    }
+
+    //para o timer e devolve as cadeias ao commit() (leds somente ligados/desligados)
+    void stop(){
+      if (!rodando) return;
+      #ifdef ARDUINO
+        timerAlarmDisable(timer);
+      #endif
+      rodando = false;
+      cadeias->release(mascara);
+    }
+
+    bool running(){
+      return rodando;
+    }
+
+    //interrupção do timer: envia o plano atual e programa a duracao dele
+    IRAM_ATTR void isr(){
+      #ifdef ARDUINO
+        uint32_t inicio = ESP.getCycleCount();
+      #endif
+
+      if (plano_atual == 0 && troca_pendente) {
+        ativo ^= 1;
+        troca_pendente = false;
+      }
+
+      cadeias->shift_isr(mascara, planos[ativo][plano_atual]);
+
+      #ifdef ARDUINO
+        timerAlarmWrite(timer, (uint64_t)BCM_TEMPO_BASE_US << plano_atual, true);
+      #endif
+      plano_atual = (plano_atual + 1) % BCM_BITS;
+
+      #ifdef ARDUINO
+        uint32_t ciclos = ESP.getCycleCount() - inicio;
+        if (ciclos > ciclos_max) ciclos_max = ciclos;
+        ciclos_soma += ciclos;
+      #endif
+      interrupcoes++;
+    }
+
+    //ciclos de cpu gastos pela interrupção (max e media desde o ultimo reset_stats)
+    uint32_t cycles_max(){
+      return ciclos_max;
+    }
+
+    uint32_t cycles_avg(){
+      return interrupcoes ? (ciclos_soma / interrupcoes) : 0;
+    }
+
+    uint32_t interrupts(){
+      return interrupcoes;
+    }
+
+    //carga da interrupção na cpu em partes por mil (media de ciclos * interrupções por segundo / clock)
+    uint32_t load_per_mille(uint32_t cpu_mhz){
+      if (cpu_mhz == 0) return 0;
+      uint64_t isr_por_segundo = (1000000ULL * BCM_BITS) / (((1 << BCM_BITS) - 1) * BCM_TEMPO_BASE_US);
+      return (uint32_t)((cycles_avg() * isr_por_segundo) / (cpu_mhz * 1000ULL));
+    }
+
+    void reset_stats(){
+      ciclos_max = 0;
+      ciclos_soma = 0;
+      interrupcoes = 0;
+    }
+};
+
+LedBcm *LedBcm::instancia = nullptr;
+
+#endif
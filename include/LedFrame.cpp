@@ -0,0 +1,155 @@
+#ifndef LED_FRAME
+#define LED_FRAME
+
+#include <stdint.h>
+#include <string.h>
+#include <ShiftChains.cpp>
+#include <LedBcm.cpp>
+
+#define LED_FRAME_QTD 12 // Leds de cada cor
+#define LED_BRILHO_MAX 255
+
+//framebuffer dos leds de cultivo: brilho de 8 bits para os 12 vermelhos e 12 azuis
+//os leds podem ser alterados livremente e so sao enviados no present(), que compara com o ultimo frame:
+//  - todos os canais em 0 ou 255: envia somente as cadeias de 74HC595 cujo byte mudou (sem interrupção)
+//  - algum canal com brilho intermediario: recalcula os planos de bits e entrega para o LedBcm
+//
+//mapa das cadeias (posicao 0 = primeiro bit enviado):
+//  cadeia 1: vermelhos 0-7
+//  cadeia 2: vermelhos 8-11 e azuis 0-3
+//  cadeia 3: azuis 4-11
+class LedFrame{
+  private:
+    ShiftChains *cadeias;
+    LedBcm bcm;
+    uint8_t cadeia[3];
+
+    uint8_t nivel[2][LED_FRAME_QTD];        // [0] = azul, [1] = vermelho (mesmo valor dos defines BLUE/RED)
+    uint8_t ultimo_nivel[2][LED_FRAME_QTD];
+    bool apresentado = false;
+
+    uint32_t chamadas_set = 0;   // cada set() custava 3 shifts no set_led antigo
+    uint32_t bytes_enviados = 0; // bytes de cadeia efetivamente alterados nos present()
+
+    //inverte a ordem dos bits, a posicao 0 do frame vai no bit 7 (MSBFIRST)
+    static uint8_t inverter(uint8_t b){
+      b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+      b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+      b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+      return b;
+    }
+
+    //converte as mascaras (bit i = led i) nos bytes das 3 cadeias
+    static void mascaras_para_bytes(uint16_t vermelho, uint16_t azul, uint8_t bytes[3]){
+      bytes[0] = inverter(vermelho & 0xFF);
+      bytes[1] = inverter(((vermelho >> 8) & 0x0F) | ((azul & 0x0F) << 4));
+      bytes[2] = inverter((azul >> 4) & 0xFF);
+    }
+
+    //mascara dos leds de uma cor que tem o bit 'b' do brilho ligado
+    uint16_t mascara_bit(uint8_t cor, uint8_t b){
+      uint16_t mascara = 0;
+      for (uint8_t i = 0; i < LED_FRAME_QTD; i++) {
+        if (nivel[cor][i] & (1 << b)) mascara |= (1 << i);
+      }
+      return mascara;
+    }
+
+    bool somente_liga_desliga(){
+      for (uint8_t cor = 0; cor < 2; cor++) {
+        for (uint8_t i = 0; i < LED_FRAME_QTD; i++) {
+          if (nivel[cor][i] != 0 && nivel[cor][i] != LED_BRILHO_MAX) return false;
+        }
+      }
+      return true;
+    }
+
+  public:
+    LedFrame(ShiftChains *cadeias_595, uint8_t cadeia1, uint8_t cadeia2, uint8_t cadeia3)
+      : bcm(cadeias_595, cadeia1, cadeia2, cadeia3){
+      cadeias = cadeias_595;
+      cadeia[0] = cadeia1;
+      cadeia[1] = cadeia2;
+      cadeia[2] = cadeia3;
+      memset(nivel, 0, sizeof(nivel));
+      memset(ultimo_nivel, 0, sizeof(ultimo_nivel));
+    }
+
+    void set(bool cor_vermelha, uint8_t led, bool ligado){
+      set_level(cor_vermelha, led, ligado ? LED_BRILHO_MAX : 0);
+    }
+
+    void set_level(bool cor_vermelha, uint8_t led, uint8_t brilho){
+      if (led >= LED_FRAME_QTD) return;
+      nivel[cor_vermelha][led] = brilho;
+      chamadas_set++;
+    }
+
+    bool get(bool cor_vermelha, uint8_t led){
+      return get_level(cor_vermelha, led) != 0;
+    }
+
+    uint8_t get_level(bool cor_vermelha, uint8_t led){
+      if (led >= LED_FRAME_QTD) return 0;
+      return nivel[cor_vermelha][led];
+    }
+
+    //liga/desliga todos os leds de cada cor
+    void fill(bool ligar_vermelho, bool ligar_azul){
+      fill_level(ligar_vermelho ? LED_BRILHO_MAX : 0, ligar_azul ? LED_BRILHO_MAX : 0);
+    }
+
+    //define o brilho de todos os leds de cada cor
+    void fill_level(uint8_t brilho_vermelho, uint8_t brilho_azul){
+      for (uint8_t i = 0; i < LED_FRAME_QTD; i++) {
+        set_level(true, i, brilho_vermelho);
+        set_level(false, i, brilho_azul);
+      }
+    }
+
+    //envia o frame, somente o que mudou é reescrito
+    void present(){
+      if (apresentado && memcmp(nivel, ultimo_nivel, sizeof(nivel)) == 0) return;
+
+      if (somente_liga_desliga()) {
+        // sem dimerizacao: desliga o BCM e escreve os bytes estaticos
+        bcm.stop();
+
+        uint8_t bytes[3];
+        mascaras_para_bytes(mascara_bit(1, 0), mascara_bit(0, 0), bytes);
+        for (uint8_t i = 0; i < 3; i++) {
+          if (!apresentado || bytes[i] != cadeias->get(cadeia[i])) {
+            cadeias->set(cadeia[i], bytes[i]);
+            bytes_enviados++;
+          }
+        }
+        cadeias->commit();
+      } else {
+        // com dimerizacao: um conjunto de bytes por plano de bit
+        uint8_t planos[BCM_BITS][BCM_CADEIAS];
+        for (uint8_t b = 0; b < BCM_BITS; b++) {
+          mascaras_para_bytes(mascara_bit(1, b), mascara_bit(0, b), planos[b]);
+        }
+        bcm.load(planos);
+        bytes_enviados += BCM_BITS * BCM_CADEIAS;
+      }
+
+      memcpy(ultimo_nivel, nivel, sizeof(nivel));
+      apresentado = true;
+    }
+
+    LedBcm &dimmer(){
+      return bcm;
+    }
+
+    //shifts que o set_led antigo teria feito (3 cadeias a cada chamada)
+    uint32_t legacy_shifts(){
+      return chamadas_set * 3;
+    }
+
+    uint32_t chain_writes(){
+      return bytes_enviados;
+    }
+};
+
+#endif
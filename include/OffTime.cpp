@@ -1,79 +1,249 @@
-#ifndef OFF_TIME
-#define OFF_TIME
-
-#include "Arduino.h"
-
-class OffTime{
-private:
-  uint32_t _unixtime = 0;
-
-public:
-  OffTime(){
-    Serial.print("ola mundo");
-  }
-
-  //retorna o unix atual (precisa ter ocorrido pelo menos 1 atualização do tipo set seja vindo de servidor ntp, rtc externo etc)
-  unsigned long now() {
-    static unsigned long last_millis;
-    while (millis() - last_millis >= 1000) {
-      this->_unixtime++;
-      last_millis += 1000;
-    }
-    return this->_unixtime;
-  }
-
-  //define o unix atual, pode ser baseado em um servidor de ntp
-  void set(unsigned long unix_new) {
-    this->_unixtime = unix_new;
-  }
-
-  //retorna hora (0-23)
-  int get_hour() {
-    return ((_unixtime % (60 * 60 * 24)) / (60 * 60));
-  }
-
-  //retorna minuto (0-59)
-  int get_minute() {
-    return ((_unixtime % (60 * 60)) / 60);
-  }
-
-  //retorna segundo (0-59)
-  int get_second() {
-    return (_unixtime % 60);
-  }
-
-  //retorna dia (1-31)
-  //Calcula o dia do mês (1-31) dividindo o timestamp Unix por 86400 (segundos em um dia) e obtendo o resto da divisão por 31.
-  //Adiciona 1 ao resultado para que o dia seja contado de 1 a 31.
-  int get_day() {
-    return ((_unixtime / (60 * 60 * 24)) % 31) + 1;
-  }
-
-  //retorna mês (1-12)
-  // Calcula o mês (1-12) usando um array com o número de dias em cada mês.
-  // Itera sobre os meses, somando os dias de cada mês até que o número total de dias acumulados seja maior ou igual ao número de dias decorridos desde o início do ano.
-  // O índice do mês no array representa o mês atual.
-  int get_month() {
-    int dias_no_mes[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-    int dias_acumulados = 0;
-    int mes = 1;
-    for (; mes <= 12; mes++) {
-      dias_acumulados += dias_no_mes[mes - 1];
-      if ((_unixtime / (60 * 60 * 24)) < dias_acumulados) {
-        break;
-      }
-    }
-    return mes;
-  }
-
-  //retorna ano (desde 1970)
-  //Calcula o ano (desde 1970) dividindo o timestamp Unix por 31536000 (segundos em um ano) e adicionando 1970 (o ano de início do timestamp Unix).
-  //O cálculo assume que um ano tem 365 dias, ignorando anos bissextos.
-  int get_year() {
-    return 1970 + (_unixtime / (60 * 60 * 24 * 365));
-  }
-};
-
-#endif
-
-
+#ifndef OFF_TIME
+#define OFF_TIME
+
+#include <Hal.cpp>
+
+#define SEGUNDOS_DIA 86400L
+#define OFFTIME_TAXA_AJUSTE_PPM 500 // Velocidade do ajuste gradual (discipline): 0,5 ms por segundo, o relogio nunca volta
+
+//data e hora civil (calendario gregoriano) de um epoch ja no fuso local
+struct DataHora{
+  int16_t ano;
+  uint8_t mes;          // 1-12
+  uint8_t dia;          // 1-31
+  uint8_t hora;         // 0-23
+  uint8_t minuto;       // 0-59
+  uint8_t segundo;      // 0-59
+  uint8_t dia_semana;   // 0 = domingo
+  uint16_t minuto_dia;  // hora * 60 + minuto (tabelas do fotoperiodo e agendas)
+};
+
+//relogio de parede sobre o uptime monotonico de 64 bits (esp_timer no ESP32, relogio simulado no pc):
+//  - set() guarda so a diferença entre o epoch e o uptime: now() é uma soma, o relogio anda sem ninguem chamar now()
+//    e nao tem a volta a zero do millis() em 49 dias
+//  - fuso fixo em segundos, sem horario de verao: now() e o calendario sao hora local, utc() é o epoch do servidor
+//  - data civil em tempo constante (days_from_civil/civil_from_days), calculada uma vez por segundo
+//  - discipline() corrige a frequencia do oscilador e absorve um erro aos poucos (sem salto) a partir do instante atual
+//now() pode ser chamado de qualquer task; set() e set_timezone() sao de um escritor so (setup, depois a task de rede).
+//calendar() e get_*() usam um cache sem trava e sao da task de controle (e do setup antes das tasks):
+//as outras tasks convertem com civil().
+class OffTime{
+private:
+  struct Base{
+    int64_t base_us;          // epoch UTC em us - uptime em us, no instante ref_us
+    int64_t ref_us;           // uptime do ultimo set()/discipline()
+    int64_t ajuste_us;        // erro a absorver a partir de ref_us, a OFFTIME_TAXA_AJUSTE_PPM
+    int32_t correcao_ppb;     // correção de frequencia do oscilador (positivo = uptime atrasa)
+    int32_t fuso_s;           // hora local - UTC
+    bool acertado;            // ja houve um set() (antes disso o epoch é so o uptime)
+  };
+
+  //o escritor preenche a copia que ninguem esta lendo e so entao troca o indice: leitores nunca esperam
+  //(escritas sao raras, um leitor teria que ficar parado durante duas delas para pegar uma copia pela metade)
+  Base bases[2] = {{0, 0, 0, 0, 0, false}, {0, 0, 0, 0, 0, false}};
+  uint8_t atual = 0;
+  DataHora cache;
+  int64_t epoch_cache = INT64_MIN; // epoch local do cache
+
+  void escrever(const Base &nova){
+    uint8_t proximo = atual ^ 1;
+    bases[proximo] = nova;
+    __atomic_store_n(&atual, proximo, __ATOMIC_RELEASE);
+  }
+
+  Base ler() const{
+    return bases[__atomic_load_n(&atual, __ATOMIC_ACQUIRE)];
+  }
+
+  //parte do ajuste ja aplicada decorrido_us depois da ancora
+  static int64_t ajuste_aplicado(const Base &base, int64_t decorrido_us){
+    int64_t maximo = decorrido_us / 1000 * OFFTIME_TAXA_AJUSTE_PPM / 1000;
+    if (base.ajuste_us >= 0) return base.ajuste_us < maximo ? base.ajuste_us : maximo;
+    return -base.ajuste_us < maximo ? base.ajuste_us : -maximo;
+  }
+
+  //epoch UTC em us no uptime dado (ms antes do produto: sem estouro em meses sem discipline())
+  static int64_t utc_de(const Base &base, int64_t uptime_us){
+    int64_t decorrido = uptime_us - base.ref_us;
+    return base.base_us + uptime_us + decorrido / 1000 * base.correcao_ppb / 1000000 + ajuste_aplicado(base, decorrido);
+  }
+
+  //divisão arredondando para baixo (epochs antes de 1970 ficam no dia certo)
+  static int64_t dividir(int64_t a, int64_t b){
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+  }
+
+public:
+  //dias desde 1970-01-01 de uma data civil (algoritmo de Howard Hinnant, sem laços nem tabelas)
+  static int32_t days_from_civil(int32_t ano, uint32_t mes, uint32_t dia){
+    ano -= mes <= 2;
+    int32_t era = (ano >= 0 ? ano : ano - 399) / 400;
+    uint32_t ano_da_era = (uint32_t)(ano - era * 400);                        // [0, 399]
+    uint32_t dia_do_ano = (153 * (mes + (mes > 2 ? -3 : 9)) + 2) / 5 + dia - 1; // [0, 365], ano começando em março
+    uint32_t dia_da_era = ano_da_era * 365 + ano_da_era / 4 - ano_da_era / 100 + dia_do_ano; // [0, 146096]
+    return era * 146097 + (int32_t)dia_da_era - 719468;
+  }
+
+  //data civil de dias desde 1970-01-01 (inverso de days_from_civil)
+  static void civil_from_days(int32_t dias, int16_t &ano, uint8_t &mes, uint8_t &dia){
+    dias += 719468;
+    int32_t era = (dias >= 0 ? dias : dias - 146096) / 146097;
+    uint32_t dia_da_era = (uint32_t)(dias - era * 146097);
+    uint32_t ano_da_era = (dia_da_era - dia_da_era / 1460 + dia_da_era / 36524 - dia_da_era / 146096) / 365;
+    uint32_t dia_do_ano = dia_da_era - (365 * ano_da_era + ano_da_era / 4 - ano_da_era / 100);
+    uint32_t mes_marco = (5 * dia_do_ano + 2) / 153;                         // 0 = março
+    dia = (uint8_t)(dia_do_ano - (153 * mes_marco + 2) / 5 + 1);
+    mes = (uint8_t)(mes_marco < 10 ? mes_marco + 3 : mes_marco - 9);
+    ano = (int16_t)(ano_da_era + era * 400 + (mes <= 2));
+  }
+
+  //data e hora de um epoch local
+  static void civil(int64_t epoch_local, DataHora &data){
+    int64_t dias = dividir(epoch_local, SEGUNDOS_DIA);
+    uint32_t segundos_dia = (uint32_t)(epoch_local - dias * SEGUNDOS_DIA);
+    civil_from_days((int32_t)dias, data.ano, data.mes, data.dia);
+    data.hora = segundos_dia / 3600;
+    data.minuto = segundos_dia / 60 % 60;
+    data.segundo = segundos_dia % 60;
+    data.minuto_dia = segundos_dia / 60;
+    data.dia_semana = (uint8_t)(dias >= -4 ? (dias + 4) % 7 : (dias + 5) % 7 + 6); // 1970-01-01 foi quinta
+  }
+
+  //define o epoch UTC atual em us, com salto (boot ou erro grande demais para ajustar aos poucos)
+  void set_us(int64_t utc_us){
+    Base nova = ler();
+    nova.ref_us = (int64_t)hal_uptime_us();
+    nova.base_us = utc_us - nova.ref_us;
+    nova.ajuste_us = 0;
+    nova.acertado = true;
+    escrever(nova);
+  }
+
+  //define o epoch UTC atual (servidor ntp, rtc externo etc)
+  void set(uint64_t unix_utc){
+    set_us((int64_t)unix_utc * 1000000);
+  }
+
+  //sem salto: a partir de agora o relogio anda com a nova correção de frequencia e absorve erro_us
+  //(servidor - local) a OFFTIME_TAXA_AJUSTE_PPM; um ajuste anterior ainda pendente é substituido
+  void discipline(int64_t erro_us, int32_t correcao_ppb){
+    Base nova = ler();
+    int64_t agora = (int64_t)hal_uptime_us();
+    nova.base_us = utc_de(nova, agora) - agora;
+    nova.ref_us = agora;
+    nova.ajuste_us = erro_us;
+    nova.correcao_ppb = correcao_ppb;
+    escrever(nova);
+  }
+
+  //fuso fixo: hora local = UTC + offset_s (ex: -3 * 3600 para Brasilia)
+  void set_timezone(int32_t offset_s){
+    Base nova = ler();
+    nova.fuso_s = offset_s;
+    escrever(nova);
+  }
+
+  int32_t timezone() const{
+    return ler().fuso_s;
+  }
+
+  int32_t frequency_ppb() const{
+    return ler().correcao_ppb;
+  }
+
+  //parte do ultimo discipline() ainda nao absorvida
+  int64_t pending_us() const{
+    Base base = ler();
+    return base.ajuste_us - ajuste_aplicado(base, (int64_t)hal_uptime_us() - base.ref_us);
+  }
+
+  //epoch UTC em us num uptime (carimbos de pacotes de rede)
+  int64_t utc_at_us(uint64_t uptime_us) const{
+    return utc_de(ler(), (int64_t)uptime_us);
+  }
+
+  //epoch UTC em us (0 + uptime antes do primeiro set)
+  int64_t utc_us() const{
+    return utc_at_us(hal_uptime_us());
+  }
+
+  //epoch UTC em segundos
+  uint32_t utc() const{
+    return (uint32_t)dividir(utc_us(), 1000000);
+  }
+
+  //epoch local em segundos, 64 bits
+  int64_t now64() const{
+    Base base = ler();
+    return dividir(utc_de(base, (int64_t)hal_uptime_us()), 1000000) + base.fuso_s;
+  }
+
+  //o relogio ja foi acertado (set) desde o boot: antes disso now() nao é uma data (amostras e gravações esperam)
+  bool synced() const{
+    return ler().acertado;
+  }
+
+  //epoch local em segundos; 0 enquanto o epoch local for negativo (antes do set, com fuso negativo), nunca a volta
+  //do unsigned para 2106
+  unsigned long now() const{
+    int64_t agora = now64();
+    return agora < 0 ? 0 : (unsigned long)agora;
+  }
+
+  //data e hora local atuais, recalculadas so quando o segundo muda
+  const DataHora &calendar(){
+    int64_t agora = now64();
+    if (agora != epoch_cache) {
+      int64_t minuto = dividir(agora, 60);
+      if (epoch_cache != INT64_MIN && minuto == dividir(epoch_cache, 60)) {
+        cache.segundo = (uint8_t)(agora - minuto * 60); // mesmo minuto: so o segundo muda
+      } else {
+        civil(agora, cache);
+      }
+      epoch_cache = agora;
+    }
+    return cache;
+  }
+
+  //retorna hora (0-23)
+  int get_hour() {
+    return calendar().hora;
+  }
+
+  //retorna minuto (0-59)
+  int get_minute() {
+    return calendar().minuto;
+  }
+
+  //retorna segundo (0-59)
+  int get_second() {
+    return calendar().segundo;
+  }
+
+  //retorna dia (1-31)
+  int get_day() {
+    return calendar().dia;
+  }
+
+  //retorna mês (1-12)
+  int get_month() {
+    return calendar().mes;
+  }
+
+  //retorna ano
+  int get_year() {
+    return calendar().ano;
+  }
+
+  //retorna dia da semana (0 = domingo)
+  int get_weekday() {
+    return calendar().dia_semana;
+  }
+
+  //retorna minuto do dia (0-1439)
+  int get_minute_of_day() {
+    return calendar().minuto_dia;
+  }
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef OUT_LATCH
+#define OUT_LATCH
+
+#include <stdint.h>
+
+//guarda o ultimo byte escrito em um 74HC595 (shadow) para so trocar o latch quando o valor mudar
+//evita refazer o shiftOut a cada chamada e conta quantas escritas foram economizadas
+class OutLatch{
+  private:
+    uint8_t sombra = 0;         // ultimo byte efetivamente escrito no registrador
+    bool sujo = true;           // força a primeira escrita (estado do registrador desconhecido no boot)
+    uint32_t escritas = 0;
+    uint32_t escritas_evitadas = 0;
+
+  public:
+    //retorna true se o byte mudou e precisa ser escrito, ja atualizando a sombra
+    bool changed(uint8_t valor){
+      if (!sujo && valor == sombra) {
+        escritas_evitadas++;
+        return false;
+      }
+      sombra = valor;
+      sujo = false;
+      escritas++;
+      return true;
+    }
+
+    //marca o registrador como desatualizado, a proxima chamada de changed() sempre escreve
+    void invalidate(){
+      sujo = true;
+    }
+
+    uint8_t last(){
+      return sombra;
+    }
+
+    uint32_t writes(){
+      return escritas;
+    }
+
+    uint32_t avoided(){
+      return escritas_evitadas;
+    }
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef PHOTOPERIOD
+#define PHOTOPERIOD
+
+#include <stdint.h>
+
+#define MINUTOS_DIA 1440
+
+//ponto da curva de luz: a partir deste minuto do dia o brilho caminha linearmente ate o proximo ponto
+struct PontoLuz{
+  uint16_t minuto;   // 0-1439
+  uint8_t vermelho;  // 0-255
+  uint8_t azul;      // 0-255
+};
+
+//fotoperiodo: curva de brilho do dia (amanhecer, dia, entardecer e noite) com proporção vermelho/azul variavel
+//a curva linear por partes é pré-calculada em uma tabela indexada pelo minuto do dia,
+//entao a consulta é O(1) e pode ser feita a cada segundo.
+class Photoperiod{
+  private:
+    uint8_t tabela[MINUTOS_DIA][2]; // [minuto][0 = azul, 1 = vermelho]
+
+    static uint8_t interpolar(uint8_t a, uint8_t b, uint16_t passo, uint16_t total){
+      return a + ((int32_t)(b - a) * passo) / total;
+    }
+
+  public:
+    Photoperiod(){
+      for (uint16_t m = 0; m < MINUTOS_DIA; m++) {
+        tabela[m][0] = 0;
+        tabela[m][1] = 0;
+      }
+    }
+
+    //recalcula a tabela a partir dos pontos (ordenados por minuto, a curva é circular: o ultimo ponto liga no primeiro)
+    //retorna false se os pontos forem invalidos (tabela anterior é mantida)
+    bool build(const PontoLuz *pontos, uint8_t quantidade){
+      if (pontos == nullptr || quantidade == 0) return false;
+      for (uint8_t i = 0; i < quantidade; i++) {
+        if (pontos[i].minuto >= MINUTOS_DIA) return false;
+        if (i > 0 && pontos[i].minuto <= pontos[i - 1].minuto) return false;
+      }
+
+      for (uint8_t i = 0; i < quantidade; i++) {
+        const PontoLuz &inicio = pontos[i];
+        const PontoLuz &fim = pontos[(i + 1) % quantidade];
+        uint16_t duracao = (fim.minuto + MINUTOS_DIA - inicio.minuto) % MINUTOS_DIA;
+        if (duracao == 0) duracao = MINUTOS_DIA; // somente um ponto: brilho constante
+
+        for (uint16_t passo = 0; passo < duracao; passo++) {
+          uint16_t m = (inicio.minuto + passo) % MINUTOS_DIA;
+          tabela[m][0] = interpolar(inicio.azul, fim.azul, passo, duracao);
+          tabela[m][1] = interpolar(inicio.vermelho, fim.vermelho, passo, duracao);
+        }
+      }
+      return true;
+    }
+
+    uint8_t red(uint16_t minuto_dia){
+      return tabela[minuto_dia % MINUTOS_DIA][1];
+    }
+
+    uint8_t blue(uint16_t minuto_dia){
+      return tabela[minuto_dia % MINUTOS_DIA][0];
+    }
+};
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef RING_LOG
+#define RING_LOG
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_CAPACIDADE 128  // Registros no anel (potencia de 2), o que passar disso enquanto o dreno nao roda é descartado
+#define LOG_MAX_ARGS 8      // Argumentos por mensagem
+#define LOG_MAX_MODULOS 32  // Modulos distintos ("CAIXA", "DHT", ...)
+#define LOG_MAX_LINHA 192   // Tamanho da linha formatada pelo dreno
+#define LOG_MAX_TEXTO 48    // Bytes dos argumentos %s copiados por mensagem (somados, com os '\0'); o que passar é cortado
+
+enum NivelLog : uint8_t{
+  LOG_NENHUM = 0,
+  LOG_ERRO,
+  LOG_AVISO,
+  LOG_INFO,
+  LOG_DEBUG,
+};
+
+// mensagens acima deste nivel nem sao compiladas (build_flags = -DLOG_NIVEL_MAXIMO=LOG_INFO, por exemplo)
+#ifndef LOG_NIVEL_MAXIMO
+  #define LOG_NIVEL_MAXIMO LOG_DEBUG
+#endif
+
+//argumento guardado no registro: inteiros ate o tamanho de um ponteiro, float ou ponteiro
+union ArgLog{
+  intptr_t inteiro;
+  float real;
+  const void *ponteiro;
+};
+
+static inline ArgLog arg_log(int valor){ ArgLog a; a.inteiro = valor; return a; }
+static inline ArgLog arg_log(unsigned int valor){ ArgLog a; a.inteiro = (intptr_t)(uintptr_t)valor; return a; }
+static inline ArgLog arg_log(long valor){ ArgLog a; a.inteiro = (intptr_t)valor; return a; }
+static inline ArgLog arg_log(unsigned long valor){ ArgLog a; a.inteiro = (intptr_t)(uintptr_t)valor; return a; }
+static inline ArgLog arg_log(double valor){ ArgLog a; a.inteiro = 0; a.real = (float)valor; return a; }
+static inline ArgLog arg_log(const char *valor){ ArgLog a; a.ponteiro = valor; return a; }
+static inline ArgLog arg_log(const void *valor){ ArgLog a; a.ponteiro = valor; return a; }
+
+//argumentos de texto sao copiados para o registro (o resto vai como valor)
+static inline bool arg_texto(const char *){ return true; }
+static inline bool arg_texto(...){ return false; }
+
+//so serve para o compilador conferir formato x argumentos (nunca é chamada)
+static inline void log_verificar_formato(const char *formato, ...) __attribute__((format(printf, 1, 2)));
+static inline void log_verificar_formato(const char *, ...){}
+
+//mensagem gravada: nada é formatado no momento do log, so o texto dos argumentos %s é copiado
+struct RegistroLog{
+  uint32_t millis;
+  const char *formato;  // string literal: o endereço é o id do formato (fica na flash, nao é copiada)
+  uint8_t modulo;
+  uint8_t nivel;
+  uint8_t quantidade;   // argumentos usados
+  uint8_t textos;       // bit de cada argumento copiado para texto (args[i].inteiro é a posição dele)
+  ArgLog args[LOG_MAX_ARGS];
+  char texto[LOG_MAX_TEXTO];
+};
+
+//log binario em anel, sem alocação: quem loga grava o ponteiro do formato e os argumentos crus (algumas
+//centenas de ns) e um dreno de baixa prioridade formata e escreve na uart depois.
+//  - varios produtores (tasks dos dois cores) sem mutex: fila limitada de Vyukov, cada posição tem
+//    um numero de sequencia e o produtor so reserva a posição com compare-and-swap no indice de escrita
+//  - um unico consumidor (o dreno): read() nunca espera, retorna false se a proxima posição ainda nao foi publicada
+//  - anel cheio: a mensagem nova é descartada e contada (dropped()), o produtor nunca bloqueia
+//  - nivel por modulo em tempo de execução (set_level), o filtro custa uma comparação
+//o texto dos argumentos %s é copiado para o registro (ate LOG_MAX_TEXTO bytes somados), entao buffers na pilha
+//podem ser logados; textos maiores sao cortados. nao ha suporte a argumentos de 64 bits (%lld, uint64_t).
+class RingLog{
+  private:
+    struct Celula{
+      uint32_t sequencia;
+      RegistroLog registro;
+    };
+
+    Celula anel[LOG_CAPACIDADE];
+    uint32_t escrita = 0;     // proxima posição a reservar (produtores)
+    uint32_t leitura = 0;     // proxima posição a ler (so o dreno)
+    uint32_t descartados = 0;
+
+    const char *modulos[LOG_MAX_MODULOS];
+    uint8_t niveis[LOG_MAX_MODULOS];
+    uint32_t quantidade_modulos = 0; // 32 bits: compare-and-swap nativo do xtensa
+    uint8_t nivel_padrao = LOG_INFO;
+
+    static const char *nome_nivel(uint8_t nivel){
+      if (nivel == LOG_ERRO) return "ERRO ";
+      if (nivel == LOG_AVISO) return "AVISO ";
+      return "";
+    }
+
+    bool gravar(uint8_t modulo, uint8_t nivel, uint32_t agora, const char *formato, const ArgLog valores[], const bool copiar[],
+                uint8_t quantidade){
+      uint32_t posicao = __atomic_load_n(&escrita, __ATOMIC_RELAXED);
+      Celula *celula;
+      while (true) {
+        celula = &anel[posicao & (LOG_CAPACIDADE - 1)];
+        uint32_t sequencia = __atomic_load_n(&celula->sequencia, __ATOMIC_ACQUIRE);
+        int32_t diferenca = (int32_t)(sequencia - posicao);
+        if (diferenca == 0) {
+          if (__atomic_compare_exchange_n(&escrita, &posicao, posicao + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        } else if (diferenca < 0) {
+          __atomic_fetch_add(&descartados, 1, __ATOMIC_RELAXED); // cheio
+          return false;
+        } else {
+          posicao = __atomic_load_n(&escrita, __ATOMIC_RELAXED); // outro produtor pegou esta posição
+        }
+      }
+
+      RegistroLog &registro = celula->registro;
+      registro.millis = agora;
+      registro.formato = formato;
+      registro.modulo = modulo;
+      registro.nivel = nivel;
+      registro.quantidade = quantidade;
+      memcpy(registro.args, valores, quantidade * sizeof(ArgLog));
+      registro.textos = 0;
+      size_t usado = 0;
+      for (uint8_t i = 0; i < quantidade; i++) {
+        if (!copiar[i] || valores[i].ponteiro == nullptr) continue;
+        if (LOG_MAX_TEXTO - usado < 2) {
+          registro.args[i].ponteiro = "..."; // sem espaço: nunca guarda o ponteiro de quem chamou
+          continue;
+        }
+        registro.args[i].inteiro = (intptr_t)usado;
+        registro.textos |= 1 << i;
+        const char *origem = (const char*)valores[i].ponteiro;
+        while (*origem != '\0' && usado < LOG_MAX_TEXTO - 1) registro.texto[usado++] = *origem++;
+        registro.texto[usado++] = '\0';
+      }
+
+      __atomic_store_n(&celula->sequencia, posicao + 1, __ATOMIC_RELEASE); // publica para o dreno
+      return true;
+    }
+
+  public:
+    RingLog(){
+      for (uint32_t i = 0; i < LOG_CAPACIDADE; i++) anel[i].sequencia = i;
+      memset(modulos, 0, sizeof(modulos));
+      modulos[0] = "LOG"; // mensagens do proprio log e modulos que nao couberam na tabela
+      niveis[0] = LOG_INFO;
+      quantidade_modulos = 1;
+    }
+
+    //id do modulo (registra na primeira vez), o nome precisa ser uma string que nunca sai da memoria
+    //o hal_log chama uma vez por ponto de log e guarda o id em uma variavel estatica
+    uint8_t module(const char *nome){
+      uint8_t total = size();
+      for (uint8_t i = 0; i < total; i++) {
+        const char *registrado = __atomic_load_n(&modulos[i], __ATOMIC_ACQUIRE);
+        if (registrado != nullptr && strcmp(registrado, nome) == 0) return i;
+      }
+
+      uint32_t id = __atomic_fetch_add(&quantidade_modulos, 1, __ATOMIC_ACQ_REL);
+      if (id >= LOG_MAX_MODULOS) {
+        __atomic_store_n(&quantidade_modulos, (uint32_t)LOG_MAX_MODULOS, __ATOMIC_RELAXED);
+        return 0;
+      }
+      niveis[id] = nivel_padrao;
+      __atomic_store_n(&modulos[id], nome, __ATOMIC_RELEASE);
+      return id;
+    }
+
+    inline bool enabled(uint8_t modulo, uint8_t nivel) const{
+      return nivel <= __atomic_load_n(&niveis[modulo], __ATOMIC_RELAXED);
+    }
+
+    //grava uma mensagem (formato do printf); false se o anel estava cheio
+    template <typename... Args>
+    bool write(uint8_t modulo, uint8_t nivel, uint32_t agora, const char *formato, Args... args){
+      static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "RingLog: argumentos demais para uma mensagem");
+      ArgLog valores[sizeof...(Args) + 1] = {arg_log(args)...};
+      bool copiar[sizeof...(Args) + 1] = {arg_texto(args)...};
+      return gravar(modulo, nivel, agora, formato, valores, copiar, sizeof...(Args));
+    }
+
+    //proxima mensagem publicada (so o dreno chama)
+    bool read(RegistroLog &registro){
+      Celula &celula = anel[leitura & (LOG_CAPACIDADE - 1)];
+      if (__atomic_load_n(&celula.sequencia, __ATOMIC_ACQUIRE) != leitura + 1) return false;
+      registro = celula.registro;
+      __atomic_store_n(&celula.sequencia, leitura + LOG_CAPACIDADE, __ATOMIC_RELEASE); // libera para os produtores
+      leitura++;
+      return true;
+    }
+
+    //formata "millis [MODULO]: mensagem" (sem quebra de linha), retorna o tamanho
+    size_t format(const RegistroLog &registro, char *linha, size_t tamanho){
+      if (tamanho == 0) return 0;
+      int cabecalho = snprintf(linha, tamanho, "%9lu [%s]: %s", (unsigned long)registro.millis,
+                               name(registro.modulo), nome_nivel(registro.nivel));
+      size_t n = (cabecalho < 0) ? 0 : ((size_t)cabecalho < tamanho ? (size_t)cabecalho : tamanho - 1);
+
+      const char *p = registro.formato;
+      uint8_t arg = 0;
+      while (*p != '\0' && n + 1 < tamanho) {
+        if (*p != '%') {
+          linha[n++] = *p++;
+          continue;
+        }
+
+        //copia a especificação inteira (flags, largura, precisão, tamanho e conversão) para um snprintf so dela
+        char especificacao[16];
+        uint8_t e = 0;
+        especificacao[e++] = *p++;
+        while (*p != '\0' && strchr("-+ #0123456789.lhzt", *p) != nullptr && e < sizeof(especificacao) - 2) especificacao[e++] = *p++;
+        char conversao = *p;
+        if (conversao == '\0') break;
+        p++;
+        if (conversao == '%') {
+          linha[n++] = '%';
+          continue;
+        }
+        especificacao[e++] = conversao;
+        especificacao[e] = '\0';
+
+        bool longo = memchr(especificacao, 'l', e) || memchr(especificacao, 'z', e) || memchr(especificacao, 't', e);
+        ArgLog valor;
+        valor.inteiro = 0;
+        bool copiado = arg < registro.quantidade && (registro.textos & (1 << arg));
+        if (arg < registro.quantidade) valor = registro.args[arg++];
+
+        char *destino = linha + n;
+        size_t livre = tamanho - n;
+        int escrito = 0;
+        switch (conversao) {
+          case 'd': case 'i':
+            escrito = longo ? snprintf(destino, livre, especificacao, (long)valor.inteiro) : snprintf(destino, livre, especificacao, (int)valor.inteiro);
+            break;
+          case 'u': case 'x': case 'X': case 'o':
+            escrito = longo ? snprintf(destino, livre, especificacao, (unsigned long)(uintptr_t)valor.inteiro)
+                            : snprintf(destino, livre, especificacao, (unsigned int)(uintptr_t)valor.inteiro);
+            break;
+          case 'c':
+            escrito = snprintf(destino, livre, especificacao, (int)valor.inteiro);
+            break;
+          case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            escrito = snprintf(destino, livre, especificacao, (double)valor.real);
+            break;
+          case 's':
+            escrito = snprintf(destino, livre, especificacao, copiado ? registro.texto + valor.inteiro
+                                                             : valor.ponteiro ? (const char*)valor.ponteiro : "(null)");
+            break;
+          case 'p':
+            escrito = snprintf(destino, livre, especificacao, valor.ponteiro);
+            break;
+        }
+        if (escrito > 0) n += ((size_t)escrito < livre) ? (size_t)escrito : livre - 1;
+      }
+      linha[n] = '\0';
+      return n;
+    }
+
+    const char *name(uint8_t modulo) const{
+      const char *nome = (modulo < LOG_MAX_MODULOS) ? __atomic_load_n(&modulos[modulo], __ATOMIC_ACQUIRE) : nullptr;
+      return nome ? nome : "?";
+    }
+
+    uint8_t level(uint8_t modulo) const{
+      return modulo < LOG_MAX_MODULOS ? __atomic_load_n(&niveis[modulo], __ATOMIC_RELAXED) : (uint8_t)LOG_NENHUM;
+    }
+
+    //altera o nivel de um modulo ja registrado (qualquer task); false se ele ainda nao logou nada
+    bool set_level(const char *nome, uint8_t nivel){
+      bool achou = false;
+      uint8_t total = size();
+      for (uint8_t i = 0; i < total; i++) {
+        const char *registrado = __atomic_load_n(&modulos[i], __ATOMIC_ACQUIRE);
+        if (registrado != nullptr && strcmp(registrado, nome) == 0) {
+          __atomic_store_n(&niveis[i], nivel, __ATOMIC_RELAXED);
+          achou = true;
+        }
+      }
+      return achou;
+    }
+
+    //altera o nivel de todos os modulos, inclusive os que ainda vao se registrar
+    void set_level_all(uint8_t nivel){
+      nivel_padrao = nivel;
+      uint8_t total = size();
+      for (uint8_t i = 0; i < total; i++) __atomic_store_n(&niveis[i], nivel, __ATOMIC_RELAXED);
+    }
+
+    //modulos registrados
+    uint8_t size() const{
+      uint32_t total = __atomic_load_n(&quantidade_modulos, __ATOMIC_ACQUIRE);
+      return total > LOG_MAX_MODULOS ? LOG_MAX_MODULOS : total;
+    }
+
+    //mensagens perdidas com o anel cheio desde o boot
+    uint32_t dropped() const{
+      return __atomic_load_n(&descartados, __ATOMIC_RELAXED);
+    }
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef ROLLUP
+#define ROLLUP
+
+#include <stdint.h>
+#include <string.h>
+
+#define ROLLUP_BALDES_MINUTO 240  // Baldes de 1 minuto na ram (4h)
+#define ROLLUP_BALDES_QUARTO 192  // Baldes de 15 minutos (48h)
+#define ROLLUP_BALDES_HORA 168    // Baldes de 1 hora (7 dias); alem disso o historico da flash tem o resumo por hora
+
+//agregado de um intervalo fixo (valores em ponto fixo de 16 bits: decimos, centesimos...)
+struct BaldeRollup{
+  int32_t soma;
+  int16_t minimo;
+  int16_t maximo;
+  uint16_t quantidade;   // 0 = intervalo sem amostras
+};
+
+//anel de baldes de SEGUNDOS cada, indexados pelo numero do intervalo (epoch / SEGUNDOS):
+//o balde do intervalo n fica em n % BALDES, e avançar o tempo so limpa os baldes pulados (O(1) por amostra)
+template <uint32_t SEGUNDOS, uint16_t BALDES>
+class AnelRollup{
+  private:
+    BaldeRollup baldes[BALDES];
+    uint32_t ultimo = 0;    // numero do intervalo mais recente
+    bool vazio = true;
+
+  public:
+    AnelRollup(){
+      memset(baldes, 0, sizeof(baldes));
+    }
+
+    void add(uint32_t epoch, int16_t valor){
+      uint32_t numero = epoch / SEGUNDOS;
+      if (vazio) {
+        ultimo = numero;
+        vazio = false;
+      } else if (numero < ultimo) {
+        if (ultimo - numero >= BALDES) return; // mais velho que o anel (relogio voltou muito)
+      } else if (numero > ultimo) {
+        uint32_t pulados = numero - ultimo;
+        if (pulados > BALDES) pulados = BALDES;
+        for (uint32_t i = 1; i <= pulados; i++) baldes[(ultimo + i) % BALDES].quantidade = 0;
+        ultimo = numero;
+      }
+
+      BaldeRollup &balde = baldes[numero % BALDES];
+      if (balde.quantidade == 0) {
+        balde.soma = valor;
+        balde.minimo = valor;
+        balde.maximo = valor;
+        balde.quantidade = 1;
+        return;
+      }
+      if (balde.quantidade == UINT16_MAX) return;
+      balde.soma += valor;
+      if (valor < balde.minimo) balde.minimo = valor;
+      if (valor > balde.maximo) balde.maximo = valor;
+      balde.quantidade++;
+    }
+
+    //copia o balde do intervalo numero (false se ja saiu do anel ou ainda nao chegou)
+    bool get(uint32_t numero, BaldeRollup &copia) const{
+      if (vazio || numero > ultimo || ultimo - numero >= BALDES) return false;
+      copia = baldes[numero % BALDES];
+      return true;
+    }
+
+    uint32_t last() const{
+      return __atomic_load_n(&ultimo, __ATOMIC_RELAXED);
+    }
+};
+
+//resoluções mantidas pelo Rollup
+enum ResolucaoRollup : uint8_t{
+  ROLLUP_MINUTO,
+  ROLLUP_QUARTO,
+  ROLLUP_HORA,
+  N_RESOLUCOES_ROLLUP
+};
+
+//min/max/media/quantidade de um canal em 1min, 15min e 1h, atualizados a cada amostra
+//consultas de grafico leem os baldes prontos: O(baldes), nunca O(amostras).
+//um escritor (task de controle); o leitor (http) copia cada balde por seqlock e tenta de novo se pegou uma escrita.
+class Rollup{
+  private:
+    AnelRollup<60, ROLLUP_BALDES_MINUTO> minuto;
+    AnelRollup<15 * 60, ROLLUP_BALDES_QUARTO> quarto;
+    AnelRollup<60 * 60, ROLLUP_BALDES_HORA> hora;
+    uint32_t sequencia = 0;   // seqlock: impar enquanto add() altera os aneis
+
+  public:
+    static uint32_t seconds(ResolucaoRollup resolucao){
+      return resolucao == ROLLUP_MINUTO ? 60 : resolucao == ROLLUP_QUARTO ? 15 * 60 : 60 * 60;
+    }
+
+    static uint16_t capacity(ResolucaoRollup resolucao){
+      return resolucao == ROLLUP_MINUTO ? ROLLUP_BALDES_MINUTO : resolucao == ROLLUP_QUARTO ? ROLLUP_BALDES_QUARTO : ROLLUP_BALDES_HORA;
+    }
+
+    //numero do intervalo mais recente da resolução (epoch / seconds(resolucao))
+    uint32_t last(ResolucaoRollup resolucao) const{
+      return resolucao == ROLLUP_MINUTO ? minuto.last() : resolucao == ROLLUP_QUARTO ? quarto.last() : hora.last();
+    }
+
+    //uma amostra (epoch em segundos) entra nas tres resoluções
+    void add(uint32_t epoch, int16_t valor){
+      __atomic_store_n(&sequencia, sequencia + 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      minuto.add(epoch, valor);
+      quarto.add(epoch, valor);
+      hora.add(epoch, valor);
+      __atomic_store_n(&sequencia, sequencia + 1, __ATOMIC_RELEASE);
+    }
+
+    //copia consistente do balde do intervalo numero (epoch / seconds(resolucao))
+    bool get(ResolucaoRollup resolucao, uint32_t numero, BaldeRollup &copia) const{
+      for (uint8_t tentativa = 0; tentativa < 8; tentativa++) {
+        uint32_t antes = __atomic_load_n(&sequencia, __ATOMIC_ACQUIRE);
+        if (antes & 1) continue;
+        bool existe = resolucao == ROLLUP_MINUTO ? minuto.get(numero, copia)
+                    : resolucao == ROLLUP_QUARTO ? quarto.get(numero, copia)
+                    : hora.get(numero, copia);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&sequencia, __ATOMIC_RELAXED) == antes) return existe;
+      }
+      return false;
+    }
+
+    //chama callback(inicio do balde, balde) para os baldes com amostras entre [inicio, fim), em ordem
+    template <typename Callback>
+    uint16_t buckets(ResolucaoRollup resolucao, uint32_t inicio, uint32_t fim, Callback callback) const{
+      uint32_t segundos = seconds(resolucao);
+      uint32_t ultimo = last(resolucao);
+      uint32_t primeiro = inicio / segundos;
+      if (ultimo >= capacity(resolucao) && primeiro <= ultimo - capacity(resolucao)) primeiro = ultimo - capacity(resolucao) + 1; // so o que ainda esta no anel
+      uint16_t entregues = 0;
+      BaldeRollup balde;
+      for (uint32_t numero = primeiro; numero <= ultimo && numero * segundos < fim; numero++) {
+        if (get(resolucao, numero, balde) && balde.quantidade > 0) {
+          callback(numero * segundos, balde);
+          entregues++;
+        }
+      }
+      return entregues;
+    }
+};
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+#define SCHED_MAX_TAREFAS 16 // Numero maximo de tarefas registradas no agendador
+#define SCHED_ID_INVALIDO 0xFF
+
+typedef void (*TarefaCallback)(void);
+typedef uint32_t (*SchedRelogioUs)(void); // relogio em us usado para medir a duração das tarefas
+typedef void (*SchedObservador)(void *contexto, uint8_t id, uint32_t atraso, uint32_t duracao_us);
+
+//agendador de tarefas periodicas ordenado por deadline (min-heap)
+//so despacha as tarefas vencidas e informa quanto tempo falta para a proxima, permitindo que o loop durma ate la.
+//nao depende do Arduino: o tempo atual é sempre recebido por parametro, entao pode ser testado no pc com um millis() simulado.
+class Scheduler{
+  private:
+    struct Tarefa{
+      TarefaCallback callback;
+      uint32_t intervalo;
+      uint32_t proximo; // deadline da proxima execucao (ms)
+    };
+
+    Tarefa tarefas[SCHED_MAX_TAREFAS];
+    uint8_t heap[SCHED_MAX_TAREFAS]; // ids das tarefas, o topo é a de menor deadline
+    uint8_t pos_heap[SCHED_MAX_TAREFAS]; // posicao de cada tarefa dentro do heap
+    uint8_t quantidade = 0;
+
+    SchedObservador observador = nullptr; // recebe o atraso e a duração de cada execução (instrumentação)
+    void *contexto_observador = nullptr;
+    SchedRelogioUs relogio_us = nullptr;
+
+    //comparacao de deadlines tolerante ao estouro do millis() (49 dias)
+    static bool antes(uint32_t a, uint32_t b){
+      return (int32_t)(a - b) < 0;
+    }
+
+    bool menor(uint8_t i, uint8_t j){
+      return antes(tarefas[heap[i]].proximo, tarefas[heap[j]].proximo);
+    }
+
+    void trocar(uint8_t i, uint8_t j){
+      uint8_t tmp = heap[i];
+      heap[i] = heap[j];
+      heap[j] = tmp;
+      pos_heap[heap[i]] = i;
+      pos_heap[heap[j]] = j;
+    }
+
+    void subir(uint8_t i){
+      while (i > 0){
+        uint8_t pai = (i - 1) / 2;
+        if (!menor(i, pai)) break;
+        trocar(i, pai);
+        i = pai;
+      }
+    }
+
+    void descer(uint8_t i){
+      while (true){
+        uint8_t esq = 2 * i + 1;
+        uint8_t dir = esq + 1;
+        uint8_t menor_idx = i;
+        if (esq < quantidade && menor(esq, menor_idx)) menor_idx = esq;
+        if (dir < quantidade && menor(dir, menor_idx)) menor_idx = dir;
+        if (menor_idx == i) break;
+        trocar(i, menor_idx);
+        i = menor_idx;
+      }
+    }
+
+    //reposiciona a tarefa no heap depois de alterar o seu deadline
+    void reordenar(uint8_t id){
+      subir(pos_heap[id]);
+      descer(pos_heap[id]);
+    }
+
+  public:
+
+    //registra uma tarefa periodica, retorna o id dela ou SCHED_ID_INVALIDO se nao houver espaco
+    //a primeira execucao ocorre em agora + atraso_inicial
+    uint8_t add(TarefaCallback callback, uint32_t intervalo, uint32_t agora, uint32_t atraso_inicial = 0){
+      if (quantidade >= SCHED_MAX_TAREFAS || callback == nullptr) return SCHED_ID_INVALIDO;
+
+      if (intervalo == 0) intervalo = 1; // intervalo zero travaria o run() em loop
+
+      uint8_t id = quantidade;
+      tarefas[id].callback = callback;
+      tarefas[id].intervalo = intervalo;
+      tarefas[id].proximo = agora + atraso_inicial;
+
+      heap[quantidade] = id;
+      pos_heap[id] = quantidade;
+      quantidade++;
+      subir(pos_heap[id]);
+      return id;
+    }
+
+    //altera o intervalo de uma tarefa, a proxima execucao passa a contar a partir de agora
+    void set_interval(uint8_t id, uint32_t intervalo, uint32_t agora){
+      if (id >= quantidade) return;
+      if (intervalo == 0) intervalo = 1;
+      tarefas[id].intervalo = intervalo;
+      tarefas[id].proximo = agora + intervalo;
+      reordenar(id);
+    }
+
+    //antecipa a tarefa para ser executada na proxima chamada de run() (usado por eventos de I/O)
+    void run_now(uint8_t id, uint32_t agora){
+      if (id >= quantidade) return;
+      tarefas[id].proximo = agora;
+      reordenar(id);
+    }
+
+    //ms que faltam para o proximo deadline (0 se ja existe tarefa vencida)
+    uint32_t time_to_next(uint32_t agora){
+      if (quantidade == 0) return UINT32_MAX;
+      uint32_t proximo = tarefas[heap[0]].proximo;
+      return antes(agora, proximo) ? (proximo - agora) : 0;
+    }
+
+    //executa somente as tarefas vencidas e retorna o tempo ate o proximo deadline
+    uint32_t run(uint32_t agora){
+      while (quantidade > 0 && !antes(agora, tarefas[heap[0]].proximo)){
+        uint8_t id = heap[0];
+        Tarefa &tarefa = tarefas[id];
+        uint32_t atraso = agora - tarefa.proximo; // execução real - deadline (jitter)
+
+        //reagenda antes de executar, assim a propria tarefa (ou um evento) pode alterar o proprio deadline
+        tarefa.proximo += tarefa.intervalo;
+        if (!antes(agora, tarefa.proximo)){
+          //atrasou mais de um intervalo: nao executa varias vezes em rajada, so retoma a cadencia
+          tarefa.proximo = agora + tarefa.intervalo;
+        }
+        descer(0);
+
+        if (observador == nullptr) {
+          tarefa.callback();
+          continue;
+        }
+        uint32_t inicio = relogio_us();
+        tarefa.callback();
+        observador(contexto_observador, id, atraso, relogio_us() - inicio);
+      }
+      return time_to_next(agora);
+    }
+
+    //registra quem recebe as medidas de cada execução (nullptr desliga, sem custo no run())
+    void observe(SchedObservador callback, void *contexto, SchedRelogioUs relogio){
+      observador = (relogio != nullptr) ? callback : nullptr;
+      contexto_observador = contexto;
+      relogio_us = relogio;
+    }
+
+    uint8_t size(){
+      return quantidade;
+    }
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef SENSOR_FILTER
+#define SENSOR_FILTER
+
+#include <stdint.h>
+
+//amostra com o instante em que foi lida
+struct Amostra{
+  int16_t valor;
+  uint32_t millis;
+};
+
+//buffer circular de amostras com filtro mediana + media movel exponencial, sem alocação dinamica
+//  - mediana das ultimas N amostras: remove picos isolados (leituras ruins do DHT11)
+//  - EMA sobre a mediana: suaviza o degrau que sobra, evitando liga/desliga dos exaustores
+//a mediana usa uma copia ordenada da janela: busca binaria para achar a posicao, entao cada push()
+//custa O(log N) comparações mais o deslocamento de no maximo N valores (N pequeno, sem alocação).
+//os valores sao ponto fixo do chamador (ex: decimos de grau); a EMA guarda 8 bits fracionarios a mais.
+template <uint8_t N, uint8_t EMA_SHIFT = 2>
+class SensorFilter{
+  private:
+    Amostra anel[N];
+    int16_t ordenado[N];
+    uint8_t inicio = 0;      // amostra mais antiga
+    uint8_t quantidade = 0;
+
+    int32_t ema_q8 = 0;      // EMA com 8 bits fracionarios (alfa = 1 / 2^EMA_SHIFT)
+    bool ema_iniciada = false;
+
+    //primeira posicao do vetor ordenado com valor >= v
+    uint8_t posicao(int16_t v){
+      uint8_t baixo = 0;
+      uint8_t alto = quantidade;
+      while (baixo < alto) {
+        uint8_t meio = (baixo + alto) / 2;
+        if (ordenado[meio] < v) baixo = meio + 1;
+        else alto = meio;
+      }
+      return baixo;
+    }
+
+    void remover_ordenado(int16_t v){
+      uint8_t p = posicao(v);
+      for (uint8_t i = p; i + 1 < quantidade; i++) ordenado[i] = ordenado[i + 1];
+    }
+
+    void inserir_ordenado(int16_t v, uint8_t tamanho_atual){
+      uint8_t baixo = 0;
+      uint8_t alto = tamanho_atual;
+      while (baixo < alto) {
+        uint8_t meio = (baixo + alto) / 2;
+        if (ordenado[meio] < v) baixo = meio + 1;
+        else alto = meio;
+      }
+      for (uint8_t i = tamanho_atual; i > baixo; i--) ordenado[i] = ordenado[i - 1];
+      ordenado[baixo] = v;
+    }
+
+  public:
+
+    //adiciona uma amostra, descartando a mais antiga quando a janela esta cheia
+    void push(int16_t valor, uint32_t agora){
+      if (quantidade == N) {
+        remover_ordenado(anel[inicio].valor);
+        anel[inicio].valor = valor;
+        anel[inicio].millis = agora;
+        inicio = (inicio + 1) % N;
+        inserir_ordenado(valor, N - 1);
+      } else {
+        uint8_t fim = (inicio + quantidade) % N;
+        anel[fim].valor = valor;
+        anel[fim].millis = agora;
+        inserir_ordenado(valor, quantidade);
+        quantidade++;
+      }
+
+      int32_t mediana_q8 = (int32_t)median() << 8;
+      if (!ema_iniciada) {
+        ema_q8 = mediana_q8;
+        ema_iniciada = true;
+      } else {
+        ema_q8 += (mediana_q8 - ema_q8) >> EMA_SHIFT;
+      }
+    }
+
+    //mediana da janela (com quantidade par usa a menor das duas centrais)
+    int16_t median(){
+      if (quantidade == 0) return 0;
+      return ordenado[(quantidade - 1) / 2];
+    }
+
+    //valor filtrado (EMA da mediana), arredondado
+    int16_t value(){
+      return (int16_t)((ema_q8 + 128) >> 8);
+    }
+
+    //i = 0 é a amostra mais recente
+    const Amostra &at(uint8_t i){
+      return anel[(inicio + quantidade - 1 - i) % N];
+    }
+
+    const Amostra &last(){
+      return at(0);
+    }
+
+    uint8_t size(){
+      return quantidade;
+    }
+
+    bool empty(){
+      return quantidade == 0;
+    }
+
+    void clear(){
+      inicio = 0;
+      quantidade = 0;
+      ema_iniciada = false;
+      ema_q8 = 0;
+    }
+};
+
+#endif
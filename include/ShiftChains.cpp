@@ -0,0 +1,225 @@
+#ifndef SHIFT_CHAINS
+#define SHIFT_CHAINS
+
+#include <stdint.h>
+#include <OutLatch.cpp>
+
+#define SHIFT_MAX_CADEIAS 4 // Reles + 3 cadeias de leds
+
+//------------------------------------------------------------------------------
+// Acesso aos pinos
+//------------------------------------------------------------------------------
+#ifdef ARDUINO
+  #include <Arduino.h>
+  #include <soc/gpio_struct.h>
+
+  // escreve direto nos registradores de set/clear, varios pinos mudam na mesma instrucao
+  static inline void shift_gpio_set(uint64_t mascara){
+    if ((uint32_t)mascara) GPIO.out_w1ts = (uint32_t)mascara;
+    if (mascara >> 32) GPIO.out1_w1ts.val = (uint32_t)(mascara >> 32);
+  }
+
+  static inline void shift_gpio_clear(uint64_t mascara){
+    if ((uint32_t)mascara) GPIO.out_w1tc = (uint32_t)mascara;
+    if (mascara >> 32) GPIO.out1_w1tc.val = (uint32_t)(mascara >> 32);
+  }
+
+  static inline void shift_gpio_output(uint8_t pino){
+    pinMode(pino, OUTPUT);
+  }
+
+  // as cadeias podem ser escritas pela task de controle e pela interrupção do BCM (LedBcm.cpp),
+  // e o data dos reles é o latch dos leds1: cada passada precisa ser atomica
+  static portMUX_TYPE shift_mux = portMUX_INITIALIZER_UNLOCKED;
+  #define SHIFT_LOCK() portENTER_CRITICAL(&shift_mux)
+  #define SHIFT_UNLOCK() portEXIT_CRITICAL(&shift_mux)
+  #define SHIFT_LOCK_ISR() portENTER_CRITICAL_ISR(&shift_mux)
+  #define SHIFT_UNLOCK_ISR() portEXIT_CRITICAL_ISR(&shift_mux)
+#else
+  #define IRAM_ATTR
+  #define SHIFT_LOCK()
+  #define SHIFT_UNLOCK()
+  #define SHIFT_LOCK_ISR()
+  #define SHIFT_UNLOCK_ISR()
+
+  // backend do pc: guarda o nivel dos pinos e avisa um espiao a cada escrita,
+  // assim um 74HC595 simulado pode conferir o frame emitido
+  static uint64_t shift_gpio_nivel = 0;
+  static void (*shift_gpio_espiao)(uint64_t nivel) = nullptr;
+
+  static inline void shift_gpio_set(uint64_t mascara){
+    shift_gpio_nivel |= mascara;
+    if (shift_gpio_espiao != nullptr) shift_gpio_espiao(shift_gpio_nivel);
+  }
+
+  static inline void shift_gpio_clear(uint64_t mascara){
+    shift_gpio_nivel &= ~mascara;
+    if (shift_gpio_espiao != nullptr) shift_gpio_espiao(shift_gpio_nivel);
+  }
+
+  static inline void shift_gpio_output(uint8_t pino){
+    (void)pino;
+  }
+#endif
+
+//driver para todas as cadeias de 74HC595 (reles e leds)
+//os bytes sao preparados com set() e enviados juntos por commit(): as cadeias que nao compartilham pinos
+//sao deslocadas em paralelo (8 pulsos de clock para todas), e as que nao mudaram nao sao reescritas.
+class ShiftChains{
+  private:
+    struct Cadeia{
+      uint64_t data;
+      uint64_t clock;
+      uint64_t latch;
+      uint8_t valor; // byte preparado, ainda nao enviado
+    };
+
+    Cadeia cadeias[SHIFT_MAX_CADEIAS];
+    OutLatch latches[SHIFT_MAX_CADEIAS]; // ultimo byte escrito em cada cadeia
+    uint8_t quantidade = 0;
+    uint8_t reservadas = 0; // cadeias controladas por fora (ex: BCM), ignoradas pelo commit()
+    volatile uint32_t passadas = 0; // quantas sequencias de 8 clocks foram emitidas
+
+    static uint64_t bit(uint8_t pino){
+      return ((uint64_t)1) << pino;
+    }
+
+    uint64_t pinos(uint8_t i){
+      return cadeias[i].data | cadeias[i].clock | cadeias[i].latch;
+    }
+
+    //desloca em paralelo as cadeias marcadas na mascara (elas nao podem compartilhar pinos)
+    //valores[i] é o byte da cadeia i
+    IRAM_ATTR void shift_paralelo(uint8_t mascara_cadeias, const uint8_t *valores){
+      uint64_t clocks = 0;
+      uint64_t latches_pinos = 0;
+
+      for (uint8_t i = 0; i < quantidade; i++) {
+        if (mascara_cadeias & (1 << i)) {
+          clocks |= cadeias[i].clock;
+          latches_pinos |= cadeias[i].latch;
+        }
+      }
+
+      shift_gpio_clear(latches_pinos | clocks);
+
+      for (int8_t b = 7; b >= 0; b--) { // MSBFIRST, igual ao shiftOut()
+        uint64_t alto = 0;
+        uint64_t baixo = 0;
+        for (uint8_t i = 0; i < quantidade; i++) {
+          if (mascara_cadeias & (1 << i)) {
+            if (valores[i] & (1 << b)) alto |= cadeias[i].data;
+            else baixo |= cadeias[i].data;
+          }
+        }
+        shift_gpio_clear(baixo);
+        shift_gpio_set(alto);
+        shift_gpio_set(clocks);
+        shift_gpio_clear(clocks);
+      }
+
+      shift_gpio_set(latches_pinos);
+      shift_gpio_clear(latches_pinos);
+      passadas++;
+    }
+
+  public:
+
+    //registra uma cadeia, retorna o indice dela (usado em set/get)
+    uint8_t add_chain(uint8_t pin_data, uint8_t pin_clock, uint8_t pin_latch){
+      if (quantidade >= SHIFT_MAX_CADEIAS) return 0xFF;
+      Cadeia &cadeia = cadeias[quantidade];
+      cadeia.data = bit(pin_data);
+      cadeia.clock = bit(pin_clock);
+      cadeia.latch = bit(pin_latch);
+      cadeia.valor = 0;
+      return quantidade++;
+    }
+
+    //configura os pinos de todas as cadeias como saida
+    void begin(){
+      for (uint8_t i = 0; i < quantidade; i++) {
+        uint64_t mascara = pinos(i);
+        for (uint8_t pino = 0; pino < 64; pino++) {
+          if (mascara & bit(pino)) shift_gpio_output(pino);
+        }
+        latches[i].invalidate();
+      }
+    }
+
+    //prepara o byte de uma cadeia (só é enviado no commit)
+    void set(uint8_t cadeia, uint8_t valor){
+      if (cadeia < quantidade) cadeias[cadeia].valor = valor;
+    }
+
+    uint8_t get(uint8_t cadeia){
+      return (cadeia < quantidade) ? cadeias[cadeia].valor : 0;
+    }
+
+    //envia as cadeias que mudaram desde o ultimo commit
+    //cadeias com pinos em comum (ex: data dos reles = latch dos leds1) vao em passadas separadas
+    void commit(){
+      uint8_t pendentes = 0;
+      uint8_t valores[SHIFT_MAX_CADEIAS];
+      for (uint8_t i = 0; i < quantidade; i++) {
+        valores[i] = cadeias[i].valor;
+        if (reservadas & (1 << i)) continue;
+        if (latches[i].changed(cadeias[i].valor)) pendentes |= (1 << i);
+      }
+
+      while (pendentes) {
+        uint8_t grupo = 0;
+        uint64_t ocupados = 0;
+        for (uint8_t i = 0; i < quantidade; i++) {
+          if ((pendentes & (1 << i)) && !(ocupados & pinos(i))) {
+            grupo |= (1 << i);
+            ocupados |= pinos(i);
+          }
+        }
+        SHIFT_LOCK();
+        shift_paralelo(grupo, valores);
+        SHIFT_UNLOCK();
+        pendentes &= ~grupo;
+      }
+    }
+
+    //envia bytes direto da interrupção, sem passar pelo estado preparado nem pelas sombras
+    //as cadeias da mascara devem estar reservadas e nao podem compartilhar pinos entre si
+    IRAM_ATTR void shift_isr(uint8_t mascara_cadeias, const uint8_t *valores){
+      SHIFT_LOCK_ISR();
+      shift_paralelo(mascara_cadeias, valores);
+      SHIFT_UNLOCK_ISR();
+    }
+
+    //reserva cadeias para escrita externa (commit() deixa de envia-las)
+    void reserve(uint8_t mascara_cadeias){
+      reservadas |= mascara_cadeias;
+    }
+
+    //devolve as cadeias ao commit(), que volta a escrever o byte preparado nelas
+    void release(uint8_t mascara_cadeias){
+      reservadas &= ~mascara_cadeias;
+      for (uint8_t i = 0; i < quantidade; i++) {
+        if (mascara_cadeias & (1 << i)) latches[i].invalidate();
+      }
+    }
+
+    //força a reescrita de todas as cadeias no proximo commit
+    void invalidate(){
+      for (uint8_t i = 0; i < quantidade; i++) latches[i].invalidate();
+    }
+
+    uint32_t writes(uint8_t cadeia){
+      return (cadeia < quantidade) ? latches[cadeia].writes() : 0;
+    }
+
+    uint32_t avoided(uint8_t cadeia){
+      return (cadeia < quantidade) ? latches[cadeia].avoided() : 0;
+    }
+
+    uint32_t shift_passes(){
+      return passadas;
+    }
+};
+
+#endif
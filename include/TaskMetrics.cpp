@@ -0,0 +1,140 @@
+#ifndef TASK_METRICS
+#define TASK_METRICS
+
+#include <stdint.h>
+#include <string.h>
+#include <Hal.cpp>
+#include <Scheduler.cpp>
+
+#define METRICAS_MAX_TAREFAS 12 // Tarefas por scheduler acompanhadas
+#define METRICAS_FAIXAS 24      // Faixas (potencias de 2) dos histogramas: a ultima cobre duração >= 4s / atraso >= 70min
+#define METRICAS_JANELA_TAXA 1000 // Janela (ms) do calculo de voltas por segundo do loop
+
+//medidas acumuladas de uma tarefa do scheduler (desde o boot)
+//histogramas em faixas de potencia de 2: faixa 0 = valor 0, faixa i = [2^(i-1), 2^i)
+struct MetricasTarefa{
+  const char *nome;
+  uint32_t sequencia;           // seqlock: impar enquanto o escritor altera a estrutura
+  uint32_t execucoes;
+  uint64_t duracao_total_us;
+  uint32_t duracao_max_us;
+  uint64_t atraso_total_ms;
+  uint32_t atraso_max_ms;
+  uint32_t duracao_us[METRICAS_FAIXAS];
+  uint32_t atraso_ms[METRICAS_FAIXAS];
+};
+
+//instrumentação de um loop (task) e das tarefas do seu scheduler
+//cada instancia tem um unico escritor, a task dona do scheduler (presa a um core), entao nao usa mutex:
+//os contadores de 32 bits sao lidos direto e cada MetricasTarefa é copiada por seqlock (snapshot()),
+//o leitor (http, serial, outro core) tenta de novo se pegou a estrutura no meio de uma escrita.
+class TaskMetrics{
+  private:
+    MetricasTarefa tarefas[METRICAS_MAX_TAREFAS];
+    uint8_t quantidade = 0;
+
+    uint32_t voltas = 0;          // iterações do loop desde o boot
+    uint32_t voltas_janela = 0;
+    uint32_t inicio_janela = 0;
+    uint32_t taxa_x10 = 0;        // voltas por segundo na ultima janela, em decimos
+
+    static uint8_t faixa(uint32_t valor){
+      if (valor == 0) return 0;
+      uint8_t f = 32 - __builtin_clz(valor);
+      return f < METRICAS_FAIXAS ? f : METRICAS_FAIXAS - 1;
+    }
+
+    static void observador(void *contexto, uint8_t id, uint32_t atraso, uint32_t duracao_us){
+      ((TaskMetrics*)contexto)->record(id, atraso, duracao_us);
+    }
+
+  public:
+    TaskMetrics(){
+      memset(tarefas, 0, sizeof(tarefas));
+    }
+
+    //passa a receber as medidas de todas as tarefas do scheduler
+    void attach(Scheduler &agenda){
+      agenda.observe(observador, this, hal_micros);
+    }
+
+    //nome mostrado nos relatorios (id retornado pelo Scheduler::add)
+    void name(uint8_t id, const char *nome){
+      if (id >= METRICAS_MAX_TAREFAS) return;
+      tarefas[id].nome = nome;
+      if (id >= quantidade) quantidade = id + 1;
+    }
+
+    //uma execução de tarefa (chamado pelo Scheduler::run, na task dona)
+    void record(uint8_t id, uint32_t atraso_ms, uint32_t duracao_us){
+      if (id >= METRICAS_MAX_TAREFAS) return;
+      if (id >= quantidade) quantidade = id + 1;
+      MetricasTarefa &m = tarefas[id];
+
+      __atomic_store_n(&m.sequencia, m.sequencia + 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+
+      m.execucoes++;
+      m.duracao_total_us += duracao_us;
+      if (duracao_us > m.duracao_max_us) m.duracao_max_us = duracao_us;
+      m.atraso_total_ms += atraso_ms;
+      if (atraso_ms > m.atraso_max_ms) m.atraso_max_ms = atraso_ms;
+      m.duracao_us[faixa(duracao_us)]++;
+      m.atraso_ms[faixa(atraso_ms)]++;
+
+      __atomic_store_n(&m.sequencia, m.sequencia + 1, __ATOMIC_RELEASE);
+    }
+
+    //uma volta do loop da task (chamado no inicio de cada iteração)
+    void tick(uint32_t agora){
+      __atomic_store_n(&voltas, voltas + 1, __ATOMIC_RELAXED);
+      voltas_janela++;
+      uint32_t passado = agora - inicio_janela;
+      if (passado >= METRICAS_JANELA_TAXA) {
+        __atomic_store_n(&taxa_x10, (uint32_t)((uint64_t)voltas_janela * 10000 / passado), __ATOMIC_RELAXED);
+        voltas_janela = 0;
+        inicio_janela = agora;
+      }
+    }
+
+    //copia consistente das medidas de uma tarefa (false se o escritor nao deu folga em 8 tentativas)
+    bool snapshot(uint8_t id, MetricasTarefa &copia) const{
+      if (id >= quantidade) return false;
+      const MetricasTarefa &m = tarefas[id];
+      for (uint8_t tentativa = 0; tentativa < 8; tentativa++) {
+        uint32_t antes = __atomic_load_n(&m.sequencia, __ATOMIC_ACQUIRE);
+        if (antes & 1) continue;
+        memcpy(&copia, &m, sizeof(copia));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&m.sequencia, __ATOMIC_RELAXED) == antes) return true;
+      }
+      return false;
+    }
+
+    //limite superior da faixa onde o histograma atinge o percentual (0 a 100) das amostras
+    static uint32_t percentile(const uint32_t faixas[METRICAS_FAIXAS], uint32_t total, uint8_t percentual){
+      if (total == 0) return 0;
+      uint32_t alvo = (uint32_t)(((uint64_t)total * percentual + 99) / 100);
+      uint32_t acumulado = 0;
+      for (uint8_t f = 0; f < METRICAS_FAIXAS; f++) {
+        acumulado += faixas[f];
+        if (acumulado >= alvo) return f == 0 ? 0 : ((uint32_t)1 << f) - 1;
+      }
+      return UINT32_MAX;
+    }
+
+    uint8_t size() const{
+      return quantidade;
+    }
+
+    uint32_t loops() const{
+      return __atomic_load_n(&voltas, __ATOMIC_RELAXED);
+    }
+
+    //voltas por segundo na ultima janela, em decimos
+    uint32_t loop_rate_x10() const{
+      return __atomic_load_n(&taxa_x10, __ATOMIC_RELAXED);
+    }
+};
+
+#endif
@@ -0,0 +1,272 @@
+#ifndef TLS_CLIENT
+#define TLS_CLIENT
+
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+#include <mbedtls/x509.h>
+#include <Hal.cpp>
+
+#define TLS_TIMEOUT 10000        // Tempo maximo esperando bytes da resposta
+#define TLS_MAX_LINHA 128        // Linha de status/cabeçalho guardada (cabeçalhos maiores sao lidos e ignorados)
+#define TLS_MAX_DRENO 4096       // Resto do corpo lido no end() para manter a conexão (acima disso fecha)
+
+//medidas do cliente (mostradas em /metricas e no resumo da serial)
+struct MetricasTls{
+  uint32_t requisicoes;
+  uint32_t conexoes;            // handshakes completos
+  uint32_t reusos;              // requisições na conexão ja aberta (keep-alive)
+  uint32_t falhas;              // conexão, timeout ou resposta malformada
+  uint32_t falhas_certificado;  // cadeia fora das raizes, impressão diferente da fixada ou host sem nenhuma das duas
+  uint32_t handshake_ultimo_ms;
+  uint32_t handshake_max_ms;
+  uint32_t heap_sessao_bytes;   // heap que a conexão aberta ocupa (medido depois do handshake)
+  uint32_t heap_pico_bytes;     // maior queda do heap minimo durante um handshake (0 se o pico do boot foi maior)
+};
+
+//cliente https/1.1 para um host, com a conexão TLS mantida entre requisições (keep-alive):
+//  - o handshake (segundos de cpu e dezenas de KB de heap) so acontece quando o servidor fechou a conexão
+//  - o certificado do servidor é conferido pela cadeia ate as raizes (setCACert) e/ou pela impressão digital SHA-256
+//    fixadas no begin(); sem nenhuma das duas a conexão é recusada (nunca conecta sem verificar)
+//  - o corpo é entregue cru por read(), ja sem o enquadramento chunked, para um parser em fluxo (JsonStream)
+//a api de sessões (tickets) do mbedtls nao é exposta pelo WiFiClientSecure do core 2.x: entre requisições
+//espaçadas o ganho vem de agrupar as chamadas ao mesmo host enquanto a conexão esta aberta.
+class TlsClient{
+  private:
+    WiFiClientSecure cliente;
+    const char *host = nullptr;
+    const char *raizes = nullptr;
+    const char *impressao = nullptr;
+    uint16_t porta = 443;
+    MetricasTls metricas;
+
+    // resposta atual
+    bool chunked = false;
+    bool manter = false;        // servidor aceitou keep-alive
+    bool fim_corpo = true;
+    int32_t restante = 0;       // bytes do corpo (ou do chunk atual); -1 ate o servidor fechar
+
+    int ler_byte(uint32_t inicio){
+      while (!cliente.available()) {
+        if (!cliente.connected() || millis() - inicio > TLS_TIMEOUT) return -1;
+        delay(1);
+      }
+      return cliente.read();
+    }
+
+    //le uma linha terminada em CRLF (false em timeout); o excesso alem de tamanho - 1 é descartado
+    bool ler_linha(char *linha, size_t tamanho, uint32_t inicio){
+      size_t n = 0;
+      while (true) {
+        int c = ler_byte(inicio);
+        if (c < 0) return false;
+        if (c == '\n') break;
+        if (c != '\r' && n < tamanho - 1) linha[n++] = (char)c;
+      }
+      linha[n] = '\0';
+      return true;
+    }
+
+    //prefixo sem diferenciar maiusculas (nomes de cabeçalho)
+    static bool comeca_com(const char *linha, const char *prefixo){
+      return strncasecmp(linha, prefixo, strlen(prefixo)) == 0;
+    }
+
+    static const char *valor_cabecalho(const char *linha){
+      const char *valor = strchr(linha, ':');
+      if (valor == nullptr) return "";
+      valor++;
+      while (*valor == ' ') valor++;
+      return valor;
+    }
+
+    bool conectar(){
+      if (cliente.connected()) {
+        metricas.reusos++;
+        return true;
+      }
+      cliente.stop();
+
+      bool tem_raizes = raizes != nullptr && raizes[0] != '\0';
+      bool tem_impressao = impressao != nullptr && impressao[0] != '\0';
+      if (!tem_raizes && !tem_impressao) {
+        metricas.falhas_certificado++;
+        hal_log_erro("TLS", "Sem raizes nem impressao digital para %s, conexao recusada", host);
+        return false;
+      }
+
+      uint32_t heap_antes = ESP.getFreeHeap();
+      uint32_t minimo_antes = ESP.getMinFreeHeap();
+      if (tem_raizes) cliente.setCACert(raizes); // cadeia e nome do host validados pelo mbedtls no handshake
+      else cliente.setInsecure();                // so a impressão, conferida depois do handshake
+      uint32_t inicio = millis();
+      if (!cliente.connect(host, porta)) {
+        char erro[64];
+        if (cliente.lastError(erro, sizeof(erro)) == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
+          metricas.falhas_certificado++;
+          hal_log_erro("TLS", "Certificado de %s nao confere com as raizes configuradas", host);
+        } else {
+          metricas.falhas++;
+          hal_log_erro("TLS", "Falha ao conectar em %s", host);
+        }
+        return false;
+      }
+      uint32_t duracao = millis() - inicio;
+
+      metricas.conexoes++;
+      metricas.handshake_ultimo_ms = duracao;
+      if (duracao > metricas.handshake_max_ms) metricas.handshake_max_ms = duracao;
+      uint32_t heap_depois = ESP.getFreeHeap();
+      metricas.heap_sessao_bytes = heap_antes > heap_depois ? heap_antes - heap_depois : 0;
+      uint32_t minimo_depois = ESP.getMinFreeHeap();
+      if (minimo_depois < minimo_antes && heap_antes - minimo_depois > metricas.heap_pico_bytes) {
+        metricas.heap_pico_bytes = heap_antes - minimo_depois;
+      }
+
+      if (tem_impressao && !cliente.verify(impressao, host)) {
+        metricas.falhas_certificado++;
+        hal_log_erro("TLS", "Certificado de %s nao confere com a impressao fixada", host);
+        cliente.stop();
+        return false;
+      }
+      hal_log("TLS", "Handshake com %s em %lu ms, %lu bytes de heap", host, (unsigned long)duracao, (unsigned long)metricas.heap_sessao_bytes);
+      return true;
+    }
+
+    //le a linha de tamanho do proximo chunk (e o trailer do ultimo)
+    bool proximo_chunk(uint32_t inicio){
+      char linha[TLS_MAX_LINHA];
+      if (!ler_linha(linha, sizeof(linha), inicio)) return false;
+      restante = (int32_t)strtol(linha, nullptr, 16);
+      if (restante > 0) return true;
+      while (ler_linha(linha, sizeof(linha), inicio) && linha[0] != '\0') {} // trailer
+      fim_corpo = true;
+      return true;
+    }
+
+  public:
+    TlsClient(){
+      memset(&metricas, 0, sizeof(metricas));
+    }
+
+    //raizes_pem: certificados raiz aceitos (PEM, varios concatenados, ver TlsRoots.cpp); impressao: SHA-256 do
+    //certificado do servidor em hexadecimal ("AB:CD:..." ou "abcd...") conferido tambem. vazios nao verificam:
+    //com os dois vazios toda conexão falha (conta em falhas_certificado)
+    void begin(const char *host_servidor, const char *raizes_pem, const char *impressao_sha256 = nullptr, uint16_t porta_servidor = 443){
+      host = host_servidor;
+      raizes = raizes_pem;
+      impressao = impressao_sha256;
+      porta = porta_servidor;
+    }
+
+    //envia GET caminho e le status e cabeçalhos; retorna o status http (negativo em falha)
+    int get(const char *caminho){
+      metricas.requisicoes++;
+      if (!fim_corpo) end(); // resposta anterior nao consumida
+
+      // uma conexão reaproveitada pode ter sido fechada pelo servidor no meio tempo: tenta de novo do zero
+      for (uint8_t tentativa = 0; tentativa < 2; tentativa++) {
+        bool reuso = cliente.connected();
+        if (!conectar()) return -1;
+
+        cliente.printf("GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\nUser-Agent: BioControl\r\n\r\n", caminho, host);
+
+        uint32_t inicio = millis();
+        char linha[TLS_MAX_LINHA];
+        if (!ler_linha(linha, sizeof(linha), inicio)) {
+          cliente.stop();
+          if (reuso) continue;
+          metricas.falhas++;
+          return -1;
+        }
+
+        int status = 0;
+        if (sscanf(linha, "HTTP/1.%*d %d", &status) != 1) {
+          metricas.falhas++;
+          cliente.stop();
+          return -1;
+        }
+
+        chunked = false;
+        manter = true;
+        restante = -1;
+        while (true) {
+          if (!ler_linha(linha, sizeof(linha), inicio)) {
+            metricas.falhas++;
+            cliente.stop();
+            return -1;
+          }
+          if (linha[0] == '\0') break;
+          if (comeca_com(linha, "Content-Length:")) restante = atol(valor_cabecalho(linha));
+          else if (comeca_com(linha, "Transfer-Encoding:")) chunked = strcasestr(linha, "chunked") != nullptr;
+          else if (comeca_com(linha, "Connection:")) manter = strcasestr(linha, "close") == nullptr;
+        }
+
+        if (chunked) restante = 0; // o tamanho vem na linha de cada chunk
+        if (restante == -1) manter = false; // corpo até o servidor fechar
+        fim_corpo = !chunked && restante == 0;
+        return status;
+      }
+      return -1;
+    }
+
+    //le ate tamanho bytes do corpo; 0 no fim do corpo, negativo em timeout/conexão perdida
+    int read(char *buffer, size_t tamanho){
+      if (fim_corpo) return 0;
+      uint32_t inicio = millis();
+      if (chunked && restante == 0) {
+        if (!proximo_chunk(inicio)) return -1;
+        if (fim_corpo) return 0;
+      }
+
+      while (!cliente.available()) {
+        if (!cliente.connected()) {
+          fim_corpo = true;
+          return restante == -1 ? 0 : -1; // sem Content-Length o fim do corpo é o fechamento
+        }
+        if (millis() - inicio > TLS_TIMEOUT) return -1;
+        delay(1);
+      }
+
+      size_t pedir = tamanho;
+      if (restante >= 0 && (size_t)restante < pedir) pedir = restante;
+      int lidos = cliente.read((uint8_t*)buffer, pedir);
+      if (lidos <= 0) return lidos;
+      if (restante >= 0) {
+        restante -= lidos;
+        if (restante == 0) {
+          if (chunked) {
+            char fim[4];
+            ler_linha(fim, sizeof(fim), inicio); // CRLF depois dos dados do chunk
+          } else {
+            fim_corpo = true;
+          }
+        }
+      }
+      return lidos;
+    }
+
+    //encerra a resposta: descarta o resto do corpo (se for pequeno) para reaproveitar a conexão, senão fecha
+    void end(){
+      char descarte[64];
+      uint32_t drenados = 0;
+      while (manter && !fim_corpo && drenados < TLS_MAX_DRENO) {
+        int lidos = read(descarte, sizeof(descarte));
+        if (lidos <= 0) break;
+        drenados += lidos;
+      }
+      if (!manter || !fim_corpo) cliente.stop();
+      fim_corpo = true;
+    }
+
+    //fecha a conexão (hosts consultados raramente: devolve o heap da sessão ate a proxima requisição)
+    void close(){
+      cliente.stop();
+      fim_corpo = true;
+    }
+
+    const MetricasTls &metrics() const{
+      return metricas;
+    }
+};
+
+#endif
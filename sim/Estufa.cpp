@@ -0,0 +1,173 @@
+#ifndef ESTUFA
+#define ESTUFA
+
+#include <stdint.h>
+#include <math.h>
+#include <FlowMeter.cpp>
+
+//gerador pseudo-aleatorio deterministico (mesma semente = mesma simulação)
+class Aleatorio{
+  private:
+    uint32_t estado;
+
+  public:
+    Aleatorio(uint32_t semente = 1) : estado(semente ? semente : 1) {}
+
+    uint32_t next(){
+      // xorshift32
+      estado ^= estado << 13;
+      estado ^= estado >> 17;
+      estado ^= estado << 5;
+      return estado;
+    }
+
+    //valor uniforme em [0, 1)
+    double uniform(){
+      return (next() >> 8) * (1.0 / 16777216.0);
+    }
+};
+
+//clima externo sintetico: ciclo diario de temperatura e umidade, dias mais quentes/frios e chuva
+//(substitui a api de clima no simulador)
+class ClimaExterno{
+  private:
+    Aleatorio &aleatorio;
+    int32_t dia_atual = -1;
+    double desvio_dia = 0;   // dia mais quente ou mais frio que a media
+    bool dia_chuvoso = false;
+    double inicio_chuva = 0; // horas
+    double duracao_chuva = 0;
+
+  public:
+    double temperatura = 20;
+    double umidade = 70;
+    bool chuva = false;
+
+    double temp_media = 22;
+    double temp_amplitude = 7;
+
+    ClimaExterno(Aleatorio &gerador) : aleatorio(gerador) {}
+
+    //previsão para daqui a horas_frente (sem sortear nada: a simulação continua igual com ou sem previsão)
+    //o dia atual é conhecido; dias seguintes ficam na media e sem chuva, com a amplitude incerta
+    void forecast(uint32_t segundos_dia, int32_t dia, uint32_t horas_frente, int16_t &temperatura_x10, uint8_t &umid, uint8_t &chuva_prob) const{
+      uint32_t segundos = segundos_dia + horas_frente * 3600;
+      bool mesmo_dia = dia == dia_atual && segundos < 86400;
+      double hora = (segundos % 86400) / 3600.0;
+      double ciclo = sin((hora - 9) * M_PI / 12);
+      bool chove = mesmo_dia && dia_chuvoso && hora >= inicio_chuva && hora < inicio_chuva + duracao_chuva;
+
+      double t = temp_media + (mesmo_dia ? desvio_dia : 0) + temp_amplitude * ciclo - (chove ? 4 : 0);
+      double u = 70 - 20 * ciclo + (chove ? 25 : 0);
+      if (u > 99) u = 99;
+      if (u < 20) u = 20;
+      temperatura_x10 = (int16_t)lround(t * 10);
+      umid = (uint8_t)u;
+      chuva_prob = chove ? 80 : mesmo_dia ? 0 : 25;
+    }
+
+    void update(uint32_t segundos_dia, int32_t dia){
+      if (dia != dia_atual) {
+        dia_atual = dia;
+        desvio_dia = (aleatorio.uniform() - 0.5) * 8;
+        dia_chuvoso = aleatorio.uniform() < 0.25;
+        inicio_chuva = aleatorio.uniform() * 20;
+        duracao_chuva = 1 + aleatorio.uniform() * 5;
+      }
+
+      double hora = segundos_dia / 3600.0;
+      // minima as 6h, maxima as 15h (aproximado por uma senoide deslocada)
+      double ciclo = sin((hora - 9) * M_PI / 12);
+      chuva = dia_chuvoso && hora >= inicio_chuva && hora < inicio_chuva + duracao_chuva;
+
+      temperatura = temp_media + desvio_dia + temp_amplitude * ciclo - (chuva ? 4 : 0);
+      umidade = 70 - 20 * ciclo + (chuva ? 25 : 0);
+      if (umidade > 99) umidade = 99;
+      if (umidade < 20) umidade = 20;
+    }
+};
+
+//modelo termico e de umidade de primeira ordem da estufa e da caixa d'agua
+//  - a estufa troca calor com o ar externo (muito mais rapido com os exaustores ligados)
+//  - sol e leds aquecem, plantas transpiram de dia, irrigação umidifica
+//  - caixa d'agua: irrigação e evaporação esvaziam, a solenoide enche; as boias seguem o nivel
+class Estufa{
+  public:
+    // estado
+    double temperatura = 24;
+    double umidade = 75;
+    double nivel_litros = 120;
+
+    // parametros
+    double tau_fechada_s = 90 * 60;   // constante de tempo com os exaustores desligados
+    double tau_exaustor_s = 8 * 60;   // com os exaustores ligados
+    double ganho_sol_c_h = 9;         // aquecimento maximo do sol (C por hora, meio dia)
+    double ganho_leds_c_h = 1.5;      // aquecimento dos leds no maximo
+    double transpiracao_h = 6;        // ganho de umidade das plantas de dia (% por hora)
+    double irrigacao_umid_h = 20;     // ganho de umidade com a irrigação ligada (% por hora)
+
+    double capacidade_litros = 200;
+    double boia_max_litros = 180;
+    double boia_min_litros = 60;
+    double enchimento_l_min = 12;
+    double irrigacao_l_min = 6;
+    double evaporacao_l_h = 0.5;
+
+    //avança dt segundos com as saidas atuais
+    //brilho_leds em [0, 1], sol em [0, 1] (0 a noite)
+    void step(double dt, const ClimaExterno &fora, bool exaustor, double brilho_leds, bool irrigando, bool enchendo, double sol){
+      double tau = exaustor ? tau_exaustor_s : tau_fechada_s;
+      double troca = dt / tau;
+      if (troca > 1) troca = 1;
+
+      temperatura += (fora.temperatura - temperatura) * troca;
+      temperatura += (ganho_sol_c_h * sol + ganho_leds_c_h * brilho_leds) * dt / 3600;
+
+      umidade += (fora.umidade - umidade) * troca;
+      umidade += (transpiracao_h * sol + (irrigando ? irrigacao_umid_h : 0)) * dt / 3600;
+      if (umidade > 99) umidade = 99;
+      if (umidade < 5) umidade = 5;
+
+      nivel_litros -= evaporacao_l_h * dt / 3600;
+      if (irrigando) nivel_litros -= irrigacao_l_min * dt / 60;
+      if (enchendo) nivel_litros += enchimento_l_min * dt / 60;
+      if (nivel_litros < 0) nivel_litros = 0;
+      if (nivel_litros > capacidade_litros) nivel_litros = capacidade_litros;
+    }
+
+    bool float_max(){
+      return nivel_litros >= boia_max_litros;
+    }
+
+    bool float_min(){
+      return nivel_litros >= boia_min_litros;
+    }
+
+    //intensidade do sol (0 a 1) pela hora do dia, nascer as 6h e por as 18h
+    static double sun(uint32_t segundos_dia){
+      double hora = segundos_dia / 3600.0;
+      if (hora < 6 || hora > 18) return 0;
+      return sin((hora - 6) * M_PI / 12);
+    }
+};
+
+//bomba da aquaponia com o sensor de vazão: gera os pulsos que o PCNT contaria
+class BombaSimulada{
+  public:
+    double vazao_l_min = 8;
+    bool quebrada = false;
+    double pulsos_por_litro = 450;
+
+    double pulsos = 0;      // fração acumulada
+    uint32_t contador = 0;  // contador do PCNT (0 a FLUXO_LIMITE_PCNT-1)
+
+    void step(double dt, bool ligada){
+      if (!ligada || quebrada) return;
+      pulsos += vazao_l_min / 60 * pulsos_por_litro * dt;
+      uint32_t inteiros = (uint32_t)pulsos;
+      pulsos -= inteiros;
+      contador = (contador + inteiros) % FLUXO_LIMITE_PCNT;
+    }
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef REGISTRADOR_595
+#define REGISTRADOR_595
+
+#include <stdint.h>
+#include <ShiftChains.cpp>
+
+#define REG595_MAX 4
+
+//74HC595 simulado: acompanha os pinos do backend de pc do ShiftChains (shift_gpio_espiao)
+//e reproduz o chip: borda de subida do clock desloca o data, borda de subida do latch copia para a saida.
+//cada latch gera um frame; frames e bordas sao contados para comparar versões do driver.
+class Registrador595{
+  private:
+    struct Chip{
+      uint64_t data;
+      uint64_t clock;
+      uint64_t latch;
+      uint8_t deslocamento;  // registrador interno
+      uint8_t saida;         // registrador de saida (o que os reles/leds veem)
+      uint32_t frames;       // quantidade de latches
+      uint32_t mudancas;     // latches que mudaram a saida
+    };
+
+    Chip chips[REG595_MAX];
+    uint8_t quantidade = 0;
+    uint64_t anterior = 0;
+    uint32_t bordas = 0;
+    uint32_t hash = 2166136261u; // FNV-1a das saidas, na ordem em que mudaram
+
+    static Registrador595 *instancia;
+
+    static void espiao(uint64_t nivel){
+      instancia->borda(nivel);
+    }
+
+    void borda(uint64_t nivel){
+      uint64_t subiu = nivel & ~anterior;
+      anterior = nivel;
+      if (subiu) bordas++;
+
+      for (uint8_t i = 0; i < quantidade; i++) {
+        Chip &chip = chips[i];
+        if (subiu & chip.clock) {
+          chip.deslocamento = (chip.deslocamento << 1) | ((nivel & chip.data) ? 1 : 0);
+        }
+        if (subiu & chip.latch) {
+          chip.frames++;
+          if (chip.saida != chip.deslocamento) {
+            chip.saida = chip.deslocamento;
+            chip.mudancas++;
+            hash = (hash ^ (uint32_t)(i << 8 | chip.saida)) * 16777619u;
+          }
+        }
+      }
+    }
+
+  public:
+    //mesmos pinos passados ao ShiftChains::add_chain (na mesma ordem)
+    uint8_t add_chip(uint8_t pin_data, uint8_t pin_clock, uint8_t pin_latch){
+      if (quantidade >= REG595_MAX) return 0xFF;
+      Chip &chip = chips[quantidade];
+      chip.data = ((uint64_t)1) << pin_data;
+      chip.clock = ((uint64_t)1) << pin_clock;
+      chip.latch = ((uint64_t)1) << pin_latch;
+      chip.deslocamento = 0;
+      chip.saida = 0;
+      chip.frames = 0;
+      chip.mudancas = 0;
+      return quantidade++;
+    }
+
+    void begin(){
+      instancia = this;
+      anterior = shift_gpio_nivel;
+      shift_gpio_espiao = espiao;
+    }
+
+    uint8_t output(uint8_t chip){
+      return chips[chip].saida;
+    }
+
+    uint32_t frames(uint8_t chip){
+      return chips[chip].frames;
+    }
+
+    uint32_t changes(uint8_t chip){
+      return chips[chip].mudancas;
+    }
+
+    uint32_t edges(){
+      return bordas;
+    }
+
+    uint32_t signature(){
+      return hash;
+    }
+};
+
+Registrador595 *Registrador595::instancia = nullptr;
+
+#endif
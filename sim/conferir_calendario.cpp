@@ -0,0 +1,216 @@
+//==============================================================================
+// Conferência do Calendario e da Agenda Cron (pc)
+//==============================================================================
+// compara as contas em tempo constante do OffTime e do CronSchedule com referencias lentas e obvias:
+//   - OffTime::civil (e days_from_civil) contra o gmtime_r da libc em epochs aleatorios de 1900 a 2400,
+//     incluindo os negativos de antes do NTP
+//   - CronSchedule::next contra uma busca minuto a minuto em expressões aleatorias (listas, faixas, passos,
+//     domingo = 7, dia do mes e da semana juntos); cada expressão é seguida por alguns disparos seguidos
+//   - expressões recusadas pelo compile nunca disparam na busca (8 anos, o bastante para um 29/02)
+// a referencia da agenda nao usa o parser: o gerador escreve o texto e marca os valores aceitos ao mesmo tempo.
+// sai com 1 na primeira divergencia.
+//
+// uso: conferir_calendario [casos] [--semente N]
+//   pio run -e native_calendario && .pio/build/native_calendario/program
+//   ou: g++ -std=gnu++11 -O2 -Iinclude -Isim sim/conferir_calendario.cpp -o conferir_calendario && ./conferir_calendario
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <CronSchedule.cpp>
+#include "Estufa.cpp"
+
+#define CASOS_PADRAO 20000
+#define EPOCH_MIN (-2208988800LL)     // 1900-01-01
+#define EPOCH_MAX (13569465600LL)     // 2400-01-01
+#define DIAS_BUSCA (366 * 9)          // Maior espera por um disparo (29/02 com 2100 no meio: 8 anos)
+#define DISPAROS_SEGUIDOS 5           // next() encadeados a partir de cada epoch sorteado
+
+Aleatorio aleatorio;
+
+int64_t sortear_epoch(){
+  uint64_t bruto = ((uint64_t)aleatorio.next() << 32) | aleatorio.next();
+  int64_t epoch = EPOCH_MIN + (int64_t)(bruto % (uint64_t)(EPOCH_MAX - EPOCH_MIN));
+  switch (aleatorio.next() % 4) {
+    case 0: return epoch - epoch % 60;           // em cima de um minuto
+    case 1: return epoch - epoch % SEGUNDOS_DIA; // meia noite (ou o fim do dia antes de 1970)
+    default: return epoch;
+  }
+}
+
+//------------------------------------------------------------------------------
+// OffTime::civil contra gmtime_r
+//------------------------------------------------------------------------------
+bool conferir_civil(int64_t epoch){
+  time_t t = (time_t)epoch;
+  struct tm ref;
+  if (gmtime_r(&t, &ref) == nullptr) {
+    printf("gmtime_r recusou %lld\n", (long long)epoch);
+    return false;
+  }
+  DataHora data;
+  OffTime::civil(epoch, data);
+  bool confere = data.ano == ref.tm_year + 1900 && data.mes == ref.tm_mon + 1 && data.dia == ref.tm_mday &&
+                 data.hora == ref.tm_hour && data.minuto == ref.tm_min && data.segundo == ref.tm_sec &&
+                 data.dia_semana == ref.tm_wday && data.minuto_dia == ref.tm_hour * 60 + ref.tm_min;
+  int64_t dias = (epoch - ((epoch % SEGUNDOS_DIA) + SEGUNDOS_DIA) % SEGUNDOS_DIA) / SEGUNDOS_DIA;
+  if (OffTime::days_from_civil(data.ano, data.mes, data.dia) != dias) confere = false;
+  if (!confere) {
+    printf("civil(%lld) = %04d-%02d-%02d %02d:%02d:%02d semana %d, gmtime = %04d-%02d-%02d %02d:%02d:%02d semana %d\n",
+           (long long)epoch, data.ano, data.mes, data.dia, data.hora, data.minuto, data.segundo, data.dia_semana,
+           ref.tm_year + 1900, ref.tm_mon + 1, ref.tm_mday, ref.tm_hour, ref.tm_min, ref.tm_sec, ref.tm_wday);
+  }
+  return confere;
+}
+
+//------------------------------------------------------------------------------
+// Expressão cron aleatoria com os valores aceitos de cada campo marcados a parte
+//------------------------------------------------------------------------------
+struct Referencia{
+  char texto[5 * 3 * 9];  // ate 3 itens "NN-NN/NN" por campo; as que nao cabem em CRON_MAX_EXPRESSAO sao sorteadas de novo
+  bool aceito[5][60];  // minuto, hora, dia, mes, dia da semana (0-6)
+  bool restrito[5];    // campo diferente de '*' (qualquer passo conta, como no compile)
+};
+
+void marcar(Referencia &r, uint8_t campo, uint8_t valor){
+  r.aceito[campo][campo == 4 ? valor % 7 : valor] = true; // 7 = domingo
+}
+
+//um item: "*", "N", "N-M", "*/P", "N/P" ou "N-M/P"; devolve os caracteres escritos
+int escrever_item(Referencia &r, uint8_t campo, uint8_t minimo, uint8_t maximo, char *saida, int espaco){
+  uint8_t tipo = aleatorio.next() % 6;
+  uint8_t de = minimo + aleatorio.next() % (maximo - minimo + 1);
+  uint8_t ate = de + aleatorio.next() % (maximo - de + 1);
+  uint8_t passo = 1 + aleatorio.next() % (maximo - minimo + 1);
+  int n;
+  switch (tipo) {
+    case 0:  n = snprintf(saida, espaco, "*");                        de = minimo; ate = maximo; passo = 1; break;
+    case 1:  n = snprintf(saida, espaco, "%d", de);                   ate = de; passo = 1; break;
+    case 2:  n = snprintf(saida, espaco, "%d-%d", de, ate);           passo = 1; break;
+    case 3:  n = snprintf(saida, espaco, "*/%d", passo);              de = minimo; ate = maximo; break;
+    case 4:  n = snprintf(saida, espaco, "%d/%d", de, passo);         ate = maximo; break;
+    default: n = snprintf(saida, espaco, "%d-%d/%d", de, ate, passo); break;
+  }
+  if (tipo != 0) r.restrito[campo] = true;
+  for (uint16_t v = de; v <= ate; v += passo) marcar(r, campo, (uint8_t)v);
+  return n;
+}
+
+//campos quase sempre "*" nos dias e meses, senao quase nenhuma expressão dispararia num intervalo curto
+void sortear_expressao(Referencia &r){
+  static const uint8_t minimos[5] = {0, 0, 1, 1, 0};
+  static const uint8_t maximos[5] = {59, 23, 31, 12, 7};
+  static const uint8_t chance_estrela[5] = {10, 30, 50, 60, 50}; // %
+  int usado;
+  do {
+    memset(&r, 0, sizeof(r));
+    usado = 0;
+    for (uint8_t campo = 0; campo < 5; campo++) {
+      if (campo > 0) r.texto[usado++] = ' ';
+      if (aleatorio.next() % 100 < chance_estrela[campo]) {
+        r.texto[usado++] = '*';
+        for (uint8_t v = minimos[campo]; v <= maximos[campo]; v++) marcar(r, campo, v);
+        continue;
+      }
+      uint8_t itens = 1 + aleatorio.next() % 3;
+      for (uint8_t i = 0; i < itens; i++) {
+        if (i > 0) r.texto[usado++] = ',';
+        usado += escrever_item(r, campo, minimos[campo], maximos[campo], r.texto + usado, 9);
+      }
+    }
+    r.texto[usado] = '\0';
+  } while (usado >= CRON_MAX_EXPRESSAO);
+}
+
+bool dia_aceito(const Referencia &r, const struct tm &data){
+  bool pelo_dia = r.aceito[2][data.tm_mday];
+  bool pela_semana = r.aceito[4][data.tm_wday];
+  if (!r.aceito[3][data.tm_mon + 1]) return false;
+  return r.restrito[2] && r.restrito[4] ? pelo_dia || pela_semana : pelo_dia && pela_semana;
+}
+
+//primeiro minuto estritamente depois de depois aceito pela referencia, olhando minuto a minuto
+//(o dia inteiro é pulado de uma vez quando a data nao é aceita); CRON_NUNCA se nao achar em DIAS_BUSCA
+int64_t buscar(const Referencia &r, int64_t depois){
+  int64_t minuto = (depois - ((depois % 60) + 60) % 60) / 60 + 1;
+  int64_t limite = minuto + (int64_t)DIAS_BUSCA * 1440;
+  while (minuto < limite) {
+    int64_t dia = (minuto - ((minuto % 1440) + 1440) % 1440) / 1440;
+    time_t t = (time_t)(dia * SEGUNDOS_DIA);
+    struct tm data;
+    gmtime_r(&t, &data);
+    if (dia_aceito(r, data)) {
+      for (; minuto < (dia + 1) * 1440; minuto++) {
+        int64_t minuto_dia = minuto - dia * 1440;
+        if (r.aceito[1][minuto_dia / 60] && r.aceito[0][minuto_dia % 60]) return minuto * 60;
+      }
+    }
+    minuto = (dia + 1) * 1440;
+  }
+  return CRON_NUNCA;
+}
+
+bool conferir_cron(const Referencia &r, int64_t epoch, uint32_t &disparos, uint32_t &recusadas){
+  ExpressaoCron e;
+  if (!CronSchedule::compile(r.texto, e)) {
+    recusadas++;
+    int64_t ref = buscar(r, epoch);
+    if (ref != CRON_NUNCA) {
+      printf("\"%s\" recusada pelo compile, mas dispara em %lld\n", r.texto, (long long)ref);
+      return false;
+    }
+    return true;
+  }
+  int64_t depois = epoch;
+  for (uint8_t i = 0; i < DISPAROS_SEGUIDOS; i++) {
+    int64_t calculado = CronSchedule::next(e, depois);
+    int64_t ref = buscar(r, depois);
+    if (calculado != ref) {
+      printf("\"%s\" depois de %lld: next = %lld, busca = %lld\n",
+             r.texto, (long long)depois, (long long)calculado, (long long)ref);
+      return false;
+    }
+    if (ref == CRON_NUNCA) break;
+    disparos++;
+    depois = ref;
+  }
+  return true;
+}
+
+int main(int argc, char **argv){
+  uint32_t casos = CASOS_PADRAO;
+  uint32_t semente = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--semente") == 0 && i + 1 < argc) semente = strtoul(argv[++i], nullptr, 10);
+    else if (argv[i][0] != '-') casos = strtoul(argv[i], nullptr, 10);
+    else {
+      printf("uso: %s [casos] [--semente N]\n", argv[0]);
+      return 1;
+    }
+  }
+  aleatorio = Aleatorio(semente);
+
+  // bordas fixas: 1970 e o segundo antes, 29/02 de 2000 e de 2400, 28/02 -> 01/03 de 2100 (sem 29), 31/12/2100, 1900
+  static const int64_t bordas[] = {0, -1, -SEGUNDOS_DIA, 951782400LL, 951868799LL, 4107542399LL, 4107542400LL,
+                                   4133894400LL, 13574563200LL, 13574649599LL, EPOCH_MIN};
+  for (uint8_t i = 0; i < sizeof(bordas) / sizeof(bordas[0]); i++) {
+    if (!conferir_civil(bordas[i])) return 1;
+  }
+  for (uint32_t i = 0; i < casos; i++) {
+    if (!conferir_civil(sortear_epoch())) return 1;
+  }
+
+  uint32_t disparos = 0, recusadas = 0;
+  Referencia r;
+  for (uint32_t i = 0; i < casos; i++) {
+    sortear_expressao(r);
+    if (!conferir_cron(r, sortear_epoch(), disparos, recusadas)) return 1;
+  }
+
+  printf("civil confere com gmtime_r em %lu epochs; next confere com a busca minuto a minuto em %lu expressoes "
+         "(%lu disparos, %lu recusadas sem disparo) [semente %lu]\n",
+         (unsigned long)casos, (unsigned long)casos, (unsigned long)disparos, (unsigned long)recusadas, (unsigned long)semente);
+  return 0;
+}
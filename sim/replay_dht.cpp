@@ -0,0 +1,140 @@
+//==============================================================================
+// Reprodução de um Trace do DHT11 pelo Filtro (pc)
+//==============================================================================
+// passa cada quadro gravado (sim/dht/) pelo mesmo caminho da task de controle: checksum, DhtRmt::convert e os
+// SensorFilter de temperatura e umidade com JANELA_FILTRO_DHT / EMA_SHIFT_DHT do FarmControl.cpp. Confere:
+//   - a mediana contra uma ordenação completa das ultimas JANELA_FILTRO_DHT leituras aceitas
+//   - o valor filtrado contra uma EMA em double da mesma mediana (no maximo 1 decimo de diferença)
+//   - os picos (mais de PICO_X10 longe da mediana da janela) nunca aparecem na mediana nem movem o filtrado
+//   - checksum errado e fora da faixa nunca chegam ao filtro
+// sai com 1 na primeira divergencia.
+//
+// uso: pio run -e native_replay_dht && .pio/build/native_replay_dht/program [trace]
+//   ou: g++ -std=gnu++11 -O2 -Iinclude -Isim sim/replay_dht.cpp -o replay_dht && ./replay_dht sim/dht/dht11_estufa.csv
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <FarmControl.cpp>
+
+#define TRACE_PADRAO "sim/dht/dht11_estufa.csv"
+#define PICO_X10 50            // Distancia da mediana (decimos) que marca uma leitura como pico
+#define PASSO_MAX_PICO_X10 3   // Maior passo do valor filtrado na chegada de um pico (decimos)
+
+//------------------------------------------------------------------------------
+// Referencia: mediana por ordenação e EMA em double sobre as mesmas leituras
+//------------------------------------------------------------------------------
+struct Referencia{
+  int16_t janela[JANELA_FILTRO_DHT];
+  uint8_t quantidade = 0;
+  uint8_t proxima = 0;
+  double ema = 0;
+
+  int16_t push(int16_t valor){
+    janela[proxima] = valor;
+    proxima = (proxima + 1) % JANELA_FILTRO_DHT;
+    bool primeira = quantidade == 0;
+    if (quantidade < JANELA_FILTRO_DHT) quantidade++;
+    int16_t ordenada[JANELA_FILTRO_DHT];
+    for (uint8_t i = 0; i < quantidade; i++) {
+      uint8_t j = i;
+      for (; j > 0 && ordenada[j - 1] > janela[i]; j--) ordenada[j] = ordenada[j - 1];
+      ordenada[j] = janela[i];
+    }
+    int16_t mediana = ordenada[(quantidade - 1) / 2];
+    ema = primeira ? mediana : ema + (mediana - ema) / (1 << EMA_SHIFT_DHT);
+    return mediana;
+  }
+};
+
+struct Canal{
+  const char *nome;
+  SensorFilter<JANELA_FILTRO_DHT, EMA_SHIFT_DHT> filtro;
+  Referencia referencia;
+  uint32_t picos = 0;
+};
+
+// Aplica uma leitura aceita e confere contra a referencia; false na divergencia
+bool conferir(Canal &canal, int16_t valor, uint32_t millis, uint32_t linha){
+  // pico: longe da mediana da janela antes dele (com a janela ja cheia)
+  bool pico = canal.filtro.size() == JANELA_FILTRO_DHT && abs(valor - canal.filtro.median()) > PICO_X10;
+  int16_t antes = canal.filtro.value();
+
+  canal.filtro.push(valor, millis);
+  int16_t mediana = canal.referencia.push(valor);
+
+  if (canal.filtro.median() != mediana) {
+    printf("linha %lu: mediana de %s %d, esperada %d\n", (unsigned long)linha, canal.nome, canal.filtro.median(), mediana);
+    return false;
+  }
+  if (fabs(canal.filtro.value() - canal.referencia.ema) > 1.0) {
+    printf("linha %lu: %s filtrada %d, EMA de referencia %.2f\n", (unsigned long)linha, canal.nome, canal.filtro.value(),
+           canal.referencia.ema);
+    return false;
+  }
+  if (pico) {
+    canal.picos++;
+    if (mediana == valor || abs(canal.filtro.value() - antes) > PASSO_MAX_PICO_X10) {
+      printf("linha %lu: pico de %s (%d) passou pelo filtro: mediana %d, filtrada %d -> %d\n", (unsigned long)linha,
+             canal.nome, valor, mediana, antes, canal.filtro.value());
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv){
+  const char *arquivo = argc > 1 ? argv[1] : TRACE_PADRAO;
+  FILE *trace = fopen(arquivo, "r");
+  if (trace == nullptr) {
+    printf("nao foi possivel abrir %s\n", arquivo);
+    return 1;
+  }
+
+  Canal temperatura;
+  temperatura.nome = "temperatura";
+  Canal umidade;
+  umidade.nome = "umidade";
+  uint32_t aceitas = 0, erros_checksum = 0, fora_faixa = 0, linha = 0;
+
+  char texto[128];
+  while (fgets(texto, sizeof(texto), trace) != nullptr) {
+    linha++;
+    if (texto[0] == '#' || texto[0] == 'm' || texto[0] == '\n') continue; // comentarios e cabeçalho
+    unsigned long millis;
+    unsigned int b[5];
+    if (sscanf(texto, "%lu,%u,%u,%u,%u,%u", &millis, &b[0], &b[1], &b[2], &b[3], &b[4]) != 6) {
+      printf("linha %lu: quadro invalido\n", (unsigned long)linha);
+      return 1;
+    }
+    uint8_t bytes[5];
+    for (uint8_t i = 0; i < 5; i++) bytes[i] = (uint8_t)b[i];
+
+    // mesma ordem do DhtRmt: checksum no decode, faixa no convert; so DHT_OK entra nos filtros
+    if ((uint8_t)(bytes[0] + bytes[1] + bytes[2] + bytes[3]) != bytes[4]) {
+      erros_checksum++;
+      continue;
+    }
+    LeituraDht leitura;
+    if (DhtRmt::convert(bytes, leitura) != DHT_OK) {
+      fora_faixa++;
+      continue;
+    }
+    aceitas++;
+    if (!conferir(temperatura, leitura.temperatura_x10, millis, linha)) return 1;
+    if (!conferir(umidade, leitura.umidade_x10, millis, linha)) return 1;
+  }
+  fclose(trace);
+
+  printf("%s: %lu leituras aceitas, %lu com checksum errado, %lu fora da faixa, picos rejeitados: temperatura %lu umidade %lu\n",
+         arquivo, (unsigned long)aceitas, (unsigned long)erros_checksum, (unsigned long)fora_faixa,
+         (unsigned long)temperatura.picos, (unsigned long)umidade.picos);
+  if (aceitas == 0 || temperatura.picos == 0 || erros_checksum == 0 || fora_faixa == 0) {
+    printf("trace sem leituras, picos ou quadros ruins: nada foi conferido\n");
+    return 1;
+  }
+  printf("filtro confere com a referencia\n");
+  return 0;
+}
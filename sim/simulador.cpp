@@ -0,0 +1,583 @@
+//==============================================================================
+// Simulador da Fazenda Vertical (pc)
+//==============================================================================
+// roda o mesmo controle do ESP32 (include/FarmControl.cpp) contra um modelo da estufa, com relogio simulado:
+// o relogio pula direto para o proximo deadline do scheduler (no maximo 1s por passo do modelo),
+// entao um mes de operação leva segundos. Mesma semente = mesma simulação (assinatura igual),
+// o que permite comparar mudanças no controle ou nos drivers. Sai com 1 se alguma conferencia falhar (frames dos
+// reles contra o estado do controle, rollups entre resoluções, ida e volta do historico).
+//
+// uso: simulador [dias] [--semente N] [--falha-bomba DIA] [--csv arquivo] [--historico diretorio] [--previsao]
+//                 [--clima diretorio] [--ntp PPM] [--config nome=valor]... [--log]
+//   --previsao: previsão sintetica do clima externo entregue ao controle a cada hora
+//   --clima: previsão lida de respostas gravadas dos provedores (sim/clima), pelo mesmo parser da task de rede
+//   --ntp: oscilador errando PPM e um servidor NTP falso consultado a cada hora pelo ClockDiscipline
+//   --config: parametro de operação do /config (ex: temp_max=28.5), todos aplicados juntos como uma transação
+//   pio run -e native && .pio/build/native/program 30
+//   ou: g++ -std=gnu++11 -O2 -Iinclude -Isim sim/simulador.cpp -o simulador
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <FarmControl.cpp>
+#include <ClockDiscipline.cpp>
+#include "Estufa.cpp"
+#include "Registrador595.cpp"
+
+//------------------------------------------------------------------------------
+// Cadeias de 74HC595 (mesmo mapa de pinos do main.cpp, incluindo o data dos reles = latch dos leds1)
+//------------------------------------------------------------------------------
+#define SIM_DATA_RELES 4
+#define SIM_CLOCK_RELES 19
+#define SIM_LATCH_RELES 18
+#define SIM_DATA_LEDS1 17
+#define SIM_CLOCK_LEDS1 16
+#define SIM_LATCH_LEDS1 4
+#define SIM_DATA_LEDS2 13
+#define SIM_CLOCK_LEDS2 14
+#define SIM_LATCH_LEDS2 27
+#define SIM_DATA_LEDS3 33
+#define SIM_CLOCK_LEDS3 25
+#define SIM_LATCH_LEDS3 26
+
+#define SIM_EPOCH_INICIO 1704067200UL // 2024-01-01 00:00
+#define SIM_PASSO_MAX_MS 1000         // maior passo do modelo da estufa
+#define SIM_T_CLIMA (15*60*1000UL)    // mesmo periodo da api de clima no main.cpp
+#define SIM_DHT_FALHA 0.01            // fração de leituras sem resposta
+#define SIM_DHT_PICO 0.005            // fração de leituras com um pico falso
+#define SIM_T_PREVISAO (60*60*1000UL) // mesmo periodo da previsão no main.cpp
+#define SIM_TAM_PEDACO 64             // pedaço entregue ao parser por vez (TAM_BUFFER_CLIMA do main.cpp)
+#define SIM_FUSO_S (-3 * 3600)        // FUSO_HORARIO_S do main.cpp (as respostas gravadas dos provedores sao em UTC)
+#define SIM_T_NTP (60*60*1000UL)      // T_NTP do main.cpp
+#define SIM_T_NTP_INICIAL (2*60*1000UL) // T_NTP_INICIAL do main.cpp (ate medir a deriva)
+#define SIM_NTP_PERDA 0.02            // fração de pedidos NTP sem resposta
+#define SIM_NTP_ATRASO_US 40000       // atraso maximo de cada sentido da rede (alem de 2 ms fixos)
+
+//------------------------------------------------------------------------------
+// Estado da Simulação
+//------------------------------------------------------------------------------
+Aleatorio aleatorio;
+ClimaExterno clima_externo(aleatorio);
+Estufa estufa;
+BombaSimulada bombas[2];
+Registrador595 registrador;
+ForecastBuilder coletor_previsao;
+ClockDiscipline disciplina_relogio(offtime);
+Aleatorio aleatorio_rede(7);          // atrasos e perdas do NTP (separado: clima e sensores nao mudam com --ntp)
+double oscilador_ppm = 0;             // erro do oscilador simulado (o uptime anda 1 + ppm/1e6 vezes mais devagar que o real)
+
+//------------------------------------------------------------------------------
+// Estatisticas
+//------------------------------------------------------------------------------
+struct Estatisticas{
+  double temp_min = 1e9;
+  double temp_max = -1e9;
+  double temp_soma = 0;
+  double umid_soma = 0;
+  double amostras = 0;
+  double s_acima_temp_max = 0;
+  double s_abaixo_temp_min = 0;
+  double s_acima_umid_max = 0;
+  double s_exaustor = 0;
+  double s_bomba = 0;
+  double s_leds = 0;
+  uint32_t partidas_exaustor = 0;
+  uint32_t partidas_bomba = 0;
+  uint32_t enchimentos = 0;
+  uint32_t divergencias_reles = 0; // frame latched diferente do estado do controle
+  double nivel_min = 1e9;
+};
+Estatisticas estatisticas;
+
+struct EstatisticasPrevisao{
+  uint32_t coletas[FONTE_OPEN_METEO + 1] = {0}; // por FonteClima (FONTE_NENHUMA = sintetica)
+  uint32_t falhas = 0;
+  double s_valida = 0;        // tempo com previsão valida
+  double s_antecipa_calor = 0; // ajuste negativo (ventila antes do calor)
+  double s_segura_calor = 0;   // ajuste positivo (segura o calor antes do frio)
+};
+EstatisticasPrevisao estatisticas_previsao;
+
+//------------------------------------------------------------------------------
+// Ganchos do Hal (sensores)
+//------------------------------------------------------------------------------
+bool sim_dht(uint8_t bytes[5]){
+  if (aleatorio.uniform() < SIM_DHT_FALHA) return false;
+
+  // DHT11: parte inteira em bytes[0]/[2], decimo em bytes[1]/[3]
+  double t = estufa.temperatura + (aleatorio.uniform() - 0.5) * 0.4;
+  double u = estufa.umidade + (aleatorio.uniform() - 0.5) * 2;
+  if (aleatorio.uniform() < SIM_DHT_PICO) t += 15;
+  if (u > 95) u = 95;
+  if (u < 20) u = 20;
+
+  int32_t t_x10 = (int32_t)lround(t * 10);
+  int32_t u_x10 = (int32_t)lround(u * 10);
+  bool negativo = t_x10 < 0;
+  if (negativo) t_x10 = -t_x10;
+  bytes[0] = u_x10 / 10;
+  bytes[1] = u_x10 % 10;
+  bytes[2] = t_x10 / 10;
+  bytes[3] = (t_x10 % 10) | (negativo ? 0x80 : 0);
+  bytes[4] = bytes[0] + bytes[1] + bytes[2] + bytes[3];
+  return true;
+}
+
+int16_t sim_pcnt(uint8_t unidade){
+  (void)unidade;
+  return (int16_t)((bombas[0].contador + bombas[1].contador) % FLUXO_LIMITE_PCNT);
+}
+
+//------------------------------------------------------------------------------
+// Inicialização (equivalente ao setup() do main.cpp, sem rede/lcd/alexa)
+//------------------------------------------------------------------------------
+void sim_setup(){
+  hal_sim.dht = sim_dht;
+  hal_sim.pcnt = sim_pcnt;
+
+  fluxo.config(PULSOS_POR_LITRO, JANELA_FLUXO, T_FLUXO);
+  fluxo.begin(0, 0);
+
+  cadeias_595.add_chain(SIM_DATA_RELES, SIM_CLOCK_RELES, SIM_LATCH_RELES);
+  cadeias_595.add_chain(SIM_DATA_LEDS1, SIM_CLOCK_LEDS1, SIM_LATCH_LEDS1);
+  cadeias_595.add_chain(SIM_DATA_LEDS2, SIM_CLOCK_LEDS2, SIM_LATCH_LEDS2);
+  cadeias_595.add_chain(SIM_DATA_LEDS3, SIM_CLOCK_LEDS3, SIM_LATCH_LEDS3);
+  cadeias_595.begin();
+
+  registrador.add_chip(SIM_DATA_RELES, SIM_CLOCK_RELES, SIM_LATCH_RELES);
+  registrador.add_chip(SIM_DATA_LEDS1, SIM_CLOCK_LEDS1, SIM_LATCH_LEDS1);
+  registrador.add_chip(SIM_DATA_LEDS2, SIM_CLOCK_LEDS2, SIM_LATCH_LEDS2);
+  registrador.add_chip(SIM_DATA_LEDS3, SIM_CLOCK_LEDS3, SIM_LATCH_LEDS3);
+  registrador.begin();
+
+  config_clima();
+  sensor_dht.begin(0, 0);
+  offtime.set_timezone(SIM_FUSO_S);
+  offtime.set(SIM_EPOCH_INICIO - SIM_FUSO_S); // hora local = SIM_EPOCH_INICIO
+
+  atualizar_boias(estufa.float_max(), estufa.float_min());
+  controle_iniciar(hal_millis());
+}
+
+//------------------------------------------------------------------------------
+// Estatisticas e Registro
+//------------------------------------------------------------------------------
+void sim_amostrar(double dt, const Outs &anterior){
+  Estatisticas &e = estatisticas;
+  if (estufa.temperatura < e.temp_min) e.temp_min = estufa.temperatura;
+  if (estufa.temperatura > e.temp_max) e.temp_max = estufa.temperatura;
+  e.temp_soma += estufa.temperatura * dt;
+  e.umid_soma += estufa.umidade * dt;
+  e.amostras += dt;
+  if (estufa.temperatura * 10 > configuracao.get(PARAM_TEMP_MAX)) e.s_acima_temp_max += dt;
+  if (estufa.temperatura * 10 < configuracao.get(PARAM_TEMP_MIN)) e.s_abaixo_temp_min += dt;
+  if (estufa.umidade > configuracao.get(PARAM_UMID_MAX_EXAUST)) e.s_acima_umid_max += dt;
+  if (state.exaustor) e.s_exaustor += dt;
+  if (state.bomba1 || state.bomba2) e.s_bomba += dt;
+  if (state.contatora_leds) e.s_leds += dt;
+  if (state.exaustor && !anterior.exaustor) e.partidas_exaustor++;
+  if ((state.bomba1 || state.bomba2) && !(anterior.bomba1 || anterior.bomba2)) e.partidas_bomba++;
+  if (state.solenoide_caixa && !anterior.solenoide_caixa) e.enchimentos++;
+  if (estufa.nivel_litros < e.nivel_min) e.nivel_min = estufa.nivel_litros;
+  if (registrador.output(CADEIA_RELES) != state.rele_byte()) e.divergencias_reles++;
+}
+
+void sim_csv(FILE *csv, uint32_t segundos){
+  fprintf(csv, "%lu,%.2f,%.1f,%.2f,%.1f,%d,%d,%d,%.1f,%d,%d,%d,%d,%d,%.1f\n",
+    (unsigned long)segundos, estufa.temperatura, estufa.umidade, clima_externo.temperatura, clima_externo.umidade,
+    clima_externo.chuva, input.temperatura, input.umidade, estufa.nivel_litros,
+    state.exaustor, clima.demand_percent(), state.bomba1 + 2 * state.bomba2, state.solenoide_caixa,
+    leds.get_level(true, 0), input.vazao_x100 / 100.0);
+}
+
+//------------------------------------------------------------------------------
+// Historico na Flash (diretorio no pc)
+//------------------------------------------------------------------------------
+//apaga os dias da simulação que ja estiverem no diretorio (o historico so acrescenta)
+bool sim_historico_iniciar(const char *diretorio, uint32_t dias){
+  char caminho[HIST_MAX_CAMINHO];
+  uint32_t primeiro_dia = SIM_EPOCH_INICIO / HIST_SEGUNDOS_DIA;
+  for (uint32_t dia = primeiro_dia; dia <= primeiro_dia + dias; dia++) {
+    snprintf(caminho, sizeof(caminho), "%s/%lu.bin", diretorio, (unsigned long)dia);
+    ArquivoHist::remove(caminho);
+  }
+  return historico.begin(diretorio);
+}
+
+//taxa de compressão e conferencia da ida e volta: os resumos dos cabeçalhos (calculados na gravação,
+//sobre os valores originais) precisam bater com as amostras decodificadas do bitstream; false se nao baterem
+bool sim_historico_resumo(uint32_t dias){
+  historico.close_block();
+  historico.flush();
+
+  uint32_t inicio = SIM_EPOCH_INICIO;
+  uint32_t fim = offtime.now() + 1; // com --ntp o relogio do controle pode estar um pouco a frente do simulado
+  ResumoHistorico<N_CANAIS_HISTORICO> cabecalhos;
+  uint32_t blocos = historico.summary(inicio, fim, cabecalhos);
+
+  ResumoHistorico<N_CANAIS_HISTORICO> decodificado;
+  decodificado.reset();
+  uint32_t fora_de_ordem = 0;
+  uint32_t anterior = 0;
+  historico.samples(inicio, fim, [&](const AmostraHistorico<N_CANAIS_HISTORICO> &amostra){
+    if (amostra.epoch < anterior) fora_de_ordem++;
+    anterior = amostra.epoch;
+    decodificado.amostras++;
+    for (uint8_t c = 0; c < N_CANAIS_HISTORICO; c++) decodificado.canais[c].add(amostra.valores[c]);
+  });
+
+  // passando de HIST_DIAS_MAX a retenção ja apagou os primeiros dias: so o que ficou precisa voltar
+  bool completo = dias < HIST_DIAS_MAX;
+  bool confere = decodificado.amostras == cabecalhos.amostras && fora_de_ordem == 0 &&
+                 (completo ? decodificado.amostras == historico.samples_written() : decodificado.amostras <= historico.samples_written());
+  for (uint8_t c = 0; c < N_CANAIS_HISTORICO; c++) {
+    confere = confere && decodificado.canais[c].minimo == cabecalhos.canais[c].minimo &&
+              decodificado.canais[c].maximo == cabecalhos.canais[c].maximo &&
+              decodificado.canais[c].soma == cabecalhos.canais[c].soma;
+  }
+
+  uint32_t bytes = historico.bytes_written();
+  uint32_t bytes_crus = cabecalhos.amostras * sizeof(AmostraHistorico<N_CANAIS_HISTORICO>);
+  printf("historico: %lu amostras em %lu blocos, %lu bytes (%.0f por dia, %.1f bits por amostra, %.1fx menor que cru), perdidos %lu, ida e volta %s\n",
+         (unsigned long)cabecalhos.amostras, (unsigned long)blocos, (unsigned long)bytes, (double)bytes / dias,
+         cabecalhos.amostras ? 8.0 * bytes / cabecalhos.amostras : 0.0, bytes ? (double)bytes_crus / bytes : 0.0,
+         (unsigned long)historico.lost_blocks(), confere ? "ok" : "DIVERGENTE");
+
+  ResumoHistorico<N_CANAIS_HISTORICO> ultimo_dia;
+  uint32_t fim_dados = cabecalhos.fim + 1;
+  historico.summary(fim_dados - HIST_SEGUNDOS_DIA, fim_dados, ultimo_dia);
+  printf("historico ultimas 24h: temperatura med %.1f C (min %.1f max %.1f), umidade med %.1f%%, %lu amostras\n",
+         ultimo_dia.mean(HIST_TEMPERATURA) / 10.0, ultimo_dia.canais[HIST_TEMPERATURA].minimo / 10.0,
+         ultimo_dia.canais[HIST_TEMPERATURA].maximo / 10.0, ultimo_dia.mean(HIST_UMIDADE) / 10.0,
+         (unsigned long)ultimo_dia.amostras);
+  return confere;
+}
+
+//------------------------------------------------------------------------------
+// Previsão do Tempo
+//------------------------------------------------------------------------------
+//previsão das proximas PREVISAO_HORAS a partir do modelo do clima externo
+void sim_previsao_sintetica(uint32_t segundos_dia, int32_t dia){
+  PrevisaoClima nova;
+  memset(&nova, 0, sizeof(nova));
+  nova.versao = PREVISAO_VERSAO;
+  nova.fonte = FONTE_NENHUMA;
+  nova.obtida = offtime.now();
+  nova.inicio = nova.obtida / 3600 * 3600;
+  nova.horas = PREVISAO_HORAS;
+  uint32_t inicio_hora = segundos_dia / 3600 * 3600;
+  for (uint8_t h = 0; h < PREVISAO_HORAS; h++) {
+    clima_externo.forecast(inicio_hora, dia, h, nova.temperatura_x10[h], nova.umidade[h], nova.chuva_prob[h]);
+  }
+  nova.verificacao = Forecast::checksum(nova);
+  previsao.set(nova);
+  estatisticas_previsao.coletas[FONTE_NENHUMA]++;
+}
+
+//resposta gravada lida em pedaços, como chegaria do socket (false sem o arquivo ou com a resposta incompleta)
+bool sim_previsao_arquivo(const char *diretorio, const char *nome, FonteClima fonte, PrevisaoClima &saida){
+  char caminho[128];
+  snprintf(caminho, sizeof(caminho), "%s/%s", diretorio, nome);
+  FILE *arquivo = fopen(caminho, "rb");
+  if (arquivo == nullptr) return false;
+
+  coletor_previsao.begin(fonte);
+  char buffer[SIM_TAM_PEDACO];
+  size_t lidos;
+  while (!coletor_previsao.done() && (lidos = fread(buffer, 1, sizeof(buffer), arquivo)) > 0) {
+    if (!coletor_previsao.feed(buffer, lidos)) break;
+  }
+  fclose(arquivo);
+  return coletor_previsao.build(saida, offtime.now(), offtime.timezone());
+}
+
+//mesma ordem do main_previsao(): OpenWeatherMap, depois Open-Meteo; sem nenhum fica a anterior ate vencer
+void sim_previsao_respostas(const char *diretorio){
+  PrevisaoClima nova;
+  bool coletada = sim_previsao_arquivo(diretorio, "owm_previsao.json", FONTE_OPENWEATHER, nova) ||
+                  sim_previsao_arquivo(diretorio, "open_meteo.json", FONTE_OPEN_METEO, nova);
+  if (!coletada) {
+    estatisticas_previsao.falhas++;
+    return;
+  }
+  previsao.set(nova);
+  estatisticas_previsao.coletas[nova.fonte]++;
+}
+
+void sim_previsao_amostrar(double dt){
+  uint32_t agora = offtime.now();
+  if (!previsao.valid(agora)) return;
+  int16_t ajuste = previsao.adjustment_x10(agora, input.temperatura, configuracao.get(PARAM_TEMP_MAX), configuracao.get(PARAM_TEMP_MIN));
+  estatisticas_previsao.s_valida += dt;
+  if (ajuste < 0) estatisticas_previsao.s_antecipa_calor += dt;
+  if (ajuste > 0) estatisticas_previsao.s_segura_calor += dt;
+}
+
+void sim_previsao_resumo(){
+  EstatisticasPrevisao &p = estatisticas_previsao;
+  double total = estatisticas.amostras;
+  printf("previsao: coletas sintetica %lu, openweathermap %lu, open-meteo %lu, falhas %lu; valida %.1f%% do tempo, "
+         "antecipando calor %.1f%%, segurando calor %.1f%%\n",
+         (unsigned long)p.coletas[FONTE_NENHUMA], (unsigned long)p.coletas[FONTE_OPENWEATHER], (unsigned long)p.coletas[FONTE_OPEN_METEO],
+         (unsigned long)p.falhas, 100 * p.s_valida / total, 100 * p.s_antecipa_calor / total, 100 * p.s_segura_calor / total);
+}
+
+//------------------------------------------------------------------------------
+// Relogio (servidor NTP falso)
+//------------------------------------------------------------------------------
+//hora UTC verdadeira num uptime do oscilador simulado
+int64_t sim_hora_real_us(uint64_t uptime_us){
+  return (int64_t)(SIM_EPOCH_INICIO - SIM_FUSO_S) * 1000000 + (int64_t)uptime_us + (int64_t)(uptime_us * oscilador_ppm / 1e6);
+}
+
+//um pedido do ClockDiscipline respondido pelo servidor falso, com atraso assimetrico, perda e o carimbo de chegada
+//atrasado como o da task de rede (que verifica a resposta a cada T_NTP_ESPERA)
+void sim_ntp_sincronizar(){
+  uint8_t pedido[NTP_TAMANHO_PACOTE];
+  uint8_t resposta[NTP_TAMANHO_PACOTE];
+  uint64_t envio = hal_uptime_us();
+  disciplina_relogio.request(pedido, envio);
+  if (aleatorio_rede.uniform() < SIM_NTP_PERDA) {
+    disciplina_relogio.timeout();
+    return;
+  }
+
+  uint64_t ida = 2000 + (uint64_t)(aleatorio_rede.uniform() * SIM_NTP_ATRASO_US);
+  uint64_t volta = 2000 + (uint64_t)(aleatorio_rede.uniform() * SIM_NTP_ATRASO_US);
+  uint64_t espera = (uint64_t)(aleatorio_rede.uniform() * 5000);
+  memset(resposta, 0, sizeof(resposta));
+  resposta[0] = (0 << 6) | (4 << 3) | 4; // servidor
+  resposta[1] = 1;                        // estrato 1
+  memcpy(resposta + 24, pedido + 40, 8);  // originate = transmit do pedido
+  ClockDiscipline::encode_timestamp(resposta + 32, sim_hora_real_us(envio + ida));
+  ClockDiscipline::encode_timestamp(resposta + 40, sim_hora_real_us(envio + ida + 100));
+  disciplina_relogio.response(resposta, envio + ida + 100 + volta + espera);
+}
+
+void sim_ntp_resumo(uint32_t dias){
+  const MetricasRelogio &m = disciplina_relogio.metrics();
+  double erro_final_ms = (offtime.utc_us() - sim_hora_real_us(hal_uptime_us())) / 1000.0;
+  printf("relogio: oscilador %+.1f ppm, deriva corrigida %+.2f ppm, %lu sincronizacoes (%lu sem resposta, %lu descartadas, %lu saltos), "
+         "maior erro ajustado %.1f ms, erro final %.2f ms (sem NTP seria %.1f s)\n",
+         oscilador_ppm, m.deriva_ppb / 1000.0, (unsigned long)m.sincronizacoes, (unsigned long)m.sem_resposta,
+         (unsigned long)m.descartadas, (unsigned long)m.saltos, m.maior_erro_us / 1000.0, erro_final_ms,
+         dias * 86400.0 * oscilador_ppm / 1e6);
+}
+
+//------------------------------------------------------------------------------
+// Rollups (baldes de 1min/15min/1h na ram)
+//------------------------------------------------------------------------------
+//as tres resoluções precisam somar o mesmo nas ultimas horas inteiras cobertas pelo anel de 1 minuto
+//(o inicio vai para a primeira hora inteira ainda no anel: com o relogio disciplinado um pouco atrasado, o anel ja
+//pode ter passado da hora de offtime.now() e descartado o primeiro minuto da janela); false se divergirem
+bool sim_rollups_resumo(){
+  uint32_t fim = offtime.now() / 3600 * 3600;
+  uint32_t inicio = fim - (uint32_t)ROLLUP_BALDES_MINUTO * 60 / 3600 * 3600;
+  uint32_t mais_antigo = (rollups[ROLLUP_TEMPERATURA].last(ROLLUP_MINUTO) - ROLLUP_BALDES_MINUTO + 1) * 60;
+  if (inicio < mais_antigo) inicio = (mais_antigo + 3599) / 3600 * 3600;
+  uint32_t horas = (fim - inicio) / 3600;
+  bool confere = true;
+  for (uint8_t c = 0; c < N_CANAIS_ROLLUP; c++) {
+    int64_t soma[N_RESOLUCOES_ROLLUP] = {0};
+    uint32_t amostras[N_RESOLUCOES_ROLLUP] = {0};
+    int16_t maximo[N_RESOLUCOES_ROLLUP] = {INT16_MIN, INT16_MIN, INT16_MIN};
+    for (uint8_t r = 0; r < N_RESOLUCOES_ROLLUP; r++) {
+      rollups[c].buckets((ResolucaoRollup)r, inicio, fim, [&](uint32_t, const BaldeRollup &balde){
+        soma[r] += balde.soma;
+        amostras[r] += balde.quantidade;
+        if (balde.maximo > maximo[r]) maximo[r] = balde.maximo;
+      });
+    }
+    for (uint8_t r = 1; r < N_RESOLUCOES_ROLLUP; r++) {
+      confere = confere && soma[r] == soma[0] && amostras[r] == amostras[0] && maximo[r] == maximo[0];
+    }
+  }
+
+  BaldeRollup ultima_hora = {0, 0, 0, 0};
+  rollups[ROLLUP_TEMPERATURA].get(ROLLUP_HORA, fim / 3600 - 1, ultima_hora);
+  printf("rollups: ultima hora inteira temperatura med %.1f C (min %.1f max %.1f, %u amostras), 1min/15min/1h nas ultimas %luh %s\n",
+         ultima_hora.quantidade ? ultima_hora.soma / 10.0 / ultima_hora.quantidade : 0.0, ultima_hora.minimo / 10.0,
+         ultima_hora.maximo / 10.0, ultima_hora.quantidade, (unsigned long)horas, confere ? "conferem" : "DIVERGEM");
+  return confere;
+}
+
+//==============================================================================
+// Programa Principal
+//==============================================================================
+int main(int argc, char **argv){
+  uint32_t dias = 30;
+  uint32_t semente = 1;
+  int32_t dia_falha_bomba = -1;
+  const char *arquivo_csv = nullptr;
+  const char *diretorio_historico = nullptr;
+  const char *diretorio_clima = nullptr;
+  bool previsao_sintetica = false;
+  bool usa_ntp = false;
+  TransacaoFazenda alteracoes;
+  hal_sim.log = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--semente") == 0 && i + 1 < argc) semente = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--falha-bomba") == 0 && i + 1 < argc) dia_falha_bomba = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) arquivo_csv = argv[++i];
+    else if (strcmp(argv[i], "--historico") == 0 && i + 1 < argc) diretorio_historico = argv[++i];
+    else if (strcmp(argv[i], "--previsao") == 0) previsao_sintetica = true;
+    else if (strcmp(argv[i], "--clima") == 0 && i + 1 < argc) diretorio_clima = argv[++i];
+    else if (strcmp(argv[i], "--ntp") == 0 && i + 1 < argc) { usa_ntp = true; oscilador_ppm = atof(argv[++i]); }
+    else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      // nome=valor no mesmo formato do json do /config
+      char *nome = argv[++i];
+      char *igual = strchr(nome, '=');
+      if (igual != nullptr) *igual = '\0';
+      int8_t id = igual != nullptr ? configuracao.find(nome) : -1;
+      int32_t valor;
+      if (id < 0 || !ConfigFazenda::parse(igual + 1, configuracao.descriptor(id).casas, valor) ||
+          !configuracao.stage(alteracoes, id, valor)) {
+        printf("parametro invalido: %s\n", nome);
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--log") == 0) hal_sim.log = true;
+    else if (argv[i][0] != '-') dias = strtoul(argv[i], nullptr, 10);
+    else {
+      printf("uso: %s [dias] [--semente N] [--falha-bomba DIA] [--csv arquivo] [--historico diretorio] [--previsao] [--clima diretorio] [--ntp PPM] [--config nome=valor] [--log]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  aleatorio = Aleatorio(semente);
+  FILE *csv = nullptr;
+  if (arquivo_csv != nullptr) {
+    csv = fopen(arquivo_csv, "w");
+    if (csv == nullptr) {
+      printf("nao foi possivel criar %s\n", arquivo_csv);
+      return 1;
+    }
+    fprintf(csv, "segundo,temp,umid,temp_ext,umid_ext,chuva,temp_dht_x10,umid_dht_x10,nivel_l,exaustor,demanda,bomba,enchendo,vermelho,vazao\n");
+  }
+
+  if (!aplicar_config(alteracoes)) {
+    printf("combinacao de parametros incoerente\n");
+    return 1;
+  }
+
+  clock_t inicio = clock();
+  sim_setup();
+  if (diretorio_historico != nullptr && !sim_historico_iniciar(diretorio_historico, dias)) {
+    printf("nao foi possivel usar %s para o historico\n", diretorio_historico);
+    return 1;
+  }
+
+  const uint64_t fim_ms = (uint64_t)dias * 86400000ULL;
+  uint64_t decorrido_ms = 0;
+  uint64_t proximo_clima = 0;
+  uint64_t proxima_previsao = 0;
+  uint64_t proximo_ntp = SIM_T_NTP_INICIAL; // o relogio começa certo (como depois do NTP do setup)
+  bool usa_previsao = previsao_sintetica || diretorio_clima != nullptr;
+  uint64_t proximo_csv = 0;
+  uint32_t ciclos = 0;
+
+  while (decorrido_ms < fim_ms) {
+    uint32_t segundos_dia = (uint32_t)((decorrido_ms / 1000) % 86400);
+    int32_t dia = (int32_t)(decorrido_ms / 86400000ULL);
+
+    // clima externo, entregue como a task de rede faria
+    clima_externo.update(segundos_dia, dia);
+    if (decorrido_ms >= proximo_clima) {
+      input.umidade_externa = (byte)clima_externo.umidade;
+      input.temperatura_externa_x10 = (int16_t)lround(clima_externo.temperatura * 10);
+      proximo_clima += SIM_T_CLIMA;
+    }
+    if (usa_previsao && decorrido_ms >= proxima_previsao) {
+      if (diretorio_clima != nullptr) sim_previsao_respostas(diretorio_clima);
+      else sim_previsao_sintetica(segundos_dia, dia);
+      proxima_previsao += SIM_T_PREVISAO;
+    }
+    if (usa_ntp && decorrido_ms >= proximo_ntp) {
+      sim_ntp_sincronizar();
+      proximo_ntp += disciplina_relogio.poll_interval_ms(SIM_T_NTP_INICIAL, SIM_T_NTP);
+    }
+    input.chuva = clima_externo.chuva;
+    bombas[0].quebrada = (dia_falha_bomba >= 0 && dia >= dia_falha_bomba);
+
+    // controle
+    Outs anterior = state;
+    uint32_t tempo_proxima = controle_ciclo();
+    historico.flush(); // no ESP32 é a task de rede (sem historico iniciado so descarta os blocos)
+    ciclos++;
+
+    // modelo da estufa ate o proximo deadline
+    uint32_t passo = tempo_proxima;
+    if (passo > SIM_PASSO_MAX_MS) passo = SIM_PASSO_MAX_MS;
+    if (passo == 0) passo = 1;
+    double dt = passo / 1000.0;
+
+    double brilho = (leds.get_level(true, 0) + leds.get_level(false, 0)) / 510.0;
+    estufa.step(dt, clima_externo, state.exaustor, state.contatora_leds ? brilho : 0,
+                state.solenoide_irrigacao, state.solenoide_caixa, Estufa::sun(segundos_dia));
+    bombas[0].step(dt, state.bomba1);
+    bombas[1].step(dt, state.bomba2);
+
+    sim_amostrar(dt, anterior);
+    if (usa_previsao) sim_previsao_amostrar(dt);
+
+    // boias (o FloatSwitch do ESP32 so publica quando o nivel muda)
+    if (estufa.float_max() != input.boia_max || estufa.float_min() != input.boia_min) {
+      atualizar_boias(estufa.float_max(), estufa.float_min());
+    }
+
+    if (csv != nullptr && decorrido_ms >= proximo_csv) {
+      sim_csv(csv, (uint32_t)(decorrido_ms / 1000));
+      proximo_csv += 60000;
+    }
+
+    hal_sim_avancar(passo);
+    decorrido_ms += passo;
+  }
+
+  double segundos_cpu = (double)(clock() - inicio) / CLOCKS_PER_SEC;
+  if (csv != nullptr) fclose(csv);
+
+  //------------------------------------------------------------------------------
+  // Resumo
+  //------------------------------------------------------------------------------
+  Estatisticas &e = estatisticas;
+  double horas = e.amostras / 3600;
+  printf("dias simulados: %lu (semente %lu)\n", (unsigned long)dias, (unsigned long)semente);
+  printf("tempo de cpu: %.3fs (%.0fx mais rapido que o real), %lu ciclos de controle\n",
+         segundos_cpu, segundos_cpu > 0 ? e.amostras / segundos_cpu : 0.0, (unsigned long)ciclos);
+  char temp_max[CONFIG_MAX_TEXTO], temp_min[CONFIG_MAX_TEXTO];
+  ConfigFazenda::format(configuracao.get(PARAM_TEMP_MAX), configuracao.descriptor(PARAM_TEMP_MAX).casas, temp_max);
+  ConfigFazenda::format(configuracao.get(PARAM_TEMP_MIN), configuracao.descriptor(PARAM_TEMP_MIN).casas, temp_min);
+  printf("temperatura: min %.1f med %.1f max %.1f C, acima de %s: %.1f%%, abaixo de %s: %.1f%%\n",
+         e.temp_min, e.temp_soma / e.amostras, e.temp_max, temp_max, 100 * e.s_acima_temp_max / e.amostras,
+         temp_min, 100 * e.s_abaixo_temp_min / e.amostras);
+  printf("umidade: med %.1f%%, acima de %ld: %.1f%%\n", e.umid_soma / e.amostras, (long)configuracao.get(PARAM_UMID_MAX_EXAUST),
+         100 * e.s_acima_umid_max / e.amostras);
+  printf("exaustores: %.1f%% ligados, %lu partidas (%.1f por hora)\n",
+         100 * e.s_exaustor / e.amostras, (unsigned long)e.partidas_exaustor, e.partidas_exaustor / horas);
+  printf("bomba: %.1f%% ligada, %lu partidas, falhas: bomba1 %d bomba2 %d, %lu mL bombeados\n",
+         100 * e.s_bomba / e.amostras, (unsigned long)e.partidas_bomba, falha_bomba[0], falha_bomba[1], (unsigned long)fluxo.total_ml());
+  printf("caixa: %lu enchimentos, nivel minimo %.1f L, estado final %d\n", (unsigned long)e.enchimentos, e.nivel_min, estado_caixa);
+  printf("leds: %.1f%% com a contatora ligada\n", 100 * e.s_leds / e.amostras);
+  printf("74hc595: %lu bordas, frames reles %lu (%lu mudancas), leds %lu/%lu/%lu, divergencias %lu\n",
+         (unsigned long)registrador.edges(), (unsigned long)registrador.frames(CADEIA_RELES), (unsigned long)registrador.changes(CADEIA_RELES),
+         (unsigned long)registrador.frames(CADEIA_LEDS1), (unsigned long)registrador.frames(CADEIA_LEDS2), (unsigned long)registrador.frames(CADEIA_LEDS3),
+         (unsigned long)e.divergencias_reles);
+  printf("atraso das tarefas (max ms):");
+  MetricasTarefa medidas;
+  for (uint8_t id = 0; id < metricas_controle.size(); id++) {
+    if (metricas_controle.snapshot(id, medidas)) printf(" %s %lu", medidas.nome, (unsigned long)medidas.atraso_max_ms);
+  }
+  printf("\n");
+  bool confere = e.divergencias_reles == 0;
+  confere = sim_rollups_resumo() && confere;
+  if (usa_previsao) sim_previsao_resumo();
+  if (usa_ntp) sim_ntp_resumo(dias);
+  if (diretorio_historico != nullptr) confere = sim_historico_resumo(dias) && confere;
+  if (!confere) printf("conferencias FALHARAM (frames dos reles, rollups ou historico)\n");
+  printf("assinatura: %08lx\n", (unsigned long)registrador.signature());
+  return confere ? 0 : 1;
+}
@@ -26,23 +26,29 @@
  *  @todo melhorias futuras:
  *          - retirar codigo inutilizado
  *          - sistemas de segurança contra travamentos ou erros em cascata
- *          - funcoes de simulacao de clima (alvos de temperatura e umidade, talvez pid etc)
- *          - melhorar controle de exaustores, deixando funcao de controle de temp com funcionamento sincronizado com umidade
  */
 
 #include <Arduino.h>
-#include <Thread.h>
-#include <DHT.h>
-#include <CronOut.h>
 #include "fauxmoESP.h"
+#include <ESPAsyncWebServer.h>
 #include <WiFi.h>
-#include <NTPClient.h>
 #include <WiFiUdp.h>
-#include <HTTPClient.h>
-#include <Arduino_JSON.h>
-
-#include <OffTime.cpp>
+#include <esp_pm.h>
+#include <Preferences.h>
+#include <StreamString.h>
+#include <new>
+
+#include <FarmControl.cpp>
+#include <FloatSwitch.cpp>
+#include <JsonStream.cpp>
+#include <TlsClient.cpp>
+#include <TlsRoots.cpp>
+#include <Forecast.cpp>
+#include <ClockDiscipline.cpp>
 #include "lcd_extend.cpp"
+#ifdef BENCH
+  #include <Bench.cpp>
+#endif
 
 //------------------------------------------------------------------------------
 // Definições Globais
@@ -53,19 +59,9 @@
 // Macros
 //------------------------------------------------------------------------------
 
-// Defina esta macro para ativar o log. Comente para desativar.
-#define ACTIVE_DEBUG
-
-#ifdef ACTIVE_DEBUG 
-  //logger("mensagem", "local")
-  #define logger(x,y) Serial.println("[" + String(y) + "]: " + String(x))
-  #define log_point() Serial.print(".")
-  #define new_line() Serial.println()
-#else
-  #define logger(x,y) // Nada
-  #define log_point() // nada tambem
-  #define new_line() // mais um nada
-#endif
+// Log: hal_log("MODULO", "formato do printf", ...) de include/Hal.cpp, gravado em um anel sem alocação
+// e escrito na serial pela task de log. Niveis por modulo mudam em tempo de execução (GET /log).
+// Para compilar sem log: build_flags = -DLOG_NIVEL_MAXIMO=LOG_NENHUM
 
 #define BAUND_RATE 115200
 
@@ -78,45 +74,69 @@
 #define latitude "-28.30"
 #define longitude "-54.22"
 #define api_key 
-#define link "https://api.openweathermap.org/data/2.5/weather?lat=" latitude "&lon=" longitude "&units=metric&appid=" api_key
+#define host_clima "api.openweathermap.org"
+#define caminho_clima "/data/2.5/weather?lat=" latitude "&lon=" longitude "&units=metric&appid=" api_key
+#define raizes_clima TLS_RAIZ_USERTRUST_RSA TLS_RAIZ_USERTRUST_ECC TLS_RAIZ_SECTIGO_R46 TLS_RAIZ_SECTIGO_E46 // CAs da cadeia (Sectigo) de host_clima
+#define impressao_clima ""  // Opcional: SHA-256 do certificado de host_clima ("AB:CD:...") conferido alem da cadeia (ver README)
+#define caminho_previsao "/data/2.5/forecast?lat=" latitude "&lon=" longitude "&units=metric&cnt=16&appid=" api_key // 16 pontos de 3h = 48h
+#define host_open_meteo "api.open-meteo.com" // Provedor reserva da previsão (sem chave)
+#define caminho_open_meteo "/v1/forecast?latitude=" latitude "&longitude=" longitude \
+  "&hourly=temperature_2m,relative_humidity_2m,precipitation_probability&forecast_hours=48&timeformat=unixtime"
+#define raizes_open_meteo TLS_RAIZ_ISRG_X1 TLS_RAIZ_ISRG_X2 // CAs da cadeia (Let's Encrypt) de host_open_meteo
+#define impressao_open_meteo ""  // Opcional: SHA-256 do certificado de host_open_meteo conferido alem da cadeia
+#define FUSO_HORARIO_S (-3 * 3600)  // Hora local = UTC + fuso, sem horario de verao (OffTime)
+#define servidor_ntp "a.st1.ntp.br" // Servidor NTP brasileiro
+#define NTP_PORTA_LOCAL 2390        // Porta udp local das respostas do NTP
+#define CHUVA_PROB_PREVISAO 60      // Sem dado atual: probabilidade prevista (%) a partir da qual conta como chuva
 
 //------------------------------------------------------------------------------
 // Configurações de Tempo (em milissegundos)
 //------------------------------------------------------------------------------
 #define T_DADOS_CLIMATICOS 15*60*1000// Tempo entre atualizações dos dados climáticos externos
-#define T_BOMBA 5*60*1000            // Tempo de ciclo da bomba d'água (ligada/desligada)
-#define CICLOS_BOMBA_DESLIGADA 3     // Quantos ciclos desligados para cada ciclo ligdado, ex: 3 = 5 ligado e 15 desligado
-#define T_DHT 5000                   // Tempo entre leituras do sensor DHT11
+#define T_PREVISAO 60*60*1000        // Tempo entre coletas da previsão (multiplo de T_DADOS_CLIMATICOS: usa a mesma conexão)
 #define T_LCD 500                    // Tempo entre atualizações do display LCD
-#define T_DURACAO_IRRIGACAO 1*60*1000 // Tempo de duração de cada ciclo de irrigação
-#define N_VEZES_CHAMADA_ENTRE_IRRIG 2 // Define a frequência da irrigação em relação ao tempo de duração (N * T_DURACAO_IRRIGACAO)
-#define T_VERIFICAR_EXAUSTOR 1*60*1000 // Tempo entre verificações da temperatura para controle dos exaustores
-#define T_VERIFICAR_LEDS 3*60*1000   // Tempo entre verificações do horário para controle dos LEDs
+#define T_LOG_MEMORIA 5000           // Tempo entre logs de memoria livre
+#define T_LOG_METRICAS 60*1000       // Tempo entre resumos das metricas das tasks na serial
+#define T_DRENO_LOG 20               // Tempo entre esvaziamentos do anel de log (escrita na serial)
+#define T_GRAVAR_HISTORICO 60*1000   // Tempo entre verificações de blocos fechados do historico (um por hora vai para a flash)
+#define T_NTP 60*60*1000             // Tempo entre sincronizações do relogio
+#define T_NTP_INICIAL 2*60*1000      // Tempo entre sincronizações ate medir a deriva do oscilador (erro pequeno sem correção)
+#define T_NTP_ESPERA 5               // Tempo entre verificações da resposta do NTP (erro de ate metade disso no carimbo)
+#define T_NTP_TIMEOUT 2000           // Tempo maximo esperando a resposta do NTP
+#define T_MAX_OCIOSO 20              // Tempo maximo que o loop dorme sem atender a Alexa (fauxmo precisa de polling)
 
 //------------------------------------------------------------------------------
-// Configurações de Operação da Fazenda Vertical
+// Mapa de Tasks (FreeRTOS)
 //------------------------------------------------------------------------------
-#define TEMP_MAX 30        // Temperatura máxima desejada na estufa
-#define TEMP_IDEAL 25       // Temperatura ideal na estufa
-#define TEMP_MIN 20         // Temperatura mínima desejada na estufa
-#define TEMP_MARGEM 2      // Margem de temperatura para ativar/desativar o controle
-
-#define UMID_MAX 95         // Umidade máxima permitida na estufa
-#define UMID_IDEAL 70        // Umidade ideal na estufa
-#define UMID_MAX_EXAUST 90  // Umidade que ativa os exaustores (se a externa for menor)
-
-#define TIMEOUT_EXAUSTORES 60*60*1000 // Tempo máximo que os exaustores podem ficar ligados continuamente
-
-#define HORA_DESLIGAR_LED 21 // Hora para desligar os LEDs
-#define HORA_LIGAR_LED 8    // Hora para ligar os LEDs
+// core 0: wifi/tcp e tudo que pode bloquear em rede (https, json)
+// core 1: atuadores (prioridade alta, nunca espera a rede) e interface (loop do arduino: lcd e alexa)
+#define CORE_REDE 0
+#define CORE_CONTROLE 1
+#define CORE_INTERFACE ARDUINO_RUNNING_CORE // loop do arduino
+#define PRIORIDADE_REDE 1
+#define PRIORIDADE_CONTROLE 3       // Acima do loop do arduino (1), preempta lcd e alexa
+#define STACK_REDE 8192             // https + parse do json
+#define TAM_BUFFER_CLIMA 64         // Pedaço da resposta da api de clima lido por vez (na stack da task de rede)
+#define STACK_CONTROLE 4096
+#define PRIORIDADE_LOG 1            // Logo acima da idle: so formata e escreve na serial quando sobra cpu
+#define STACK_LOG 3072              // snprintf (com float) do dreno
+#define T_MAX_OCIOSO_CONTROLE 1000  // Tempo maximo sem reavaliar as saidas, mesmo sem deadline/comando
+#define PORTA_HTTP 80               // Servidor http compartilhado: alexa (fauxmo) e /metricas
+#define DIR_HISTORICO "/h"          // Diretorio do historico no LittleFS (um arquivo por dia)
+#define HORAS_MAX_HISTORICO 168     // Maior janela do GET /historico (uma semana)
+#define TAM_MAX_JSON_CONFIG 1024    // Maior corpo aceito no POST /config (todos os parametros cabem com folga)
+#define TAM_ERRO_CONFIG 96          // Resposta de erro do /config e do websocket
 
 //------------------------------------------------------------------------------
 // Mapeamento de Pinos
 //------------------------------------------------------------------------------
 #define PIN_SENSOR_DHT11 32
+#define CANAL_RMT_DHT 0      // Canal do RMT que captura a resposta do DHT11
 #define PIN_SENSOR_FLUXO 2
+#define UNIDADE_PCNT_FLUXO 0 // Unidade do PCNT que conta os pulsos do sensor de fluxo
 #define PIN_BOIA_MAX  34
 #define PIN_BOIA_MIN 35
+#define NIVEL_BOIA_ACIONADA HIGH // Nivel lido com a boia levantada (pull-down externo, 34/35 nao tem pull interno)
 #define PIN_LED_IR 0
 #define PIN_DATA_RELES 4
 #define PIN_CLOCK_RELES 19
@@ -131,73 +151,90 @@
 #define PIN_CLOCK_LEDS3 25
 #define PIN_LATCH_LEDS3 26
 
-//------------------------------------------------------------------------------
-// Definições de Cor dos LEDs
-//------------------------------------------------------------------------------
-#define RED 1
-#define BLUE 0
-
 //------------------------------------------------------------------------------
 // Estruturas de Dados
 //------------------------------------------------------------------------------
+// (estado, entradas, comandos e configurações do controle ficam em FarmControl.cpp)
 
 /**
- * @brief Estrutura para armazenar o estado dos atuadores.
+ * @brief Copia do estado publicada pela task de controle para a interface (lcd).
  */
-struct Outs{
-  bool bomba1 = false;
-  bool bomba2 = false;
-  bool solenoide_caixa = false;
-  bool solenoide_irrigacao = false;
-  bool exaustor = false;
-  bool contatora_leds = false;
-  bool refletor = false;
-  bool lampada = false;
-  bool ac = false;
+struct Status{
+  Outs saidas;
+  Ins entradas;
+  int64_t proximo_evento[N_TRABALHOS_AGENDA]; // epoch local do proximo liga/desliga de cada trabalho (CRON_NUNCA desativado)
+  uint8_t agenda_ligada = 0;                  // bit por TrabalhoAgenda dentro da janela
 };
 
 /**
- * @brief Estrutura para armazenar os dados dos sensores.
+ * @brief Task acompanhada pelas metricas (loop e tarefas do seu scheduler).
  */
-struct Ins{
-  byte temperatura = TEMP_IDEAL;
-  byte umidade = UMID_IDEAL;
-  bool chuva = false;
-  byte umidade_externa = UMID_IDEAL;
+struct LoopMonitorado{
+  const char* nome;
+  TaskMetrics* metricas;
+  TaskHandle_t* handle;
+  uint8_t core;
 };
 
-//------------------------------------------------------------------------------
-// Variáveis Globais
-//------------------------------------------------------------------------------
-Outs state;                // Variável global para armazenar o estado dos atuadores
-Ins input;                 // Variável global para armazenar os dados dos sensores
-unsigned long millis_last_bomba = 0; // Variável para controlar o tempo de atuação da bomba d'água
-
-bool alexa_controll_exaust = false; // Flag para indicar se o controle dos exaustores está sendo feito pela Alexa
-bool alexa_controll_bomba = false;  // Flag para indicar se o controle da bomba d'água está sendo feito pela Alexa
-bool alexa_controll_leds = false;   // Flag para indicar se o controle dos LEDs está sendo feito pela Alexa
-
 //------------------------------------------------------------------------------
 // Instâncias de Objetos
 //------------------------------------------------------------------------------
-OffTime offtime;           // Objeto para lidar com o horário
 WiFiUDP udp;              // Objeto para comunicação UDP (NTP)
-NTPClient ntp(udp, "a.st1.ntp.br", -3 * 3600); // Objeto para sincronizar o horário com o servidor NTP brasileiro
+ClockDiscipline disciplina_relogio(offtime); // Sincroniza o OffTime pelo NTP: deriva do oscilador e ajuste sem saltos
+uint8_t id_relogio = SCHED_ID_INVALIDO;   // Tarefa do NTP na task de rede (alterna entre T_NTP e T_NTP_ESPERA)
 fauxmoESP fauxmo;         // Objeto para comunicação com a Amazon Alexa
-
-Thread thread_bomba = Thread();          // Thread para controle da bomba d'água
-Thread thread_irrigacao = Thread();       // Thread para controle da irrigação
-Thread thread_dht = Thread();            // Thread para leitura do sensor DHT11
-Thread thread_lcd = Thread();             // Thread para atualização do display LCD
-Thread thread_exaustor = Thread();        // Thread para controle dos exaustores
-Thread thread_clima = Thread();           // Thread para obter dados climáticos externos
-Thread thread_leds = Thread();            // Thread para controle dos LEDs
-
-DHT dht(PIN_SENSOR_DHT11, DHT11);        // Objeto para o sensor DHT11
-CronOut exaustor_timeout((60*60*1000),nullptr); // Timeout para os exaustores (60 minutos)
+AsyncWebServer servidor_http(PORTA_HTTP); // Servidor http (alexa e metricas)
+TlsClient cliente_clima;  // Conexão https com a api de clima, mantida entre requisições (so a task de rede usa)
+TlsClient cliente_open_meteo; // Provedor reserva da previsão, fechado depois de cada uso (task de rede)
+ForecastBuilder coletor_previsao; // Monta a previsão por hora direto do fluxo da resposta (task de rede)
+Forecast previsao_rede;   // Ultima previsão coletada, reserva quando o clima atual falha (task de rede)
+Preferences nvs_clima;    // Cache da previsão no NVS, sobrevive a reinicialização
+Preferences nvs_agenda;   // Agenda alterada pelo GET /agenda, sobrevive a reinicialização
+ComandoAgenda agendas[N_TRABALHOS_AGENDA]; // Configuração atual da agenda (setup e servidor http; a task de controle recebe copias)
+Preferences nvs_config;   // Parametros de operação alterados pelo /config, sobrevivem a reinicialização
+ConfigFazenda configuracao_servidor(descritores_config, config_coerente); // Copia do servidor http (json, validação e NVS)
+AsyncWebSocket ws_config("/ws/config");   // Parametros em tempo real: envia os valores a cada alteração e recebe alterações
+
+Scheduler scheduler_rede;                // Agendador da task de rede (clima)
+Scheduler scheduler_interface;           // Agendador do loop (lcd e log)
+TaskMetrics metricas_rede;               // Duração e atraso das tarefas da rede (o https aparece aqui)
+TaskMetrics metricas_interface;          // Duração e atraso das tarefas do loop
+TaskHandle_t handle_controle = nullptr;  // Task de controle, acordada por comandos e eventos de I/O
+TaskHandle_t handle_rede = nullptr;      // Task de rede
+TaskHandle_t handle_interface = nullptr; // Task do loop do arduino
+TaskHandle_t handle_log = nullptr;       // Task que escreve o log na serial
+
+QueueHandle_t fila_clima = nullptr;      // rede -> controle (ultimo valor, tamanho 1)
+QueueHandle_t fila_previsao = nullptr;   // rede -> controle (ultima previsão, tamanho 1)
+QueueHandle_t fila_comandos = nullptr;   // alexa -> controle
+QueueHandle_t fila_agenda = nullptr;     // GET /agenda -> controle
+QueueHandle_t fila_config = nullptr;     // /config e websocket -> controle (transações inteiras)
+QueueHandle_t fila_status = nullptr;     // controle -> interface (ultimo valor, tamanho 1)
+
+FloatSwitch boias;                      // Boias da caixa d'agua (interrupção + debounce por timer)
 // AC_CTRL ar_condicionado = AC_CTRL();    // Objeto para controle do ar condicionado (não implementado)
 CtrlLCD lcd(0x27,16,2);                // Objeto para o display LCD
 
+LoopMonitorado loops_monitorados[] = {
+  {"controle",  &metricas_controle,  &handle_controle,  CORE_CONTROLE},
+  {"interface", &metricas_interface, &handle_interface, CORE_INTERFACE},
+  {"rede",      &metricas_rede,      &handle_rede,      CORE_REDE},
+};
+#define N_LOOPS_MONITORADOS (sizeof(loops_monitorados) / sizeof(loops_monitorados[0]))
+
+/**
+ * @brief Alteração dos parametros sendo recebida (corpo do POST /config, mensagem do websocket ou query string).
+ */
+void campo_config(void* contexto, uint8_t indice, const char* valor, bool texto);
+
+struct SessaoConfig{
+  TransacaoFazenda transacao;
+  int8_t invalido = -1;  // primeiro parametro com valor invalido (nada é aplicado)
+  JsonStream parser;     // filtro: um caminho por parametro (indice do caminho = ParametroConfig)
+
+  SessaoConfig() : parser(configuracao_servidor.names(), N_PARAMETROS, campo_config, this){}
+};
+
 //------------------------------------------------------------------------------
 // Símbolo Personalizado para a Barra de Carregamento do LCD
 //------------------------------------------------------------------------------
@@ -216,24 +253,42 @@ byte bar_char_custom[8] = {
 // Protótipos de Funções
 //------------------------------------------------------------------------------
 void wifi_config();
-void modo_apresentacao();
-void main_bomba_agua();
-void set_outs();
-void code_74hc595(bool data_arr[], byte pin_data, byte pin_clock, byte pin_latch);
 void print_bin(byte aByte);
-void main_get_dht();
 void main_lcd();
 void self_test(bool* state);
-void main_irrigacao();
-void controll_umid();
-void set_state_leds(bool red_value, bool blue_value);
-void controll_temp();
-void set_led(bool color, byte num_led, bool state);
-void ligar_leds();
-void desligar_leds();
 void main_dados_clima();
-void main_exaustores();
-void main_leds();
+void campo_clima(void* contexto, uint8_t indice, const char* valor, bool texto);
+bool clima_da_previsao(DadosClima& clima);
+void main_previsao();
+bool ntp_enviar();
+bool ntp_receber();
+void main_relogio();
+bool baixar_previsao(TlsClient& cliente, const char* caminho, FonteClima fonte, PrevisaoClima& saida);
+void carregar_previsao();
+void carregar_agenda();
+void carregar_config();
+void valor_config(SessaoConfig& sessao, uint8_t parametro, const char* valor, bool texto);
+int alterar_config(const SessaoConfig& sessao, char* erro);
+void config_json(Print& saida, bool limites);
+void evento_ws_config(AsyncWebSocket* servidor, AsyncWebSocketClient* cliente, AwsEventType tipo, void* argumento, uint8_t* dados, size_t tamanho);
+void main_log_memoria();
+void acordar_controle();
+void IRAM_ATTR acordar_controle_isr();
+void dormir_task(uint32_t ms);
+void task_controle(void* parametro);
+void task_rede(void* parametro);
+void task_log(void* parametro);
+void publicar_status();
+void main_log_metricas();
+void metricas_json(Print& saida);
+void json_histograma(Print& saida, const char* nome, const uint32_t faixas[], uint32_t total, uint64_t soma, uint32_t maximo);
+void servidor_config();
+void main_gravar_historico();
+void historico_json(Print& saida, uint32_t horas);
+void serie_json(Print& saida, CanalRollup canal, ResolucaoRollup resolucao, uint32_t horas);
+#ifdef BENCH
+  void bench_interface();
+#endif
 
 //------------------------------------------------------------------------------
 // Funções para Controle da Alexa
@@ -252,18 +307,18 @@ void main_leds();
 //==============================================================================
 void wifi_config() {
     WiFi.mode(WIFI_STA);
-    logger("conectando a rede "+String(WIFI_SSID), "WIFI");
+    hal_log("WIFI", "conectando a rede %s", WIFI_SSID);
     WiFi.begin(WIFI_SSID, WIFI_PASS);
 
     // Aguarda a conexão
+    unsigned long inicio = millis();
     while (WiFi.status() != WL_CONNECTED) {
-        log_point();
         delay(100);
     }
-    new_line();
 
     // Conexão estabelecida
-    logger("Ip adquirido: "+ String(WiFi.localIP()), "WIFI");
+    IPAddress ip = WiFi.localIP();
+    hal_log("WIFI", "Ip adquirido: %u.%u.%u.%u em %lu ms", ip[0], ip[1], ip[2], ip[3], millis() - inicio);
 }
 
 //==============================================================================
@@ -284,213 +339,366 @@ class AC_CTRL{
 //==============================================================================
 // Função para Obter Dados Climáticos Externos
 //==============================================================================
+
+// Campos lidos da resposta do OpenWeatherMap (o resto do documento é ignorado pelo parser)
+enum CampoClima{
+  CAMPO_UMIDADE,
+  CAMPO_TEMPERATURA,
+  CAMPO_CHUVA,
+  CAMPO_VENTO,
+  N_CAMPOS_CLIMA
+};
+
+const char* const caminhos_clima[N_CAMPOS_CLIMA] = {"main.humidity", "main.temp", "rain.1h", "wind.speed"};
+
+// Recebe cada campo do filtro assim que o parser termina de ler o valor
+void campo_clima(void* contexto, uint8_t indice, const char* valor, bool){
+  DadosClima& clima = *(DadosClima*)contexto;
+  switch (indice) {
+    case CAMPO_UMIDADE:     clima.umidade_externa = constrain(JsonStream::fixed(valor, 0), 0, 100); break;
+    case CAMPO_TEMPERATURA: clima.temperatura_externa_x10 = JsonStream::fixed(valor, 1); break;
+    case CAMPO_CHUVA:       clima.chuva_x10 = JsonStream::fixed(valor, 1); break;
+    case CAMPO_VENTO:       clima.vento_x10 = JsonStream::fixed(valor, 1); break;
+  }
+}
+
+// Le a resposta direto da conexão TLS persistente, em pedaços de TAM_BUFFER_CLIMA, sem String nem arvore do json
 void main_dados_clima(){
     if(WiFi.status()== WL_CONNECTED){
-      WiFiClientSecure client;
-      HTTPClient http;
-
-      // Ignorar a verificação SSL (não recomendado para produção)
-      client.setInsecure();
-    
-      http.begin(client, link);
-      
-      int httpResponseCode = http.GET();
-      
-      String jsonBuffer = "{}"; 
-      
-      if (httpResponseCode>0) {
-        jsonBuffer = http.getString();
+      uint32_t heap_antes = ESP.getFreeHeap();
+      uint32_t maior_bloco_antes = ESP.getMaxAllocHeap();
+
+      int httpResponseCode = cliente_clima.get(caminho_clima);
+      hal_log("CLIMA", "Resposta http: %d", httpResponseCode);
+
+      DadosClima clima;
+      JsonStream parser(caminhos_clima, N_CAMPOS_CLIMA, campo_clima, &clima);
+      bool completo = false;
+
+      if (httpResponseCode == 200) {
+        char buffer[TAM_BUFFER_CLIMA];
+        int lidos;
+        while (!parser.done() && !parser.complete() && !parser.error() && (lidos = cliente_clima.read(buffer, sizeof(buffer))) > 0) {
+          parser.feed(buffer, lidos);
+        }
+        completo = parser.done() || parser.complete(); // com todos os campos o resto so é drenado pelo end()
       }
 
-      logger("Resposta http: "+String(httpResponseCode),"CLIMA");
+      // Libera a resposta (a conexão fica aberta se o servidor aceitar keep-alive)
+      cliente_clima.end();
 
-      // Free resources
-      http.end();
+      hal_log_debug("CLIMA", "heap livre antes %lu depois %lu bytes, maior bloco antes %lu depois %lu bytes",
+                    (unsigned long)heap_antes, (unsigned long)ESP.getFreeHeap(),
+                    (unsigned long)maior_bloco_antes, (unsigned long)ESP.getMaxAllocHeap());
 
-      //Serial.println(jsonBuffer);
-      JSONVar myObject = JSON.parse(jsonBuffer);
-  
-      if (JSON.typeof(myObject) == "undefined") {
-        logger("Erro ao processar o Json", "CLIMA");
-        return;
+      if (!completo) {
+        if (!clima_da_previsao(clima)) {
+          hal_log_aviso("CLIMA", "Erro ao processar o Json");
+          return;
+        }
+        hal_log_aviso("CLIMA", "Erro ao processar o Json, usando a previsao para esta hora");
       }
     
-      logger("Umidade Externa: " + myObject["main"]["humidity"], "CLIMA");
-
-      input.umidade_externa = myObject["main"]["humidity"];
+      int16_t externa_x10 = clima.temperatura_externa_x10;
+      hal_log("CLIMA", "Umidade Externa: %d, temperatura %s%d.%d C, chuva %d.%d mm/h, vento %d.%d m/s", clima.umidade_externa,
+              externa_x10 < 0 ? "-" : "", abs(externa_x10) / 10, abs(externa_x10) % 10,
+              clima.chuva_x10 / 10, clima.chuva_x10 % 10, clima.vento_x10 / 10, clima.vento_x10 % 10);
+      xQueueOverwrite(fila_clima, &clima);
+      acordar_controle();
     }
 }
 
+// Sem resposta do clima atual: valores previstos para a hora atual (false sem previsão valida)
+bool clima_da_previsao(DadosClima& clima){
+  uint32_t agora = offtime.now();
+  int16_t temperatura_x10;
+  uint8_t umidade, chuva_prob;
+  if (!previsao_rede.valid(agora) || !previsao_rede.at(agora, temperatura_x10, umidade, chuva_prob)) return false;
+  clima = DadosClima();
+  clima.umidade_externa = umidade;
+  clima.temperatura_externa_x10 = temperatura_x10;
+  clima.chuva_x10 = chuva_prob >= CHUVA_PROB_PREVISAO ? 1 : 0;
+  return true;
+}
+
 //==============================================================================
-// Função para Atualizar o Display LCD
+// Função para Sincronizar o Relogio (NTP sem bloquear a task de rede)
 //==============================================================================
-void main_lcd(){
 
-  // Primeira linha do LCD: Umidade, Temperatura e Tempo até a Próxima Ativação da Bomba
-  char buffer[20];
-  sprintf(buffer, "Umd:%d% Temp:%dC", String(input.umidade), String(input.temperatura));
-  lcd.msg(0,0,String(buffer));
+// Envia o pedido SNTP carimbado com o uptime do envio (o DNS é resolvido antes do carimbo)
+bool ntp_enviar(){
+  IPAddress ip;
+  if (!WiFi.hostByName(servidor_ntp, ip)) return false;
+  while (udp.parsePacket() > 0) udp.flush(); // resposta atrasada de um pedido anterior
+
+  uint8_t pacote[NTP_TAMANHO_PACOTE];
+  udp.beginPacket(ip, NTP_PORTA);
+  disciplina_relogio.request(pacote, hal_uptime_us());
+  udp.write(pacote, sizeof(pacote));
+  return udp.endPacket() == 1;
+}
 
-  // Calcula o tempo restante para ligar/desligar a bomba
-  unsigned long tempo_passado = millis() - millis_last_bomba;
-  unsigned short segundos_restantes;
+// Entrega a resposta, se ja chegou, carimbada com o uptime da leitura
+bool ntp_receber(){
+  if (udp.parsePacket() != NTP_TAMANHO_PACOTE) return false;
+  uint64_t chegada = hal_uptime_us();
+  uint8_t pacote[NTP_TAMANHO_PACOTE];
+  udp.read(pacote, sizeof(pacote));
+  return disciplina_relogio.response(pacote, chegada);
+}
 
-  if (state.bomba1 == true || state.bomba2 == true) {
-      // Bomba ligada: calcula o tempo restante até desligar
-      if (tempo_passado < T_BOMBA) {
-          segundos_restantes = (T_BOMBA - tempo_passado) / 1000;
-      } else {
-          segundos_restantes = 0; 
-      }
-  } else {
-      // Bomba desligada: calcula o tempo restante até ligar
-      if (tempo_passado < T_BOMBA * CICLOS_BOMBA_DESLIGADA) {  // Considera o tempo total do ciclo (ligada + desligada)
-          segundos_restantes = (T_BOMBA * CICLOS_BOMBA_DESLIGADA - tempo_passado) / 1000;
-      } else {
-          segundos_restantes = 0; 
-      }
+// Pedido a cada T_NTP_INICIAL ate a deriva ser medida, depois em intervalos dobrando ate T_NTP; enquanto espera a
+// resposta a tarefa volta a cada T_NTP_ESPERA em vez de bloquear
+void main_relogio(){
+  static bool esperando = false;
+  static uint32_t millis_envio = 0;
+
+  if (!esperando) {
+    if (WiFi.status() != WL_CONNECTED || !ntp_enviar()) return;
+    esperando = true;
+    millis_envio = millis();
+    scheduler_rede.set_interval(id_relogio, T_NTP_ESPERA, millis());
+    return;
   }
 
-  // Formata a mensagem de tempo restante
-  byte minutos = segundos_restantes / 60;
-  byte segundos = segundos_restantes % 60;
-  sprintf(buffer, "Bomba %d:%02d Min", minutos, segundos);
-  String msg = String(buffer);
+  bool respondeu = ntp_receber();
+  if (!respondeu && millis() - millis_envio < T_NTP_TIMEOUT) return;
 
-  logger(msg, "MAIN LCD");
-  lcd.msg(1,0,msg);
+  if (respondeu) {
+    const MetricasRelogio& medidas = disciplina_relogio.metrics();
+    hal_log_debug("RELOGIO", "Erro %ld us, ida e volta %lu us, deriva %ld ppb", (long)medidas.ultimo_erro_us,
+                  (unsigned long)medidas.ida_volta_us, (long)medidas.deriva_ppb);
+  } else {
+    disciplina_relogio.timeout();
+    hal_log_aviso("RELOGIO", "Servidor NTP sem resposta");
+  }
+  esperando = false;
+  scheduler_rede.set_interval(id_relogio, disciplina_relogio.poll_interval_ms(T_NTP_INICIAL, T_NTP), millis());
 }
 
 //==============================================================================
-// Função para Controlar a Bomba D'Água
+// Função para Obter a Previsão do Tempo (proximas 48h)
 //==============================================================================
-void main_bomba_agua(){
-  static char flag_vez_ligar = 0; 
 
+// GET caminho e monta a previsão por hora em fluxo; a conexão fica como o servidor deixar (keep-alive)
+bool baixar_previsao(TlsClient& cliente, const char* caminho, FonteClima fonte, PrevisaoClima& saida){
+  int status = cliente.get(caminho);
+  if (status != 200) {
+    cliente.end();
+    hal_log_aviso("CLIMA", "Previsao (fonte %d): resposta http %d", fonte, status);
+    return false;
+  }
 
-  // Verifica se o controle pela Alexa está desativado
-  if(alexa_controll_bomba == false){
-    // Lógica de alternância entre as bombas (ainda não implementada a detecção de falhas)
-    if(state.bomba1 == false && flag_vez_ligar < CICLOS_BOMBA_DESLIGADA){
-      flag_vez_ligar++;
-    }
-    
-    if (state.bomba1 == false && flag_vez_ligar >= CICLOS_BOMBA_DESLIGADA){
-      millis_last_bomba = millis();
-      state.bomba1 = true; 
-      state.bomba2 = false;
-      flag_vez_ligar = 0;
-    } else if (state.bomba1 == true){
-      millis_last_bomba = millis();
-      state.bomba1 = false; 
-      state.bomba2 = false;
-      flag_vez_ligar++;
-    }
-    set_outs();
+  coletor_previsao.begin(fonte);
+  char buffer[TAM_BUFFER_CLIMA];
+  int lidos;
+  while (!coletor_previsao.done() && (lidos = cliente.read(buffer, sizeof(buffer))) > 0) {
+    if (!coletor_previsao.feed(buffer, lidos)) break;
   }
+  cliente.end();
 
-  //Serial.println("main_bomba_agua "+String(alexa_controll_bomba) + " contagem: "+String((int)flag_vez_ligar));
+  if (!coletor_previsao.build(saida, offtime.now(), offtime.timezone())) {
+    hal_log_aviso("CLIMA", "Previsao (fonte %d): resposta incompleta", fonte);
+    return false;
+  }
+  return true;
 }
 
+// OpenWeatherMap na conexão ja aberta pelo clima atual; se falhar, Open-Meteo. Sem nenhum dos dois a ultima
+// previsão continua valendo ate PREVISAO_VALIDADE_S, depois o controle de clima fica so reativo.
+void main_previsao(){
+  if (WiFi.status() != WL_CONNECTED || !offtime.synced() || offtime.now() < EPOCH_VALIDO) return;
 
-//==============================================================================
-// Função para Ler os Dados do Sensor DHT11
-//==============================================================================
-void main_get_dht(){
-  if (!isnan(dht.readHumidity()) == false || isnan(dht.readTemperature()) == false) { 
-    input.umidade = int(dht.readHumidity());
-    input.temperatura = int(dht.readTemperature());
+  PrevisaoClima nova;
+  bool coletada = baixar_previsao(cliente_clima, caminho_previsao, FONTE_OPENWEATHER, nova);
+  if (!coletada) {
+    coletada = baixar_previsao(cliente_open_meteo, caminho_open_meteo, FONTE_OPEN_METEO, nova);
+    cliente_open_meteo.close(); // consultado raramente: nao vale segurar o heap da sessão
+  }
+  if (!coletada) {
+    hal_log_aviso("CLIMA", "Previsao indisponivel, %s", previsao_rede.valid(offtime.now()) ? "mantendo a anterior" : "controle so reativo");
+    return;
   }
-}
 
-//==============================================================================
-// Função para Controlar a Irrigação
-//==============================================================================
-void main_irrigacao(){
-  static byte vez_de_irrigar = 0;
+  previsao_rede.set(nova);
+  xQueueOverwrite(fila_previsao, &nova);
+  acordar_controle();
+  nvs_clima.putBytes("previsao", &nova, sizeof(nova));
+  int16_t agora_x10 = nova.temperatura_x10[0];
+  hal_log("CLIMA", "Previsao (fonte %d): %d horas, agora %s%d.%d C, chuva %d%%", nova.fonte, nova.horas,
+          agora_x10 < 0 ? "-" : "", abs(agora_x10) / 10, abs(agora_x10) % 10, nova.chuva_prob[0]); // sinal a parte: -0.5 nao vira 0.5
+}
 
-  vez_de_irrigar++;
+// Previsão gravada antes de reiniciar: vale ate PREVISAO_VALIDADE_S depois da coleta, mesmo sem rede
+void carregar_previsao(){
+  nvs_clima.begin("clima", false);
+  PrevisaoClima gravada;
+  if (nvs_clima.getBytes("previsao", &gravada, sizeof(gravada)) != sizeof(gravada) || !previsao_rede.set(gravada)) {
+    hal_log("CLIMA", "Sem previsao gravada");
+    return;
+  }
+  xQueueOverwrite(fila_previsao, &gravada);
+  hal_log("CLIMA", "Previsao gravada: %d horas, %s", gravada.horas, previsao_rede.valid(offtime.now()) ? "valida" : "vencida");
+}
 
-  if (vez_de_irrigar >= N_VEZES_CHAMADA_ENTRE_IRRIG){
-    vez_de_irrigar = 0;
-    state.solenoide_irrigacao = true;
-  }else{
-    state.solenoide_irrigacao = false;
+// Agenda gravada pelo GET /agenda; sem gravação (ou invalida) vale a padrão do FarmControl.cpp
+void carregar_agenda(){
+  nvs_agenda.begin("agenda", false);
+  for (uint8_t i = 0; i < N_TRABALHOS_AGENDA; i++) {
+    agendas[i] = agenda_padrao[i];
+    ComandoAgenda gravada;
+    if (nvs_agenda.getBytes(nomes_trabalhos_agenda[i], &gravada, sizeof(gravada)) != sizeof(gravada)) continue;
+    if (gravada.trabalho != i || !agenda_valida(gravada, configuracao_servidor.get(PARAM_RAMPA_LEDS))) {
+      hal_log_aviso("AGENDA", "Agenda gravada de %s invalida, usando a padrao", nomes_trabalhos_agenda[i]);
+      continue;
+    }
+    agendas[i] = gravada;
+    hal_log("AGENDA", "%s gravada: '%s' por %lus", nomes_trabalhos_agenda[i], agendas[i].expressao, (unsigned long)agendas[i].duracao_s);
   }
-  set_outs();
 }
 
-//==============================================================================
-// Função para Controlar os Exaustores
-//==============================================================================
-void main_exaustores(){
-  if(alexa_controll_exaust == false){
-    controll_umid(); // verifica o controle de umidade
-    controll_temp(); // verifica acoes para controle de temperatura
+// Parametros gravados pelo /config; os que faltam (ou uma gravação corrompida) ficam com o padrão do FarmControl.cpp
+// (antes das tasks: a task de controle ja começa com os mesmos valores da copia do servidor)
+void carregar_config(){
+  nvs_config.begin("config", false);
+  ConfigGravada gravada;
+  if (nvs_config.getBytes("valores", &gravada, sizeof(gravada)) != sizeof(gravada)) {
+    hal_log("CONFIG", "Sem parametros gravados, usando os padroes");
+    return;
+  }
+  uint8_t lidos = configuracao.load(gravada);
+  configuracao_servidor.load(gravada);
+  if (lidos == 0) {
+    hal_log_aviso("CONFIG", "Parametros gravados invalidos, usando os padroes");
+    return;
   }
+  hal_log("CONFIG", "%d parametros gravados", lidos);
 }
 
 //==============================================================================
-// Função para Controlar a Temperatura (Exaustores e Ar Condicionado)
+// Funções dos Parametros de Operação (servidor http e websocket, na task do AsyncTCP)
 //==============================================================================
-void controll_temp(){
-  static bool status_ac = false;
 
-  if (input.temperatura > TEMP_MAX) {
-    // Temperatura alta: liga os exaustores
-    if (state.exaustor == false && status_ac == false) {
-        state.exaustor = true;
-        exaustor_timeout.start(); 
-    } 
-  } else if (input.temperatura < TEMP_MIN) {
-    // Temperatura baixa: liga o ar condicionado (não implementado)
-    state.exaustor = false;
-    status_ac = true;
-    //ar_condicionado.on();
-    //ar_condicionado.set_temp(TEMP_MAX - TEMP_MARGEM); 
+// Recebe cada parametro do json assim que o parser termina de ler o valor
+void campo_config(void* contexto, uint8_t indice, const char* valor, bool texto){
+  valor_config(*(SessaoConfig*)contexto, indice, valor, texto);
+}
+
+// Numero no formato do json (30.5) dentro dos limites entra na transação, senao marca a sessão como invalida
+void valor_config(SessaoConfig& sessao, uint8_t parametro, const char* valor, bool texto){
+  int32_t fixo;
+  if (!texto && ConfigFazenda::parse(valor, configuracao_servidor.descriptor(parametro).casas, fixo) &&
+      configuracao_servidor.stage(sessao.transacao, parametro, fixo)) return;
+  if (sessao.invalido < 0) sessao.invalido = parametro;
+}
+
+// Valida a alteração inteira, envia para a task de controle, grava no NVS e avisa os clientes do websocket;
+// retorna o status http (200 aplicada) e, nos erros, o json da resposta em erro (TAM_ERRO_CONFIG)
+int alterar_config(const SessaoConfig& sessao, char* erro){
+  if (sessao.invalido >= 0) {
+    snprintf(erro, TAM_ERRO_CONFIG, "{\"erro\":\"valor invalido\",\"parametro\":\"%s\"}", descritores_config[sessao.invalido].nome);
+    return 400;
   }
+  if (sessao.transacao.quantidade == 0) return 200;
+  if (!configuracao_servidor.check(sessao.transacao)) {
+    snprintf(erro, TAM_ERRO_CONFIG, "{\"erro\":\"combinacao incoerente\"}");
+    return 400;
+  }
+  if (fila_config == nullptr || xQueueSend(fila_config, &sessao.transacao, 0) != pdTRUE) {
+    snprintf(erro, TAM_ERRO_CONFIG, "{\"erro\":\"controle ocupado\"}");
+    return 503;
+  }
+  acordar_controle();
+  configuracao_servidor.commit(sessao.transacao);
+
+  // um blob so: a gravação tambem vale inteira ou nada
+  ConfigGravada gravada;
+  configuracao_servidor.save(gravada);
+  nvs_config.putBytes("valores", &gravada, sizeof(gravada));
+
+  StreamString valores;
+  config_json(valores, false);
+  ws_config.textAll(valores);
+  return 200;
+}
 
-  // Verifica se o tempo máximo dos exaustores foi atingido
-  if (exaustor_timeout.hasTimedOut() && input.temperatura > TEMP_MAX) {
-    state.exaustor  = false;
-    // status_ac = true;
-    // ar_condicionado.on();
-    // ar_condicionado.set_temp(TEMP_MIN + TEMP_MARGEM);
+// {"temp_max":30.0,...}; com limites cada parametro vira {"valor":30.0,"minimo":15.0,"maximo":45.0,"padrao":30.0,"unidade":"C"}
+void config_json(Print& saida, bool limites){
+  char texto[CONFIG_MAX_TEXTO];
+  saida.print("{");
+  for (uint8_t i = 0; i < N_PARAMETROS; i++) {
+    const DescritorConfig& descritor = configuracao_servidor.descriptor(i);
+    ConfigFazenda::format(configuracao_servidor.get(i), descritor.casas, texto);
+    saida.printf(limites ? "%s\"%s\":{\"valor\":%s" : "%s\"%s\":%s", i ? "," : "", descritor.nome, texto);
+    if (!limites) continue;
+    ConfigFazenda::format(descritor.minimo, descritor.casas, texto);
+    saida.printf(",\"minimo\":%s", texto);
+    ConfigFazenda::format(descritor.maximo, descritor.casas, texto);
+    saida.printf(",\"maximo\":%s", texto);
+    ConfigFazenda::format(descritor.padrao, descritor.casas, texto);
+    saida.printf(",\"padrao\":%s,\"unidade\":\"%s\"}", texto, descritor.unidade);
   }
+  saida.print("}");
+}
+
+// Websocket /ws/config: valores ao conectar e depois de cada alteração (de qualquer cliente ou do http);
+// uma mensagem {"temp_max":28.5,...} altera como o POST /config (so o erro volta para quem enviou)
+void evento_ws_config(AsyncWebSocket* servidor, AsyncWebSocketClient* cliente, AwsEventType tipo, void* argumento, uint8_t* dados, size_t tamanho){
+  if (tipo == WS_EVT_CONNECT) {
+    StreamString valores;
+    config_json(valores, false);
+    cliente->text(valores);
+    return;
+  }
+  if (tipo != WS_EVT_DATA) return;
 
-  // Desliga os exaustores e o ar condicionado se a temperatura estiver ideal
-  if (input.temperatura <= (TEMP_MAX - TEMP_MARGEM) && input.temperatura >= (TEMP_MIN + TEMP_MARGEM)) {
-    state.exaustor  = false;
-    //ar_condicionado.off();
+  // so mensagens de texto inteiras em um frame (uma alteração de todos os parametros cabe com folga)
+  AwsFrameInfo* frame = (AwsFrameInfo*)argumento;
+  if (!frame->final || frame->index != 0 || frame->len != tamanho || frame->opcode != WS_TEXT) {
+    cliente->text("{\"erro\":\"mensagem fragmentada\"}");
+    return;
   }
+  SessaoConfig sessao;
+  sessao.parser.feed((const char*)dados, tamanho);
+  if (!sessao.parser.done()) {
+    cliente->text("{\"erro\":\"json invalido\"}");
+    return;
+  }
+  char erro[TAM_ERRO_CONFIG];
+  if (alterar_config(sessao, erro) != 200) cliente->text(erro);
 }
 
 //==============================================================================
-// Função para Controlar a Umidade (Exaustores e Ar Condicionado)
+// Função para Atualizar o Display LCD
 //==============================================================================
-void controll_umid(){
-  // Liga os exaustores se a umidade estiver alta (mas não no extremo) e temperatura tiver nao tao baixa, 
-  // para poder manter a temperatura interna em caso de dia frio e umido, melhor manter quente e umido do que seco e frio (peixes principalemtne)
-  if ((input.umidade > UMID_MAX_EXAUST && input.umidade < UMID_MAX) && input.temperatura > TEMP_MIN){
-    if(input.chuva == false && input.umidade_externa < UMID_MAX_EXAUST){
-      state.exaustor = true;
-      exaustor_timeout.start();
+void main_lcd(){
+  // Copia do estado publicada pela task de controle
+  Status status;
+  if (xQueuePeek(fila_status, &status, 0) != pdTRUE) return;
+
+  // Primeira linha do LCD: Umidade, Temperatura e Tempo até a Próxima Ativação da Bomba
+  char buffer[20];
+  sprintf(buffer, "Umd:%d%% Temp:%dC", status.entradas.umidade / 10, status.entradas.temperatura / 10);
+  lcd.msg(0,0,String(buffer));
+
+  // Tempo ate a bomba ligar ou desligar, pelo proximo evento da agenda
+  int64_t proximo = status.proximo_evento[TRABALHO_BOMBA];
+  int64_t restante = -1; // sem agenda
+  if (proximo == CRON_NUNCA) {
+    sprintf(buffer, "Bomba sem agenda");
+  } else {
+    restante = proximo - offtime.now64();
+    if (restante < 0) restante = 0;
+    if (restante < 100 * 60) {
+      sprintf(buffer, "Bomba %d:%02d Min", (int)(restante / 60), (int)(restante % 60));
+    } else {
+      sprintf(buffer, "Bomba %dh%02d", (int)min(restante / 3600, (int64_t)999), (int)(restante / 60 % 60));
     }
-  } else if(input.umidade >= UMID_MAX){  // Liga o ar condicionado se a umidade estiver muito alta (não implementado)
-      //ar_condicionado.on();
-      //delay(1000);
-      //ar_condicionado.set_desumid();
   }
 
-  // Desliga os exaustores após o timeout ou se a umidade baixar
-  if (exaustor_timeout.hasTimedOut() || input.umidade <= (UMID_MAX_EXAUST - 5)) { 
-    state.exaustor  = false;
-    // ar_condicionado.on();
-    // delay(1000);
-    // ar_condicionado.set_normal();
-    // delay(1000);
-    // ar_condicionado.off();
-  }
+  hal_log_debug("LCD", "Umd:%d%% Temp:%dC, bomba em %lds", status.entradas.umidade / 10, status.entradas.temperatura / 10,
+                (long)restante);
+  lcd.msg(1,0,String(buffer));
 }
 
 //==============================================================================
@@ -510,120 +718,527 @@ void self_test(bool* state) {
 }
 
 //==============================================================================
-// Função para Atualizar o Estado das Saídas
+// Função para Logar a Memoria Livre
 //==============================================================================
-void set_outs(){
-  static bool array_reles[8] = {0,0,0,0,0,0,0,0};
-
-  array_reles[0] = state.bomba1;
-  array_reles[1] = state.bomba2;
-  array_reles[2] = state.solenoide_caixa;
-  array_reles[3] = state.solenoide_irrigacao;
-  array_reles[4] = state.contatora_leds;
-  array_reles[5] = state.exaustor;
-  array_reles[6] = state.refletor;
-  array_reles[7] = state.lampada;
+void main_log_memoria(){
+  hal_log("LOOP", "Memoria livre: %lu bytes", (unsigned long)ESP.getFreeHeap());
+  hal_log("LOOP", "Reles: %lu escritas, %lu evitadas, %lu envios 595",
+          (unsigned long)cadeias_595.writes(CADEIA_RELES), (unsigned long)cadeias_595.avoided(CADEIA_RELES), (unsigned long)cadeias_595.shift_passes());
+  hal_log("LOOP", "Leds: %lu bytes enviados (set_led antigo: %lu shifts)", (unsigned long)leds.chain_writes(), (unsigned long)leds.legacy_shifts());
+
+  LedBcm &bcm = leds.dimmer();
+  if (bcm.running()) {
+    hal_log("LOOP", "BCM: isr med %lu ciclos, max %lu ciclos, carga %lu por mil",
+            (unsigned long)bcm.cycles_avg(), (unsigned long)bcm.cycles_max(), (unsigned long)bcm.load_per_mille(getCpuFrequencyMhz()));
+    bcm.reset_stats();
+  }
 
-  code_74hc595(array_reles,PIN_DATA_RELES,PIN_CLOCK_RELES,PIN_LATCH_RELES);
+  hal_log("CLIMA", "Exaustores: demanda %d%%, motivo %d", clima.demand_percent(), clima.reason());
 }
 
 //==============================================================================
-// Função para Enviar Dados para o Shift Register 74HC595
+// Funções de Metricas das Tasks (serial e GET /metricas)
 //==============================================================================
-void code_74hc595(bool data_arr[], byte pin_data, byte pin_clock, byte pin_latch){
-  byte binario = 0b00000000;
 
-  for (int i = 0; i < 8; i++) {
-      if (data_arr[i] == 1) {
-          bitWrite(binario, 7 - i, 1);
-      }
+// Resumo periodico na serial: voltas por segundo, stack e duração/atraso de cada tarefa
+void main_log_metricas(){
+  hal_log("METRICAS", "heap livre %lu bytes, minimo desde o boot %lu bytes", (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMinFreeHeap());
+
+  const MetricasTls& tls = cliente_clima.metrics();
+  hal_log("METRICAS", "tls clima: %lu requisicoes, %lu handshakes (ultimo %lu ms, max %lu ms), %lu reusos, %lu falhas, %lu certificado, heap sessao %lu pico %lu bytes",
+          (unsigned long)tls.requisicoes, (unsigned long)tls.conexoes, (unsigned long)tls.handshake_ultimo_ms, (unsigned long)tls.handshake_max_ms,
+          (unsigned long)tls.reusos, (unsigned long)tls.falhas, (unsigned long)tls.falhas_certificado,
+          (unsigned long)tls.heap_sessao_bytes, (unsigned long)tls.heap_pico_bytes);
+
+  const MetricasRelogio& relogio = disciplina_relogio.metrics();
+  hal_log("METRICAS", "relogio: %lu sincronizacoes, %lu sem resposta, %lu descartadas, %lu saltos, erro %ld us (max %ld), ida e volta %lu us, deriva %ld ppb, ajustando %ld us",
+          (unsigned long)relogio.sincronizacoes, (unsigned long)relogio.sem_resposta, (unsigned long)relogio.descartadas,
+          (unsigned long)relogio.saltos, (long)relogio.ultimo_erro_us, (long)relogio.maior_erro_us, (unsigned long)relogio.ida_volta_us,
+          (long)relogio.deriva_ppb, (long)disciplina_relogio.pending_us());
+
+  for (uint8_t l = 0; l < N_LOOPS_MONITORADOS; l++) {
+    LoopMonitorado& monitorado = loops_monitorados[l];
+    TaskMetrics& metricas = *monitorado.metricas;
+    uint32_t taxa = metricas.loop_rate_x10();
+    uint32_t stack_livre = (*monitorado.handle != nullptr) ? uxTaskGetStackHighWaterMark(*monitorado.handle) : 0;
+    hal_log("METRICAS", "%s (core %u): %lu.%lu voltas/s, stack livre minima %lu bytes",
+            monitorado.nome, monitorado.core, (unsigned long)(taxa / 10), (unsigned long)(taxa % 10), (unsigned long)stack_livre);
+
+    MetricasTarefa tarefa;
+    for (uint8_t id = 0; id < metricas.size(); id++) {
+      if (!metricas.snapshot(id, tarefa) || tarefa.nome == nullptr || tarefa.execucoes == 0) continue;
+      hal_log("METRICAS", "  %s: %lu exec, duracao med %lu p99 %lu max %lu us, atraso med %lu p99 %lu max %lu ms",
+              tarefa.nome, (unsigned long)tarefa.execucoes,
+              (unsigned long)(tarefa.duracao_total_us / tarefa.execucoes),
+              (unsigned long)TaskMetrics::percentile(tarefa.duracao_us, tarefa.execucoes, 99),
+              (unsigned long)tarefa.duracao_max_us,
+              (unsigned long)(tarefa.atraso_total_ms / tarefa.execucoes),
+              (unsigned long)TaskMetrics::percentile(tarefa.atraso_ms, tarefa.execucoes, 99),
+              (unsigned long)tarefa.atraso_max_ms);
+    }
   }
+}
 
-  digitalWrite(pin_latch, LOW);
-  shiftOut(pin_data, pin_clock, MSBFIRST, binario);
-  digitalWrite(pin_latch, HIGH);
-  digitalWrite(pin_latch, LOW);
+// Histograma em json: resumo e contagem por faixa (faixa 0 = 0, faixa i = 2^(i-1) ate 2^i - 1)
+void json_histograma(Print& saida, const char* nome, const uint32_t faixas[], uint32_t total, uint64_t soma, uint32_t maximo){
+  saida.printf("\"%s\":{\"media\":%lu,\"p50\":%lu,\"p99\":%lu,\"max\":%lu,\"faixas\":[",
+               nome, (unsigned long)(total ? soma / total : 0),
+               (unsigned long)TaskMetrics::percentile(faixas, total, 50),
+               (unsigned long)TaskMetrics::percentile(faixas, total, 99),
+               (unsigned long)maximo);
+  for (uint8_t f = 0; f < METRICAS_FAIXAS; f++) {
+    saida.printf(f ? ",%lu" : "%lu", (unsigned long)faixas[f]);
+  }
+  saida.print("]}");
+}
+
+// Todas as metricas em json, escritas direto na saida (sem montar String): Serial ou resposta http
+void metricas_json(Print& saida){
+  saida.printf("{\"millis\":%lu,\"heap_livre\":%lu,\"heap_minimo\":%lu,\"loops\":[",
+               (unsigned long)millis(), (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMinFreeHeap());
+
+  for (uint8_t l = 0; l < N_LOOPS_MONITORADOS; l++) {
+    LoopMonitorado& monitorado = loops_monitorados[l];
+    TaskMetrics& metricas = *monitorado.metricas;
+    uint32_t taxa = metricas.loop_rate_x10();
+    uint32_t stack_livre = (*monitorado.handle != nullptr) ? uxTaskGetStackHighWaterMark(*monitorado.handle) : 0;
+    saida.printf("%s{\"nome\":\"%s\",\"core\":%u,\"voltas\":%lu,\"voltas_s\":%lu.%lu,\"stack_livre_min\":%lu,\"tarefas\":[",
+                 l ? "," : "", monitorado.nome, monitorado.core, (unsigned long)metricas.loops(),
+                 (unsigned long)(taxa / 10), (unsigned long)(taxa % 10), (unsigned long)stack_livre);
+
+    MetricasTarefa tarefa;
+    bool primeira = true;
+    for (uint8_t id = 0; id < metricas.size(); id++) {
+      if (!metricas.snapshot(id, tarefa) || tarefa.nome == nullptr) continue;
+      saida.printf("%s{\"nome\":\"%s\",\"execucoes\":%lu,", primeira ? "" : ",", tarefa.nome, (unsigned long)tarefa.execucoes);
+      json_histograma(saida, "duracao_us", tarefa.duracao_us, tarefa.execucoes, tarefa.duracao_total_us, tarefa.duracao_max_us);
+      saida.print(',');
+      json_histograma(saida, "atraso_ms", tarefa.atraso_ms, tarefa.execucoes, tarefa.atraso_total_ms, tarefa.atraso_max_ms);
+      saida.print('}');
+      primeira = false;
+    }
+    saida.print("]}");
+  }
+
+  const MetricasTls& tls = cliente_clima.metrics();
+  saida.printf("],\"tls_clima\":{\"requisicoes\":%lu,\"handshakes\":%lu,\"reusos\":%lu,\"falhas\":%lu,\"falhas_certificado\":%lu,"
+               "\"handshake_ultimo_ms\":%lu,\"handshake_max_ms\":%lu,\"heap_sessao\":%lu,\"heap_pico\":%lu}",
+               (unsigned long)tls.requisicoes, (unsigned long)tls.conexoes, (unsigned long)tls.reusos, (unsigned long)tls.falhas,
+               (unsigned long)tls.falhas_certificado, (unsigned long)tls.handshake_ultimo_ms, (unsigned long)tls.handshake_max_ms,
+               (unsigned long)tls.heap_sessao_bytes, (unsigned long)tls.heap_pico_bytes);
+
+  const MetricasRelogio& relogio = disciplina_relogio.metrics();
+  saida.printf(",\"relogio\":{\"sincronizacoes\":%lu,\"sem_resposta\":%lu,\"descartadas\":%lu,\"saltos\":%lu,\"erro_us\":%ld,"
+               "\"erro_max_us\":%ld,\"ida_volta_us\":%lu,\"deriva_ppb\":%ld,\"ajustando_us\":%ld,\"ultima_utc\":%lu}}",
+               (unsigned long)relogio.sincronizacoes, (unsigned long)relogio.sem_resposta, (unsigned long)relogio.descartadas,
+               (unsigned long)relogio.saltos, (long)relogio.ultimo_erro_us, (long)relogio.maior_erro_us, (unsigned long)relogio.ida_volta_us,
+               (long)relogio.deriva_ppb, (long)disciplina_relogio.pending_us(), (unsigned long)relogio.ultima_utc);
 }
 
 //==============================================================================
-// Função para Controlar os LEDs
+// Funções do Historico na Flash (GET /historico)
 //==============================================================================
-void main_leds(){
-  if(alexa_controll_leds == false){
-    byte hora = offtime.get_hour();
-    if((hora >= HORA_LIGAR_LED) && (hora <= HORA_DESLIGAR_LED)){
-      ligar_leds();
-    }else{
-      desligar_leds();
-    }
+
+// Grava os blocos que a task de controle fechou (uma escrita por hora, fora do caminho do controle)
+void main_gravar_historico(){
+  historico.flush();
+}
+
+// Resumo das ultimas horas gravadas e um resumo por hora, lidos so dos cabeçalhos dos blocos
+void historico_json(Print& saida, uint32_t horas){
+  uint32_t fim = offtime.now();
+  uint32_t inicio = fim - horas * 3600;
+
+  ResumoHistorico<N_CANAIS_HISTORICO> resumo;
+  historico.summary(inicio, fim, resumo);
+  saida.printf("{\"inicio\":%lu,\"fim\":%lu,\"amostras\":%lu,\"blocos_perdidos\":%lu,\"canais\":{",
+               (unsigned long)inicio, (unsigned long)fim, (unsigned long)resumo.amostras, (unsigned long)historico.lost_blocks());
+  for (uint8_t c = 0; c < N_CANAIS_HISTORICO; c++) {
+    saida.printf("%s\"%s\":{\"min\":%ld,\"max\":%ld,\"media\":%ld}", c ? "," : "", nomes_canais_historico[c],
+                 (long)(resumo.amostras ? resumo.canais[c].minimo : 0), (long)(resumo.amostras ? resumo.canais[c].maximo : 0),
+                 (long)resumo.mean(c));
   }
+
+  saida.print("},\"horas\":[");
+  bool primeira = true;
+  historico.hours(inicio, fim, [&](const ResumoHistorico<N_CANAIS_HISTORICO>& hora) {
+    saida.printf("%s{\"inicio\":%lu,\"amostras\":%lu,\"media\":[", primeira ? "" : ",",
+                 (unsigned long)hora.inicio, (unsigned long)hora.amostras);
+    for (uint8_t c = 0; c < N_CANAIS_HISTORICO; c++) saida.printf(c ? ",%ld" : "%ld", (long)hora.mean(c));
+    saida.print("]}");
+    primeira = false;
+  });
+  saida.print("]}");
+}
+
+// Baldes agregados de um canal (rollups na ram): [inicio, min, max, media, amostras] por balde
+void serie_json(Print& saida, CanalRollup canal, ResolucaoRollup resolucao, uint32_t horas){
+  uint32_t fim = offtime.now() + 1;
+  uint32_t inicio = fim - horas * 3600;
+  saida.printf("{\"canal\":\"%s\",\"resolucao\":%lu,\"baldes\":[", nomes_canais_rollup[canal], (unsigned long)Rollup::seconds(resolucao));
+  bool primeiro = true;
+  rollups[canal].buckets(resolucao, inicio, fim, [&](uint32_t inicio_balde, const BaldeRollup& balde) {
+    saida.printf("%s[%lu,%d,%d,%ld,%u]", primeiro ? "" : ",", (unsigned long)inicio_balde, balde.minimo, balde.maximo,
+                 (long)(balde.soma / balde.quantidade), balde.quantidade);
+    primeiro = false;
+  });
+  saida.print("]}");
 }
 
 //==============================================================================
-// Função para Modo de Apresentação dos LEDs (Não Implementado)
+// Servidor HTTP: Alexa (fauxmo) e Metricas
 //==============================================================================
-void modo_apresentacao(){
-  // Lógica para o modo de apresentação dos LEDs (a ser implementada)
+void servidor_config(){
+  // GET /metricas: json com os histogramas (leitura lock-free, nao para as tasks)
+  servidor_http.on("/metricas", HTTP_GET, [](AsyncWebServerRequest* request) {
+    AsyncResponseStream* resposta = request->beginResponseStream("application/json");
+    metricas_json(*resposta);
+    request->send(resposta);
+  });
+
+  // GET /historico?horas=24: medias/min/max do periodo e media de cada hora (a hora corrente entra quando é gravada)
+  servidor_http.on("/historico", HTTP_GET, [](AsyncWebServerRequest* request) {
+    uint32_t horas = request->hasParam("horas") ? request->getParam("horas")->value().toInt() : 24;
+    horas = constrain(horas, 1, HORAS_MAX_HISTORICO);
+    AsyncResponseStream* resposta = request->beginResponseStream("application/json");
+    historico_json(*resposta, horas);
+    request->send(resposta);
+  });
+
+  // GET /serie?canal=temperatura_x10&horas=24[&resolucao=60|900|3600]: baldes prontos dos rollups (sem resolução,
+  // a mais fina que cobre as horas pedidas)
+  servidor_http.on("/serie", HTTP_GET, [](AsyncWebServerRequest* request) {
+    String nome = request->hasParam("canal") ? request->getParam("canal")->value() : String(nomes_canais_rollup[0]);
+    uint8_t canal = 0;
+    while (canal < N_CANAIS_ROLLUP && nome != nomes_canais_rollup[canal]) canal++;
+    if (canal == N_CANAIS_ROLLUP) {
+      request->send(404, "application/json", "{\"erro\":\"canal desconhecido\"}");
+      return;
+    }
+
+    uint32_t horas = request->hasParam("horas") ? request->getParam("horas")->value().toInt() : 24;
+    horas = constrain(horas, 1, HORAS_MAX_HISTORICO);
+    ResolucaoRollup resolucao = ROLLUP_MINUTO;
+    while (resolucao < ROLLUP_HORA && (uint32_t)Rollup::capacity(resolucao) * Rollup::seconds(resolucao) < horas * 3600) {
+      resolucao = (ResolucaoRollup)(resolucao + 1);
+    }
+    if (request->hasParam("resolucao")) {
+      uint32_t segundos = request->getParam("resolucao")->value().toInt();
+      resolucao = segundos <= 60 ? ROLLUP_MINUTO : segundos <= 15 * 60 ? ROLLUP_QUARTO : ROLLUP_HORA;
+    }
+
+    AsyncResponseStream* resposta = request->beginResponseStream("application/json");
+    serie_json(*resposta, (CanalRollup)canal, resolucao, horas);
+    request->send(resposta);
+  });
+
+  // GET /log: niveis de cada modulo; GET /log?modulo=CAIXA&nivel=4 altera (0 nenhum, 1 erro, 2 aviso, 3 info, 4 debug, modulo=* para todos)
+  servidor_http.on("/log", HTTP_GET, [](AsyncWebServerRequest* request) {
+    if (request->hasParam("modulo") && request->hasParam("nivel")) {
+      String modulo = request->getParam("modulo")->value();
+      uint8_t nivel = constrain(request->getParam("nivel")->value().toInt(), LOG_NENHUM, LOG_DEBUG);
+      if (modulo == "*") {
+        registro_log.set_level_all(nivel);
+      } else if (!registro_log.set_level(modulo.c_str(), nivel)) {
+        request->send(404, "application/json", "{\"erro\":\"modulo ainda nao registrado\"}");
+        return;
+      }
+    }
+
+    AsyncResponseStream* resposta = request->beginResponseStream("application/json");
+    resposta->printf("{\"descartados\":%lu,\"modulos\":{", (unsigned long)registro_log.dropped());
+    for (uint8_t id = 0; id < registro_log.size(); id++) {
+      resposta->printf(id ? ",\"%s\":%u" : "\"%s\":%u", registro_log.name(id), registro_log.level(id));
+    }
+    resposta->print("}}");
+    request->send(resposta);
+  });
+
+  // GET /agenda: expressão, duração e proximo evento de cada trabalho
+  // GET /agenda?trabalho=bomba&expressao=*/30+6-20+*+*+*&duracao=300 altera (expressao vazia desativa): vale na hora e fica no NVS
+  servidor_http.on("/agenda", HTTP_GET, [](AsyncWebServerRequest* request) {
+    if (request->hasParam("trabalho")) {
+      String nome = request->getParam("trabalho")->value();
+      uint8_t trabalho = 0;
+      while (trabalho < N_TRABALHOS_AGENDA && nome != nomes_trabalhos_agenda[trabalho]) trabalho++;
+      if (trabalho == N_TRABALHOS_AGENDA) {
+        request->send(404, "application/json", "{\"erro\":\"trabalho desconhecido\"}");
+        return;
+      }
+
+      ComandoAgenda comando = agendas[trabalho];
+      if (request->hasParam("expressao")) {
+        String expressao = request->getParam("expressao")->value();
+        expressao.trim();
+        if (expressao.length() >= CRON_MAX_EXPRESSAO) {
+          request->send(400, "application/json", "{\"erro\":\"expressao longa demais\"}");
+          return;
+        }
+        strcpy(comando.expressao, expressao.c_str());
+      }
+      if (request->hasParam("duracao")) comando.duracao_s = request->getParam("duracao")->value().toInt();
+      if (!agenda_valida(comando, configuracao_servidor.get(PARAM_RAMPA_LEDS))) {
+        request->send(400, "application/json", "{\"erro\":\"expressao ou duracao invalida\"}");
+        return;
+      }
+      if (fila_agenda == nullptr || xQueueSend(fila_agenda, &comando, 0) != pdTRUE) {
+        request->send(503, "application/json", "{\"erro\":\"controle ocupado\"}");
+        return;
+      }
+      acordar_controle();
+      agendas[trabalho] = comando;
+      nvs_agenda.putBytes(nomes_trabalhos_agenda[trabalho], &comando, sizeof(comando));
+    }
+
+    // estado publicado pela task de controle (uma alteração aparece depois que ela consome a fila)
+    Status status;
+    bool tem_status = fila_status != nullptr && xQueuePeek(fila_status, &status, 0) == pdTRUE;
+    AsyncResponseStream* resposta = request->beginResponseStream("application/json");
+    resposta->printf("{\"agora\":%lld,\"trabalhos\":{", (long long)offtime.now64());
+    for (uint8_t i = 0; i < N_TRABALHOS_AGENDA; i++) {
+      resposta->printf("%s\"%s\":{\"expressao\":\"%s\",\"duracao_s\":%lu", i ? "," : "", nomes_trabalhos_agenda[i],
+                       agendas[i].expressao, (unsigned long)agendas[i].duracao_s);
+      if (tem_status && status.proximo_evento[i] != CRON_NUNCA) {
+        resposta->printf(",\"ligado\":%s,\"proximo_evento\":%lld", (status.agenda_ligada >> i) & 1 ? "true" : "false",
+                         (long long)status.proximo_evento[i]);
+      }
+      resposta->print("}");
+    }
+    resposta->print("}}");
+    request->send(resposta);
+  });
+
+  // GET /config: valor, limites, padrão e unidade de cada parametro de operação
+  // GET /config?temp_max=28.5&umid_max_exaust=85 altera (todos ou nenhum): vale na hora e fica no NVS
+  servidor_http.on("/config", HTTP_GET, [](AsyncWebServerRequest* request) {
+    SessaoConfig sessao;
+    for (size_t i = 0; i < request->params(); i++) {
+      AsyncWebParameter* parametro = request->getParam(i);
+      int8_t id = configuracao_servidor.find(parametro->name().c_str());
+      if (id < 0) {
+        request->send(404, "application/json", "{\"erro\":\"parametro desconhecido\"}");
+        return;
+      }
+      valor_config(sessao, id, parametro->value().c_str(), false);
+    }
+    char erro[TAM_ERRO_CONFIG];
+    int codigo = alterar_config(sessao, erro);
+    if (codigo != 200) {
+      request->send(codigo, "application/json", erro);
+      return;
+    }
+    AsyncResponseStream* resposta = request->beginResponseStream("application/json");
+    config_json(*resposta, true);
+    request->send(resposta);
+  });
+
+  // POST /config com {"temp_max":28.5,"umid_max_exaust":85}: mesma alteração do GET, o corpo vai direto para o
+  // JsonStream a cada pedaço recebido (chaves que nao sao parametros sao ignoradas)
+  servidor_http.on("/config", HTTP_POST, [](AsyncWebServerRequest* request) {
+    SessaoConfig* sessao = (SessaoConfig*)request->_tempObject;
+    if (sessao == nullptr || !sessao->parser.done()) {
+      request->send(400, "application/json", "{\"erro\":\"json invalido\"}");
+      return;
+    }
+    char erro[TAM_ERRO_CONFIG];
+    int codigo = alterar_config(*sessao, erro);
+    if (codigo != 200) {
+      request->send(codigo, "application/json", erro);
+      return;
+    }
+    AsyncResponseStream* resposta = request->beginResponseStream("application/json");
+    config_json(*resposta, true);
+    request->send(resposta);
+  }, nullptr, [](AsyncWebServerRequest* request, uint8_t* dados, size_t tamanho, size_t indice, size_t total) {
+    // a sessão vive no _tempObject (o servidor libera com free() junto com o request)
+    if (indice == 0 && total <= TAM_MAX_JSON_CONFIG) {
+      void* memoria = malloc(sizeof(SessaoConfig));
+      if (memoria != nullptr) request->_tempObject = new (memoria) SessaoConfig();
+    }
+    if (request->_tempObject != nullptr) ((SessaoConfig*)request->_tempObject)->parser.feed((const char*)dados, tamanho);
+  });
+
+  ws_config.onEvent(evento_ws_config);
+  servidor_http.addHandler(&ws_config);
+
+  // O resto vai para o fauxmo (descoberta e comandos da Alexa)
+  servidor_http.onRequestBody([](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+    fauxmo.process(request->client(), request->method() == HTTP_GET, request->url(), String((char*)data));
+  });
+  servidor_http.onNotFound([](AsyncWebServerRequest* request) {
+    String body = (request->hasParam("body", true)) ? request->getParam("body", true)->value() : String();
+    if (fauxmo.process(request->client(), request->method() == HTTP_GET, request->url(), body)) return;
+    request->send(404);
+  });
+
+  servidor_http.begin();
 }
 
 //==============================================================================
-// Função para Ligar os LEDs
+// Funções para Dormir/Acordar as Tasks
 //==============================================================================
-void ligar_leds(){
-  state.contatora_leds = true;
-  state.refletor = true;
-  set_outs();
 
-  set_state_leds(1,1);
-  //Serial.println("ligando leds");
+// Acorda a task de controle antes do proximo deadline (chamado por outras tasks)
+void acordar_controle(){
+  if (handle_controle != nullptr) xTaskNotifyGive(handle_controle);
+}
+
+// Acorda a task de controle a partir de uma interrupção de I/O
+void IRAM_ATTR acordar_controle_isr(){
+  if (handle_controle == nullptr) return;
+  BaseType_t troca_contexto = pdFALSE;
+  vTaskNotifyGiveFromISR(handle_controle, &troca_contexto);
+  if (troca_contexto) portYIELD_FROM_ISR();
+}
+
+// Bloqueia a task atual ate o proximo deadline ou ate ser notificada, liberando a cpu para a task idle (que pode entrar em light sleep)
+void dormir_task(uint32_t ms){
+  if (ms == 0) return;
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms) > 0 ? pdMS_TO_TICKS(ms) : 1);
 }
 
 //==============================================================================
-// Função para Desligar os LEDs
+// Função para Publicar o Estado para a Interface
 //==============================================================================
-void desligar_leds(){
-  state.contatora_leds = false;
-  state.refletor = false;
-  set_outs();
+void publicar_status(){
+  Status status;
+  status.saidas = state;
+  status.entradas = input;
+  status.agenda_ligada = 0;
+  for (uint8_t i = 0; i < N_TRABALHOS_AGENDA; i++) {
+    status.proximo_evento[i] = agenda.next_event(i);
+    if (agenda.active(i)) status.agenda_ligada |= 1 << i;
+  }
+  xQueueOverwrite(fila_status, &status);
+}
+
+#ifdef BENCH
+//==============================================================================
+// Microbenchmarks da Interface (env bench do platformio.ini)
+//==============================================================================
+void caso_main_lcd(){
+  main_lcd();
+}
+
+void caso_update_scroll(){
+  lcd.update_scroll(0);
+}
 
-  set_state_leds(0,0);
-  //Serial.println("desligando leds");
+// Montagem da linha do logger() antigo (sem o Serial.println), para comparar com o hal_log
+void caso_legado_logger(){
+  byte minutos = bench_contador % 60;
+  String linha = "[" + String("MAIN LCD") + "]: " + String("Bomba " + String(minutos) + ":05 Min");
+  bench_sumidouro += linha.length();
+  bench_contador++;
 }
 
+void caso_hal_log(){
+  hal_log("BENCH", "Bomba %d:%02d Min", (int)(bench_contador % 60), 5);
+  bench_contador++;
+}
+
+void bench_interface(){
+  Serial.printf("\r\n%-34s %16s %16s %14s\r\n", "caso", "tempo", "alocacoes", "heap perdido");
+
+  // main_lcd le a fila de status: cria uma temporaria com o estado atual
+  fila_status = xQueueCreate(1, sizeof(Status));
+  publicar_status();
+  bench("main_lcd (sprintf/String/i2c/log)", caso_main_lcd, 50);
+  vQueueDelete(fila_status);
+  fila_status = nullptr;
+
+  lcd.set_scroll(0, "Temperatura alta, exaustores ligados ");
+  bench("CtrlLCD::update_scroll (i2c)", caso_update_scroll, 50);
+  lcd.delete_scroll(0);
+
+  bench("legado logger (String)", caso_legado_logger, 2000);
+  bench("hal_log (anel)", caso_hal_log, 20); // 6 lotes de 20 cabem no anel (o dreno so roda a cada T_DRENO_LOG)
+
+  bench_modulos(PIN_DATA_LEDS3, PIN_CLOCK_LEDS3, PIN_LATCH_LEDS3);
+  lcd.clear();
+}
+#endif
+
 //==============================================================================
-// Função para Controlar um LED Individual
+// Task de Controle (core 1, prioridade alta): sensores e atuadores
 //==============================================================================
-void set_led(bool color, byte num_led, bool state){
-  static bool data_arr_2[8] = {0,0,0,0,0,0,0,0};
-  static bool data_arr_3[8] = {0,0,0,0,0,0,0,0};
-  static bool data_arr_4[8] = {0,0,0,0,0,0,0,0};
+void task_controle(void* parametro){
+  controle_iniciar(millis(), agendas);
+
+  while (true) {
+    metricas_controle.tick(millis());
+
+    // Consome as mensagens das outras tasks sem bloquear
+    ComandoAlexa comando;
+    while (xQueueReceive(fila_comandos, &comando, 0) == pdTRUE) {
+      aplicar_comando_alexa(comando);
+    }
+
+    ComandoAgenda nova_agenda;
+    while (xQueueReceive(fila_agenda, &nova_agenda, 0) == pdTRUE) {
+      aplicar_agenda(nova_agenda);
+    }
+
+    TransacaoFazenda alteracao;
+    while (xQueueReceive(fila_config, &alteracao, 0) == pdTRUE) {
+      aplicar_config(alteracao);
+    }
+
+    DadosClima clima;
+    if (xQueueReceive(fila_clima, &clima, 0) == pdTRUE) {
+      input.umidade_externa = clima.umidade_externa;
+      input.temperatura_externa_x10 = clima.temperatura_externa_x10;
+      input.vento_x10 = clima.vento_x10;
+      input.chuva = clima.chuva_x10 > 0;
+    }
 
-  if(color == RED){
-    if(num_led < 8){
-      data_arr_2[num_led] = state;
-    }else if (num_led >= 8 && num_led < 12){
-      data_arr_3[num_led-8] = state;
+    PrevisaoClima nova_previsao;
+    if (xQueueReceive(fila_previsao, &nova_previsao, 0) == pdTRUE) {
+      previsao.set(nova_previsao);
     }
-  }else{
-    if(num_led < 4){
-      data_arr_3[num_led+4] = state;
-    }else if (num_led >= 4 && num_led < 12){
-      data_arr_4[num_led-4] = state;
-    }    
+
+    // Eventos das boias: atualiza o nivel e antecipa o controle da caixa
+    EventoNivel nivel;
+    if (boias.next(nivel)) {
+      atualizar_boias(nivel.maximo, nivel.minimo);
+    }
+
+    // Leituras prontas, tarefas vencidas e saidas
+    uint32_t tempo_proxima = controle_ciclo();
+    publicar_status();
+
+    dormir_task(min(tempo_proxima, (uint32_t)T_MAX_OCIOSO_CONTROLE));
   }
+}
 
-  code_74hc595(data_arr_2,PIN_DATA_LEDS1,PIN_CLOCK_LEDS1,PIN_LATCH_LEDS1);
-  code_74hc595(data_arr_3,PIN_DATA_LEDS2,PIN_CLOCK_LEDS2,PIN_LATCH_LEDS2);
-  code_74hc595(data_arr_4,PIN_DATA_LEDS3,PIN_CLOCK_LEDS3,PIN_LATCH_LEDS3);
+//==============================================================================
+// Task de Rede (core 0, prioridade baixa): requisições que podem demorar
+//==============================================================================
+void task_rede(void* parametro){
+  cliente_clima.begin(host_clima, raizes_clima, impressao_clima);
+  cliente_open_meteo.begin(host_open_meteo, raizes_open_meteo, impressao_open_meteo);
+  metricas_rede.attach(scheduler_rede);
+  metricas_rede.name(scheduler_rede.add(main_dados_clima, T_DADOS_CLIMATICOS, millis()), "dados_clima");
+  metricas_rede.name(scheduler_rede.add(main_previsao, T_PREVISAO, millis()), "previsao"); // mesma passagem do clima atual a cada hora
+  metricas_rede.name(scheduler_rede.add(main_gravar_historico, T_GRAVAR_HISTORICO, millis()), "gravar_historico");
+  bool sincronizado = disciplina_relogio.metrics().sincronizacoes > 0; // pelo setup
+  id_relogio = scheduler_rede.add(main_relogio, T_NTP_INICIAL, millis(), sincronizado ? T_NTP_INICIAL : 0);
+  metricas_rede.name(id_relogio, "relogio");
+
+  while (true) {
+    metricas_rede.tick(millis());
+    uint32_t tempo_proxima = scheduler_rede.run(millis());
+    dormir_task(tempo_proxima);
+  }
 }
 
 //==============================================================================
-// Função para Definir o Estado de Todos os LEDs
+// Task de Log (core 0, prioridade minima): formata o anel de log e escreve na serial
 //==============================================================================
-void set_state_leds(bool red_value, bool blue_value){  
-  for (byte i = 0; i < 12; i++){
-    set_led(RED, i, red_value);
-    set_led(BLUE, i, blue_value);
+void task_log(void* parametro){
+  while (true) {
+    hal_log_drenar();
+    vTaskDelay(pdMS_TO_TICKS(T_DRENO_LOG));
   }
 }
 
@@ -633,33 +1248,39 @@ void set_state_leds(bool red_value, bool blue_value){
 void setup(){
   
   // Configuração dos pinos
-  pinMode(PIN_SENSOR_FLUXO, INPUT);
-  pinMode(PIN_LED_IR, OUTPUT);
-  pinMode(PIN_DATA_RELES, OUTPUT);
-  pinMode(PIN_CLOCK_RELES, OUTPUT);
-  pinMode(PIN_LATCH_RELES, OUTPUT);
+  // Medidor de vazão (o PCNT configura o pino como entrada)
+  fluxo.config(PULSOS_POR_LITRO, JANELA_FLUXO, T_FLUXO);
+  fluxo.begin(PIN_SENSOR_FLUXO, UNIDADE_PCNT_FLUXO);
 
-  pinMode(PIN_DATA_LEDS1, OUTPUT);
-  pinMode(PIN_CLOCK_LEDS1, OUTPUT);
-  pinMode(PIN_LATCH_LEDS1, OUTPUT);
-
-  pinMode(PIN_DATA_LEDS2, OUTPUT);
-  pinMode(PIN_CLOCK_LEDS2, OUTPUT);
-  pinMode(PIN_LATCH_LEDS2, OUTPUT);
+  // Boias da caixa d'agua (cada mudança acorda a task de controle)
+  if (!boias.begin(PIN_BOIA_MAX, PIN_BOIA_MIN, NIVEL_BOIA_ACIONADA, T_DEBOUNCE_BOIAS, acordar_controle)) {
+    hal_log_erro("CAIXA", "Falha ao iniciar as boias");
+  }
+  pinMode(PIN_LED_IR, OUTPUT);
 
-  pinMode(PIN_DATA_LEDS3, OUTPUT);
-  pinMode(PIN_CLOCK_LEDS3, OUTPUT);
-  pinMode(PIN_LATCH_LEDS3, OUTPUT);
+  // Cadeias de 74HC595, na ordem dos defines CADEIA_*
+  cadeias_595.add_chain(PIN_DATA_RELES, PIN_CLOCK_RELES, PIN_LATCH_RELES);
+  cadeias_595.add_chain(PIN_DATA_LEDS1, PIN_CLOCK_LEDS1, PIN_LATCH_LEDS1);
+  cadeias_595.add_chain(PIN_DATA_LEDS2, PIN_CLOCK_LEDS2, PIN_LATCH_LEDS2);
+  cadeias_595.add_chain(PIN_DATA_LEDS3, PIN_CLOCK_LEDS3, PIN_LATCH_LEDS3);
+  cadeias_595.begin();
 
   Serial.begin(BAUND_RATE);
 
+  // Quem escreve o log na serial (as mensagens anteriores esperam no anel)
+  xTaskCreatePinnedToCore(task_log, "log", STACK_LOG, nullptr, PRIORIDADE_LOG, &handle_log, CORE_REDE);
+
   // Inicialização do LCD
   lcd.init();                     
   lcd.backlight();
   lcd.createChar(0, bar_char_custom);
 
-  // Inicialização do sensor DHT11
-  dht.begin();
+  // Parametros de operação gravados e controlador de clima (exaustores)
+  carregar_config();
+  config_clima();
+
+  // Inicialização do sensor DHT11 (a captura acorda a task de controle ao terminar)
+  sensor_dht.begin(PIN_SENSOR_DHT11, CANAL_RMT_DHT, acordar_controle);
 
   // Tela de carregamento no LCD
   lcd.set_scroll(0,"Inicializando Sistema... ");
@@ -674,23 +1295,6 @@ void setup(){
   lcd.delete_scroll(1);
   lcd.delete_scroll(0);
 
-  // Inicialização das threads
-	thread_bomba.onRun(main_bomba_agua);
-  thread_dht.onRun(main_get_dht);
-  thread_lcd.onRun(main_lcd);
-  thread_irrigacao.onRun(main_irrigacao);
-  thread_exaustor.onRun(main_exaustores);
-  thread_leds.onRun(main_leds);
-  thread_clima.onRun(main_dados_clima);
-
-  thread_exaustor.setInterval(T_VERIFICAR_EXAUSTOR);
-  thread_leds.setInterval(T_VERIFICAR_LEDS);
-  thread_irrigacao.setInterval(T_DURACAO_IRRIGACAO);
-	thread_bomba.setInterval(T_BOMBA);
-  thread_dht.setInterval(T_DHT);
-  thread_lcd.setInterval(T_LCD);
-  thread_clima.setInterval(T_DADOS_CLIMATICOS);
-
   // Rotinas de testes
   lcd.msg(0,0,"Iniciando testes");
 
@@ -705,6 +1309,10 @@ void setup(){
   self_test(&state.exaustor);  
   self_test(&state.refletor);  
   self_test(&state.lampada);  
+
+  #ifdef BENCH
+    bench_interface(); // mede antes de criar as tasks, sem concorrencia
+  #endif
   
   
   lcd.msg(1,0,"Conectando wifi");
@@ -713,18 +1321,34 @@ void setup(){
   lcd.clear();
   lcd.msg(1,0,"Obtendo horario");
 
-  ntp.begin();               
-  ntp.forceUpdate();    
-  unsigned long unix_time_ntp = ntp.getEpochTime();
-  offtime.set(unix_time_ntp);
+  // Primeira sincronização esperando a resposta (a diferença do boot vira salto); depois a task de rede mantem
+  offtime.set_timezone(FUSO_HORARIO_S);
+  udp.begin(NTP_PORTA_LOCAL);
+  for (uint8_t tentativa = 0; tentativa < 3 && disciplina_relogio.metrics().sincronizacoes == 0; tentativa++) {
+    if (!ntp_enviar()) continue;
+    uint32_t inicio = millis();
+    while (!ntp_receber() && millis() - inicio < T_NTP_TIMEOUT) delay(1);
+    disciplina_relogio.timeout(); // sem efeito se respondeu
+  }
+  if (disciplina_relogio.metrics().sincronizacoes == 0) hal_log_erro("OFFTIME", "Sem resposta do NTP, horario invalido ate a proxima sincronizacao");
+
+  const DataHora& data = offtime.calendar();
+  hal_log("OFFTIME", "Data: %02d/%02d/%04d %02d:%02d:%02d", data.dia, data.mes, data.ano, data.hora, data.minuto, data.segundo);
 
-  logger("Hora: "+offtime.get_hour(), "OFFTIME");
+  // Historico na flash (LittleFS, formatado na primeira vez); sem ele as amostras ficam so na ram e sao descartadas
+  if (!historico.begin(DIR_HISTORICO)) {
+    hal_log_erro("HISTORICO", "Falha ao montar o LittleFS");
+  }
   
+  // Agenda da bomba, irrigação e leds (a curva de luz é montada pela task de controle a partir da janela dos leds)
+  carregar_agenda();
+
   lcd.msg(1,0,"Config. Alexa");
 
-  // Configuração da Alexa
-  fauxmo.createServer(true); 
-  fauxmo.setPort(80); 
+  // Configuração da Alexa (o servidor http é nosso, para dividir a porta com /metricas)
+  servidor_config();
+  fauxmo.createServer(false); 
+  fauxmo.setPort(PORTA_HTTP); 
   fauxmo.enable(true);
 
   // Adiciona os dispositivos virtuais
@@ -740,26 +1364,36 @@ void setup(){
   // Define a função de callback para quando o estado de um dispositivo for alterado
   fauxmo.onSetState([](unsigned char device_id, const char * device_name, bool state_in, unsigned char value) {
         
-    logger("Device: "+String(device_name) + " state: "+(state_in ? "ON" : "OFF"),"ALEXA");
+    hal_log("ALEXA", "Device: %s state: %s", device_name, state_in ? "ON" : "OFF");
+
+    // Os atuadores pertencem a task de controle: aqui so traduz o nome e envia o comando
+    ComandoAlexa comando;
+    comando.estado = state_in;
 
     if (strcmp(device_name, ID_bomba)==0) {
-      state.bomba1 = state_in;
+      comando.dispositivo = ALEXA_BOMBA;
     } else if (strcmp(device_name, ID_bomba_auto)==0) {
-      alexa_controll_bomba = !state_in;
+      comando.dispositivo = ALEXA_BOMBA_AUTO;
     } else if (strcmp(device_name, ID_exaustor)==0) {
-      state.exaustor = state_in;
+      comando.dispositivo = ALEXA_EXAUSTOR;
     } else if (strcmp(device_name, ID_exaustor_auto)==0) {
-      alexa_controll_exaust = !state_in;
+      comando.dispositivo = ALEXA_EXAUSTOR_AUTO;
     } else if (strcmp(device_name, ID_lampadas)==0) {
-      state.lampada = state_in;
+      comando.dispositivo = ALEXA_LAMPADAS;
     } else if (strcmp(device_name, ID_leds)==0) {
-      set_state_leds(state_in,state_in);
-      state.contatora_leds = state_in;
+      comando.dispositivo = ALEXA_LEDS;
     } else if (strcmp(device_name, ID_refletor)==0) {
-      state.refletor = state_in;
+      comando.dispositivo = ALEXA_REFLETOR;
     } else if (strcmp(device_name, ID_leds_auto)==0) {
-      alexa_controll_leds = !state_in;
+      comando.dispositivo = ALEXA_LEDS_AUTO;
+    } else {
+      return;
     }
+
+    if (xQueueSend(fila_comandos, &comando, 0) != pdTRUE) {
+      hal_log_aviso("ALEXA", "Fila de comandos cheia");
+    }
+    acordar_controle();
   });
   
   lcd.msg(1,0,"Sistema OK");
@@ -768,46 +1402,58 @@ void setup(){
   
   set_state_leds(1,1);
 
-  millis_last_bomba = millis();
-
-  // Executa as threads ao iniciar
-  thread_bomba.run();
-  thread_clima.run();
-  thread_leds.run();
-  thread_irrigacao.run(); 
-  thread_dht.run(); 
-  thread_lcd.run(); 
-  thread_exaustor.run(); 
+  // Tarefas do loop (interface), executam logo na primeira passagem
+  unsigned long agora = millis();
+  handle_interface = xTaskGetCurrentTaskHandle(); // setup() e loop() rodam na mesma task
+  metricas_interface.attach(scheduler_interface);
+  metricas_interface.name(scheduler_interface.add(main_lcd, T_LCD, agora), "lcd");
+  metricas_interface.name(scheduler_interface.add(main_log_memoria, T_LOG_MEMORIA, agora, T_LOG_MEMORIA), "log_memoria");
+  metricas_interface.name(scheduler_interface.add(main_log_metricas, T_LOG_METRICAS, agora, T_LOG_METRICAS), "log_metricas");
+
+  // Filas entre as tasks
+  fila_clima = xQueueCreate(1, sizeof(DadosClima));
+  fila_comandos = xQueueCreate(8, sizeof(ComandoAlexa));
+  fila_agenda = xQueueCreate(N_TRABALHOS_AGENDA, sizeof(ComandoAgenda));
+  fila_config = xQueueCreate(2, sizeof(TransacaoFazenda));
+  fila_status = xQueueCreate(1, sizeof(Status));
+  fila_previsao = xQueueCreate(1, sizeof(PrevisaoClima));
+  publicar_status();
+  carregar_previsao();
+
+  // Tasks de controle e de rede
+  xTaskCreatePinnedToCore(task_controle, "controle", STACK_CONTROLE, nullptr, PRIORIDADE_CONTROLE, &handle_controle, CORE_CONTROLE);
+  xTaskCreatePinnedToCore(task_rede, "rede", STACK_REDE, nullptr, PRIORIDADE_REDE, &handle_rede, CORE_REDE);
+
+  // Com o loop bloqueado entre deadlines a task idle pode reduzir o clock e, se o sdk permitir, entrar em light sleep
+  #if CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t config_pm = {};
+    config_pm.max_freq_mhz = 240;
+    config_pm.min_freq_mhz = 80;
+    #if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+      config_pm.light_sleep_enable = true;
+    #endif
+    esp_pm_configure(&config_pm);
+  #endif
 }
 
 //==============================================================================
 // Função de Loop Principal
 //==============================================================================
 void loop(){
+  metricas_interface.tick(millis());
 
-  // Executa as threads
-	if(thread_bomba.shouldRun())
-		thread_bomba.run();
-  if(thread_clima.shouldRun())
-		thread_clima.run();
-  if(thread_leds.shouldRun())
-		thread_leds.run();
-	if(thread_irrigacao.shouldRun())
-		thread_irrigacao.run(); 
-  if(thread_dht.shouldRun())
-		thread_dht.run(); 
-  if(thread_lcd.shouldRun())
-		thread_lcd.run(); 
-  if(thread_exaustor.shouldRun())
-		thread_exaustor.run(); 
+  // Interface: lcd e log (os atuadores ficam na task de controle)
+  uint32_t tempo_proxima = scheduler_interface.run(millis());
 
   fauxmo.handle();
-  
-  set_outs();
+  ws_config.cleanupClients(); // fecha os clientes desconectados que ainda ocupam memoria
 
-  static unsigned long last = millis();
-  if (millis() - last > 5000) {
-      last = millis();
-      logger("Memoria livre: " + String(ESP.getFreeHeap()) + " bytes", "LOOP");
+  // 'm' na serial: metricas completas em json
+  if (Serial.available() > 0 && Serial.read() == 'm') {
+    metricas_json(Serial);
+    Serial.println();
   }
+
+  // Dorme ate o proximo deadline (limitado para continuar atendendo a Alexa)
+  dormir_task(min(tempo_proxima, (uint32_t)T_MAX_OCIOSO));
 }